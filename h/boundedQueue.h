@@ -0,0 +1,127 @@
+/* ******************************** FILE *********************************** */
+/** \file    boundedQueue.h
+ *
+ *  \brief   Declaration and definition of CBoundedQueue, a blocking FIFO of
+ *           limited capacity used to connect the stages of a pipeline. A
+ *           full queue blocks the producer, so a fast stage cannot run
+ *           more than the capacity ahead of a slow one. Producers that must
+ *           not wait (e.g. a camera) can drop the new item or the oldest
+ *           one instead.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_BOUNDED_QUEUE_H
+#define FILE_BOUNDED_QUEUE_H
+
+// Common includes
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+template<typename T>
+class CBoundedQueue
+{
+public:
+  explicit CBoundedQueue( const unsigned f_capacity_ui )
+    : m_capacity_ui( f_capacity_ui > 0 ? f_capacity_ui : 1 ),
+      m_closed_b( false )
+  { }
+
+  // Blocks while the queue is full. False if the queue was closed (the item
+  // is dropped)
+  bool push( const T &f_item )
+  {
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_notFull.wait( lock, [this]{ return m_closed_b || m_items.size() < m_capacity_ui; } );
+    if( m_closed_b )
+    {
+      return false;
+    }
+    m_items.push_back( f_item );
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  // Does not block: false if the queue is full or closed (the item is
+  // dropped)
+  bool tryPush( const T &f_item )
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    if( m_closed_b || m_items.size() >= m_capacity_ui )
+    {
+      return false;
+    }
+    m_items.push_back( f_item );
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  // Does not block: a full queue makes room by removing its oldest item,
+  // which is moved to f_evicted (f_evicted_b tells whether it happened).
+  // False if the queue was closed (the item is dropped)
+  bool pushEvicting( const T &f_item, T &f_evicted, bool &f_evicted_b )
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    f_evicted_b = false;
+    if( m_closed_b )
+    {
+      return false;
+    }
+    if( m_items.size() >= m_capacity_ui )
+    {
+      f_evicted   = m_items.front();
+      f_evicted_b = true;
+      m_items.pop_front();
+    }
+    m_items.push_back( f_item );
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  // Blocks while the queue is empty. False once the queue is closed and
+  // empty, i.e. there will be no more items
+  bool pop( T &f_item )
+  {
+    std::unique_lock<std::mutex> lock( m_mutex );
+    m_notEmpty.wait( lock, [this]{ return m_closed_b || !m_items.empty(); } );
+    if( m_items.empty() )
+    {
+      return false;
+    }
+    f_item = m_items.front();
+    m_items.pop_front();
+    m_notFull.notify_one();
+    return true;
+  }
+
+  // No more items will be pushed. Wakes up all the waiting threads; the
+  // remaining items can still be popped
+  void close()
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_closed_b = true;
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+  }
+
+private:
+
+  // Non copyable
+  CBoundedQueue( const CBoundedQueue& );
+  CBoundedQueue& operator=( const CBoundedQueue& );
+
+  const unsigned m_capacity_ui;
+
+  bool m_closed_b;
+
+  std::deque<T> m_items;
+
+  std::mutex m_mutex;
+
+  std::condition_variable m_notEmpty;
+
+  std::condition_variable m_notFull;
+};
+
+#endif /* FILE_BOUNDED_QUEUE_H */
@@ -0,0 +1,84 @@
+/* ******************************** FILE *********************************** */
+/** \file    imagePool.h
+ *
+ *  \brief   This file declares the class CImagePool, a cv::MatAllocator that
+ *           recycles image buffers. Released buffers are kept and handed out
+ *           again to images of the same size, so once the buffers of the
+ *           first frames exist, the following frames do not allocate image
+ *           buffers. Small allocations (containers, task closures) are not
+ *           covered. The buffers are 64-byte aligned and the rows are padded to a
+ *           multiple of 64 bytes, so every row starts on a cache line.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_IMAGE_POOL_H
+#define FILE_IMAGE_POOL_H
+
+// Common includes
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Alignment of the buffers and of the rows
+#define IMAGE_POOL_ALIGNMENT 64
+
+// Header of a buffer (defined in imagePool.cpp)
+struct SPoolBlock;
+
+class CImagePool : public cv::MatAllocator
+{
+public:
+  CImagePool();
+
+  // The pool must outlive its images (see imagePool)
+  ~CImagePool();
+
+  // Same as f_img.create( f_size, f_type_i ), with a buffer of the pool.
+  // Nothing is done if f_img already has that size and type
+  void create( cv::Mat &f_img, const cv::Size f_size, const int f_type_i );
+
+  // New image with a buffer of the pool
+  cv::Mat acquire( const cv::Size f_size, const int f_type_i );
+
+  // Image buffers allocated from the heap so far. It stays constant once
+  // the pool is warm
+  size_t getNumAllocations();
+
+  // Released buffers waiting to be reused
+  size_t getNumFreeBlocks();
+
+  // Frees the released buffers
+  void trim();
+
+  // cv::MatAllocator interface
+  void allocate( int f_dims_i, const int* f_sizes_p, int f_type_i, int*& f_refcount_p,
+		 uchar*& f_datastart_p, uchar*& f_data_p, size_t* f_step_p );
+
+  void deallocate( int* f_refcount_p, uchar* f_datastart_p, uchar* f_data_p );
+
+private:
+
+  // Non copyable
+  CImagePool( const CImagePool& );
+  CImagePool& operator=( const CImagePool& );
+
+  std::mutex m_mutex;
+
+  // Released buffers, one list per capacity
+  std::map<size_t, SPoolBlock*> m_freeLists;
+
+  size_t m_numAllocations;
+
+  size_t m_numFreeBlocks;
+};
+
+// Pool used by CThirdEye, CThirdEyeMask and CThirdEyeStats: that of the
+// NUMA node of the calling thread (see currentNumaNode). The pools are never
+// destroyed, so images can be released at any time, even at exit
+CImagePool& imagePool();
+
+#endif /* FILE_IMAGE_POOL_H */
@@ -4,10 +4,46 @@
 // Regular includes
 #include <string>
 
+// Project includes
+#include "rawImageIO.h"
+
 cv::Mat loadImageFile( const std::string &f_name_str, const unsigned f_bits_ui );
 
+// Same as above, into f_output, which is reused if it already has the size 
+// and type of the image (e.g. when loading a sequence)
+bool loadImageFile( const std::string &f_name_str, const unsigned f_bits_ui, cv::Mat &f_output );
+
+// Loads a single channel image as is (8 or 16 bit, no conversion to float).
+// f_scale_f is the factor that brings its values to [0,255]
+cv::Mat loadImageFileNative( const std::string &f_name_str, const unsigned f_bits_ui,
+			     float &f_scale_f );
+
+// Factor that brings f_bits_ui bit values to [0,255]. -1 if not supported
+double intensityScaleFactor( const unsigned f_bits_ui );
+
 cv::Mat loadRawImage( const std::string &f_name_str );
 
+// Same as above, also returns the number of subpixel bits of 16-bit fixed 
+// point disparities (CV_16UC1 images, see IO_DATATYPE_16Q)
+cv::Mat loadRawImage( const std::string &f_name_str, unsigned &f_subpixelBits_ui );
+
+// 32 and 64 float images, and 16-bit fixed point disparities (CV_16UC1) 
+// with f_subpixelBits_ui fractional bits. 32 float and fixed point images can
+// be stored with the lossless disparity codec (see IO_DATATYPE_COMPRESSED)
+bool saveRawImage( const std::string &f_name_str, const cv::Mat f_img,
+		   const std::string &f_comments_str = "",
+		   const unsigned f_subpixelBits_ui = 0,
+		   const bool f_compress_b = false );
+
+// Converts a 32 float disparity map into 16-bit fixed point. Invalid values,
+// and values out of range, are set to IO_16Q_INVALID
+cv::Mat toFixedPointDisparity( const cv::Mat f_disp, const unsigned f_subpixelBits_ui,
+			       const float f_invalid_f );
+
+// File name of frame f_frame_i, f_pattern_str being a printf format of the 
+// frame number (e.g. img_%06d_c0.pgm)
+std::string frameFileName( const std::string &f_pattern_str, const int f_frame_i );
+
 void showImage( const cv::Mat f_img, const std::string &f_name_str = "Image display" );
 
 cv::Mat	makeIt8bit( const cv::Mat f_img );
@@ -0,0 +1,73 @@
+/* ******************************** FILE *********************************** */
+/** \file    mappedFile.h
+ *
+ *  \brief   This file declares the class CMappedFile, a read-only view of a
+ *           whole file through mmap. cv::Mat headers can point into the
+ *           mapping; they share its ownership, so it is unmapped when the
+ *           object is closed and the last of those Mats is released. Pages
+ *           are read on demand.
+ *
+ *  \note    .enpeda.. Project, The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_MAPPED_FILE_H
+#define FILE_MAPPED_FILE_H
+
+// Common includes
+#include <string>
+#include <cstddef>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Reference count of a mapping (defined in mappedFile.cpp)
+struct SMappingBlock;
+
+class CMappedFile
+{
+public:
+  // Constructor
+  CMappedFile();
+
+  // Destructor. Unmaps the file, unless a cv::Mat still refers to it
+  ~CMappedFile();
+
+  // Maps the whole file. The pages are private (copy on write), so the
+  // data can be modified without touching the file
+  bool open( const std::string &f_fileName_str );
+
+  void close();
+
+  inline const char* getData() const
+  { return m_data_p; };
+
+  inline size_t getSize() const
+  { return m_size; };
+
+  // Returns a cv::Mat header of f_rows_i x f_cols_i pixels of type f_type_i
+  // pointing at the mapped data, from byte f_offset on. The Mat shares the
+  // mapping, which stays valid as long as it (or a copy) lives. An empty Mat
+  // is returned if the data does not fit in the file, or if the offset is not
+  // aligned to the pixel size.
+  cv::Mat getMat( const size_t f_offset, const int f_rows_i,
+		  const int f_cols_i, const int f_type_i ) const;
+
+  // Same as getMat, but the object is closed afterwards (if the Mat could
+  // be created), so the Mat is the only owner of the mapping
+  cv::Mat releaseToMat( const size_t f_offset, const int f_rows_i,
+			const int f_cols_i, const int f_type_i );
+
+private:
+
+  // Non copyable
+  CMappedFile( const CMappedFile& );
+  CMappedFile& operator=( const CMappedFile& );
+
+  char*  m_data_p;
+  size_t m_size;
+
+  // Reference held by this object
+  SMappingBlock* m_block_p;
+};
+
+#endif /* FILE_MAPPED_FILE_H */
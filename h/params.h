@@ -73,6 +73,12 @@ struct SThirdEyeParams
 		f_pixelSizeX_f,             f_pixelSizeY_f );
   }
     
+  // Copy constructor
+  SThirdEyeParams( const SThirdEyeParams &f_params )
+  {
+    *this = f_params;
+  }
+
   // Default destructor
   ~SThirdEyeParams()
   {};
@@ -0,0 +1,31 @@
+/* ******************************** FILE *********************************** */
+/** \file    pnmReader.h
+ *
+ *  \brief   Reader of binary PGM (P5) and PPM (P6) images with 8 or 16 bit
+ *           samples. The file is mapped (see CMappedFile) and the big-endian
+ *           samples are converted to the working type in a single pass,
+ *           byte swap and scaling included, straight into the output image.
+ *           PPM images are returned in BGR order, as cv::imread does.
+ *
+ *  \note    .enpeda.. Project, The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_PNM_READER_H
+#define FILE_PNM_READER_H
+
+// Common includes
+#include <string>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Reads the image into f_img as 32 float (CV_32FC1 or CV_32FC3), each sample
+// multiplied by f_scale_f. f_img is reused if it already has the size and
+// type. False if the file is not a binary PGM/PPM or cannot be read.
+bool readPnmImage( const std::string &f_name_str, const float f_scale_f, cv::Mat &f_img );
+
+// Same as above, but the samples are kept in their native type (8 or 16 bit
+// unsigned), in host byte order
+bool readPnmImageNative( const std::string &f_name_str, cv::Mat &f_img );
+
+#endif /* FILE_PNM_READER_H */
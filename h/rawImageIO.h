@@ -16,10 +16,20 @@
 #include <fstream>
 #include <iostream>
 
+#define IO_DATATYPE_16Q	     16	// 16-bit unsigned fixed point (disparities)
 #define IO_DATATYPE_32F	     32	// 32-bit float (float)
 #define IO_DATATYPE_64F	     64	// 64-bit float (double)
 #define INTERNAL_STRINGSIZE 255
 
+// Invalid value of the 16-bit fixed point type. Any other code v stands for
+// v / 2^subpixelBits
+#define IO_16Q_INVALID	 0xFFFF
+
+// Added to IO_DATATYPE_16Q or IO_DATATYPE_32F: the data is stored with the
+// lossless disparity codec (MED prediction, zigzag, run-length and varint
+// coding). Readers that do not know it reject the file
+#define IO_DATATYPE_COMPRESSED 100
+
 
 // Class for defining size of an image
 class CImageSize
@@ -41,7 +51,8 @@ public:
 	     f_imageSize.m_height_ui     == m_height_ui     &&
 	     f_imageSize.m_pixelDepth_ui == m_pixelDepth_ui &&
 	     f_imageSize.m_dataSize_ui   == m_dataSize_ui   &&
-	     f_imageSize.m_maxValue_ui   == m_maxValue_ui       );
+	     f_imageSize.m_maxValue_ui   == m_maxValue_ui   &&
+	     f_imageSize.m_subpixelBits_ui == m_subpixelBits_ui );
   };
 
   CImageSize operator= (const CImageSize& f_imageSize) const
@@ -52,6 +63,7 @@ public:
     outSize.m_dataSize_ui   = f_imageSize.m_dataSize_ui;
     outSize.m_pixelDepth_ui = f_imageSize.m_pixelDepth_ui;
     outSize.m_maxValue_ui   = f_imageSize.m_maxValue_ui;
+    outSize.m_subpixelBits_ui = f_imageSize.m_subpixelBits_ui;
     return outSize;
   };	
 	
@@ -77,6 +89,14 @@ public:
   // Set the data size of individual values (Num of bits per pixel)
   void		setDataSize();
 
+  // True for the IO_DATATYPE_COMPRESSED variants
+  inline bool	isCompressed() const
+  { return m_pixelDepth_ui > IO_DATATYPE_COMPRESSED; };
+
+  // Data type of the values, without the compression flag
+  inline unsigned getBaseDataType() const
+  { return isCompressed() ? m_pixelDepth_ui - IO_DATATYPE_COMPRESSED : m_pixelDepth_ui; };
+
   // Member variables
   unsigned	m_width_ui;
   unsigned	m_height_ui;
@@ -84,6 +104,7 @@ public:
   unsigned	m_pixelDepth_ui;
   unsigned	m_nChannels_ui;
   unsigned	m_maxValue_ui;
+  unsigned	m_subpixelBits_ui;	// Fractional bits of IO_DATATYPE_16Q
 };
 
 
@@ -112,7 +133,7 @@ public:
   // Raw Data file functions
   bool readRawDataHeader( std::ifstream & f_file_in, 
 			  int& f_xsize_i, int& f_ysize_i, 
-			  int& f_dataType_i );
+			  int& f_dataType_i, int* f_subpixelBits_p = nullptr );
 
   void writeRawDataHeader( std::ofstream & f_file_out, 
 			   CImageSize& f_imageSize, 
@@ -127,6 +148,14 @@ public:
 
   bool writeData ( std::ofstream & f_file_out, const CImageSize& f_imageSize, 
 		   char* f_src );
+
+  // Lossless disparity codec, for the IO_DATATYPE_COMPRESSED types. The
+  // payload is the size of the coded data (uint64) followed by the data
+  bool readCompressedData( std::ifstream & f_file_in, char* f_dst_p, 
+			   const CImageSize& f_imageSize );
+
+  bool writeCompressedData( std::ofstream & f_file_out, const CImageSize& f_imageSize, 
+			    const char* f_src_p );
 	
   inline void writeComments( std::ofstream &f_fileOut, 
 			     const std::string &f_comments_s )
@@ -0,0 +1,182 @@
+/* ******************************** FILE *********************************** */
+/** \file    sequenceFile.h
+ *
+ *  \brief   This file declares the classes CSequenceWriter and
+ *           CSequenceReader, for single-file trinocular sequences. A file
+ *           holds a number of streams (e.g. base, control and disparity)
+ *           and, for each frame, one image per stream. Layout (host byte
+ *           order):
+ *
+ *             SSequenceFileHeader
+ *             SSequenceStreamDesc x number of streams
+ *             payloads, each one aligned to SEQUENCE_ALIGNMENT bytes
+ *             index: uint64 offset of each payload, frame-major
+ *
+ *           The reader maps the file, so a frame is one index lookup and
+ *           no file is opened or parsed per frame. Frames are returned as
+ *           cv::Mat headers pointing into the mapping (no copy).
+ *
+ *  \note    .enpeda.. Project, The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_SEQUENCE_FILE_H
+#define FILE_SEQUENCE_FILE_H
+
+// Common includes
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdint.h>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Project includes
+#include "mappedFile.h"
+
+#define SEQUENCE_MAGIC	       "3EYESEQ"
+#define SEQUENCE_VERSION       1
+#define SEQUENCE_BYTE_ORDER    0x01020304
+#define SEQUENCE_ALIGNMENT     64
+#define SEQUENCE_NAME_SIZE     16
+
+// On-disk file header
+struct SSequenceFileHeader
+{
+  char     m_magic[ 8 ];
+  uint32_t m_version;
+  uint32_t m_byteOrder;		// SEQUENCE_BYTE_ORDER as written by the packer
+  uint32_t m_numStreams;
+  uint32_t m_alignment;
+  uint64_t m_numFrames;
+  uint64_t m_indexOffset;
+};
+
+// On-disk stream descriptor
+struct SSequenceStreamDesc
+{
+  char     m_name[ SEQUENCE_NAME_SIZE ];
+  int32_t  m_type;		// OpenCV type
+  uint32_t m_width;
+  uint32_t m_height;
+  uint32_t m_subpixelBits;	// Fixed point disparities (see IO_DATATYPE_16Q)
+  float    m_intensityScale;	// Factor to [0,255] (see intensityScaleFactor)
+  uint32_t m_reserved;
+};
+
+// Stream description
+struct SSequenceStream
+{
+  SSequenceStream( )
+    : m_name_str( ),
+      m_type_i( CV_32FC1 ),
+      m_width_ui( 0 ),
+      m_height_ui( 0 ),
+      m_subpixelBits_ui( 0 ),
+      m_intensityScale_f( 1.f )
+  { }
+
+  std::string m_name_str;
+  int	      m_type_i;
+  unsigned    m_width_ui;
+  unsigned    m_height_ui;
+  unsigned    m_subpixelBits_ui;
+  float	      m_intensityScale_f;
+};
+
+
+class CSequenceWriter
+{
+public:
+  // Constructor
+  CSequenceWriter();
+
+  // Destructor. Closes the file
+  ~CSequenceWriter();
+
+  // Creates the file. Every frame will have one image per stream, of the
+  // type and size of the stream
+  bool open( const std::string &f_fileName_str,
+	     const std::vector<SSequenceStream> &f_streams );
+
+  // Appends a frame, one image per stream (in the order of the streams)
+  bool addFrame( const std::vector<cv::Mat> &f_images );
+
+  // Writes the index and the final header
+  bool close();
+
+  inline unsigned getNumFrames() const
+  { return m_numFrames_ui; };
+
+private:
+
+  // Non copyable
+  CSequenceWriter( const CSequenceWriter& );
+  CSequenceWriter& operator=( const CSequenceWriter& );
+
+  // Pads the file with zeros up to the alignment
+  void align();
+
+  bool writeHeader( const uint64_t f_numFrames, const uint64_t f_indexOffset );
+
+  std::ofstream m_file;
+
+  std::vector<SSequenceStream> m_streams;
+
+  unsigned m_numFrames_ui;
+
+  // Offset of each payload, frame-major
+  std::vector<uint64_t> m_offsets;
+};
+
+
+class CSequenceReader
+{
+public:
+  // Constructor
+  CSequenceReader();
+
+  // Destructor
+  ~CSequenceReader();
+
+  // Maps the file and checks its header and index
+  bool open( const std::string &f_fileName_str );
+
+  void close();
+
+  inline unsigned getNumFrames() const
+  { return m_numFrames_ui; };
+
+  inline unsigned getNumStreams() const
+  { return static_cast<unsigned>( m_streams.size() ); };
+
+  inline const SSequenceStream& getStream( const unsigned f_stream_ui ) const
+  { return m_streams[ f_stream_ui ]; };
+
+  // Index of the stream with the given name. -1 if there is none
+  int findStream( const std::string &f_name_str ) const;
+
+  // Image of a stream in a frame, pointing into the mapped file (no copy).
+  // It stays valid after the reader is closed, as long as the Mat lives
+  cv::Mat getFrame( const unsigned f_frame_ui, const unsigned f_stream_ui ) const;
+
+  // All the images of a frame, in the order of the streams
+  bool getFrame( const unsigned f_frame_ui, std::vector<cv::Mat> &f_images ) const;
+
+private:
+
+  // Non copyable
+  CSequenceReader( const CSequenceReader& );
+  CSequenceReader& operator=( const CSequenceReader& );
+
+  CMappedFile m_file;
+
+  std::vector<SSequenceStream> m_streams;
+
+  unsigned m_numFrames_ui;
+
+  // Points into the mapped file
+  const uint64_t* m_index_p;
+};
+
+#endif /* FILE_SEQUENCE_FILE_H */
@@ -9,6 +9,9 @@
 #ifndef FILE_THIRDEYE_H
 #define FILE_THIRDEYE_H
 
+// Common includes
+#include <vector>
+
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 
@@ -59,10 +62,54 @@ public:
     m_invalid_f = f_invalid_f;
   }
 
+  // Factor that brings the intensities of the base image to [0,255]. The
+  // background of the virtual image is 127 in that range
+  inline void setIntensityScale( const float f_scale_f )
+  {
+    m_intensityScale_f = f_scale_f;
+  }
+
+  // Fractional bits of 16-bit fixed point disparity maps (CV_16UC1, see
+  // IO_DATATYPE_16Q). Their invalid value is always IO_16Q_INVALID
+  inline void setSubpixelBits( const unsigned f_subpixelBits_ui )
+  {
+    m_subpixelBits_ui = f_subpixelBits_ui;
+  }
+
+  inline unsigned getSubpixelBits() const
+  { return m_subpixelBits_ui; };
+
+  inline float getIntensityScale() const
+  { return m_intensityScale_f; };
+
+  // Max number of threads computing the positions in the virtual image (see
+  // parallelFor). Zero means the scheduler bound
+  inline void setNumThreads( const unsigned f_numThreads_ui )
+  {
+    m_numThreads_ui = f_numThreads_ui;
+  }
+
+  inline float getInvalidValue() const
+  { return m_invalid_f; };
+
+  inline const SThirdEyeParams& getParams() const
+  { return m_params; };
+
   void  print();
 
   bool  generateVirtualImage( const cv::Mat f_disparityMap, const cv::Mat f_baseImg,
-			      cv::Mat &f_virtualImg );
+			      cv::Mat &f_virtualImg ) const;
+
+  // Also returns the disparity that won each position of the virtual image
+  // (-1 where nothing was mapped)
+  bool  generateVirtualImage( const cv::Mat f_disparityMap, const cv::Mat f_baseImg,
+			      cv::Mat &f_virtualImg, cv::Mat &f_sourceDisparity ) const;
+
+  // Position in the virtual image of a set of base image positions. Only the
+  // disparities of those positions are read
+  bool  projectPoints( const cv::Mat f_disparityMap, 
+		       const std::vector<cv::Point> &f_basePoints,
+		       std::vector<cv::Point> &f_virtualPoints ) const;
 		
 private:
 
@@ -75,10 +122,26 @@ private:
   //
   float m_invalid_f;
 
+  float m_intensityScale_f;
+
+  unsigned m_subpixelBits_ui;
+
+  unsigned m_numThreads_ui;
+
+  // Reads the disparity at (x,y) of a 32 float or 16-bit fixed point map.
+  // False if it is invalid
+  template<typename D>
+  inline bool readDisparity( const cv::Mat &f_disparityMap, const int f_y_i, 
+			     const int f_x_i, float &f_disparity_f ) const;
+
+  template<typename T, typename D>
+  void  warp( const cv::Mat f_disparityMap, const cv::Mat f_baseImg,
+	      cv::Mat &f_virtualImg, cv::Mat &f_sourceDisparity ) const;
+
   /// Methods
   bool computeNewPosition( const float f_xPos_f, const float f_yPos_f, 
 			   const float f_disparity_f,
-			   int& f_xNewPos_f, int& f_yNewPos_f );
+			   int& f_xNewPos_f, int& f_yNewPos_f ) const;
 
   /* *************************** METHOD ************************************** */
   /* myRound
@@ -93,7 +156,7 @@ private:
    *
    * \return     The rounded value as an integer.
    *************************************************************************** */
-  inline int myRound( const float f_value_f )
+  inline int myRound( const float f_value_f ) const
   {
     if( f_value_f == 0.f )
     {
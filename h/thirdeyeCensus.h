@@ -0,0 +1,119 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeCensus.h
+ *
+ *  \brief   Declaration of the class CThirdEyeCensus. It computes a census
+ *           (rank) transform based similarity index between the control and
+ *           the virtual image. It is an alternative to the NCC index that is
+ *           less sensitive to exposure differences between the cameras.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_CENSUS_H
+#define FILE_THIRDEYE_CENSUS_H
+
+// Common includes
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Sums of the census Hamming distances of a set of pixels: of all of them,
+// of the masked ones, and the number of masked ones
+struct SCensusSums
+{
+  uint64_t m_hamming;
+  uint64_t m_hammingMask;
+  uint64_t m_countMask;
+
+  SCensusSums()
+    : m_hamming( 0 ), m_hammingMask( 0 ), m_countMask( 0 )
+  {};
+};
+
+// Census kernel shared by CThirdEyeCensus and the 3x3 census metric of the
+// statistics. Instantiated for uchar, ushort and float
+template<typename T>
+void censusHammingRow( const T* f_control_p, const T* f_virtual_p,
+		       const size_t f_stepC, const size_t f_stepV,
+		       const unsigned f_count_ui,
+		       const int* f_offsetsY_p, const int* f_offsetsX_p,
+		       const unsigned f_numBits_ui, const float* f_mask_p,
+		       SCensusSums &f_sums );
+
+class CThirdEyeCensus
+{
+public:
+
+  // Default constructor
+  CThirdEyeCensus();
+
+  // Destructor
+  ~CThirdEyeCensus();
+
+  bool evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
+		 const cv::Mat f_maskImg );
+
+  void setROI( const unsigned f_x1_ui, const unsigned f_y1_ui,
+	       const unsigned f_x2_ui, const unsigned f_y2_ui  );
+
+  bool setWindow( const unsigned f_width_ui, const unsigned f_height_ui );
+
+  // Copies the settings of f_config, not its results (see CThirdEyeEvaluation)
+  void setConfiguration( const CThirdEyeCensus &f_config );
+
+  inline void setNumThreads( const unsigned f_numThreads_ui )
+  { m_numThreads_ui = f_numThreads_ui; };
+
+  // Census index (* 100): 100 if all the bits of the descriptors match
+  inline float getIndex()
+  { return m_index_f; };
+
+  inline float getIndexMask()
+  { return m_indexMask_f; };
+
+  // Mean Hamming distance between the descriptors
+  inline double getMeanHamming()
+  { return m_meanHamming_d; };
+
+  inline double getMeanHammingMask()
+  { return m_meanHammingMask_d; };
+
+  inline unsigned getNumBits()
+  { return static_cast<unsigned>( m_offsetsY.size() ); };
+
+private:
+
+  void censusRow( const cv::Mat &f_controlImg, const cv::Mat &f_virtualImg,
+		  const unsigned f_y_ui, const unsigned f_x_ui,
+		  const unsigned f_count_ui, const float* f_mask_p,
+		  SCensusSums &f_sums );
+
+  //Roi
+  unsigned m_x1_ui, m_y1_ui,
+           m_x2_ui, m_y2_ui;
+
+  // Window
+  unsigned m_width_ui, m_height_ui;
+
+  // Offsets of the neighbours, one per bit of the descriptors
+  std::vector<int> m_offsetsY;
+
+  std::vector<int> m_offsetsX;
+
+  unsigned m_numThreads_ui;
+
+  // Results
+  float    m_index_f;
+
+  float    m_indexMask_f;
+
+  double   m_meanHamming_d;
+
+  double   m_meanHammingMask_d;
+
+}; // end class CThirdEyeCensus
+
+#endif /* FILE_THIRDEYE_CENSUS_H */
@@ -0,0 +1,68 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeConfig.h
+ *
+ *  \brief   Declaration of SThirdEyeConfig and of the functions that read it
+ *           from a text file and apply it to a CThirdEyeEvaluation. The file
+ *           has one "key = values" line per setting; '#' starts a comment.
+ *           See thirdeye.cfg for the keys.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_CONFIG_H
+#define FILE_THIRDEYE_CONFIG_H
+
+// Common includes
+#include <string>
+
+// Project includes
+#include "params.h"
+#include "thirdeyeEval.h"
+
+// Settings of an evaluation. The geometry is required, the rest have the
+// defaults of CThirdEyeEvaluation
+struct SThirdEyeConfig
+{
+  SThirdEyeConfig()
+    : m_params( ),
+      m_x1_ui( 0 ), m_y1_ui( 0 ), m_x2_ui( 640 ), m_y2_ui( 480 ),
+      m_maskGradient_f( 5.f ),
+      m_maskDistance_f( 10.f ),
+      m_bits_ui( 16 ),
+      m_invalid_f( -1.f ),
+      m_indexType_e( INDEX_NCC ),
+      m_latencyBudget_f( 0.f )
+  { }
+
+  // Rig geometry (baseline, translation, rotation, principal points, focal
+  // lengths, pixel size)
+  SThirdEyeParams m_params;
+
+  // Evaluation RoI
+  unsigned m_x1_ui, m_y1_ui, m_x2_ui, m_y2_ui;
+
+  // Mask thresholds (see CThirdEyeMask)
+  float    m_maskGradient_f;
+
+  float    m_maskDistance_f;
+
+  // Bit depth of the base and control images
+  unsigned m_bits_ui;
+
+  // Invalid value of 32 float disparity maps
+  float    m_invalid_f;
+
+  EThirdEyeIndex m_indexType_e;
+
+  // Per frame budget (ms) of the adaptive mode. Zero disables it
+  float    m_latencyBudget_f;
+};
+
+// Reads a configuration file. False (with a message) if the file cannot be
+// read, a key is unknown or has a wrong number of values, or a geometry key
+// is missing
+bool loadConfig( const std::string &f_fileName_str, SThirdEyeConfig &f_config );
+
+void applyConfig( const SThirdEyeConfig &f_config, CThirdEyeEvaluation &f_eval );
+
+#endif /* FILE_THIRDEYE_CONFIG_H */
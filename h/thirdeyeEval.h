@@ -1,6 +1,10 @@
 #ifndef FILE_THIRDEYE_EVALUATION_H
 #define FILE_THIRDEYE_EVALUATION_H
 
+// Common includes
+#include <cstdint>
+#include <vector>
+
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 
@@ -8,7 +12,236 @@
 #include "thirdeyeMask.h"
 #include "thirdeye.h"
 #include "thirdeyeStats.h"
+#include "thirdeyeCensus.h"
+
+// Similarity index reported by computeEvaluationIndices
+enum EThirdEyeIndex
+{
+  INDEX_NCC    = 0,
+  INDEX_CENSUS = 1
+};
+
+// Quality levels of the adaptive mode (see setLatencyBudget), from the most
+// to the least expensive
+enum EThirdEyeQuality
+{
+  QUALITY_FULL        = 0,	// Full resolution evaluation
+  QUALITY_COARSE_MASK = 1,	// Mask from the control image at 1/2 resolution
+  QUALITY_COARSE      = 2,	// Whole evaluation at 1/4 resolution (as setPyramid)
+  QUALITY_SAMPLED     = 3,	// Sampled estimate of the NCC only (see
+				// estimateEvaluationIndex), not an index
+  QUALITY_NUM_LEVELS  = 4
+};
+
+// Quality control of the adaptive mode (see setLatencyBudget). Keeps the
+// expected time (ms) of each quality level and chooses the most expensive
+// level that fits in the budget. The expected time of a level only goes
+// down when the level runs, so a more expensive level is tried again (probed)
+// only after a run of frames well under the budget, and only if its time,
+// predicted from the current level, fits in the budget. A probe that does
+// not fit doubles the frames to wait for the next one
+class CThirdEyeQualityControl
+{
+public:
+  CThirdEyeQualityControl();
+
+  // Most expensive of the first f_numLevels_ui levels whose expected time is
+  // within 90% of f_budget_f
+  EThirdEyeQuality choose( const float f_budget_f, const unsigned f_numLevels_ui ) const;
+
+  // Time of an evaluation at f_quality_e. Only measured times (e.g. not those
+  // of frames whose virtual image was cached) update the expected time
+  void record( const EThirdEyeQuality f_quality_e, const float f_time_f,
+	       const float f_budget_f, const bool f_measured_b );
+
+  // Expected time of a level, -1 if unknown
+  inline float getExpectedTime( const EThirdEyeQuality f_quality_e ) const
+  { return m_levelTime_f[ f_quality_e ]; };
+
+private:
+  float    m_levelTime_f[ QUALITY_NUM_LEVELS ];
+
+  // Level of the last frame, and frames in a row well under the budget at it
+  EThirdEyeQuality m_level_e;
+
+  unsigned m_roomFrames_ui;
+
+  // Frames under the budget needed for the next probe, and level being
+  // probed (-1 if none)
+  unsigned m_probeWait_ui;
+
+  int      m_probe_i;
+};
+
+// Per-caller state of an evaluation: the intermediate images and the
+// objects that hold the results. The const methods of CThirdEyeEvaluation
+// only write into a workspace, so several threads can evaluate frames with
+// one shared CThirdEyeEvaluation, each one with its own workspace. Reusing a
+// workspace for the frames of a sequence keeps its buffers allocated.
+//
+// The warp, mask and stats outputs are cached: each one keeps the frame
+// token (see setFrame), the inputs and the settings stamp (see
+// CThirdEyeEvaluation) it was computed from, and is only recomputed when one
+// of them changes. So changing e.g. the RoI only reruns the stats of the
+// frame. Without a frame token the inputs are never taken to be unchanged,
+// since a buffer can get new contents (in-place loads and writes, external
+// memory) that its pointer and size do not reveal.
+struct SThirdEyeWorkspace
+{
+  SThirdEyeWorkspace()
+    : m_frame( 0 ),
+      m_warpFrame( 0 ),
+      m_warpSettings( 0 ),
+      m_warpStamp( 0 ),
+      m_maskFrame( 0 ),
+      m_maskSettings( 0 ),
+      m_maskStamp( 0 ),
+      m_statsSettings( 0 ),
+      m_statsWarp( 0 ),
+      m_statsMask( 0 ),
+      m_fullIndex_f( -1.f ),
+      m_maskIndex_f( -1.f ),
+      m_coarseResult_b( false ),
+      m_quality_e( QUALITY_FULL ),
+      m_lastTime_f( 0.f ),
+      m_estimate_f( -32000.f ),
+      m_estimateLower_f( -32000.f ),
+      m_estimateUpper_f( -32000.f ),
+      m_samplingRate_f( -1.f ),
+      m_samplingSeed_ui( 0 )
+  {}
+
+  // Token of the input images of the next evaluations, chosen by the caller.
+  // The calls with the same nonzero token reuse the cached stages, so the
+  // token must change whenever the contents of an input change, also when
+  // they are written into the same buffer. Zero (the default) disables the
+  // reuse of the stages across calls
+  inline void setFrame( const uint64_t f_frame )
+  {
+    m_frame = f_frame;
+  }
+
+  // Drops the cached outputs, so the next evaluation recomputes all stages
+  inline void invalidate()
+  {
+    m_warpSettings = m_maskSettings = m_statsSettings = 0;
+    m_warpDisparity.release();
+    m_warpBase.release();
+    m_maskControl.release();
+  }
+
+  // Virtual image and disparity that generated each of its pixels
+  cv::Mat m_virtualImage;
+
+  cv::Mat m_sourceDisparity;
+
+  // Frame token of the next evaluations (see setFrame)
+  uint64_t m_frame;
+
+  // Frame token, inputs and settings stamp of the virtual image (zero if
+  // there is none), and stamp of the virtual image itself
+  uint64_t m_warpFrame;
+
+  cv::Mat  m_warpDisparity;
+
+  cv::Mat  m_warpBase;
+
+  uint64_t m_warpSettings;
+
+  uint64_t m_warpStamp;
+
+  // Same for the mask of m_maskGenerator
+  uint64_t m_maskFrame;
+
+  cv::Mat  m_maskControl;
+
+  uint64_t m_maskSettings;
+
+  uint64_t m_maskStamp;
+
+  // Settings stamp, and virtual image and mask stamps, of the indices
+  uint64_t m_statsSettings;
+
+  uint64_t m_statsWarp;
+
+  uint64_t m_statsMask;
+
+  float    m_fullIndex_f;
+
+  float    m_maskIndex_f;
+
+  // Mask and results of the last evaluation (NCC, metrics, local NCC maps,
+  // region, label and band statistics; census index)
+  CThirdEyeMask   m_maskGenerator;
+
+  CThirdEyeStats  m_errorCalculator;
+
+  CThirdEyeCensus m_censusCalculator;
 
+  // Pyramid mode. True if the last indices come from the coarse level
+  bool     m_coarseResult_b;
+
+  cv::Mat  m_coarseBase;
+
+  cv::Mat  m_coarseControl;
+
+  cv::Mat  m_coarseDisparity;
+
+  cv::Mat  m_coarseVirtualImage;
+
+  cv::Mat  m_coarseSourceDisparity;
+
+  CThirdEye      m_coarseImgGenerator;
+
+  CThirdEyeMask  m_coarseMaskGenerator;
+
+  CThirdEyeStats m_coarseCalculator;
+
+  // Adaptive mode. Quality level and time (ms) of the last evaluation, and
+  // expected time of each level
+  EThirdEyeQuality m_quality_e;
+
+  float    m_lastTime_f;
+
+  CThirdEyeQualityControl m_qualityControl;
+
+  // Estimate of the last evaluation at QUALITY_SAMPLED and its 95% interval
+  // (see estimateEvaluationIndex), -32000 at the other levels. The estimate
+  // is the NCC of the mapped pixels, not comparable with the indices, which
+  // are not computed at that level
+  float    m_estimate_f;
+
+  float    m_estimateLower_f;
+
+  float    m_estimateUpper_f;
+
+  // Control image at 1/2 resolution, its mask generator, and the mask at full
+  // resolution (QUALITY_COARSE_MASK)
+  cv::Mat  m_halfControl;
+
+  CThirdEyeMask m_halfMaskGenerator;
+
+  cv::Mat  m_halfMask;
+
+  // Sampling pattern of estimateEvaluationIndex, and the size, rate and seed
+  // it was generated for
+  cv::Size m_samplesSize;
+
+  float    m_samplingRate_f;
+
+  unsigned m_samplingSeed_ui;
+
+  std::vector<cv::Point> m_samples;
+
+  std::vector<cv::Point> m_virtualSamples;
+};
+
+// The set methods define the evaluation; the results of the methods without
+// a workspace argument are kept in an internal workspace and read with the
+// get methods. Each method with a workspace argument has a const overload.
+// The settings are grouped by the stage they affect (warp, mask, stats), and
+// each set method gives its group a new stamp, so the cached outputs of a
+// workspace are only recomputed from the first stage whose settings changed
 class CThirdEyeEvaluation
 {
 public:
@@ -40,6 +273,7 @@ public:
   inline void setParams( const SThirdEyeParams &f_params )
   {
     m_virtualImgGenerator.setParams( f_params );
+    m_warpSettings = newStamp();
   }
 
   // Set the parameters that define the mask
@@ -48,6 +282,7 @@ public:
   {
     m_maskGenerator.setParams( f_thresholdDistance_f,
 			       f_thresholdGradient_f );
+    m_maskSettings = newStamp();
   }
 
   // Set a RoI to discard obvious occluded regions
@@ -56,6 +291,109 @@ public:
   {
     m_errorCalculator.setROI( f_x1_ui, f_y1_ui,
 			      f_x2_ui, f_y2_ui );
+    m_censusCalculator.setROI( f_x1_ui, f_y1_ui,
+			       f_x2_ui, f_y2_ui );
+    m_statsSettings = newStamp();
+  }
+
+  // Max number of threads of the parallel loops of each stage (see
+  // parallelFor). Zero means the scheduler bound (see setSchedulerThreads)
+  inline void setNumThreads( const unsigned f_numThreads_ui )
+  {
+    m_virtualImgGenerator.setNumThreads( f_numThreads_ui );
+    m_maskGenerator.setNumThreads( f_numThreads_ui );
+    m_errorCalculator.setNumThreads( f_numThreads_ui );
+    m_censusCalculator.setNumThreads( f_numThreads_ui );
+  }
+
+  // Index reported by computeEvaluationIndices (see EThirdEyeIndex)
+  inline void setIndexType( const EThirdEyeIndex f_indexType_e )
+  {
+    m_indexType_e = f_indexType_e;
+    m_statsSettings = newStamp();
+  }
+
+  // Window of the census index (odd sizes, at most 64 neighbours)
+  inline bool setCensusWindow( const unsigned f_width_ui, const unsigned f_height_ui )
+  {
+    m_statsSettings = newStamp();
+    return m_censusCalculator.setWindow( f_width_ui, f_height_ui );
+  }
+
+  // Window size and stride of the local NCC maps. Zero disables them
+  inline void setLocalNCCWindow( const unsigned f_window_ui, const unsigned f_stride_ui = 1 )
+  {
+    m_errorCalculator.setLocalWindow( f_window_ui, f_stride_ui );
+    m_statsSettings = newStamp();
+  }
+
+  // Local NCC maps (full and masked approach) of the last evaluation
+  inline cv::Mat getLocalNCCMap()
+  {
+    return m_workspace.m_errorCalculator.getLocalNCC();
+  }
+
+  inline cv::Mat getLocalNCCMapMask()
+  {
+    return m_workspace.m_errorCalculator.getLocalNCCmask();
+  }
+
+  // Metrics computed besides the NCC (see EThirdEyeMetric)
+  inline void setMetrics( const unsigned f_metrics_ui )
+  {
+    m_errorCalculator.setMetrics( f_metrics_ui );
+    m_statsSettings = newStamp();
+  }
+
+  // Metrics of the last evaluation (full and masked approach)
+  inline const SThirdEyeMetrics& getMetrics()
+  {
+    return m_workspace.m_errorCalculator.getMetrics();
+  }
+
+  inline const SThirdEyeMetrics& getMetricsMask()
+  {
+    return m_workspace.m_errorCalculator.getMetricsMask();
+  }
+
+  // Additional evaluation regions: rectangles and/or a label image
+  inline void setEvaluationRegions( const std::vector<cv::Rect> &f_regions )
+  {
+    m_errorCalculator.setRegions( f_regions );
+    m_statsSettings = newStamp();
+  }
+
+  inline void setEvaluationLabels( const cv::Mat f_labels, const unsigned f_numLabels_ui )
+  {
+    m_errorCalculator.setLabelImage( f_labels, f_numLabels_ui );
+    m_statsSettings = newStamp();
+  }
+
+  // Per-rectangle and per-label results of the last evaluation
+  inline const std::vector<SRegionStats>& getRegionStats()
+  {
+    return m_workspace.m_errorCalculator.getRegionStats();
+  }
+
+  inline const std::vector<SRegionStats>& getLabelStats()
+  {
+    return m_workspace.m_errorCalculator.getLabelStats();
+  }
+
+  // Disparity bands of the per-band breakdown (see 
+  // CThirdEyeStats::setDisparityBands). A count of zero disables them
+  inline void setDisparityBands( const float f_min_f, const float f_max_f,
+				 const unsigned f_count_ui )
+  {
+    m_errorCalculator.setDisparityBands( f_min_f, f_max_f, f_count_ui );
+    m_statsSettings = newStamp();
+  }
+
+  // Per-band results of the last evaluation, binned by the disparity that
+  // generated each pixel of the virtual image
+  inline const std::vector<SRegionStats>& getBandStats()
+  {
+    return m_workspace.m_errorCalculator.getBandStats();
   }
 
   // Pixels whose respective disparity has this value will be ignored
@@ -63,27 +401,195 @@ public:
   inline void setInvalidValue( const float f_invalid_f )
   {
     m_virtualImgGenerator.setInvalidValue( f_invalid_f  );
+    m_warpSettings = newStamp();
+  }
+
+  // Fractional bits of 16-bit fixed point disparity maps (CV_16UC1, see
+  // loadRawImage). Such maps are warped without converting them to float.
+  // Usually set for every frame, so the stamp only changes with the value
+  inline void setSubpixelBits( const unsigned f_subpixelBits_ui )
+  {
+    if( f_subpixelBits_ui != m_virtualImgGenerator.getSubpixelBits() )
+    {
+      m_virtualImgGenerator.setSubpixelBits( f_subpixelBits_ui );
+      m_warpSettings = newStamp();
+    }
+  }
+
+  // Factor that brings the intensities of the base and control images to
+  // [0,255] (see loadImageFileNative). The images can then be used in their
+  // native 8 or 16 bit type; the NCC does not depend on it
+  inline void setIntensityScale( const float f_scale_f )
+  {
+    if( f_scale_f != m_virtualImgGenerator.getIntensityScale() )
+    {
+      m_virtualImgGenerator.setIntensityScale( f_scale_f );
+      m_maskGenerator.setIntensityScale( f_scale_f );
+      m_errorCalculator.setIntensityScale( f_scale_f );
+      m_warpSettings  = newStamp();
+      m_maskSettings  = newStamp();
+      m_statsSettings = newStamp();
+    }
+  }
+
+  // Pyramid mode: computeEvaluationIndices first evaluates the images at 1/4
+  // of the resolution and only runs the full resolution evaluation if the
+  // coarse NCC index of the full approach is within [low, high]. The band
+  // is an NCC band, so the census index (INDEX_CENSUS) always runs at full
+  // resolution
+  inline void setPyramid( const bool f_enable_b, 
+			  const float f_low_f = -100.f, const float f_high_f = 100.f )
+  {
+    m_pyramid_b     = f_enable_b;
+    m_pyramidLow_f  = f_low_f;
+    m_pyramidHigh_f = f_high_f;
+    m_statsSettings = newStamp();
+  }
+
+  // True if the indices of the last computeEvaluationIndices call come from
+  // the coarse level (i.e. the full resolution evaluation was skipped)
+  inline bool isCoarseResult()
+  {
+    return m_workspace.m_coarseResult_b;
+  }
+
+  // Adaptive mode: computeEvaluationIndices keeps within f_budget_f ms by
+  // lowering the quality level (see EThirdEyeQuality) when its measured
+  // times get close to the budget, and raising it again when there is room.
+  // The pyramid mode is not used meanwhile. Zero (the default) disables it
+  inline void setLatencyBudget( const float f_budget_f )
+  {
+    m_latencyBudget_f = f_budget_f;
+  }
+
+  inline float getLatencyBudget() const
+  {
+    return m_latencyBudget_f;
+  }
+
+  // Quality level and time (ms) of the last computeEvaluationIndices call.
+  // Always QUALITY_FULL without a latency budget
+  inline EThirdEyeQuality getQuality()
+  {
+    return m_workspace.m_quality_e;
+  }
+
+  inline float getEvaluationTime()
+  {
+    return m_workspace.m_lastTime_f;
   }
 		
   void  computeEvaluationIndices( const cv::Mat f_dispMap, const cv::Mat f_baseImg, 
 				  const cv::Mat f_controlImg,
 				  float &f_fullIndex_f, float &f_maskIndex_f );
 
+  bool  computeEvaluationIndices( const cv::Mat f_dispMap, const cv::Mat f_baseImg, 
+				  const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace,
+				  float &f_fullIndex_f, float &f_maskIndex_f ) const;
+
+  // Fraction of the base pixels used by estimateEvaluationIndex, and the seed
+  // of the (reproducible) sampling pattern
+  inline void setSampling( const float f_rate_f, const unsigned f_seed_ui = 0 )
+  {
+    m_samplingRate_f  = f_rate_f;
+    m_samplingSeed_ui = f_seed_ui;
+  }
+
+  bool  estimateEvaluationIndex( const cv::Mat f_dispMap, const cv::Mat f_baseImg, 
+				 const cv::Mat f_controlImg,
+				 float &f_index_f, float &f_lower_f, float &f_upper_f );
+
+  bool  estimateEvaluationIndex( const cv::Mat f_dispMap, const cv::Mat f_baseImg, 
+				 const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace,
+				 float &f_index_f, float &f_lower_f, float &f_upper_f ) const;
+
   cv::Mat getVirtualImage( const cv::Mat f_dispMap, 
 			   const cv::Mat f_baseImg );
+
+  cv::Mat getVirtualImage( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+			   SThirdEyeWorkspace &f_workspace ) const;
   
   cv::Mat getMask( const cv::Mat f_controlImg,
 		   const float f_thresholdGradient_f = -1.f, 
 		   const float f_thresholdDistance_f = -1.f );
 
+  cv::Mat getMask( const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace,
+		   const float f_thresholdGradient_f = -1.f, 
+		   const float f_thresholdDistance_f = -1.f ) const;
+
+  // Warp and mask stages of computeEvaluationIndices on their own. Their
+  // outputs are cached in the workspace, so a computeEvaluationIndices call
+  // with the same frame token and inputs then only runs the stats (see
+  // CThirdEyeSequence)
+  bool  runWarpStage( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+		      SThirdEyeWorkspace &f_workspace ) const;
+
+  bool  runMaskStage( const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace ) const;
+
+  // True if computeEvaluationIndices always runs the full resolution warp
+  // and mask stages, i.e. neither the pyramid nor the adaptive mode is on
+  inline bool hasFullStages() const
+  {
+    return ( !m_pyramid_b || m_indexType_e == INDEX_CENSUS ) && m_latencyBudget_f <= 0.f;
+  }
+
+  // Frame token of the internal workspace (see SThirdEyeWorkspace::setFrame)
+  inline void setFrame( const uint64_t f_frame )
+  {
+    m_workspace.setFrame( f_frame );
+  }
+
+  // Drops the cached outputs of the internal workspace (see
+  // SThirdEyeWorkspace::invalidate)
+  inline void invalidate()
+  {
+    m_workspace.invalidate();
+  }
+
   void print();
 
 private:
 
-  // Virtual image
-  cv::Mat m_virtualImage;
+  // New, process-wide unique, settings stamp. Zero is never returned
+  static uint64_t newStamp();
 
-  /// Auxiliary objects
+  void  configure( SThirdEyeWorkspace &f_workspace ) const;
+
+  // Virtual image and mask of a workspace, recomputed only if their inputs or
+  // settings changed
+  bool  updateVirtualImage( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+			    SThirdEyeWorkspace &f_workspace ) const;
+
+  bool  updateMask( const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace ) const;
+
+  bool  isCached( const cv::Mat f_dispMap, const cv::Mat f_baseImg, const cv::Mat f_controlImg,
+		  const SThirdEyeWorkspace &f_workspace ) const;
+
+  bool  evaluateFull( const cv::Mat f_dispMap, const cv::Mat f_baseImg, 
+		      const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace,
+		      float &f_fullIndex_f, float &f_maskIndex_f ) const;
+
+  bool  evaluateStats( const cv::Mat f_controlImg, const cv::Mat f_mask,
+		       SThirdEyeWorkspace &f_workspace,
+		       float &f_fullIndex_f, float &f_maskIndex_f ) const;
+
+  bool  evaluateAdaptive( const cv::Mat f_dispMap, const cv::Mat f_baseImg, 
+			  const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace,
+			  float &f_fullIndex_f, float &f_maskIndex_f ) const;
+
+  bool  generateCoarseMask( const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace ) const;
+
+  void  generateSamples( const cv::Size f_size, SThirdEyeWorkspace &f_workspace ) const;
+
+  bool  evaluateCoarse( const cv::Mat f_dispMap, const cv::Mat f_baseImg, 
+			const cv::Mat f_controlImg, SThirdEyeWorkspace &f_workspace,
+			float &f_fullIndex_f, float &f_maskIndex_f ) const;
+
+  // Workspace of the methods without a workspace argument
+  SThirdEyeWorkspace m_workspace;
+
+  /// Auxiliary objects. They hold the settings of the evaluation; the
+  /// evaluations are done by the objects of a workspace (see configure)
   // Mask generator   
   CThirdEyeMask  m_maskGenerator;
 
@@ -93,6 +599,34 @@ private:
   // Error calculator
   CThirdEyeStats m_errorCalculator;
 
+  // Census index calculator
+  CThirdEyeCensus m_censusCalculator;
+
+  // Settings stamps of the warp, mask and stats stages
+  uint64_t m_warpSettings;
+
+  uint64_t m_maskSettings;
+
+  uint64_t m_statsSettings;
+
+  // Reported index
+  EThirdEyeIndex m_indexType_e;
+
+  // Sampling (see estimateEvaluationIndex)
+  float    m_samplingRate_f;
+
+  unsigned m_samplingSeed_ui;
+
+  // Pyramid mode (see setPyramid)
+  bool     m_pyramid_b;
+
+  float    m_pyramidLow_f;
+
+  float    m_pyramidHigh_f;
+
+  // Adaptive mode (see setLatencyBudget), in ms
+  float    m_latencyBudget_f;
+
 }; // end class CThirdEyeEvaluation
 
 
@@ -0,0 +1,72 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeIntegral.h
+ *
+ *  \brief   Declaration of the class CMomentsIntegral. It holds the integral
+ *           images (summed-area tables) of the moments of a pair of images
+ *           (control and virtual), so the moments of any axis-aligned
+ *           rectangle can be obtained in constant time.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_INTEGRAL_H
+#define FILE_THIRDEYE_INTEGRAL_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Project includes
+#include "thirdeyeMoments.h"
+
+class CMomentsIntegral
+{
+public:
+
+  // Default constructor
+  CMomentsIntegral();
+
+  // Destructor
+  ~CMomentsIntegral();
+
+  bool build( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
+	      const cv::Mat f_mask, const cv::Rect &f_roi,
+	      const double f_shiftC_d, const double f_shiftV_d,
+	      const unsigned f_numThreads_ui = 0 );
+
+  // Build in steps, for callers that traverse the images themselves
+  bool begin( const cv::Size &f_imageSize, const cv::Rect &f_roi, const bool f_mask_b,
+	      const double f_shiftC_d, const double f_shiftV_d );
+
+  void addRow( const int f_y_i, const float* f_control_p,
+	       const float* f_virtual_p, const float* f_mask_p );
+
+  void finish( const unsigned f_numThreads_ui = 0 );
+
+  bool query( const cv::Rect &f_rect, SNCCMoments &f_moments ) const;
+
+  bool queryMask( const cv::Rect &f_rect, SNCCMoments &f_moments ) const;
+
+  inline const cv::Rect& getROI() const
+  { return m_roi; };
+
+  inline bool hasMask() const
+  { return !m_tableMask.empty(); };
+
+private:
+
+  bool queryTable( const cv::Mat &f_table, const cv::Rect &f_rect, 
+		   SNCCMoments &f_moments ) const;
+
+  // Region covered by the tables (image coordinates)
+  cv::Rect m_roi;
+
+  double   m_shiftC_d, m_shiftV_d;
+
+  // (h+1)x(w+1) tables with 6 channels: n, c, v, c^2, v^2 and cv
+  cv::Mat  m_table;
+
+  cv::Mat  m_tableMask;
+
+}; // end class CMomentsIntegral
+
+#endif /* FILE_THIRDEYE_INTEGRAL_H */
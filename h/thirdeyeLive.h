@@ -0,0 +1,248 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeLive.h
+ *
+ *  \brief   Declaration of CThirdEyeLive, a live front end for
+ *           CThirdEyeEvaluation: frames are pushed by the capture side
+ *           (e.g. a camera callback) into a bounded queue and evaluated by a
+ *           worker thread as they come. A drop policy decides what happens
+ *           when the evaluation falls behind. The results wait in a bounded
+ *           ring until the caller takes them, and the end-to-end latencies
+ *           are summed up in running statistics, so a front end that runs
+ *           for days keeps a fixed memory. CThirdEyeReplayer feeds a recorded
+ *           sequence at a fixed frame rate to test a setup without the rig.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_LIVE_H
+#define FILE_THIRDEYE_LIVE_H
+
+// Common includes
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Project includes
+#include "thirdeyeEval.h"
+#include "thirdeyeSequence.h"
+#include "boundedQueue.h"
+
+// What pushFrame does when the queue is full
+enum EThirdEyeDropPolicy
+{
+  DROP_OLDEST = 0,	// The oldest waiting frame is dropped (lowest latency)
+  DROP_NEWEST,		// The pushed frame is dropped
+  DROP_NONE		// pushFrame blocks until there is room (no frame lost)
+};
+
+// Result of a live frame
+struct SThirdEyeLiveResult
+{
+  SThirdEyeLiveResult( )
+    : m_index_ui( 0 ),
+      m_valid_b( false ),
+      m_dropped_b( false ),
+      m_fullIndex_f( -1.f ),
+      m_maskIndex_f( -1.f ),
+      m_quality_e( QUALITY_FULL ),
+      m_estimate_f( -32000.f ),
+      m_estimateLower_f( -32000.f ),
+      m_estimateUpper_f( -32000.f ),
+      m_waitTime_f( 0.f ),
+      m_latency_f( 0.f )
+  { }
+
+  unsigned         m_index_ui;
+  bool             m_valid_b;
+  bool             m_dropped_b;	// Never evaluated (see EThirdEyeDropPolicy)
+  float            m_fullIndex_f;
+  float            m_maskIndex_f;
+  EThirdEyeQuality m_quality_e;
+
+  // Sampled estimate and its interval (see SThirdEyeWorkspace::m_estimate_f)
+  float            m_estimate_f;
+  float            m_estimateLower_f;
+  float            m_estimateUpper_f;
+
+  // Times (ms) from the push: until the evaluation starts, and until the
+  // indices are ready
+  float            m_waitTime_f;
+  float            m_latency_f;
+};
+
+// Summary of the results of a live run. Latencies in ms, of the evaluated
+// frames only
+struct SThirdEyeLiveStats
+{
+  SThirdEyeLiveStats( )
+    : m_pushed_ui( 0 ),
+      m_evaluated_ui( 0 ),
+      m_dropped_ui( 0 ),
+      m_lost_ui( 0 ),
+      m_late_ui( 0 ),
+      m_meanLatency_f( 0.f ),
+      m_p95Latency_f( 0.f ),
+      m_maxLatency_f( 0.f )
+  { }
+
+  unsigned m_pushed_ui;
+  unsigned m_evaluated_ui;
+  unsigned m_dropped_ui;
+  unsigned m_lost_ui;		// Results overwritten before they were taken
+  unsigned m_late_ui;		// Latency above the deadline (see setDeadline)
+  float    m_meanLatency_f;
+  float    m_p95Latency_f;	// From a histogram, within 2%
+  float    m_maxLatency_f;
+};
+
+
+class CThirdEyeLive
+{
+public:
+  // The evaluation is copied: configure it (e.g. with applyConfig) first.
+  // The intensity scale and the disparity format come with each frame
+  explicit CThirdEyeLive( const CThirdEyeEvaluation &f_eval );
+
+  // Stops (see stop)
+  ~CThirdEyeLive();
+
+  // Frames that can wait for the evaluation, and what to do with a new
+  // frame when they are all taken. Only before start. Default: 4 frames,
+  // DROP_OLDEST
+  bool setQueue( const unsigned f_capacity_ui, const EThirdEyeDropPolicy f_policy_e );
+
+  // Results kept until they are taken (see takeResults). When the caller
+  // does not take them in time, the oldest are overwritten. Default: 1024.
+  // Only before start
+  bool setResultRing( const unsigned f_capacity_ui );
+
+  // Frames with a latency above f_deadline_f ms (e.g. the frame period) are
+  // counted as late. Zero (the default) disables it. Only before start
+  inline void setDeadline( const float f_deadline_f )
+  {
+    m_deadline_f = f_deadline_f;
+  }
+
+  // Called by the worker thread with each evaluated frame, in queue order.
+  // Dropped frames only go to the ring. Only before start
+  inline void setResultCallback( const std::function<void( const SThirdEyeLiveResult& )> &f_callback )
+  {
+    m_callback = f_callback;
+  }
+
+  // Starts the worker thread
+  bool start();
+
+  // Queues a frame for evaluation, and timestamps it. Thread safe; the
+  // images are not copied, so they must not be overwritten until the frame
+  // is evaluated (e.g. with a camera reusing its buffers). False if the
+  // frame was dropped or the front end is not running
+  bool pushFrame( const SThirdEyeFrame &f_frame );
+
+  // No more frames: evaluates the queued ones and stops the worker thread
+  void stop();
+
+  // Appends the results not taken yet to f_results and empties the ring:
+  // one per evaluated or dropped frame, in the order they were done. Thread
+  // safe. Returns the number of results appended
+  size_t takeResults( std::vector<SThirdEyeLiveResult> &f_results );
+
+  // Running summary of the frames pushed since start. Thread safe
+  SThirdEyeLiveStats getStats() const;
+
+private:
+
+  typedef std::chrono::steady_clock TClock;
+
+  // A frame with its arrival time
+  struct SItem
+  {
+    SThirdEyeFrame     m_frame;
+    TClock::time_point m_arrival;
+  };
+
+  // Non copyable
+  CThirdEyeLive( const CThirdEyeLive& );
+  CThirdEyeLive& operator=( const CThirdEyeLive& );
+
+  // Body of the worker thread
+  void run();
+
+  // Records the result of a dropped frame
+  void drop( const SItem &f_item );
+
+  // Puts a result into the ring and its latency into the stats. Under
+  // m_resultsMutex
+  void record( const SThirdEyeLiveResult &f_result );
+
+  CThirdEyeEvaluation m_eval;
+
+  SThirdEyeWorkspace  m_workspace;
+
+  std::function<void( const SThirdEyeLiveResult& )> m_callback;
+
+  unsigned            m_capacity_ui;
+
+  EThirdEyeDropPolicy m_policy_e;
+
+  std::unique_ptr<CBoundedQueue<SItem> > m_queue_p;
+
+  std::thread         m_worker;
+
+  float               m_deadline_f;
+
+  // Guards the ring and the stats
+  mutable std::mutex  m_resultsMutex;
+
+  // Results not taken yet: m_ringSize_ui of them from m_ringFirst_ui on
+  std::vector<SThirdEyeLiveResult> m_ring;
+
+  size_t              m_ringFirst_ui;
+
+  size_t              m_ringSize_ui;
+
+  // Running stats, with the sum of the latencies and their histogram on a
+  // logarithmic scale (see record)
+  SThirdEyeLiveStats  m_stats;
+
+  double              m_latencySum_d;
+
+  std::vector<unsigned> m_latencyBins;
+};
+
+
+// Plays the frames of a source as a camera would: frame i is pushed at
+// i / fps seconds after the start. Each frame is loaded before its time, so
+// the loading time is not part of the latency
+class CThirdEyeReplayer
+{
+public:
+  CThirdEyeReplayer( CThirdEyeFrameSource &f_source, const float f_fps_f );
+
+  // Pushes frames [f_first_ui, f_first_ui + f_count_ui) through f_push (e.g.
+  // CThirdEyeLive::pushFrame) and returns after the last push. A frame that
+  // cannot be loaded is skipped. If a push blocks past the time of the next
+  // frames, they are pushed at once, as a camera driver with a backlog would
+  bool run( const unsigned f_first_ui, const unsigned f_count_ui,
+	    const std::function<bool( const SThirdEyeFrame& )> &f_push );
+
+  // Frames of the last run pushed more than a frame period after their
+  // time (slow loading or a blocking push)
+  inline unsigned getLateFrames() const
+  {
+    return m_late_ui;
+  }
+
+private:
+
+  CThirdEyeFrameSource &m_source;
+
+  float    m_fps_f;
+
+  unsigned m_late_ui;
+};
+
+#endif /* FILE_THIRDEYE_LIVE_H */
@@ -77,12 +77,29 @@ public:
 
   cv::Mat  getMask( );
 
-  inline float getThresholdDistance()
+  // Factor that brings the intensities of the input image to [0,255], e.g.
+  // 255/65535 for native 16 bit images. The gradient threshold is given in
+  // [0,255] units
+  inline void setIntensityScale( const float f_scale_f )
+  { m_intensityScale_f = f_scale_f; };
+
+  inline float getIntensityScale() const
+  { return m_intensityScale_f; };
+
+  inline float getThresholdDistance() const
   { return m_thresholdDistance_f; };
 
-  inline float getThresholdGradient()
+  inline float getThresholdGradient() const
   { return m_thresholdGradient_f; };
 
+  // Max number of threads of the per pixel loops (see parallelFor). Zero
+  // means the scheduler bound
+  inline void setNumThreads( const unsigned f_numThreads_ui )
+  { m_numThreads_ui = f_numThreads_ui; };
+
+  inline unsigned getNumThreads() const
+  { return m_numThreads_ui; };
+
   void print();
 
 private:
@@ -104,6 +121,10 @@ private:
 
   unsigned m_kernelSize_ui;
 
+  float  m_intensityScale_f;
+
+  unsigned m_numThreads_ui;
+
   // Kernels for generating the gradient
   cv::Mat m_horizontalKernel;
 
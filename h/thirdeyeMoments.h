@@ -0,0 +1,257 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeMoments.h
+ *
+ *  \brief   This file contains the definition and declaration of the struct
+ *           SNCCMoments. The struct holds the raw moments (number of
+ *           elements, sums, sums of squares and cross sum) of a pair of
+ *           images, from which the NCC index of the third eye analysis is
+ *           derived.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_MOMENTS_H
+#define FILE_THIRDEYE_MOMENTS_H
+
+// Common includes
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+// Metrics that can be evaluated on top of the NCC (see CThirdEyeStats::setMetrics)
+enum EThirdEyeMetric
+{
+  METRIC_NCC    =  1,   // Always computed
+  METRIC_SAD    =  2,   // Mean absolute difference
+  METRIC_SSD    =  4,   // Mean squared difference
+  METRIC_PSNR   =  8,   // Requires (and implies) METRIC_SSD
+  METRIC_CENSUS = 16,   // Mean Hamming distance of the 3x3 census transforms
+  METRIC_ALL    = 31
+};
+
+// Centered sums at or below this fraction of the sum of squares are taken
+// as zero (see SNCCMoments::ncc). They are then at the level of the
+// rounding error of the sums they are derived from, e.g. when the sums of a
+// window are differences of integral image values
+const double MOMENTS_RELATIVE_EPSILON_D = 1e-10;
+
+struct SNCCMoments
+{
+  double m_n_d;                         // Number of elements
+  double m_sumC_d,  m_sumV_d;           // Sum of control and virtual values
+  double m_sumCC_d, m_sumVV_d;          // Sum of squares
+  double m_sumCV_d;                     // Cross sum
+
+  // Sums of the differences (not affected by the shifts)
+  double m_sumAbsDiff_d;                // Sum of |c-v|
+  double m_sumSqDiff_d;                 // Sum of (c-v)^2
+
+  // Census: number of pixels with a full neighbourhood and the sum of the 
+  // Hamming distances of their census transforms
+  double m_nCensus_d;
+  double m_sumHamming_d;
+
+  // The sums are taken over the values minus these shifts. It keeps the
+  // magnitude of the sums small (the NCC is shift invariant). Moments to be
+  // merged must share the same shifts.
+  double m_shiftC_d, m_shiftV_d;
+
+  // Default constructor
+  SNCCMoments()
+  {
+    reset();
+  };
+
+  // Default destructor
+  ~SNCCMoments()
+  {};
+
+  // Methods
+  inline void reset( const double f_shiftC_d = 0.0, const double f_shiftV_d = 0.0 )
+  {
+    m_shiftC_d = f_shiftC_d;
+    m_shiftV_d = f_shiftV_d;
+
+    m_n_d     = 0.0;
+    m_sumC_d  = 0.0;  m_sumV_d  = 0.0;
+    m_sumCC_d = 0.0;  m_sumVV_d = 0.0;
+    m_sumCV_d = 0.0;
+
+    m_sumAbsDiff_d = 0.0;  m_sumSqDiff_d  = 0.0;
+    m_nCensus_d    = 0.0;  m_sumHamming_d = 0.0;
+  }
+
+  // Adds a control/virtual pair
+  inline void add( const double f_control_d, const double f_virtual_d )
+  {
+    const double control_d = f_control_d - m_shiftC_d;
+    const double virtual_d = f_virtual_d - m_shiftV_d;
+
+    m_n_d     += 1.0;
+    m_sumC_d  += control_d;
+    m_sumV_d  += virtual_d;
+    m_sumCC_d += control_d * control_d;
+    m_sumVV_d += virtual_d * virtual_d;
+    m_sumCV_d += control_d * virtual_d;
+
+    const double diff_d = f_control_d - f_virtual_d;
+    m_sumAbsDiff_d += std::fabs( diff_d );
+    m_sumSqDiff_d  += diff_d * diff_d;
+  }
+
+  // Adds partial sums already computed over shifted values
+  inline void addShifted( const double f_n_d, 
+			  const double f_sumC_d,  const double f_sumV_d,
+			  const double f_sumCC_d, const double f_sumVV_d,
+			  const double f_sumCV_d )
+  {
+    m_n_d     += f_n_d;
+    m_sumC_d  += f_sumC_d;
+    m_sumV_d  += f_sumV_d;
+    m_sumCC_d += f_sumCC_d;
+    m_sumVV_d += f_sumVV_d;
+    m_sumCV_d += f_sumCV_d;
+  }
+
+  inline void addDifferences( const double f_sumAbsDiff_d, const double f_sumSqDiff_d )
+  {
+    m_sumAbsDiff_d += f_sumAbsDiff_d;
+    m_sumSqDiff_d  += f_sumSqDiff_d;
+  }
+
+  inline void addCensus( const double f_nCensus_d, const double f_sumHamming_d )
+  {
+    m_nCensus_d    += f_nCensus_d;
+    m_sumHamming_d += f_sumHamming_d;
+  }
+
+  // Adds the moments of another (disjoint) set of pairs
+  inline void merge( const SNCCMoments &f_moments )
+  {
+    m_n_d     += f_moments.m_n_d;
+    m_sumC_d  += f_moments.m_sumC_d;
+    m_sumV_d  += f_moments.m_sumV_d;
+    m_sumCC_d += f_moments.m_sumCC_d;
+    m_sumVV_d += f_moments.m_sumVV_d;
+    m_sumCV_d += f_moments.m_sumCV_d;
+
+    m_sumAbsDiff_d += f_moments.m_sumAbsDiff_d;
+    m_sumSqDiff_d  += f_moments.m_sumSqDiff_d;
+    m_nCensus_d    += f_moments.m_nCensus_d;
+    m_sumHamming_d += f_moments.m_sumHamming_d;
+  }
+
+  inline double meanControl() const
+  { return ( m_n_d > 0.0 ) ? m_sumC_d / m_n_d + m_shiftC_d : 0.0; };
+
+  inline double meanVirtual() const
+  { return ( m_n_d > 0.0 ) ? m_sumV_d / m_n_d + m_shiftV_d : 0.0; };
+
+  // Centered sums, i.e. n times the (co)variances
+  inline double centeredCC() const
+  { return m_sumCC_d - ( m_sumC_d * m_sumC_d ) / m_n_d; };
+
+  inline double centeredVV() const
+  { return m_sumVV_d - ( m_sumV_d * m_sumV_d ) / m_n_d; };
+
+  inline double centeredCV() const
+  { return m_sumCV_d - ( m_sumC_d * m_sumV_d ) / m_n_d; };
+
+  // Smallest centered sum of squares taken as a variance: a fraction of the
+  // sum of squares of the values, shifted or not (n * mean^2 plus the
+  // centered sum), whichever is larger
+  inline double centeredEpsilon( const double f_sum_d, const double f_sumSq_d,
+				 const double f_shift_d ) const
+  {
+    const double raw_d = f_sumSq_d + 2.0 * f_shift_d * f_sum_d + m_n_d * f_shift_d * f_shift_d;
+    return MOMENTS_RELATIVE_EPSILON_D * std::max( f_sumSq_d, raw_d );
+  }
+
+  /* *************************** METHOD ************************************** */
+  /* ncc
+   *
+   * \brief      Derives the NCC value from the moments. A set whose
+   *             centered sum of squares is not above centeredEpsilon is
+   *             taken as constant, and the value is clamped to [-1,1], which
+   *             rounding could otherwise leave.
+   *
+   * \param[out] double &f_ncc_d: NCC value in [-1,1].
+   *
+   * \return     False if the NCC is not defined (no elements or one of the
+   *             sets is constant). True otherwise.
+   *************************************************************************** */
+  inline bool ncc( double &f_ncc_d ) const
+  {
+    if( m_n_d <= 0.0 )
+    {
+      return false;
+    }
+
+    const double cc_d = centeredCC();
+    const double vv_d = centeredVV();
+    if( cc_d <= centeredEpsilon( m_sumC_d, m_sumCC_d, m_shiftC_d ) ||
+	vv_d <= centeredEpsilon( m_sumV_d, m_sumVV_d, m_shiftV_d ) )
+    {
+      return false;
+    }
+
+    f_ncc_d = std::min( 1.0, std::max( -1.0, centeredCV() / std::sqrt( cc_d * vv_d ) ) );
+    return true;
+  }
+
+  /* *************************** METHOD ************************************** */
+  /* nccInterval
+   *
+   * \brief      Confidence interval of the NCC, taking the pairs as a random
+   *             sample of a larger set (Fisher z-transform, the standard
+   *             error of z is 1 / sqrt( n - 3 )).
+   *
+   * \param[out] double &f_lower_d: Lower bound in [-1,1].
+   * \param[out] double &f_upper_d: Upper bound in [-1,1].
+   * \param[in]  const double f_quantile_d: Normal quantile of the confidence
+   *             level. 1.96 (default) for a 95% interval.
+   *
+   * \return     False if the NCC is not defined or there are less than four
+   *             pairs. True otherwise.
+   *************************************************************************** */
+  inline bool nccInterval( double &f_lower_d, double &f_upper_d,
+			   const double f_quantile_d = 1.96 ) const
+  {
+    double ncc_d = 0.0;
+    if( m_n_d < 4.0 || !ncc( ncc_d ) )
+    {
+      return false;
+    }
+
+    // Perfect (anti)correlation: z is not finite
+    if( std::fabs( ncc_d ) >= 1.0 )
+    {
+      f_lower_d = ncc_d;
+      f_upper_d = ncc_d;
+      return true;
+    }
+
+    const double z_d     = 0.5 * std::log( ( 1.0 + ncc_d ) / ( 1.0 - ncc_d ) );
+    const double delta_d = f_quantile_d / std::sqrt( m_n_d - 3.0 );
+
+    f_lower_d = std::tanh( z_d - delta_d );
+    f_upper_d = std::tanh( z_d + delta_d );
+    return true;
+  }
+};
+
+// Accumulates the moments of one row (or any run of contiguous pixels). If
+// the steps (row steps in floats of the control and virtual images) are not
+// zero, the census Hamming distances are also accumulated; all the pixels of
+// the run must then have a full 3x3 neighbourhood.
+void accumulateMomentsRow( const float* f_control_p, const float* f_virtual_p,
+			   const float* f_mask_p, const unsigned f_count_ui,
+			   const size_t f_stepC, const size_t f_stepV,
+			   SNCCMoments &f_moments, SNCCMoments &f_momentsMask );
+
+// Merges partial moments in a fixed pairwise tree order (deterministic for a
+// given number of partials). The partials are overwritten.
+void mergeMomentsTree( std::vector<SNCCMoments> &f_partials, SNCCMoments &f_moments );
+
+#endif /* FILE_THIRDEYE_MOMENTS_H */
@@ -0,0 +1,85 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeParallel.h
+ *
+ *  \brief   Declaration of the helpers used to run the loops of the third
+ *           eye analysis in parallel. All the loops (frames, and the row
+ *           blocks of the warp, mask and stats stages within each frame)
+ *           run on one work-stealing scheduler, so nested loops share the
+ *           same threads instead of each starting their own.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_PARALLEL_H
+#define FILE_THIRDEYE_PARALLEL_H
+
+// Reference to the task of a loop: the callable and a function that calls
+// it. Unlike a std::function, it neither copies the callable nor allocates,
+// so a loop costs no heap memory. The callable must outlive the reference,
+// as the temporary of a parallelFor call does
+class CTaskRef
+{
+public:
+  template<typename TTask>
+  CTaskRef( const TTask &f_task )
+    : m_task_p( &f_task ),
+      m_call_p( &call<TTask> )
+  {}
+
+  inline void operator()( const unsigned f_index_ui ) const
+  { m_call_p( m_task_p, f_index_ui ); }
+
+private:
+
+  template<typename TTask>
+  static void call( const void* f_task_p, const unsigned f_index_ui )
+  { ( *static_cast<const TTask*>( f_task_p ) )( f_index_ui ); }
+
+  const void* m_task_p;
+
+  void ( *m_call_p )( const void*, unsigned );
+};
+
+// Number of threads used when a zero is requested (hardware concurrency)
+unsigned defaultNumThreads();
+
+// Bound on the threads of the scheduler: its worker threads plus the thread
+// that calls parallelFor. Zero means defaultNumThreads(). The workers are
+// started on the first parallel loop
+void setSchedulerThreads( const unsigned f_numThreads_ui );
+
+unsigned getSchedulerThreads();
+
+// Counts threads started outside of the scheduler (e.g. the stages of
+// CThirdEyeSequence) against its bound while they run: as many workers stay
+// idle, and the loops get as many runners less. The thread that calls a
+// loop always works on it, so a loop has at least one
+void reserveSchedulerThreads( const unsigned f_count_ui );
+
+void releaseSchedulerThreads( const unsigned f_count_ui );
+
+// Pins the scheduler workers to the NUMA nodes of the machine (read from
+// /sys/devices/system/node), spread over the nodes in turn, and lets them
+// steal only from workers of their node. Loops started by other threads
+// can run on any node, while the loops nested in their tasks stay on the
+// node that runs the task. Disabled by default
+void setSchedulerNuma( const bool f_numa_b );
+
+// Nodes with CPUs. One if the topology is not available
+unsigned getNumNumaNodes();
+
+// Node of the calling thread: that of its worker with NUMA pinning, zero
+// otherwise (also for the threads that are not workers)
+unsigned currentNumaNode();
+
+// Runs f_task( i ) for i in [0, f_numTasks_ui) using up to f_numThreads_ui
+// threads (the calling one included), and never more than the scheduler
+// threads. Tasks are handed out dynamically, so the task index, and not the
+// thread, must define what is computed. A task may call parallelFor itself:
+// the inner loop is queued on the current worker and idle workers steal it.
+// An exception thrown by a task stops the loop and is rethrown to the caller.
+void parallelFor( const unsigned f_numTasks_ui,
+		  const CTaskRef &f_task,
+		  const unsigned f_numThreads_ui = 0 );
+
+#endif /* FILE_THIRDEYE_PARALLEL_H */
@@ -0,0 +1,47 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyePixel.h
+ *
+ *  \brief   Helpers to read the intensity images of the third eye analysis in
+ *           their native pixel type (8 bit, 16 bit unsigned or 32 float).
+ *           The kernels work on float rows; integer rows are converted on the
+ *           fly, one row at a time, so no converted copy of the images is
+ *           kept.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_PIXEL_H
+#define FILE_THIRDEYE_PIXEL_H
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// True for the supported intensity types: CV_8UC1, CV_16UC1 and CV_32FC1
+inline bool isIntensityType( const int f_type_i )
+{
+  return f_type_i == CV_8UC1 || f_type_i == CV_16UC1 || f_type_i == CV_32FC1;
+}
+
+// Value of a pixel of an intensity image, as a float
+inline float pixelValue( const cv::Mat &f_img, const int f_y_i, const int f_x_i )
+{
+  switch( f_img.depth() )
+  {
+    case CV_8U:
+      return f_img.ptr<uchar>( f_y_i )[ f_x_i ];
+    case CV_16U:
+      return f_img.ptr<ushort>( f_y_i )[ f_x_i ];
+    default:
+      return f_img.ptr<float>( f_y_i )[ f_x_i ];
+  }
+}
+
+// Returns f_count_ui pixels of row f_y_ui, starting at column f_x_ui, as
+// floats. Float images are not copied (the returned pointer points into the
+// image); the other types are converted into f_buffer_p, which must hold at
+// least f_count_ui floats.
+const float* rowAsFloat( const cv::Mat &f_img, const unsigned f_y_ui, 
+			 const unsigned f_x_ui, const unsigned f_count_ui,
+			 float* f_buffer_p );
+
+#endif /* FILE_THIRDEYE_PIXEL_H */
@@ -0,0 +1,223 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeSequence.h
+ *
+ *  \brief   Declaration of CThirdEyeSequence, which evaluates a sequence of
+ *           frames as a pipeline: load -> warp -> mask -> stats. The stages
+ *           run in their own threads, connected by bounded queues, so frame
+ *           N+1 is warped while frame N is scored and the loader threads
+ *           prefetch the next frames while both run. The threads count
+ *           against the scheduler bound (see setSchedulerThreads); with a
+ *           small bound the stages share them. All the stages use the
+ *           const API of one CThirdEyeEvaluation; each frame in flight has
+ *           its own workspace, which carries its virtual image and mask from
+ *           stage to stage, so no state is shared between frames.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_THIRDEYE_SEQUENCE_H
+#define FILE_THIRDEYE_SEQUENCE_H
+
+// Common includes
+#include <memory>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+// Project includes
+#include "thirdeyeEval.h"
+#include "sequenceFile.h"
+
+// A frame on its way through the pipeline
+struct SThirdEyeFrame
+{
+  SThirdEyeFrame( )
+    : m_index_ui( 0 ),
+      m_intensityScale_f( 1.f ),
+      m_subpixelBits_ui( 0 ),
+      m_valid_b( false )
+  { }
+
+  unsigned m_index_ui;
+
+  // Inputs, filled by the frame source
+  cv::Mat  m_base;
+  cv::Mat  m_control;
+  cv::Mat  m_disparity;
+  float    m_intensityScale_f;	// See CThirdEye::setIntensityScale
+  unsigned m_subpixelBits_ui;	// See CThirdEye::setSubpixelBits
+
+  // False if a stage failed
+  bool     m_valid_b;
+};
+
+// Result of a frame
+struct SThirdEyeFrameResult
+{
+  SThirdEyeFrameResult( )
+    : m_index_ui( 0 ),
+      m_valid_b( false ),
+      m_fullIndex_f( -1.f ),
+      m_maskIndex_f( -1.f ),
+      m_quality_e( QUALITY_FULL ),
+      m_estimate_f( -32000.f ),
+      m_estimateLower_f( -32000.f ),
+      m_estimateUpper_f( -32000.f )
+  { }
+
+  unsigned m_index_ui;
+  bool     m_valid_b;
+  float    m_fullIndex_f;
+  float    m_maskIndex_f;
+  EThirdEyeQuality m_quality_e;	// See CThirdEyeEvaluation::setLatencyBudget
+
+  // Sampled estimate and its interval (see SThirdEyeWorkspace::m_estimate_f)
+  float    m_estimate_f;
+  float    m_estimateLower_f;
+  float    m_estimateUpper_f;
+};
+
+
+// Source of frames. loadFrame is called concurrently by the loader threads
+class CThirdEyeFrameSource
+{
+public:
+  virtual ~CThirdEyeFrameSource() { }
+
+  // Fills the inputs of f_frame (m_index_ui is already set)
+  virtual bool loadFrame( SThirdEyeFrame &f_frame ) = 0;
+};
+
+// Frames stored one file each: base and control images (loaded in their
+// native type) and raw disparity maps. The names are printf formats of the
+// frame index, e.g. img_%06d_c0.pgm
+class CThirdEyePatternSource : public CThirdEyeFrameSource
+{
+public:
+  CThirdEyePatternSource( const std::string &f_basePattern_str,
+			  const std::string &f_controlPattern_str,
+			  const std::string &f_dispPattern_str,
+			  const unsigned f_bits_ui );
+
+  bool loadFrame( SThirdEyeFrame &f_frame );
+
+private:
+
+  std::string m_basePattern_str;
+  std::string m_controlPattern_str;
+  std::string m_dispPattern_str;
+  unsigned    m_bits_ui;
+};
+
+// Frames given as lists of file names (e.g. expanded glob patterns). Frame
+// i is made of the i-th file of each list
+class CThirdEyeListSource : public CThirdEyeFrameSource
+{
+public:
+  CThirdEyeListSource( const std::vector<std::string> &f_baseFiles,
+		       const std::vector<std::string> &f_controlFiles,
+		       const std::vector<std::string> &f_dispFiles,
+		       const unsigned f_bits_ui );
+
+  // Length of the shortest list
+  unsigned getNumFrames() const;
+
+  bool loadFrame( SThirdEyeFrame &f_frame );
+
+private:
+
+  std::vector<std::string> m_baseFiles;
+  std::vector<std::string> m_controlFiles;
+  std::vector<std::string> m_dispFiles;
+  unsigned                 m_bits_ui;
+};
+
+// Frames of a sequence file (see sequenceFile.h), with streams named
+// "base", "control" and "disparity". No copy, the images point into the
+// mapped file
+class CThirdEyeContainerSource : public CThirdEyeFrameSource
+{
+public:
+  CThirdEyeContainerSource( );
+
+  bool open( const std::string &f_fileName_str );
+
+  inline unsigned getNumFrames() const
+  { return m_reader.getNumFrames(); };
+
+  bool loadFrame( SThirdEyeFrame &f_frame );
+
+private:
+
+  CSequenceReader m_reader;
+
+  int m_base_i;
+  int m_control_i;
+  int m_disparity_i;
+};
+
+
+class CThirdEyeSequence
+{
+public:
+  // The evaluation is copied, later changes to f_eval do not affect the
+  // sequence
+  CThirdEyeSequence( const CThirdEyeEvaluation &f_eval );
+
+  ~CThirdEyeSequence();
+
+  // Max number of loader threads and number of loaded frames that can wait
+  // in the queues between the stages (i.e. how far the loaders can run
+  // ahead). The loaders get what the stages leave of the scheduler bound
+  inline void setPrefetch( const unsigned f_numLoaders_ui, const unsigned f_depth_ui )
+  {
+    m_numLoaders_ui = f_numLoaders_ui > 0 ? f_numLoaders_ui : 1;
+    m_depth_ui      = f_depth_ui > 0 ? f_depth_ui : 1;
+  }
+
+  // Evaluates frames [f_first_ui, f_first_ui + f_count_ui) of the source.
+  // The results are sorted by frame index
+  bool run( CThirdEyeFrameSource &f_source, const unsigned f_first_ui,
+	    const unsigned f_count_ui, std::vector<SThirdEyeFrameResult> &f_results );
+
+private:
+
+  // Non copyable
+  CThirdEyeSequence( const CThirdEyeSequence& );
+  CThirdEyeSequence& operator=( const CThirdEyeSequence& );
+
+  // State of a frame in flight: the evaluation, with the intensity scale and
+  // the disparity format of the frame (setting them again to the same values
+  // keeps the cached stages valid), and the workspace of the frame
+  struct SSlot
+  {
+    CThirdEyeEvaluation m_eval;
+    SThirdEyeWorkspace  m_workspace;
+  };
+
+  // A frame and its slot, as passed from stage to stage
+  struct SItem
+  {
+    SItem( ) : m_slot_p( nullptr ) { }
+
+    SThirdEyeFrame m_frame;
+    SSlot*         m_slot_p;
+  };
+
+  CThirdEyeEvaluation m_eval;
+
+  // Kept from run to run, so the workspace buffers stay allocated
+  std::vector<std::unique_ptr<SSlot> > m_slots;
+
+  // Last frame token given to a slot. Each loaded frame gets a new one, so
+  // the stages of a frame share their outputs, and never with another frame
+  uint64_t m_lastFrame;
+
+  unsigned m_numLoaders_ui;
+
+  unsigned m_depth_ui;
+};
+
+#endif /* FILE_THIRDEYE_SEQUENCE_H */
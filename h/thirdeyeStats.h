@@ -9,9 +9,50 @@
 #ifndef FILE_THIRDEYE_STATS_H
 #define FILE_THIRDEYE_STATS_H
 
+// Common includes
+#include <algorithm>
+#include <vector>
+
 // OpenCV includes
 #include <opencv2/core/core.hpp>
 
+// Project includes
+#include "thirdeyeMoments.h"
+#include "thirdeyeIntegral.h"
+
+// Metrics of an evaluation. Metrics that were not computed are -32000
+struct SThirdEyeMetrics
+{
+  float m_ncc_f;        // NCC * 100
+  float m_sad_f;        // Mean absolute difference
+  float m_ssd_f;        // Mean squared difference
+  float m_psnr_f;       // Peak signal-to-noise ratio [dB]
+  float m_census_f;     // Mean Hamming distance of the 3x3 census transforms
+
+  SThirdEyeMetrics()
+    : m_ncc_f(    -32000.f ),
+      m_sad_f(    -32000.f ),
+      m_ssd_f(    -32000.f ),
+      m_psnr_f(   -32000.f ),
+      m_census_f( -32000.f )
+  {};
+};
+
+// Moments and NCC indices of one region (rectangle or label)
+struct SRegionStats
+{
+  SNCCMoments m_moments;
+  SNCCMoments m_momentsMask;
+
+  float m_ncc_f;        // -32000 if not defined
+  float m_nccMask_f;    // -32000 if not defined
+
+  SRegionStats()
+    : m_ncc_f( -32000.f ),
+      m_nccMask_f( -32000.f )
+  {};
+};
+
 class CThirdEyeStats 
 {    
 public:
@@ -21,54 +62,314 @@ public:
   bool evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
 		 const cv::Mat f_maskImg  );
 
-  // TO DO
+  // Also computes the per-band statistics (see setDisparityBands). The source
+  // disparity is the one that won each pixel of the virtual image (see 
+  // CThirdEye::generateVirtualImage); negative values are ignored
+  bool evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
+		 const cv::Mat f_maskImg, const cv::Mat f_sourceDisparity );
+
+  // Only the full approach is evaluated
   bool evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg );
 
   void setROI( const unsigned f_x1_ui, const unsigned f_y1_ui,
 	       const unsigned f_x2_ui, const unsigned f_y2_ui  );
 
+  // Copies the settings of f_config, not its results (see CThirdEyeEvaluation)
+  void setConfiguration( const CThirdEyeStats &f_config );
+
+  inline cv::Rect getROI() const
+  { return cv::Rect( m_x1_ui, m_y1_ui, m_x2_ui - m_x1_ui, m_y2_ui - m_y1_ui ); };
+
+  // Max number of threads used to reduce the RoI. Zero means the scheduler
+  // bound (see setSchedulerThreads). The results do not depend on this value.
+  inline void setNumThreads( const unsigned f_numThreads_ui )
+  { m_numThreads_ui = f_numThreads_ui; };
+
+  // Window size and stride (in pixels) of the local NCC map. A window size
+  // of zero disables the map.
+  inline void setLocalWindow( const unsigned f_window_ui, const unsigned f_stride_ui = 1 )
+  {
+    m_localWindow_ui = f_window_ui;
+    m_localStride_ui = ( f_stride_ui > 0 ) ? f_stride_ui : 1;
+  };
+
   inline float getNCC()
   { return m_ncc_f; };
 
   inline float getNCCmask()
   { return m_nccMask_f; };
 
+  // Metrics computed, besides the NCC, in the same pass. A combination of
+  // EThirdEyeMetric values
+  inline void setMetrics( const unsigned f_metrics_ui )
+  { m_metrics_ui = f_metrics_ui | METRIC_NCC; };
+
+  // Factor that brings the intensities to [0,255] (e.g. 255/65535 for native
+  // 16 bit images). Only the SAD, SSD and PSNR depend on it
+  inline void setIntensityScale( const float f_scale_f )
+  { m_intensityScale_f = f_scale_f; };
+
+  inline float getIntensityScale() const
+  { return m_intensityScale_f; };
+
+  inline const SThirdEyeMetrics& getMetrics()
+  { return m_metrics; };
+
+  inline const SThirdEyeMetrics& getMetricsMask()
+  { return m_metricsMask; };
+
+  // Additional evaluation regions. The rectangles are given in image 
+  // coordinates (not restricted to the RoI). An empty vector disables them
+  inline void setRegions( const std::vector<cv::Rect> &f_regions )
+  { m_regions = f_regions; };
+
+  // Label image (8 or 16 bit unsigned, same size as the evaluated images).
+  // Labels equal or larger than f_numLabels_ui are ignored, and
+  // f_numLabels_ui is capped to the range of the label type (256 or 65536).
+  // Only the pixels within the RoI are considered. An empty image disables it
+  inline void setLabelImage( const cv::Mat f_labels, const unsigned f_numLabels_ui )
+  { 
+    m_labels       = f_labels; 
+    m_numLabels_ui = f_numLabels_ui;
+  };
+
+  // Per-rectangle and per-label results of the last evaluation
+  inline const std::vector<SRegionStats>& getRegionStats()
+  { return m_regionStats; };
+
+  inline const std::vector<SRegionStats>& getLabelStats()
+  { return m_labelStats; };
+
+  // Uniform disparity bands: band i covers the source disparities in
+  // [min + i*w, min + (i+1)*w), with w = (max - min) / count. Disparities
+  // outside [min, max) are ignored. A count of zero disables them
+  inline void setDisparityBands( const float f_min_f, const float f_max_f,
+				 const unsigned f_count_ui )
+  {
+    m_bandMin_f   = f_min_f;
+    m_bandMax_f   = f_max_f;
+    m_numBands_ui = ( f_max_f > f_min_f ) ? f_count_ui : 0;
+  };
+
+  // Per-band results of the last evaluation
+  inline const std::vector<SRegionStats>& getBandStats()
+  { return m_bandStats; };
+
+  // Moments of the last evaluation (full and masked approach)
+  inline const SNCCMoments& getMoments()
+  { return m_moments; };
+
+  inline const SNCCMoments& getMomentsMask()
+  { return m_momentsMask; };
+
+  // Local NCC maps of the last evaluation (32 float, NCC * 100). Empty if
+  // disabled. See setLocalWindow.
+  inline cv::Mat getLocalNCC()
+  { return m_localNCC; };
+
+  inline cv::Mat getLocalNCCmask()
+  { return m_localNCCMask; };
+
 private:
 
   bool normalizedCrossCorrelation( cv::Mat f_controlImg, cv::Mat f_virtualImg,
-				   cv::Mat f_mask );
+				   cv::Mat f_mask, cv::Mat f_sourceDisparity );
+
+  bool accumulateMoments( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
+			  const cv::Mat f_mask, const cv::Mat f_sourceDisparity,
+			  SNCCMoments &f_moments, SNCCMoments &f_momentsMask,
+			  std::vector<SRegionStats> &f_bands );
+
+  bool computeNCC( const SNCCMoments &f_moments, float &f_ncc_f );
+
+  void computeMetrics( const SNCCMoments &f_moments, const float f_ncc_f,
+		       SThirdEyeMetrics &f_metrics );
+
+  bool integralBox( const cv::Size &f_size, cv::Rect &f_box ) const;
+
+  // Moments of the labels seen in a row block (see accumulateMoments). Only
+  // the labels present in the block get an entry, so the memory follows the
+  // block and not the number of labels. The entries are found through an
+  // open addressing hash table.
+  class CLabelTable
+  {
+  public:
+
+    struct SEntry
+    {
+      unsigned    m_label_ui;
+      SNCCMoments m_moments;
+      SNCCMoments m_momentsMask;
+    };
+
+    CLabelTable()
+      : m_slots( 64, -1 ),
+        m_last_i( -1 )
+    {};
+
+    // Entry of a label, created with empty moments if missing
+    inline SEntry& entry( const unsigned f_label_ui, const SNCCMoments &f_empty )
+    {
+      // Neighbouring pixels mostly share the label
+      if( m_last_i >= 0 && m_entries[ m_last_i ].m_label_ui == f_label_ui )
+      {
+        return m_entries[ m_last_i ];
+      }
+
+      size_t slot = slotOf( f_label_ui );
+      if( m_slots[ slot ] < 0 )
+      {
+        if( 2 * ( m_entries.size() + 1 ) > m_slots.size() )
+        {
+	  grow();
+	  slot = slotOf( f_label_ui );
+        }
 
-  bool computeNCC( const float f_addSDControl_f, const float f_addSDVirtual_f,
-		   const float f_size_f, const float f_numeratorNCC_f,
-		   float &f_ncc_f );
+        m_slots[ slot ] = static_cast<int>( m_entries.size() );
+        m_entries.push_back( SEntry() );
+        m_entries.back().m_label_ui    = f_label_ui;
+        m_entries.back().m_moments     = f_empty;
+        m_entries.back().m_momentsMask = f_empty;
+      }
 
+      m_last_i = m_slots[ slot ];
+      return m_entries[ m_last_i ];
+    }
 
-  bool mean( cv::Mat f_controlImg, cv::Mat f_virtualImg,
-	     cv::Mat f_mask,
-	     float& f_meanControl_f, float& f_meanVirtual_f,
-	     float& f_meanControlMask_f, float& f_meanVirtualMask_f );
+    // Removes all the entries. The memory is kept for the next frame
+    inline void reset()
+    {
+      m_entries.clear();
+      std::fill( m_slots.begin(), m_slots.end(), -1 );
+      m_last_i = -1;
+    }
 
-  inline float  numeratorNCC( const float f_imageValue1_f, const float f_mean1_f,
-			      const float f_imageValue2_f, const float f_mean2_f    )
-  { return ( ( f_imageValue1_f - f_mean1_f ) * ( f_imageValue2_f - f_mean2_f ) ); };
+    // Sorts the entries by label. No entries can be added afterwards, until
+    // the next reset
+    inline void sort()
+    {
+      std::sort( m_entries.begin(), m_entries.end(),
+		 []( const SEntry &f_a, const SEntry &f_b ) { return f_a.m_label_ui < f_b.m_label_ui; } );
+      m_last_i = -1;
+    }
 
-  inline float denominatorNCC( const float f_size_f, const float f_sd1_f, const float f_sd2_f )
-  { return ( ( f_size_f - 1.f ) * f_sd1_f * f_sd2_f ); }
+    inline const std::vector<SEntry>& entries() const
+    { return m_entries; };
 
-  inline float  addSD( const float f_imageValue_f, const float f_mean_f )
-  { return ( ( f_imageValue_f - f_mean_f ) * ( f_imageValue_f - f_mean_f ) ); };
+  private:
 
-  inline float SD( const float f_num_f, const float f_den_f )
-  { return sqrt( ( f_num_f / f_den_f ) ); };
+    // Slot of a label, or the empty slot where it goes
+    inline size_t slotOf( const unsigned f_label_ui ) const
+    {
+      const size_t mask = m_slots.size() - 1;
+      size_t slot = ( f_label_ui * 2654435761u ) & mask;
+      while( m_slots[ slot ] >= 0 && m_entries[ m_slots[ slot ] ].m_label_ui != f_label_ui )
+      {
+        slot = ( slot + 1 ) & mask;
+      }
+      return slot;
+    }
+
+    inline void grow()
+    {
+      m_slots.assign( 2 * m_slots.size(), -1 );
+      for( size_t i = 0; i < m_entries.size(); ++i )
+      {
+        m_slots[ slotOf( m_entries[ i ].m_label_ui ) ] = static_cast<int>( i );
+      }
+    }
+
+    // Power of two entries: index into m_entries, -1 if empty
+    std::vector<int>    m_slots;
+
+    std::vector<SEntry> m_entries;
+
+    // Entry of the last label looked up
+    int                 m_last_i;
+  };
+
+  void mergeLabels( const unsigned f_numTables_ui, const unsigned f_numLabels_ui,
+		    const SNCCMoments &f_empty );
+
+  bool localNCC();
+
+  bool regionStats();
+
+  void regionNCC( SRegionStats &f_stats );
 
   //Roi
   unsigned m_x1_ui, m_y1_ui,
            m_x2_ui, m_y2_ui;
 
+  unsigned m_numThreads_ui;
+
   float    m_ncc_f;
 
   float    m_nccMask_f;
 
+  SNCCMoments m_moments;
+
+  SNCCMoments m_momentsMask;
+
+  // Local NCC
+  unsigned m_localWindow_ui;
+
+  unsigned m_localStride_ui;
+
+  CMomentsIntegral m_integral;
+
+  cv::Mat  m_localNCC;
+
+  cv::Mat  m_localNCCMask;
+
+  // Regions
+  std::vector<cv::Rect>     m_regions;
+
+  std::vector<SRegionStats> m_regionStats;
+
+  cv::Mat  m_labels;
+
+  unsigned m_numLabels_ui;
+
+  std::vector<SRegionStats> m_labelStats;
+
+  // Disparity bands
+  float    m_bandMin_f;
+
+  float    m_bandMax_f;
+
+  unsigned m_numBands_ui;
+
+  std::vector<SRegionStats> m_bandStats;
+
+  // Scratch of accumulateMoments, kept so that its memory is reused: the
+  // partial moments, band and label tables of the row blocks, the row
+  // buffers of the integer images, and the lists of mergeLabels
+  std::vector<SNCCMoments>  m_partials;
+
+  std::vector<SNCCMoments>  m_partialsMask;
+
+  std::vector<SNCCMoments>  m_bandTables;
+
+  std::vector<SNCCMoments>  m_bandTablesMask;
+
+  std::vector<CLabelTable>  m_labelTables;
+
+  std::vector<float>        m_rowBuffers;
+
+  std::vector<unsigned>     m_labelsSeen;
+
+  std::vector<size_t>       m_labelsNext;
+
+  // Metrics
+  unsigned m_metrics_ui;
+
+  SThirdEyeMetrics m_metrics;
+
+  SThirdEyeMetrics m_metricsMask;
+
+  float    m_intensityScale_f;
+
 }; // end class CThirdEyeStats
 
 
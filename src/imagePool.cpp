@@ -0,0 +1,239 @@
+/* ******************************** FILE *********************************** */
+/** \file    imagePool.cpp
+ *
+ *  \brief   Definition of the class CImagePool.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/imagePool.h"
+
+// Common includes
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// Project includes
+#include "../h/thirdeyeParallel.h"
+
+// Header of a buffer, in the first cache line of its allocation (the data
+// starts at the second one). cv::Mat only knows the address of the counter,
+// so it must be the first member
+struct SPoolBlock
+{
+  int         m_refcount_i;
+  size_t      m_capacity;
+  SPoolBlock* m_next_p;
+};
+
+namespace
+{
+  // Capacities are rounded to pages, so images of similar size share buffers
+  const size_t POOL_GRANULARITY = 4096;
+
+  inline size_t alignUp( const size_t f_value, const size_t f_alignment )
+  {
+    return ( f_value + f_alignment - 1 ) / f_alignment * f_alignment;
+  }
+
+  inline uchar* blockData( SPoolBlock* f_block_p )
+  {
+    return reinterpret_cast<uchar*>( f_block_p ) + IMAGE_POOL_ALIGNMENT;
+  }
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard constructor.
+ *
+ * \brief          Standard constructor.
+ *
+ * \return         -
+ *************************************************************************** */
+CImagePool::CImagePool()
+  : m_mutex( ),
+    m_freeLists( ),
+    m_numAllocations( 0 ),
+    m_numFreeBlocks( 0 )
+{
+  /* Empty body */
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard destructor.
+ *
+ * \brief          Standard destructor. Frees the released buffers.
+ *
+ * \return         -
+ *************************************************************************** */
+CImagePool::~CImagePool()
+{
+  trim();
+}
+
+/* *************************** METHOD ************************************** */
+/* create
+ *
+ * \brief      Same as cv::Mat::create, with a buffer of the pool. The
+ *             allocator of the image is set to the pool, so the buffer goes
+ *             back to it when the last reference is released, and later
+ *             create calls on the image also draw from it.
+ *
+ * \param[out] cv::Mat &f_img: Image to (re)allocate.
+ * \param[in]  const cv::Size f_size: Size of the image.
+ * \param[in]  const int f_type_i: Type of the image.
+ *
+ * \return     -
+ *************************************************************************** */
+void CImagePool::create( cv::Mat &f_img, const cv::Size f_size, const int f_type_i )
+{
+  if( !f_img.empty() && f_img.size() == f_size && f_img.type() == f_type_i )
+  {
+    return;
+  }
+
+  f_img.release();
+  f_img.allocator = this;
+  f_img.create( f_size, f_type_i );
+}
+
+cv::Mat CImagePool::acquire( const cv::Size f_size, const int f_type_i )
+{
+  cv::Mat img;
+  create( img, f_size, f_type_i );
+  return img;
+}
+
+size_t CImagePool::getNumAllocations()
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_numAllocations;
+}
+
+size_t CImagePool::getNumFreeBlocks()
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  return m_numFreeBlocks;
+}
+
+/* *************************** METHOD ************************************** */
+/* trim
+ *
+ * \brief      Frees the released buffers. The buffers in use are not
+ *             affected; they come back to the pool when released.
+ *
+ * \return     -
+ *************************************************************************** */
+void CImagePool::trim()
+{
+  std::lock_guard<std::mutex> lock( m_mutex );
+  for( std::map<size_t, SPoolBlock*>::iterator it = m_freeLists.begin();
+       it != m_freeLists.end(); ++it )
+  {
+    while( it->second )
+    {
+      SPoolBlock* block_p = it->second;
+      it->second = block_p->m_next_p;
+      free( block_p );
+    }
+  }
+  m_numFreeBlocks = 0;
+}
+
+/* *************************** METHOD ************************************** */
+/* allocate
+ *
+ * \brief      Called by cv::Mat::create. The rows are padded to a multiple
+ *             of IMAGE_POOL_ALIGNMENT bytes. A released buffer of the same
+ *             capacity is reused if there is one; otherwise a new one is
+ *             allocated and counted (see getNumAllocations). The empty free
+ *             lists are kept, so reusing a buffer does not allocate.
+ *
+ * \return     -
+ *************************************************************************** */
+void CImagePool::allocate( int f_dims_i, const int* f_sizes_p, int f_type_i, int*& f_refcount_p,
+			   uchar*& f_datastart_p, uchar*& f_data_p, size_t* f_step_p )
+{
+  size_t total = CV_ELEM_SIZE( f_type_i );
+  for( int i = f_dims_i - 1; i >= 0; --i )
+  {
+    f_step_p[ i ] = total;
+    total *= f_sizes_p[ i ];
+    // Padded rows
+    if( i == f_dims_i - 1 && f_dims_i > 1 )
+    {
+      total = alignUp( total, IMAGE_POOL_ALIGNMENT );
+    }
+  }
+
+  const size_t capacity = alignUp( std::max<size_t>( total, 1 ), POOL_GRANULARITY );
+
+  SPoolBlock* block_p = nullptr;
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    SPoolBlock* &list_p = m_freeLists[ capacity ];
+    if( list_p )
+    {
+      block_p = list_p;
+      list_p  = block_p->m_next_p;
+      --m_numFreeBlocks;
+    }
+    else
+    {
+      ++m_numAllocations;
+    }
+  }
+
+  if( !block_p )
+  {
+    void* memory_p = nullptr;
+    if( posix_memalign( &memory_p, IMAGE_POOL_ALIGNMENT, IMAGE_POOL_ALIGNMENT + capacity ) != 0 )
+    {
+      CV_Error( CV_StsNoMem, "CImagePool::allocate: Out of memory" );
+    }
+    block_p = static_cast<SPoolBlock*>( memory_p );
+    block_p->m_capacity = capacity;
+  }
+
+  block_p->m_refcount_i = 1;
+  block_p->m_next_p     = nullptr;
+
+  f_refcount_p  = &block_p->m_refcount_i;
+  f_datastart_p = f_data_p = blockData( block_p );
+}
+
+/* *************************** METHOD ************************************** */
+/* deallocate
+ *
+ * \brief      Called by cv::Mat::release when the last reference to a
+ *             buffer goes away. The buffer is kept for reuse.
+ *
+ * \return     -
+ *************************************************************************** */
+void CImagePool::deallocate( int* f_refcount_p, uchar* /*f_datastart_p*/, uchar* /*f_data_p*/ )
+{
+  SPoolBlock* block_p = reinterpret_cast<SPoolBlock*>( f_refcount_p );
+
+  std::lock_guard<std::mutex> lock( m_mutex );
+  SPoolBlock* &list_p = m_freeLists[ block_p->m_capacity ];
+  block_p->m_next_p = list_p;
+  list_p = block_p;
+  ++m_numFreeBlocks;
+}
+
+CImagePool& imagePool()
+{
+  // One pool per NUMA node, so a buffer is only reused on the node where it
+  // was first touched. Never deleted: images held by static objects may be
+  // released after any static pool would have been destroyed
+  static std::vector<CImagePool*>* pools_p = []()
+  {
+    std::vector<CImagePool*>* pools_p = new std::vector<CImagePool*>( getNumNumaNodes() );
+    for( size_t i = 0; i < pools_p->size(); ++i )
+    {
+      ( *pools_p )[ i ] = new CImagePool();
+    }
+    return pools_p;
+  }();
+  return *( *pools_p )[ currentNumaNode() ];
+}
@@ -6,111 +6,272 @@
 
 // Project includes
 #include "../h/rawImageIO.h"
+#include "../h/mappedFile.h"
+#include "../h/pnmReader.h"
 
 // Regular includes
+#include <cstdio>
 #include <iostream>
 
-using std::cout;
+using std::cerr;
 using std::endl;
 
 cv::Mat loadImageFile( const std::string &f_name_str, const unsigned f_bits_ui )
 {
-  // Load the image, as is.
-  cv::Mat input = cv::imread( f_name_str, -1 );
-  
-  if( input.empty() )
-  {
-    cout << "ERROR loadImageFile: Could not load " << f_name_str << endl;
-    return input;
-  }
-
-  double scaleFactor_d;
-  switch( f_bits_ui )
-  {
-    case 8:
-      scaleFactor_d = 1.0;
-    break;	
-    case 10:
-      scaleFactor_d = 255.0 / 1023.0;
-    break;
-    case 12:
-      scaleFactor_d = 255.0 / 4095.0;
-    break;
-    case 16:
-      scaleFactor_d = 255.0 / 65535.0;
-    break;
-    default:
-      scaleFactor_d = -1.0;
-    break;
-  }
-
   cv::Mat output;
+  loadImageFile( f_name_str, f_bits_ui, output );
+  return output;
+}
+
+bool loadImageFile( const std::string &f_name_str, const unsigned f_bits_ui, cv::Mat &f_output )
+{
+  const double scaleFactor_d = intensityScaleFactor( f_bits_ui );
 
   // Error checking
   if( scaleFactor_d == -1.0 )
   {
-    cout << "ERROR loadImageFile: Image depth of " <<  f_bits_ui 
+    cerr << "ERROR loadImageFile: Image depth of " <<  f_bits_ui 
 	 << " bits not supported yet! Try with 8, 10, 12 or 16 bit images\n";
     //system("pause");
 		
-    output.release();
-    return output;
+    f_output.release();
+    return false;
+  }
+
+  // Binary PGM/PPM: decode, byte swap and rescale in a single pass
+  if( readPnmImage( f_name_str, static_cast<float>( scaleFactor_d ), f_output ) )
+  {
+    return true;
+  }
+
+  // Any other format: load the image, as is.
+  cv::Mat input = cv::imread( f_name_str, -1 );
+  
+  if( input.empty() )
+  {
+    cerr << "ERROR loadImageFile: Could not load " << f_name_str << endl;
+    f_output.release();
+    return false;
   }
 	
   // Convert the image into a 32 float one, reescaled into the 
   // [0,255] interval
   if( input.channels() == 1 )
   {
-    input.convertTo( output, CV_32FC1, scaleFactor_d );
+    input.convertTo( f_output, CV_32FC1, scaleFactor_d );
   }
   else if( input.channels() == 3 )
   {
-    input.convertTo( output, CV_32FC3, scaleFactor_d );
+    input.convertTo( f_output, CV_32FC3, scaleFactor_d );
   } 
 	
-  return output;
+  return true;
+}
+
+cv::Mat loadImageFileNative( const std::string &f_name_str, const unsigned f_bits_ui,
+			     float &f_scale_f )
+{
+  // Load the image, as is.
+  cv::Mat input;
+  if( !readPnmImageNative( f_name_str, input ) )
+  {
+    input = cv::imread( f_name_str, -1 );
+  }
+  
+  if( input.empty() )
+  {
+    cerr << "ERROR loadImageFileNative: Could not load " << f_name_str << endl;
+    return input;
+  }
+
+  const double scaleFactor_d = intensityScaleFactor( f_bits_ui );
+
+  // Error checking
+  if( scaleFactor_d == -1.0 )
+  {
+    cerr << "ERROR loadImageFileNative: Image depth of " <<  f_bits_ui 
+	 << " bits not supported yet! Try with 8, 10, 12 or 16 bit images\n";
+    return cv::Mat();
+  }
+
+  if( input.type() != CV_8UC1 && input.type() != CV_16UC1 )
+  {
+    cerr << "ERROR loadImageFileNative: Only single channel 8 or 16 bit images are supported!\n";
+    return cv::Mat();
+  }
+
+  f_scale_f = static_cast<float>( scaleFactor_d );
+  return input;
+}
+
+double intensityScaleFactor( const unsigned f_bits_ui )
+{
+  switch( f_bits_ui )
+  {
+    case 8:
+      return 1.0;
+    case 10:
+      return 255.0 / 1023.0;
+    case 12:
+      return 255.0 / 4095.0;
+    case 16:
+      return 255.0 / 65535.0;
+    default:
+      return -1.0;
+  }
 }
 
 cv::Mat loadRawImage( const std::string &f_fileInName_str )
 {
-  CImageSize tempSize;
-  CRawImageIO rawLoader;
-  cv::Mat tempImg_p;
+  unsigned subpixelBits_ui = 0;
+  return loadRawImage( f_fileInName_str, subpixelBits_ui );
+}
 
-  // Get image data
-  char* outputData_p = rawLoader.loadRawDataImage( f_fileInName_str, tempSize );
+cv::Mat loadRawImage( const std::string &f_fileInName_str, unsigned &f_subpixelBits_ui )
+{
+  cv::Mat tempImg_p;
 
-  // If no data returned, clean up and return the empty image
-  if( !outputData_p )
+  // Parse the header only, to know where the data starts
+  CImageSize tempSize;
+  CRawImageIO rawLoader;
+  std::ifstream fileIn( f_fileInName_str.c_str(), std::ios::in | std::ios::binary );
+  if( !fileIn )
   {
-    delete[] outputData_p;
+    cerr << "ERROR loadRawImage: Cannot open the input file: " << f_fileInName_str << endl;
     return tempImg_p;
   }
+  if( !rawLoader.loadRawDataFileHeader( fileIn, tempSize ) )
+  {
+    return tempImg_p;
+  }
+  const std::streamoff offset = fileIn.tellg();
+  fileIn.close();
 
   // Set the image type
   int imgType_i = 0;
-  if( tempSize.m_pixelDepth_ui == IO_DATATYPE_32F )
+  if( tempSize.getBaseDataType() == IO_DATATYPE_32F )
   {
     imgType_i = CV_32FC1;
   }
-  else if( tempSize.m_pixelDepth_ui == IO_DATATYPE_64F )
+  else if( tempSize.getBaseDataType() == IO_DATATYPE_64F )
   {
     imgType_i = CV_64FC1;
   }
-		
-  // Create image
-  tempImg_p.create( tempSize.m_height_ui, tempSize.m_width_ui, imgType_i );
+  else if( tempSize.getBaseDataType() == IO_DATATYPE_16Q )
+  {
+    imgType_i = CV_16UC1;
+  }
+  f_subpixelBits_ui = tempSize.m_subpixelBits_ui;
+
+  // Map the file and point the image at the data: no copy, and the pages
+  // are read on demand. The mapping is released with the image
+  if( !tempSize.isCompressed() )
+  {
+    CMappedFile mappedFile;
+    if( offset < 0 || !mappedFile.open( f_fileInName_str ) )
+    {
+      return tempImg_p;
+    }
+    tempImg_p = mappedFile.releaseToMat( static_cast<size_t>( offset ), tempSize.m_height_ui,
+					 tempSize.m_width_ui, imgType_i );
+    if( !tempImg_p.empty() || !mappedFile.getData() )
+    {
+      return tempImg_p;
+    }
+  }
 
-  // Copy image data to image
-  for( unsigned y = 0 ; y < tempSize.getNumberBytes(); ++y )
+  // Compressed data, or data not aligned to the pixel size (long comments):
+  // decode or read it into a new image
+  tempImg_p.create( tempSize.m_height_ui, tempSize.m_width_ui, imgType_i );
+  if( !rawLoader.loadRawDataImage( f_fileInName_str, tempSize, 
+				   reinterpret_cast<char*>( tempImg_p.data ) ) )
   {
-    tempImg_p.data[y] = outputData_p[y];
+    tempImg_p.release();
   }
 
-  delete [] outputData_p;
   return tempImg_p;
 }
 
+bool saveRawImage( const std::string &f_fileOutName_str, const cv::Mat f_img,
+		   const std::string &f_comments_str, const unsigned f_subpixelBits_ui,
+		   const bool f_compress_b )
+{
+  // Set the data type
+  int dataType_i = 0;
+  if( f_img.type() == CV_32FC1 )
+  {
+    dataType_i = IO_DATATYPE_32F;
+  }
+  else if( f_img.type() == CV_64FC1 )
+  {
+    dataType_i = IO_DATATYPE_64F;
+  }
+  else if( f_img.type() == CV_16UC1 )
+  {
+    dataType_i = IO_DATATYPE_16Q;
+  }
+  else
+  {
+    cerr << "ERROR saveRawImage: Only 32 and 64 float and 16-bit fixed point images are supported!\n";
+    return false;
+  }
+
+  if( f_compress_b )
+  {
+    if( dataType_i == IO_DATATYPE_64F )
+    {
+      cerr << "ERROR saveRawImage: 64 float images cannot be compressed!\n";
+      return false;
+    }
+    dataType_i += IO_DATATYPE_COMPRESSED;
+  }
+
+  // The raw writer expects the rows one after the other
+  const cv::Mat continuous = f_img.isContinuous() ? f_img : f_img.clone();
+
+  CImageSize tempSize( continuous.cols, continuous.rows, dataType_i );
+  tempSize.m_subpixelBits_ui = ( tempSize.getBaseDataType() == IO_DATATYPE_16Q ) ? f_subpixelBits_ui : 0;
+  CRawImageIO rawWriter;
+
+  return rawWriter.writeRawDataImage( f_fileOutName_str, tempSize,
+				      reinterpret_cast<char*>( continuous.data ),
+				      f_comments_str );
+}
+
+cv::Mat toFixedPointDisparity( const cv::Mat f_disp, const unsigned f_subpixelBits_ui,
+			       const float f_invalid_f )
+{
+  cv::Mat output;
+  if( f_disp.type() != CV_32FC1 || f_subpixelBits_ui > 15 )
+  {
+    cerr << "ERROR toFixedPointDisparity: Expected a 32 float image and at most 15 subpixel bits!\n";
+    return output;
+  }
+
+  output.create( f_disp.size(), CV_16UC1 );
+  const float scale_f = static_cast<float>( 1u << f_subpixelBits_ui );
+  for( int y = 0; y < f_disp.rows; ++y )
+  {
+    const float* disp_p = f_disp.ptr<float>( y );
+    ushort*      out_p  = output.ptr<ushort>( y );
+    for( int x = 0; x < f_disp.cols; ++x )
+    {
+      const float code_f = disp_p[ x ] * scale_f + 0.5f;
+      out_p[ x ] = ( disp_p[ x ] == f_invalid_f || !( code_f >= 0.f ) || code_f >= IO_16Q_INVALID ) ?
+	           IO_16Q_INVALID : static_cast<ushort>( code_f );
+    }
+  }
+
+  return output;
+}
+
+std::string frameFileName( const std::string &f_pattern_str, const int f_frame_i )
+{
+  char name_p[ 1024 ];
+  snprintf( name_p, sizeof( name_p ), f_pattern_str.c_str(), f_frame_i );
+  return std::string( name_p );
+}
+
 void showImage( const cv::Mat f_img, const std::string &f_name_str )
 {
   // Set the name of the window
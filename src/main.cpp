@@ -1,76 +1,735 @@
+/* ******************************** FILE *********************************** */
+/** \file    main.cpp
+ *
+ *  \brief   Batch evaluation of disparity maps with the third eye approach.
+ *           The rig geometry and the evaluation settings are read from a
+ *           configuration file (see thirdeye.cfg), the frames from a sequence
+ *           file, a list file or file name patterns. The frames are
+ *           evaluated in parallel and the indices are written as CSV or
+ *           JSON. No window is opened unless --show is given.
+ *
+ *           Usage:
+ *             thirdEye -c <config> [options] <input>
+ *
+ *           Input (one of):
+ *             --sequence <file>      Sequence file (see thirdEyePack)
+ *             --list <file>          One frame per line: base control disparity
+ *             --base <pattern> --control <pattern> --disp <pattern>
+ *                                    Glob patterns (sorted, matched by order),
+ *                                    or printf patterns of the frame number
+ *                                    together with --frames <first> <last>
+ *
+ *           Options:
+ *             -j <N>                 Threads shared by the frames and the
+ *                                    row blocks within them (default:
+ *                                    number of cores)
+ *             --numa                 Pin the threads to the NUMA nodes; the
+ *                                    row blocks of a frame stay on its node
+ *             --pipeline             Evaluate the frames in order through
+ *                                    load, warp, mask and stats stages, with
+ *                                    prefetching loaders (see
+ *                                    thirdeyeSequence.h)
+ *             -o <file>              Output file (default: standard output)
+ *             --format csv|json      Default: json if the output file ends in
+ *                                    .json, csv otherwise
+ *             --show                 Show the virtual image and the masked
+ *                                    control image of each frame
+ *             --live <fps>           Replay the input at a fixed frame rate
+ *                                    through the live front end (see
+ *                                    thirdeyeLive.h) and add the latency of
+ *                                    each frame to the output
+ *             --queue <N>            Frames waiting in live mode (default 4)
+ *             --drop oldest|newest|block
+ *                                    Live mode policy for a full queue
+ *                                    (default oldest)
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
 // Regular includes
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// POSIX includes
+#include <glob.h>
 
 /// OpenCv icnludes
 #include <opencv2/core/core.hpp>
 
 // Project includes
 #include "../h/thirdeyeEval.h"
+#include "../h/thirdeyeConfig.h"
+#include "../h/thirdeyeLive.h"
+#include "../h/thirdeyeParallel.h"
+#include "../h/thirdeyeSequence.h"
 #include "../h/loader.h"
 
-int main( void )
+using std::cerr;
+using std::cout;
+using std::endl;
+
+namespace
+{
+  struct SOptions
+  {
+    SOptions()
+      : m_first_i( 0 ), m_last_i( -1 ), m_frames_b( false ),
+	m_numJobs_ui( 0 ), m_numa_b( false ), m_pipeline_b( false ), m_show_b( false ),
+	m_liveFps_f( 0.f ), m_queue_ui( 4 ), m_drop_e( DROP_OLDEST )
+    { }
+
+    std::string m_config_str;
+    std::string m_sequence_str;
+    std::string m_list_str;
+    std::string m_base_str;
+    std::string m_control_str;
+    std::string m_disp_str;
+    int         m_first_i;
+    int         m_last_i;
+    bool        m_frames_b;
+    unsigned    m_numJobs_ui;
+    bool        m_numa_b;
+    bool        m_pipeline_b;
+    std::string m_output_str;
+    std::string m_format_str;
+    bool        m_show_b;
+    float       m_liveFps_f;	// Zero: batch mode
+    unsigned    m_queue_ui;
+    EThirdEyeDropPolicy m_drop_e;
+  };
+
+  void printUsage( const char* f_name_p )
+  {
+    cerr << "Usage: " << f_name_p << " -c <config> [options] <input>\n"
+	 << "Input (one of):\n"
+	 << "  --sequence <file>         Sequence file (see thirdEyePack)\n"
+	 << "  --list <file>             One frame per line: base control disparity\n"
+	 << "  --base <p> --control <p> --disp <p>\n"
+	 << "                            Glob patterns (sorted, matched by order), or printf\n"
+	 << "                            patterns of the frame number with --frames <first> <last>\n"
+	 << "Options:\n"
+	 << "  -j <N>                    Threads for frames and row blocks (default: number of cores)\n"
+	 << "  --numa                    Pin the threads to the NUMA nodes, one node per frame\n"
+	 << "  --pipeline                Evaluate the frames in order through load, warp, mask and\n"
+	 << "                            stats stages with prefetching loaders\n"
+	 << "  -o <file>                 Output file (default: standard output)\n"
+	 << "  --format csv|json         Default: json for *.json outputs, csv otherwise\n"
+	 << "  --show                    Show the virtual and masked control images of each frame\n"
+	 << "  --live <fps>              Replay the input at <fps> through the live front end and\n"
+	 << "                            report the latency of each frame (summary with -o)\n"
+	 << "  --queue <N>               Frames that can wait in live mode (default: 4)\n"
+	 << "  --drop oldest|newest|block\n"
+	 << "                            Live mode policy for a full queue (default: oldest)\n";
+  }
+
+  bool parseArguments( const int argc, char** argv, SOptions &f_options )
+  {
+    for( int i = 1; i < argc; ++i )
+    {
+      const std::string arg_str = argv[ i ];
+      // Number of values the option takes
+      const int left_i = argc - 1 - i;
+      if( ( arg_str == "-c" || arg_str == "--config" ) && left_i >= 1 )
+	f_options.m_config_str = argv[ ++i ];
+      else if( arg_str == "--sequence" && left_i >= 1 )
+	f_options.m_sequence_str = argv[ ++i ];
+      else if( arg_str == "--list" && left_i >= 1 )
+	f_options.m_list_str = argv[ ++i ];
+      else if( arg_str == "--base" && left_i >= 1 )
+	f_options.m_base_str = argv[ ++i ];
+      else if( arg_str == "--control" && left_i >= 1 )
+	f_options.m_control_str = argv[ ++i ];
+      else if( arg_str == "--disp" && left_i >= 1 )
+	f_options.m_disp_str = argv[ ++i ];
+      else if( arg_str == "--frames" && left_i >= 2 )
+      {
+	f_options.m_first_i  = atoi( argv[ ++i ] );
+	f_options.m_last_i   = atoi( argv[ ++i ] );
+	f_options.m_frames_b = true;
+      }
+      else if( arg_str == "-j" && left_i >= 1 )
+	f_options.m_numJobs_ui = static_cast<unsigned>( atoi( argv[ ++i ] ) );
+      else if( arg_str == "-o" && left_i >= 1 )
+	f_options.m_output_str = argv[ ++i ];
+      else if( arg_str == "--format" && left_i >= 1 )
+	f_options.m_format_str = argv[ ++i ];
+      else if( arg_str == "--numa" )
+	f_options.m_numa_b = true;
+      else if( arg_str == "--pipeline" )
+	f_options.m_pipeline_b = true;
+      else if( arg_str == "--show" )
+	f_options.m_show_b = true;
+      else if( arg_str == "--live" && left_i >= 1 )
+      {
+	f_options.m_liveFps_f = static_cast<float>( atof( argv[ ++i ] ) );
+	if( f_options.m_liveFps_f <= 0.f )
+	{
+	  cerr << "ERROR thirdEye: The live frame rate must be positive\n";
+	  return false;
+	}
+      }
+      else if( arg_str == "--queue" && left_i >= 1 )
+      {
+	f_options.m_queue_ui = static_cast<unsigned>( std::max( atoi( argv[ ++i ] ), 0 ) );
+	if( f_options.m_queue_ui == 0 )
+	{
+	  cerr << "ERROR thirdEye: The live queue needs room for a frame\n";
+	  return false;
+	}
+      }
+      else if( arg_str == "--drop" && left_i >= 1 )
+      {
+	const std::string drop_str = argv[ ++i ];
+	if( drop_str == "oldest" )
+	  f_options.m_drop_e = DROP_OLDEST;
+	else if( drop_str == "newest" )
+	  f_options.m_drop_e = DROP_NEWEST;
+	else if( drop_str == "block" )
+	  f_options.m_drop_e = DROP_NONE;
+	else
+	{
+	  cerr << "ERROR thirdEye: The drop policy must be oldest, newest or block\n";
+	  return false;
+	}
+      }
+      else
+      {
+	cerr << "ERROR thirdEye: Unknown option or missing value: " << arg_str << endl;
+	return false;
+      }
+    }
+
+    if( f_options.m_config_str.empty() )
+    {
+      cerr << "ERROR thirdEye: A configuration file is required (-c)\n";
+      return false;
+    }
+
+    const bool patterns_b = !f_options.m_base_str.empty() || !f_options.m_control_str.empty() ||
+                            !f_options.m_disp_str.empty();
+    const int numInputs_i = ( f_options.m_sequence_str.empty() ? 0 : 1 ) +
+                            ( f_options.m_list_str.empty() ? 0 : 1 ) + ( patterns_b ? 1 : 0 );
+    if( numInputs_i != 1 )
+    {
+      cerr << "ERROR thirdEye: Give exactly one input: --sequence, --list or the patterns\n";
+      return false;
+    }
+    if( patterns_b && ( f_options.m_base_str.empty() || f_options.m_control_str.empty() ||
+			f_options.m_disp_str.empty() ) )
+    {
+      cerr << "ERROR thirdEye: --base, --control and --disp go together\n";
+      return false;
+    }
+
+    if( f_options.m_pipeline_b && ( f_options.m_numa_b || f_options.m_liveFps_f > 0.f ) )
+    {
+      cerr << "ERROR thirdEye: --pipeline is a batch mode of its own (not with --numa or --live)\n";
+      return false;
+    }
+
+    if( f_options.m_format_str.empty() )
+    {
+      const std::string &out_str = f_options.m_output_str;
+      const bool json_b = out_str.size() >= 5 && out_str.compare( out_str.size() - 5, 5, ".json" ) == 0;
+      f_options.m_format_str = json_b ? "json" : "csv";
+    }
+    if( f_options.m_format_str != "csv" && f_options.m_format_str != "json" )
+    {
+      cerr << "ERROR thirdEye: The format must be csv or json\n";
+      return false;
+    }
+
+    return true;
+  }
+
+  // Files matching a glob pattern, sorted. A name without wildcards is
+  // returned as is
+  bool expandPattern( const std::string &f_pattern_str, std::vector<std::string> &f_files )
+  {
+    f_files.clear();
+    if( f_pattern_str.find_first_of( "*?[" ) == std::string::npos )
+    {
+      f_files.push_back( f_pattern_str );
+      return true;
+    }
+
+    glob_t matches;
+    const int status_i = glob( f_pattern_str.c_str(), 0, nullptr, &matches );
+    if( status_i == 0 )
+    {
+      for( size_t i = 0; i < matches.gl_pathc; ++i )
+      {
+	f_files.push_back( matches.gl_pathv[ i ] );
+      }
+    }
+    globfree( &matches );
+
+    if( f_files.empty() )
+    {
+      cerr << "ERROR thirdEye: No file matches " << f_pattern_str << endl;
+      return false;
+    }
+    return true;
+  }
+
+  bool readList( const std::string &f_list_str, std::vector<std::string> &f_bases,
+		 std::vector<std::string> &f_controls, std::vector<std::string> &f_disps )
+  {
+    std::ifstream file( f_list_str.c_str() );
+    if( !file )
+    {
+      cerr << "ERROR thirdEye: Cannot open the list " << f_list_str << endl;
+      return false;
+    }
+
+    std::string line_str;
+    unsigned lineNumber_ui = 0;
+    while( std::getline( file, line_str ) )
+    {
+      ++lineNumber_ui;
+      line_str = line_str.substr( 0, line_str.find( '#' ) );
+      std::istringstream line( line_str );
+      std::string base_str, control_str, disp_str, extra_str;
+      if( !( line >> base_str ) )
+      {
+	continue;
+      }
+      if( !( line >> control_str >> disp_str ) || ( line >> extra_str ) )
+      {
+	cerr << "ERROR thirdEye: " << f_list_str << ":" << lineNumber_ui
+	     << ": Expected \"base control disparity\"\n";
+	return false;
+      }
+      f_bases.push_back( base_str );
+      f_controls.push_back( control_str );
+      f_disps.push_back( disp_str );
+    }
+    return true;
+  }
+
+  std::string jsonString( const std::string &f_str )
+  {
+    std::string out_str = "\"";
+    for( size_t i = 0; i < f_str.size(); ++i )
+    {
+      const char c = f_str[ i ];
+      if( c == '"' || c == '\\' )
+      {
+	out_str += '\\';
+	out_str += c;
+      }
+      else if( static_cast<unsigned char>( c ) < 0x20 )
+      {
+	char escaped_p[ 8 ];
+	snprintf( escaped_p, sizeof( escaped_p ), "\\u%04x", c );
+	out_str += escaped_p;
+      }
+      else
+      {
+	out_str += c;
+      }
+    }
+    return out_str + "\"";
+  }
+
+  std::string csvString( const std::string &f_str )
+  {
+    if( f_str.find_first_of( ",\"\n" ) == std::string::npos )
+    {
+      return f_str;
+    }
+    std::string out_str = "\"";
+    for( size_t i = 0; i < f_str.size(); ++i )
+    {
+      out_str += f_str[ i ];
+      if( f_str[ i ] == '"' )
+      {
+	out_str += '"';
+      }
+    }
+    return out_str + "\"";
+  }
+
+  const char* qualityName( const EThirdEyeQuality f_quality_e )
+  {
+    switch( f_quality_e )
+    {
+    case QUALITY_FULL:        return "full";
+    case QUALITY_COARSE_MASK: return "coarse_mask";
+    case QUALITY_COARSE:      return "coarse";
+    default:                  return "sampled";
+    }
+  }
+
+  // The indices are not computed at the sampled quality level; in adaptive
+  // mode the sampled estimate and its interval have their own fields. The
+  // live results (empty in batch mode) add whether each frame was dropped
+  // and its latency
+  void writeResults( std::ostream &f_out, const std::string &f_format_str,
+		     const std::vector<SThirdEyeFrameResult> &f_results,
+		     const std::vector<EThirdEyeQuality> &f_qualities,
+		     const std::vector<SThirdEyeLiveResult> &f_live,
+		     const std::vector<std::string> &f_names, const bool f_adaptive_b )
+  {
+    const bool live_b = !f_live.empty();
+    f_out.precision( 8 );
+    if( f_format_str == "json" )
+    {
+      f_out << "[\n";
+      for( size_t i = 0; i < f_results.size(); ++i )
+      {
+	const SThirdEyeFrameResult &r = f_results[ i ];
+	f_out << "  { \"frame\": " << r.m_index_ui
+	      << ", \"base\": " << jsonString( f_names[ i ] )
+	      << ", \"valid\": " << ( r.m_valid_b ? "true" : "false" );
+	const bool sampled_b = r.m_valid_b && f_qualities[ i ] == QUALITY_SAMPLED;
+	if( r.m_valid_b && !sampled_b )
+	{
+	  f_out << ", \"full_index\": " << r.m_fullIndex_f << ", \"mask_index\": " << r.m_maskIndex_f;
+	}
+	else
+	{
+	  f_out << ", \"full_index\": null, \"mask_index\": null";
+	}
+	if( r.m_valid_b )
+	{
+	  f_out << ", \"quality\": \"" << qualityName( f_qualities[ i ] ) << "\"";
+	}
+	else
+	{
+	  f_out << ", \"quality\": null";
+	}
+	if( f_adaptive_b && sampled_b )
+	{
+	  f_out << ", \"estimate\": " << r.m_estimate_f << ", \"estimate_lower\": " << r.m_estimateLower_f
+		<< ", \"estimate_upper\": " << r.m_estimateUpper_f;
+	}
+	else if( f_adaptive_b )
+	{
+	  f_out << ", \"estimate\": null, \"estimate_lower\": null, \"estimate_upper\": null";
+	}
+	if( live_b )
+	{
+	  f_out << ", \"dropped\": " << ( f_live[ i ].m_dropped_b ? "true" : "false" )
+		<< ", \"latency_ms\": ";
+	  if( r.m_valid_b )
+	  {
+	    f_out << f_live[ i ].m_latency_f;
+	  }
+	  else
+	  {
+	    f_out << "null";
+	  }
+	}
+	f_out << ( i + 1 < f_results.size() ? " },\n" : " }\n" );
+      }
+      f_out << "]\n";
+      return;
+    }
+
+    f_out << "frame,base,valid,full_index,mask_index,quality"
+	  << ( f_adaptive_b ? ",estimate,estimate_lower,estimate_upper" : "" )
+	  << ( live_b ? ",dropped,latency_ms\n" : "\n" );
+    for( size_t i = 0; i < f_results.size(); ++i )
+    {
+      const SThirdEyeFrameResult &r = f_results[ i ];
+      const bool sampled_b = r.m_valid_b && f_qualities[ i ] == QUALITY_SAMPLED;
+      f_out << r.m_index_ui << "," << csvString( f_names[ i ] ) << ","
+	    << ( r.m_valid_b ? 1 : 0 ) << ",";
+      if( r.m_valid_b && !sampled_b )
+      {
+	f_out << r.m_fullIndex_f << "," << r.m_maskIndex_f;
+      }
+      else
+      {
+	f_out << ",";
+      }
+      f_out << "," << ( r.m_valid_b ? qualityName( f_qualities[ i ] ) : "" );
+      if( f_adaptive_b && sampled_b )
+      {
+	f_out << "," << r.m_estimate_f << "," << r.m_estimateLower_f << "," << r.m_estimateUpper_f;
+      }
+      else if( f_adaptive_b )
+      {
+	f_out << ",,,";
+      }
+      if( live_b )
+      {
+	f_out << "," << ( f_live[ i ].m_dropped_b ? 1 : 0 ) << ",";
+	if( r.m_valid_b )
+	{
+	  f_out << f_live[ i ].m_latency_f;
+	}
+      }
+      f_out << "\n";
+    }
+  }
+}
+
+int main( int argc, char** argv )
 {
-  // Create an evaluation object
+  SOptions options;
+  if( argc < 2 || !parseArguments( argc, argv, options ) )
+  {
+    printUsage( argv[ 0 ] );
+    return 1;
+  }
+
+  SThirdEyeConfig config;
+  if( !loadConfig( options.m_config_str, config ) )
+  {
+    return 1;
+  }
+
+  /// Frame source, first frame number and names of the frames
+  CThirdEyeContainerSource containerSource;
+  CThirdEyeFrameSource* source_p = nullptr;
+  std::vector<CThirdEyeListSource> listSource;
+  std::vector<CThirdEyePatternSource> patternSource;
+  unsigned first_ui = 0, count_ui = 0;
+  std::vector<std::string> names;
+
+  if( !options.m_sequence_str.empty() )
+  {
+    if( !containerSource.open( options.m_sequence_str ) )
+    {
+      return 1;
+    }
+    source_p = &containerSource;
+    count_ui = containerSource.getNumFrames();
+    names.assign( count_ui, options.m_sequence_str );
+  }
+  else if( options.m_frames_b && options.m_base_str.find( '%' ) != std::string::npos )
+  {
+    if( options.m_last_i < options.m_first_i || options.m_first_i < 0 )
+    {
+      cerr << "ERROR thirdEye: Invalid frame range\n";
+      return 1;
+    }
+    patternSource.push_back( CThirdEyePatternSource( options.m_base_str, options.m_control_str,
+						     options.m_disp_str, config.m_bits_ui ) );
+    source_p = &patternSource.back();
+    first_ui = static_cast<unsigned>( options.m_first_i );
+    count_ui = static_cast<unsigned>( options.m_last_i - options.m_first_i + 1 );
+    for( unsigned i = 0; i < count_ui; ++i )
+    {
+      names.push_back( frameFileName( options.m_base_str, first_ui + i ) );
+    }
+  }
+  else
+  {
+    std::vector<std::string> bases, controls, disps;
+    if( !options.m_list_str.empty() )
+    {
+      if( !readList( options.m_list_str, bases, controls, disps ) )
+      {
+	return 1;
+      }
+    }
+    else if( !expandPattern( options.m_base_str, bases ) ||
+	     !expandPattern( options.m_control_str, controls ) ||
+	     !expandPattern( options.m_disp_str, disps ) )
+    {
+      return 1;
+    }
+    if( bases.size() != controls.size() || bases.size() != disps.size() )
+    {
+      cerr << "ERROR thirdEye: The patterns match " << bases.size() << " base, "
+	   << controls.size() << " control and " << disps.size() << " disparity files\n";
+      return 1;
+    }
+    listSource.push_back( CThirdEyeListSource( bases, controls, disps, config.m_bits_ui ) );
+    source_p = &listSource.back();
+    count_ui = listSource.back().getNumFrames();
+    names = bases;
+  }
+
+  if( count_ui == 0 )
+  {
+    cerr << "ERROR thirdEye: No frames to evaluate\n";
+    return 1;
+  }
+
   CThirdEyeEvaluation eval;
+  applyConfig( config, eval );
+
+  /// Evaluate
+  setSchedulerThreads( options.m_numJobs_ui );
+  setSchedulerNuma( options.m_numa_b );
+  std::vector<SThirdEyeFrameResult> results( count_ui );
+  std::vector<EThirdEyeQuality> qualities( count_ui, QUALITY_FULL );
+  std::vector<SThirdEyeLiveResult> live;
+
+  if( options.m_liveFps_f > 0.f )
+  {
+    /// Live mode: the frames come one by one at the given rate and are
+    /// evaluated in their arrival order, each with all the threads
+    const float period_f = 1000.f / options.m_liveFps_f;
+    CThirdEyeLive frontEnd( eval );
+    frontEnd.setQueue( options.m_queue_ui, options.m_drop_e );
+    frontEnd.setDeadline( period_f );
+    frontEnd.start();
+
+    // The results are taken as the frames are pushed, so the ring of the
+    // front end never fills up
+    std::vector<SThirdEyeLiveResult> frames;
+    frames.reserve( count_ui );
+    CThirdEyeReplayer replayer( *source_p, options.m_liveFps_f );
+    replayer.run( first_ui, count_ui, [&]( const SThirdEyeFrame &f_frame )
+		  {
+		    const bool pushed_b = frontEnd.pushFrame( f_frame );
+		    frontEnd.takeResults( frames );
+		    return pushed_b;
+		  } );
+    frontEnd.stop();
+    frontEnd.takeResults( frames );
+
+    live.resize( count_ui );
+    for( unsigned i = 0; i < count_ui; ++i )
+    {
+      results[ i ].m_index_ui = live[ i ].m_index_ui = first_ui + i;
+    }
+    for( size_t k = 0; k < frames.size(); ++k )
+    {
+      const unsigned i = frames[ k ].m_index_ui - first_ui;
+      live[ i ]                      = frames[ k ];
+      results[ i ].m_valid_b         = frames[ k ].m_valid_b;
+      results[ i ].m_fullIndex_f     = frames[ k ].m_fullIndex_f;
+      results[ i ].m_maskIndex_f     = frames[ k ].m_maskIndex_f;
+      results[ i ].m_estimate_f      = frames[ k ].m_estimate_f;
+      results[ i ].m_estimateLower_f = frames[ k ].m_estimateLower_f;
+      results[ i ].m_estimateUpper_f = frames[ k ].m_estimateUpper_f;
+      qualities[ i ]                 = frames[ k ].m_quality_e;
+    }
+
+    const SThirdEyeLiveStats stats = frontEnd.getStats();
+    cerr << "Live: " << stats.m_pushed_ui << " frames at " << options.m_liveFps_f << " fps, "
+	 << stats.m_evaluated_ui << " evaluated, " << stats.m_dropped_ui << " dropped, "
+	 << replayer.getLateFrames() << " pushed late\n"
+	 << "Latency (ms): mean " << stats.m_meanLatency_f << ", p95 " << stats.m_p95Latency_f
+	 << ", max " << stats.m_maxLatency_f << "; " << stats.m_late_ui
+	 << " frames above the " << period_f << " ms period" << endl;
+  }
+  else if( options.m_pipeline_b )
+  {
+    /// Pipelined batch mode: the stages of consecutive frames overlap, and the
+    /// loaders run ahead of them
+    CThirdEyeSequence sequence( eval );
+    sequence.run( *source_p, first_ui, count_ui, results );
+    for( unsigned i = 0; i < count_ui; ++i )
+    {
+      qualities[ i ] = results[ i ].m_quality_e;
+    }
+  }
+  else
+  {
+    /// Batch mode. The frames are the top-level tasks of the scheduler, and the
+    /// row blocks of each frame its child tasks, so idle threads help with the
+    /// last frames. A task takes a free copy of the evaluation (the intensity
+    /// scale and the disparity format come with each frame) and its workspace
+    /// of the node that runs it. The buffers of a workspace are allocated and
+    /// first touched by the tasks that use it, so they stay on that node
+    struct SFrameState
+    {
+      CThirdEyeEvaluation m_eval;
+      SThirdEyeWorkspace  m_workspace;
+    };
+    std::vector<std::unique_ptr<SFrameState> > states;
+    std::vector<std::vector<SFrameState*> > freeStates( getNumNumaNodes() );
+    std::mutex statesMutex;
+
+    parallelFor( count_ui, [&]( const unsigned i )
+    {
+      SThirdEyeFrameResult &result = results[ i ];
+      SThirdEyeFrame frame;
+      frame.m_index_ui = result.m_index_ui = first_ui + i;
+
+      if( !source_p->loadFrame( frame ) )
+      {
+	cerr << "ERROR thirdEye: Cannot load frame " << frame.m_index_ui << endl;
+	return;
+      }
+
+      SFrameState* state_p = nullptr;
+      std::vector<SFrameState*> &nodeStates = freeStates[ currentNumaNode() ];
+      {
+	std::lock_guard<std::mutex> lock( statesMutex );
+	if( nodeStates.empty() )
+	{
+	  states.push_back( std::unique_ptr<SFrameState>( new SFrameState{ eval, SThirdEyeWorkspace() } ) );
+	  nodeStates.push_back( states.back().get() );
+	}
+	state_p = nodeStates.back();
+	nodeStates.pop_back();
+      }
+
+      state_p->m_eval.setIntensityScale( frame.m_intensityScale_f );
+      state_p->m_eval.setSubpixelBits( frame.m_subpixelBits_ui );
+      result.m_valid_b = state_p->m_eval.computeEvaluationIndices( frame.m_disparity, frame.m_base,
+								   frame.m_control,
+								   state_p->m_workspace,
+								   result.m_fullIndex_f,
+								   result.m_maskIndex_f );
+      qualities[ i ]           = state_p->m_workspace.m_quality_e;
+      result.m_estimate_f      = state_p->m_workspace.m_estimate_f;
+      result.m_estimateLower_f = state_p->m_workspace.m_estimateLower_f;
+      result.m_estimateUpper_f = state_p->m_workspace.m_estimateUpper_f;
+
+      std::lock_guard<std::mutex> lock( statesMutex );
+      nodeStates.push_back( state_p );
+    } );
+  }
+
+  /// Write the results. Frames dropped in live mode are not errors
+  bool ok_b = true;
+  for( size_t i = 0; i < results.size(); ++i )
+  {
+    ok_b = ok_b && ( results[ i ].m_valid_b || ( !live.empty() && live[ i ].m_dropped_b ) );
+  }
+
+  if( options.m_output_str.empty() )
+  {
+    writeResults( cout, options.m_format_str, results, qualities, live, names,
+		  config.m_latencyBudget_f > 0.f );
+  }
+  else
+  {
+    std::ofstream out( options.m_output_str.c_str() );
+    if( !out )
+    {
+      cerr << "ERROR thirdEye: Cannot write " << options.m_output_str << endl;
+      return 1;
+    }
+    writeResults( out, options.m_format_str, results, qualities, live, names,
+		  config.m_latencyBudget_f > 0.f );
+  }
 
-  // Set a RoI to discard the obvious occlusions in the border of the images.
-  // Depends on the calibration (has to be set manually by analizing the control, 
-  // base and match images)
-  eval.setEvaluationRoi( 50, 20, 600, 420);
-
-  /// Set the parameters that define the transformation 
-  // between the reference and control camera.
-  // Depends on the calibration
-  SThirdEyeParams paramsSample( 0.299663f,              // Base line StereoCam
-				-0.505707f, 0.0f, 0.0f, // Translation base-control
-				1.f, 0.f, 0.f,	        // Rotation matrix base-control
-				0.f, 1.f, 0.f,
-				0.f, 0.f, 1.f,
-				302.454f, 285.46f,	// PP base camera
-				1031.02f, 1031.02f,	// Focal lenght base camera
-				302.454f, 285.46f,	// PP control camera
-				1031.02f, 1031.02f,	// Focal lenght control camera
-				1.f, 0.998045f	        // Pixel size
-				);
-
-  // Set the params
-  eval.setParams( paramsSample );
-
-  /// Set the mask params
-  eval.setMaskParams( 10.f, 5.f );
-
-  /// Load images. Input images are expected to be float images scaled to the range [0,255]
-  cv::Mat base     = loadImageFile( "../images/img_000001_c0.pgm", 16 );
-  showImage( base, "Base" );
-  cv::Mat control = loadImageFile( "../images/img_000001_c1.pgm", 16 );
-  showImage( control, "Control" );
-
-  // The disparity image is expected to be 32-float image. 
-  cv::Mat disp    = loadRawImage( "../images/disp_bp.raw" );
-  showImage( disp, "Disparity Map" );
-
-  eval.print();
-
-  /// Compute the error
-  float fullIndex_f = -1.f;
-  float maskIndex_f = -1.f;
-  eval.computeEvaluationIndices( disp,        // Disparity map
-				 base,        // Base image of the stereo pair
-				 control,     // Control image of the trinocular set
-				 fullIndex_f, // NCC index of the full approach
-				 maskIndex_f  // NCC index of the masked approach
-				 );
-  
-  std::cout << "Ncc      = " << fullIndex_f << std::endl
-	    << "Ncc mask = " << maskIndex_f << std::endl;
-
-  
-
-  /// Get and show the virtual image
-  showImage( eval.getVirtualImage( disp, base ), "Virtual Image" );
-  // Get and show the masked control image
-  showImage( eval.getMask( control ), "Control Image" );
-
-  return 0;
+  /// Only if asked: show the virtual image and the masked control image
+  if( options.m_show_b )
+  {
+    for( unsigned i = 0; i < count_ui; ++i )
+    {
+      SThirdEyeFrame frame;
+      frame.m_index_ui = first_ui + i;
+      if( !results[ i ].m_valid_b || !source_p->loadFrame( frame ) )
+      {
+	continue;
+      }
+      eval.setIntensityScale( frame.m_intensityScale_f );
+      eval.setSubpixelBits( frame.m_subpixelBits_ui );
+      showImage( eval.getVirtualImage( frame.m_disparity, frame.m_base ), "Virtual Image" );
+      showImage( eval.getMask( frame.m_control ), "Control Image" );
+    }
+  }
 
+  return ok_b ? 0 : 1;
 }
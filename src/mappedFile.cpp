@@ -0,0 +1,258 @@
+/* ******************************** FILE *********************************** */
+/** \file    mappedFile.cpp
+ *
+ *  \brief   Definition of the class CMappedFile.
+ *
+ *  \note    .enpeda.. Project, The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/mappedFile.h"
+
+// Common includes
+#include <iostream>
+
+// POSIX includes
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::cerr;
+using std::endl;
+
+// Reference count of a mapping, shared by the CMappedFile object and the
+// Mats that point into it. cv::Mat only knows the address of the counter, so
+// it must be the first member
+struct SMappingBlock
+{
+  int    m_refcount_i;
+  void*  m_base_p;
+  size_t m_size;
+};
+
+namespace
+{
+  // Unmaps (or frees) the data of a block and deletes it
+  void releaseBlock( SMappingBlock* f_block_p, uchar* f_datastart_p )
+  {
+    if( f_block_p->m_base_p )
+    {
+      munmap( f_block_p->m_base_p, f_block_p->m_size );
+    }
+    else
+    {
+      cv::fastFree( f_datastart_p );
+    }
+    delete f_block_p;
+  }
+
+  /* *************************** CLASS *************************************** */
+  /* CMappingAllocator
+   *
+   * \brief      Allocator of the Mats returned by CMappedFile::getMat.
+   *             deallocate is called by cv::Mat::release when the count
+   *             drops to zero and unmaps the file. OpenCV keeps the allocator
+   *             if such a Mat is later re-created with another size, so
+   *             allocate does a regular heap allocation (m_base_p is null
+   *             for those).
+   *************************************************************************** */
+  class CMappingAllocator : public cv::MatAllocator
+  {
+  public:
+    void allocate( int f_dims_i, const int* f_sizes_p, int f_type_i, int*& f_refcount_p,
+		   uchar*& f_datastart_p, uchar*& f_data_p, size_t* f_step_p )
+    {
+      size_t total = CV_ELEM_SIZE( f_type_i );
+      for( int i = f_dims_i - 1; i >= 0; --i )
+      {
+	f_step_p[ i ] = total;
+	total *= f_sizes_p[ i ];
+      }
+
+      SMappingBlock* block_p = new SMappingBlock;
+      block_p->m_refcount_i = 1;
+      block_p->m_base_p     = nullptr;
+      block_p->m_size       = total;
+
+      f_datastart_p = f_data_p = static_cast<uchar*>( cv::fastMalloc( total ) );
+      f_refcount_p  = &block_p->m_refcount_i;
+    }
+
+    void deallocate( int* f_refcount_p, uchar* f_datastart_p, uchar* /*f_data_p*/ )
+    {
+      releaseBlock( reinterpret_cast<SMappingBlock*>( f_refcount_p ), f_datastart_p );
+    }
+  };
+
+  CMappingAllocator g_mappingAllocator;
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard constructor.
+ *
+ * \brief          Standard constructor.
+ *
+ * \return         -
+ *************************************************************************** */
+CMappedFile::CMappedFile()
+  : m_data_p( nullptr ),
+    m_size( 0 ),
+    m_block_p( nullptr )
+{
+  /* Empty body */
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard destructor.
+ *
+ * \brief          Standard destructor.
+ *
+ * \return         -
+ *************************************************************************** */
+CMappedFile::~CMappedFile()
+{
+  close();
+}
+
+/* *************************** METHOD ************************************** */
+/* open
+ *
+ * \brief      Maps the whole file into memory. Nothing is read until the
+ *             pages are touched. A previously mapped file is closed first.
+ *
+ * \param[in]  const std::string &f_fileName_str: Name of the file.
+ *
+ * \return     True if the file was mapped. False otherwise.
+ *************************************************************************** */
+bool CMappedFile::open( const std::string &f_fileName_str )
+{
+  close();
+
+  const int file_i = ::open( f_fileName_str.c_str(), O_RDONLY );
+  if( file_i < 0 )
+  {
+    cerr << "ERROR CMappedFile::open: Cannot open the file: " << f_fileName_str << endl;
+    return false;
+  }
+
+  struct stat status;
+  if( fstat( file_i, &status ) != 0 || status.st_size <= 0 )
+  {
+    cerr << "ERROR CMappedFile::open: Cannot get the size of the file (or it is empty): "
+	 << f_fileName_str << endl;
+    ::close( file_i );
+    return false;
+  }
+
+  const size_t size = static_cast<size_t>( status.st_size );
+  void* data_p = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file_i, 0 );
+
+  // The mapping keeps its own reference to the file
+  ::close( file_i );
+
+  if( data_p == MAP_FAILED )
+  {
+    cerr << "ERROR CMappedFile::open: Cannot map the file: " << f_fileName_str << endl;
+    return false;
+  }
+
+  m_data_p  = static_cast<char*>( data_p );
+  m_size    = size;
+  m_block_p = new SMappingBlock;
+  m_block_p->m_refcount_i = 1;
+  m_block_p->m_base_p     = data_p;
+  m_block_p->m_size       = size;
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* close
+ *
+ * \brief      Drops the reference of this object to the mapping. The file is
+ *             unmapped if no Mat refers to it.
+ *
+ * \return     -
+ *************************************************************************** */
+void CMappedFile::close()
+{
+  if( m_block_p && CV_XADD( &m_block_p->m_refcount_i, -1 ) == 1 )
+  {
+    releaseBlock( m_block_p, nullptr );
+  }
+  m_data_p  = nullptr;
+  m_size    = 0;
+  m_block_p = nullptr;
+}
+
+/* *************************** METHOD ************************************** */
+/* getMat
+ *
+ * \brief      Builds a cv::Mat header on top of the mapped data, without
+ *             copying it. The Mat gets the reference count of the mapping and
+ *             the mapping allocator, so the mapping lives as long as the Mat
+ *             or any copy of it (ROIs included), even if this object is
+ *             closed before.
+ *
+ * \param[in]  const size_t f_offset: Position of the first pixel in the file.
+ * \param[in]  const int f_rows_i: Number of rows.
+ * \param[in]  const int f_cols_i: Number of columns.
+ * \param[in]  const int f_type_i: OpenCV type of the pixels.
+ *
+ * \return     The Mat. Empty if the data does not fit in the file or the
+ *             offset is not aligned to the pixel size.
+ *************************************************************************** */
+cv::Mat CMappedFile::getMat( const size_t f_offset, const int f_rows_i,
+			     const int f_cols_i, const int f_type_i ) const
+{
+  const size_t elemSize = CV_ELEM_SIZE( f_type_i );
+
+  // Compared against the room left, so that no product or sum can wrap around
+  if( !m_data_p || f_rows_i <= 0 || f_cols_i <= 0 || f_offset > m_size ||
+      static_cast<size_t>( f_cols_i ) > ( m_size - f_offset ) / elemSize / f_rows_i )
+  {
+    cerr << "ERROR CMappedFile::getMat: The image does not fit in the file!\n";
+    return cv::Mat();
+  }
+
+  // The caller may fall back to a copy
+  if( f_offset % elemSize != 0 )
+  {
+    return cv::Mat();
+  }
+
+  CV_XADD( &m_block_p->m_refcount_i, 1 );
+
+  cv::Mat output( f_rows_i, f_cols_i, f_type_i, m_data_p + f_offset );
+  output.refcount  = &m_block_p->m_refcount_i;
+  output.allocator = &g_mappingAllocator;
+
+  return output;
+}
+
+/* *************************** METHOD ************************************** */
+/* releaseToMat
+ *
+ * \brief      Same as getMat, but this object drops its reference afterwards,
+ *             so the mapping is released with the Mat.
+ *
+ * \param[in]  const size_t f_offset: Position of the first pixel in the file.
+ * \param[in]  const int f_rows_i: Number of rows.
+ * \param[in]  const int f_cols_i: Number of columns.
+ * \param[in]  const int f_type_i: OpenCV type of the pixels.
+ *
+ * \return     The Mat. Empty (and the object still open) if the data does not
+ *             fit in the file or the offset is not aligned to the pixel size.
+ *************************************************************************** */
+cv::Mat CMappedFile::releaseToMat( const size_t f_offset, const int f_rows_i,
+				   const int f_cols_i, const int f_type_i )
+{
+  cv::Mat output = getMat( f_offset, f_rows_i, f_cols_i, f_type_i );
+  if( !output.empty() )
+  {
+    close();
+  }
+
+  return output;
+}
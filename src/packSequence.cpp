@@ -0,0 +1,127 @@
+/* ******************************** FILE *********************************** */
+/** \file    packSequence.cpp
+ *
+ *  \brief   Packs a trinocular sequence (base and control PGM images and
+ *           raw disparity maps, one file each per frame) into a single
+ *           sequence file (see sequenceFile.h). The images are stored in
+ *           their native type, the disparities as they are (32 float or
+ *           16-bit fixed point).
+ *
+ *           Usage:
+ *             thirdEyePack <output> <bits> <first> <last>
+ *                          <base pattern> <control pattern> <disp pattern>
+ *
+ *           The patterns are printf formats of the frame number, e.g.
+ *           ../images/img_%06d_c0.pgm
+ *
+ *  \note    .enpeda.. Project, The University of Auckland
+ *
+ *************************************************************************** */
+// Regular includes
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/// OpenCv icnludes
+#include <opencv2/core/core.hpp>
+
+// Project includes
+#include "../h/loader.h"
+#include "../h/sequenceFile.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+
+namespace
+{
+  SSequenceStream makeStream( const std::string &f_name_str, const cv::Mat &f_img,
+			      const unsigned f_subpixelBits_ui, const float f_scale_f )
+  {
+    SSequenceStream stream;
+    stream.m_name_str         = f_name_str;
+    stream.m_type_i           = f_img.type();
+    stream.m_width_ui         = f_img.cols;
+    stream.m_height_ui        = f_img.rows;
+    stream.m_subpixelBits_ui  = f_subpixelBits_ui;
+    stream.m_intensityScale_f = f_scale_f;
+    return stream;
+  }
+}
+
+int main( int argc, char** argv )
+{
+  if( argc != 8 )
+  {
+    cerr << "Usage: " << argv[ 0 ] << " <output> <bits> <first> <last> "
+	 << "<base pattern> <control pattern> <disp pattern>\n"
+	 << "  The patterns are printf formats of the frame number, "
+	 << "e.g. img_%06d_c0.pgm\n";
+    return 1;
+  }
+
+  const std::string output_str = argv[ 1 ];
+  const unsigned    bits_ui    = static_cast<unsigned>( atoi( argv[ 2 ] ) );
+  const int         first_i    = atoi( argv[ 3 ] );
+  const int         last_i     = atoi( argv[ 4 ] );
+
+  if( last_i < first_i )
+  {
+    cerr << "ERROR thirdEyePack: Empty frame range!\n";
+    return 1;
+  }
+
+  CSequenceWriter writer;
+  std::vector<cv::Mat> images( 3 );
+  unsigned firstSubpixelBits_ui = 0;
+
+  for( int frame_i = first_i; frame_i <= last_i; ++frame_i )
+  {
+    float baseScale_f = 1.f, controlScale_f = 1.f;
+    unsigned subpixelBits_ui = 0;
+    images[ 0 ] = loadImageFileNative( frameFileName( argv[ 5 ], frame_i ), bits_ui, baseScale_f );
+    images[ 1 ] = loadImageFileNative( frameFileName( argv[ 6 ], frame_i ), bits_ui, controlScale_f );
+    images[ 2 ] = loadRawImage( frameFileName( argv[ 7 ], frame_i ), subpixelBits_ui );
+
+    if( images[ 0 ].empty() || images[ 1 ].empty() || images[ 2 ].empty() )
+    {
+      cerr << "ERROR thirdEyePack: Cannot load frame " << frame_i << endl;
+      return 1;
+    }
+
+    // The streams are defined by the first frame
+    if( frame_i == first_i )
+    {
+      std::vector<SSequenceStream> streams;
+      streams.push_back( makeStream( "base",      images[ 0 ], 0, baseScale_f ) );
+      streams.push_back( makeStream( "control",   images[ 1 ], 0, controlScale_f ) );
+      streams.push_back( makeStream( "disparity", images[ 2 ], subpixelBits_ui, 1.f ) );
+      if( !writer.open( output_str, streams ) )
+      {
+	return 1;
+      }
+      firstSubpixelBits_ui = subpixelBits_ui;
+    }
+    else if( subpixelBits_ui != firstSubpixelBits_ui )
+    {
+      cerr << "ERROR thirdEyePack: The disparity format of frame " << frame_i 
+	   << " differs from the first frame!\n";
+      return 1;
+    }
+
+    if( !writer.addFrame( images ) )
+    {
+      cerr << "ERROR thirdEyePack: Cannot add frame " << frame_i << endl;
+      return 1;
+    }
+  }
+
+  if( !writer.close() )
+  {
+    return 1;
+  }
+
+  cout << "Packed " << ( last_i - first_i + 1 ) << " frames into " << output_str << endl;
+  return 0;
+}
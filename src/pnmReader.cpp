@@ -0,0 +1,312 @@
+/* ******************************** FILE *********************************** */
+/** \file    pnmReader.cpp
+ *
+ *  \brief   Definition of the binary PGM/PPM reader.
+ *
+ *  \note    .enpeda.. Project, The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/pnmReader.h"
+
+// Common includes
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+
+// Project includes
+#include "../h/mappedFile.h"
+
+// SIMD includes. SSE2 is part of the x86-64 baseline.
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+using std::cerr;
+using std::endl;
+
+namespace
+{
+  // Header of a binary PGM/PPM file
+  struct SPnmHeader
+  {
+    unsigned m_width_ui;
+    unsigned m_height_ui;
+    unsigned m_channels_ui;
+    unsigned m_bytesPerSample_ui;
+    size_t   m_offset;
+  };
+
+  /* *************************** FUNCTION ************************************ */
+  /* readHeaderValue
+   *
+   * \brief      Reads the next unsigned value of a PNM header, skipping white
+   *             spaces and comments. f_pos is left after the last digit.
+   *************************************************************************** */
+  bool readHeaderValue( const char* f_data_p, const size_t f_size, size_t &f_pos,
+			unsigned &f_value_ui )
+  {
+    while( f_pos < f_size )
+    {
+      const char c = f_data_p[ f_pos ];
+      if( c == '#' )
+      {
+	while( f_pos < f_size && f_data_p[ f_pos ] != '\n' ) ++f_pos;
+      }
+      else if( c == ' ' || c == '\t' || c == '\n' || c == '\r' )
+      {
+	++f_pos;
+      }
+      else
+      {
+	break;
+      }
+    }
+
+    if( f_pos >= f_size || f_data_p[ f_pos ] < '0' || f_data_p[ f_pos ] > '9' )
+    {
+      return false;
+    }
+
+    f_value_ui = 0;
+    while( f_pos < f_size && f_data_p[ f_pos ] >= '0' && f_data_p[ f_pos ] <= '9' )
+    {
+      f_value_ui = f_value_ui * 10 + ( f_data_p[ f_pos ] - '0' );
+      ++f_pos;
+    }
+
+    return true;
+  }
+
+  /* *************************** FUNCTION ************************************ */
+  /* parseHeader
+   *
+   * \brief      Parses the header of a mapped binary PGM/PPM file. Returns
+   *             false, quietly, if the magic number is not P5 or P6.
+   *************************************************************************** */
+  bool parseHeader( const CMappedFile &f_file, const std::string &f_name_str,
+		    SPnmHeader &f_header )
+  {
+    const char*  data_p = f_file.getData();
+    const size_t size   = f_file.getSize();
+
+    if( size < 2 || data_p[ 0 ] != 'P' || ( data_p[ 1 ] != '5' && data_p[ 1 ] != '6' ) )
+    {
+      return false;
+    }
+
+    size_t pos = 2;
+    unsigned maxValue_ui = 0;
+    if( !readHeaderValue( data_p, size, pos, f_header.m_width_ui  ) ||
+	!readHeaderValue( data_p, size, pos, f_header.m_height_ui ) ||
+	!readHeaderValue( data_p, size, pos, maxValue_ui )         ||
+	maxValue_ui == 0 || maxValue_ui > 65535 )
+    {
+      cerr << "ERROR readPnmImage: Invalid header in " << f_name_str << endl;
+      return false;
+    }
+
+    f_header.m_channels_ui       = ( data_p[ 1 ] == '5' ) ? 1 : 3;
+    f_header.m_bytesPerSample_ui = ( maxValue_ui < 256 ) ? 1 : 2;
+    // A single white space separates the header from the samples
+    f_header.m_offset            = pos + 1;
+
+    const size_t numBytes = static_cast<size_t>( f_header.m_width_ui ) * f_header.m_height_ui *
+      f_header.m_channels_ui * f_header.m_bytesPerSample_ui;
+    if( f_header.m_width_ui == 0 || f_header.m_height_ui == 0 ||
+	f_header.m_offset + numBytes > size )
+    {
+      cerr << "ERROR readPnmImage: The file is too short: " << f_name_str << endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  /* *************************** FUNCTION ************************************ */
+  /* convertRow8 / convertRow16
+   *
+   * \brief      Converts a run of samples into scaled floats. 16 bit samples
+   *             are big-endian. With SSE2, 8 samples are byte swapped,
+   *             widened, converted and scaled per iteration.
+   *************************************************************************** */
+  void convertRow8( const uchar* f_src_p, const unsigned f_count_ui, const float f_scale_f,
+		    float* f_dst_p )
+  {
+    unsigned x = 0;
+#if defined( __SSE2__ )
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128  scale = _mm_set1_ps( f_scale_f );
+    for( ; x + 8 <= f_count_ui; x += 8 )
+    {
+      const __m128i bytes = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( f_src_p + x ) );
+      const __m128i words = _mm_unpacklo_epi8( bytes, zero );
+      _mm_storeu_ps( f_dst_p + x,
+		     _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( words, zero ) ), scale ) );
+      _mm_storeu_ps( f_dst_p + x + 4,
+		     _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( words, zero ) ), scale ) );
+    }
+#endif
+    for( ; x < f_count_ui; ++x )
+    {
+      f_dst_p[ x ] = f_src_p[ x ] * f_scale_f;
+    }
+  }
+
+  void convertRow16( const uchar* f_src_p, const unsigned f_count_ui, const float f_scale_f,
+		     float* f_dst_p )
+  {
+    unsigned x = 0;
+#if defined( __SSE2__ )
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128  scale = _mm_set1_ps( f_scale_f );
+    for( ; x + 8 <= f_count_ui; x += 8 )
+    {
+      const __m128i raw   = _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_src_p + 2 * x ) );
+      const __m128i words = _mm_or_si128( _mm_slli_epi16( raw, 8 ), _mm_srli_epi16( raw, 8 ) );
+      _mm_storeu_ps( f_dst_p + x,
+		     _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpacklo_epi16( words, zero ) ), scale ) );
+      _mm_storeu_ps( f_dst_p + x + 4,
+		     _mm_mul_ps( _mm_cvtepi32_ps( _mm_unpackhi_epi16( words, zero ) ), scale ) );
+    }
+#endif
+    for( ; x < f_count_ui; ++x )
+    {
+      f_dst_p[ x ] = ( ( f_src_p[ 2 * x ] << 8 ) | f_src_p[ 2 * x + 1 ] ) * f_scale_f;
+    }
+  }
+
+  // Byte swap only, for the native reader
+  void swapRow16( const uchar* f_src_p, const unsigned f_count_ui, ushort* f_dst_p )
+  {
+    unsigned x = 0;
+#if defined( __SSE2__ )
+    for( ; x + 8 <= f_count_ui; x += 8 )
+    {
+      const __m128i raw = _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_src_p + 2 * x ) );
+      _mm_storeu_si128( reinterpret_cast<__m128i*>( f_dst_p + x ),
+			_mm_or_si128( _mm_slli_epi16( raw, 8 ), _mm_srli_epi16( raw, 8 ) ) );
+    }
+#endif
+    for( ; x < f_count_ui; ++x )
+    {
+      f_dst_p[ x ] = static_cast<ushort>( ( f_src_p[ 2 * x ] << 8 ) | f_src_p[ 2 * x + 1 ] );
+    }
+  }
+
+  // PPM samples are RGB, OpenCV images BGR
+  template<typename T>
+  void swapRedBlue( T* f_row_p, const unsigned f_width_ui )
+  {
+    for( unsigned x = 0; x < f_width_ui; ++x )
+    {
+      std::swap( f_row_p[ 3 * x ], f_row_p[ 3 * x + 2 ] );
+    }
+  }
+
+  /* *************************** FUNCTION ************************************ */
+  /* readPnm
+   *
+   * \brief      Common part of readPnmImage and readPnmImageNative. The rows
+   *             are converted one at a time, from the mapped file into the
+   *             output image.
+   *************************************************************************** */
+  bool readPnm( const std::string &f_name_str, const bool f_native_b, const float f_scale_f,
+		cv::Mat &f_img )
+  {
+    CMappedFile file;
+    if( !file.open( f_name_str ) )
+    {
+      return false;
+    }
+
+    SPnmHeader header;
+    if( !parseHeader( file, f_name_str, header ) )
+    {
+      return false;
+    }
+
+    const int depth_i = !f_native_b ? CV_32F :
+      ( header.m_bytesPerSample_ui == 1 ? CV_8U : CV_16U );
+    f_img.create( header.m_height_ui, header.m_width_ui,
+		  CV_MAKETYPE( depth_i, header.m_channels_ui ) );
+
+    const unsigned rowSamples_ui = header.m_width_ui * header.m_channels_ui;
+    const size_t   rowBytes      = static_cast<size_t>( rowSamples_ui ) * header.m_bytesPerSample_ui;
+    const uchar*   src_p         = reinterpret_cast<const uchar*>( file.getData() ) + header.m_offset;
+
+    for( unsigned y = 0; y < header.m_height_ui; ++y, src_p += rowBytes )
+    {
+      switch( depth_i )
+      {
+	case CV_32F:
+	  if( header.m_bytesPerSample_ui == 1 )
+	  {
+	    convertRow8( src_p, rowSamples_ui, f_scale_f, f_img.ptr<float>( y ) );
+	  }
+	  else
+	  {
+	    convertRow16( src_p, rowSamples_ui, f_scale_f, f_img.ptr<float>( y ) );
+	  }
+	  if( header.m_channels_ui == 3 )
+	  {
+	    swapRedBlue( f_img.ptr<float>( y ), header.m_width_ui );
+	  }
+	break;
+	case CV_16U:
+	  swapRow16( src_p, rowSamples_ui, f_img.ptr<ushort>( y ) );
+	  if( header.m_channels_ui == 3 )
+	  {
+	    swapRedBlue( f_img.ptr<ushort>( y ), header.m_width_ui );
+	  }
+	break;
+	default:
+	  memcpy( f_img.ptr<uchar>( y ), src_p, rowBytes );
+	  if( header.m_channels_ui == 3 )
+	  {
+	    swapRedBlue( f_img.ptr<uchar>( y ), header.m_width_ui );
+	  }
+	break;
+      }
+    }
+
+    return true;
+  }
+}
+
+/* *************************** FUNCTION ************************************ */
+/* readPnmImage
+ *
+ * \brief      Reads a binary PGM/PPM image as 32 float, scaled. Replaces
+ *             cv::imread followed by convertTo: there is a single pass over
+ *             the samples and no intermediate image.
+ *
+ * \param[in]  const std::string &f_name_str: Name of the file.
+ * \param[in]  const float f_scale_f: Factor applied to every sample (see
+ *             intensityScaleFactor).
+ * \param[out] cv::Mat &f_img: Output image, CV_32FC1 or CV_32FC3. Reused if
+ *             it already has the right size and type.
+ *
+ * \return     True if the image was read. False otherwise, also if the file is
+ *             not a binary PGM/PPM (no message in that case).
+ *************************************************************************** */
+bool readPnmImage( const std::string &f_name_str, const float f_scale_f, cv::Mat &f_img )
+{
+  return readPnm( f_name_str, false, f_scale_f, f_img );
+}
+
+/* *************************** FUNCTION ************************************ */
+/* readPnmImageNative
+ *
+ * \brief      Reads a binary PGM/PPM image in its native 8 or 16 bit type.
+ *
+ * \param[in]  const std::string &f_name_str: Name of the file.
+ * \param[out] cv::Mat &f_img: Output image, 8 or 16 bit unsigned, 1 or 3
+ *             channels. Reused if it already has the right size and type.
+ *
+ * \return     True if the image was read. False otherwise.
+ *************************************************************************** */
+bool readPnmImageNative( const std::string &f_name_str, cv::Mat &f_img )
+{
+  return readPnm( f_name_str, true, 1.f, f_img );
+}
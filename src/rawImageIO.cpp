@@ -1,14 +1,159 @@
 // Common includes
 #include <string>
 #include <typeinfo>
+#include <vector>
+#include <stdint.h>
 
 // Corresponding header
 #include "../h/rawImageIO.h"
 
-using std::cout;
+using std::cerr;
 using std::endl;
 using std::string;
 
+namespace
+{
+  /* *************************** FUNCTION ************************************ */
+  /* Lossless disparity codec
+   *
+   * \brief      Each value is handled as an unsigned integer code (the bits of
+   *             a float, or a 16-bit fixed point code) and predicted from its
+   *             left (a), upper (b) and upper-left (c) neighbours with the MED
+   *             predictor of LOCO-I: min(a,b) if c >= max(a,b), max(a,b) if
+   *             c <= min(a,b), a + b - c otherwise. First row: a; first
+   *             column: b. The residual (modulo 2^bits) is zigzag mapped, so
+   *             small negative residuals are small numbers.
+   *
+   *             Disparity maps are piecewise smooth and invalid regions are
+   *             constant, so most residuals are zero. The stream is a
+   *             sequence of pairs: varint( number of zero residuals ),
+   *             varint( next non-zero residual ). The pair after the last
+   *             non-zero residual has no residual. Varints are LEB128: 7 bits
+   *             per byte, high bit set if more bytes follow.
+   *************************************************************************** */
+  template<typename T>
+  inline T predictMED( const T f_a, const T f_b, const T f_c )
+  {
+    const T mn = f_a < f_b ? f_a : f_b;
+    const T mx = f_a < f_b ? f_b : f_a;
+    if( f_c >= mx ) return mn;
+    if( f_c <= mn ) return mx;
+    return static_cast<T>( f_a + f_b - f_c );
+  }
+
+  template<typename T>
+  inline T predictAt( const T* f_row_p, const T* f_up_p, const unsigned f_x_ui )
+  {
+    if( !f_up_p )
+    {
+      return f_x_ui ? f_row_p[ f_x_ui - 1 ] : 0;
+    }
+    if( !f_x_ui )
+    {
+      return f_up_p[ 0 ];
+    }
+    return predictMED( f_row_p[ f_x_ui - 1 ], f_up_p[ f_x_ui ], f_up_p[ f_x_ui - 1 ] );
+  }
+
+  // Coded data of the file being read or written. Kept per thread, so that
+  // reading the frames of a sequence reuses it
+  thread_local std::vector<uint8_t> t_coded;
+
+  inline void putVarint( std::vector<uint8_t> &f_out, uint64_t f_value )
+  {
+    while( f_value >= 0x80 )
+    {
+      f_out.push_back( static_cast<uint8_t>( f_value | 0x80 ) );
+      f_value >>= 7;
+    }
+    f_out.push_back( static_cast<uint8_t>( f_value ) );
+  }
+
+  inline bool getVarint( const uint8_t* &f_in_p, const uint8_t* f_end_p, uint64_t &f_value )
+  {
+    f_value = 0;
+    for( unsigned shift_ui = 0; f_in_p < f_end_p && shift_ui < 64; shift_ui += 7 )
+    {
+      const uint8_t byte = *f_in_p++;
+      f_value |= static_cast<uint64_t>( byte & 0x7F ) << shift_ui;
+      if( !( byte & 0x80 ) )
+      {
+	return true;
+      }
+    }
+    return false;
+  }
+
+  template<typename T>
+  void encodeCodes( const T* f_src_p, const unsigned f_width_ui, const unsigned f_height_ui,
+		    std::vector<uint8_t> &f_out )
+  {
+    const unsigned signShift_ui = sizeof( T ) * 8 - 1;
+    uint64_t run = 0;
+    for( unsigned y = 0; y < f_height_ui; ++y )
+    {
+      const T* row_p = f_src_p + static_cast<size_t>( y ) * f_width_ui;
+      const T* up_p  = y ? row_p - f_width_ui : nullptr;
+      for( unsigned x = 0; x < f_width_ui; ++x )
+      {
+	const T residual = static_cast<T>( row_p[ x ] - predictAt( row_p, up_p, x ) );
+	if( residual == 0 )
+	{
+	  ++run;
+	  continue;
+	}
+	// Zigzag: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+	const T zigzag = static_cast<T>( ( residual << 1 ) ^ 
+					 ( ( residual >> signShift_ui ) ? static_cast<T>( ~T( 0 ) ) : T( 0 ) ) );
+	putVarint( f_out, run );
+	putVarint( f_out, zigzag );
+	run = 0;
+      }
+    }
+    if( run )
+    {
+      putVarint( f_out, run );
+    }
+  }
+
+  template<typename T>
+  bool decodeCodes( const uint8_t* f_in_p, const uint8_t* f_end_p, 
+		    const unsigned f_width_ui, const unsigned f_height_ui, T* f_dst_p )
+  {
+    uint64_t run = 0;
+    bool     run_b = false;	// True once the current run has been read
+    for( unsigned y = 0; y < f_height_ui; ++y )
+    {
+      T*       row_p = f_dst_p + static_cast<size_t>( y ) * f_width_ui;
+      const T* up_p  = y ? row_p - f_width_ui : nullptr;
+      for( unsigned x = 0; x < f_width_ui; ++x )
+      {
+	if( !run_b )
+	{
+	  if( !getVarint( f_in_p, f_end_p, run ) ) return false;
+	  run_b = true;
+	}
+
+	const T prediction = predictAt( row_p, up_p, x );
+	if( run )
+	{
+	  row_p[ x ] = prediction;
+	  --run;
+	  continue;
+	}
+
+	uint64_t zigzag = 0;
+	if( !getVarint( f_in_p, f_end_p, zigzag ) ) return false;
+	const T code     = static_cast<T>( zigzag );
+	const T residual = static_cast<T>( ( code >> 1 ) ^ ( ( code & 1 ) ? static_cast<T>( ~T( 0 ) ) : T( 0 ) ) );
+	row_p[ x ] = static_cast<T>( prediction + residual );
+	run_b = false;
+      }
+    }
+    return true;
+  }
+}
+
 /*******************************************************************************/
 /***********************  Class CImageSize *************************************/
 // Constructors
@@ -18,13 +163,15 @@ CImageSize::CImageSize( )
 	  m_dataSize_ui(    10 ),
 	  m_pixelDepth_ui(   1 ),
 	  m_nChannels_ui(    1 ),
-	  m_maxValue_ui(  1023 )
+	  m_maxValue_ui(  1023 ),
+	  m_subpixelBits_ui( 0 )
 { 
 	
 }
 
 CImageSize::CImageSize( const int f_width_i, const int f_height_i, 
 			const int f_dataType_i, const int f_nChannels_i )
+  : m_subpixelBits_ui( 0 )
 { 
   setImage( f_width_i, f_height_i, f_dataType_i, f_nChannels_i); 
 }
@@ -43,7 +190,7 @@ bool CImageSize::setImage( const int f_width_i, const int f_height_i,
   // Error checking
   if ( f_width_i < 0 || f_height_i < 0 || f_dataType_i < 0 || f_nChannels_i < 0 )
   {
-    cout << "ERROR CImageSize::setImage: One of your input parameters is negative!!\n";
+    cerr << "ERROR CImageSize::setImage: One of your input parameters is negative!!\n";
     return false;
   }
 
@@ -59,8 +206,11 @@ bool CImageSize::setImage( const int f_width_i, const int f_height_i,
 
 void CImageSize::setDataSize()
 {
-  switch ( m_pixelDepth_ui )
+  switch ( getBaseDataType() )
   {
+    case IO_DATATYPE_16Q:
+      m_dataSize_ui = sizeof( unsigned short );
+      break;
     case IO_DATATYPE_32F:
       m_dataSize_ui = sizeof( float );
       break;
@@ -116,7 +266,7 @@ char* CRawImageIO::loadRawDataImage( const std::string &f_fileInName_s, CImageSi
   // Error checking
   if ( !fileIn )
   {
-    cout << "ERROR CRawImageIO::loadRawDataImage: Cannot open the input file: " 
+    cerr << "ERROR CRawImageIO::loadRawDataImage: Cannot open the input file: " 
 	 << f_fileInName_s.c_str() << endl;
     return nullptr;
   }
@@ -134,7 +284,7 @@ char* CRawImageIO::loadRawDataImage( const std::string &f_fileInName_s, CImageSi
   // Read image data
   if ( !readData( fileIn, outImage_p, f_imageSize ) )
   {
-    cout << "ERROR CRawImageIO::loadRawDataImage: input file's image data is incorrect!\n";
+    cerr << "ERROR CRawImageIO::loadRawDataImage: input file's image data is incorrect!\n";
     delete[] outImage_p;
     fileIn.close();
     return nullptr;
@@ -153,7 +303,7 @@ bool CRawImageIO::loadRawDataImage( const std::string &f_fileInName_s,
   // Error checking
   if ( !fileIn )
     {
-      cout << "ERROR CRawImageIO::loadRawDataImage: Cannot open the input file: " 
+      cerr << "ERROR CRawImageIO::loadRawDataImage: Cannot open the input file: " 
 	   << f_fileInName_s.c_str() << endl;
       return false;
     }
@@ -172,7 +322,7 @@ bool CRawImageIO::loadRawDataImage( const std::string &f_fileInName_s,
       // Read the ground truth data
       if ( !readData( fileIn, f_imageData_p, f_imageSize ) )
 	{
-	  cout << "ERROR CRawImageIO::loadRawDataImage: input file's image data not correct!\n";
+	  cerr << "ERROR CRawImageIO::loadRawDataImage: input file's image data not correct!\n";
 	  fileIn.close();
 	  return false;
 	}
@@ -184,7 +334,7 @@ bool CRawImageIO::loadRawDataImage( const std::string &f_fileInName_s,
     }
   else
     {
-      cout << "ERROR CRawImageIO::loadRawDataImage: input image does not match input file!" << endl;
+      cerr << "ERROR CRawImageIO::loadRawDataImage: input image does not match input file!" << endl;
       fileIn.close();
       return false;
     }
@@ -200,7 +350,7 @@ bool CRawImageIO::writeRawDataImage( const std::string &f_fileOutName_s,
 
   if ( !fileOut.is_open() )
   {
-    cout << "ERROR CRawImageIO::writeRawData: Cannot open the file: " 
+    cerr << "ERROR CRawImageIO::writeRawData: Cannot open the file: " 
 	      << f_fileOutName_s.c_str() << endl;
     return false;
   }
@@ -211,7 +361,7 @@ bool CRawImageIO::writeRawDataImage( const std::string &f_fileOutName_s,
   // Write data ito file
   if ( !writeData( fileOut, f_imageSize, f_imageData_p) )
   {
-    cout << "ERROR CRawImageIO::writeRawData: Output file failed to write!\n";
+    cerr << "ERROR CRawImageIO::writeRawData: Output file failed to write!\n";
     fileOut.close();
     return false;
   }
@@ -231,19 +381,33 @@ void CRawImageIO::writeRawDataHeader( std::ofstream& f_fileOut, CImageSize & f_i
   }
 
   f_fileOut << "# width height DataType(";
-  f_fileOut << writeDataType( f_imageSize ) << ")\n";
+  f_fileOut << writeDataType( f_imageSize ) << ")";
+
+  // The fixed point type also needs the number of fractional bits. Readers
+  // that do not know it ignore the rest of the line
+  if( f_imageSize.getBaseDataType() == IO_DATATYPE_16Q )
+  {
+    f_fileOut << " SubpixelBits";
+  }
+  f_fileOut << "\n";
+
   f_fileOut << f_imageSize.m_width_ui << " " 
 	    << f_imageSize.m_height_ui << " " 
-	    << f_imageSize.m_pixelDepth_ui << "\n";
+	    << f_imageSize.m_pixelDepth_ui;
+  if( f_imageSize.getBaseDataType() == IO_DATATYPE_16Q )
+  {
+    f_fileOut << " " << f_imageSize.m_subpixelBits_ui;
+  }
+  f_fileOut << "\n";
 }
 
 bool CRawImageIO::loadRawDataFileHeader( std::ifstream& f_fileIn, CImageSize& f_imageSize )
 {
-  int width_i, height_i, dataType_i;
+  int width_i, height_i, dataType_i, subpixelBits_i = 0;
 
-  if( !readRawDataHeader( f_fileIn, width_i, height_i, dataType_i ) )
+  if( !readRawDataHeader( f_fileIn, width_i, height_i, dataType_i, &subpixelBits_i ) )
     {
-      cout << "ERROR CRawImageIO::loadRawData: Cannot read header of input file!\n";
+      cerr << "ERROR CRawImageIO::loadRawData: Cannot read header of input file!\n";
       return false;
     }
 
@@ -255,19 +419,27 @@ bool CRawImageIO::loadRawDataFileHeader( std::ifstream& f_fileIn, CImageSize& f_
   const char* temp_p = writeDataType( dataType_i );
   if ( temp_p == nullptr )
     {
-      cout << "ERROR CRawImageIO::loadRawData: datatype not supported!\n";
+      cerr << "ERROR CRawImageIO::loadRawData: datatype not supported!\n";
       delete[] temp_p;
       return false;
     }
 
+  if( subpixelBits_i < 0 || subpixelBits_i > 15 )
+    {
+      cerr << "ERROR CRawImageIO::loadRawData: invalid number of subpixel bits!\n";
+      return false;
+    }
+
   f_imageSize.setImage( width_i, height_i, dataType_i );
+  f_imageSize.m_subpixelBits_ui = 
+    ( f_imageSize.getBaseDataType() == IO_DATATYPE_16Q ) ? subpixelBits_i : 0;
 	
   return true;
 }
 
 // Read the Raw Data Header
 bool CRawImageIO::readRawDataHeader( std::ifstream& f_fileIn, int& f_xsize_i, int& f_ysize_i, 
-				     int& f_dataType_i  )
+				     int& f_dataType_i, int* f_subpixelBits_p )
 {
   // Set up reading parameters
   int count_i;
@@ -327,6 +499,17 @@ bool CRawImageIO::readRawDataHeader( std::ifstream& f_fileIn, int& f_xsize_i, in
 	  {
 	    continue;
 	  }
+
+	// Optional number of subpixel bits, on the same line
+	int subpixelBits_i = 0;
+	if ( sscanf ( next_p, "%d", &subpixelBits_i ) != 1 )
+	  {
+	    subpixelBits_i = 0;
+	  }
+	if ( f_subpixelBits_p )
+	  {
+	    *f_subpixelBits_p = subpixelBits_i;
+	  }
 	break;
       }
   }
@@ -338,12 +521,17 @@ bool CRawImageIO::readRawDataHeader( std::ifstream& f_fileIn, int& f_xsize_i, in
 // Read 2D data from file
 bool CRawImageIO::readData( std::ifstream& f_fileIn, char* src_p, CImageSize& f_imageSize )
 {
+  if( f_imageSize.isCompressed() )
+  {
+    return readCompressedData( f_fileIn, src_p, f_imageSize );
+  }
+
   // Read data
   f_fileIn.read( src_p, f_imageSize.getNumberBytes() );
   // Check for errors
   if( f_fileIn.eof() )
   {
-    cout << "Error CRawImageIO::readData: Something is wrong with the input file!\n";
+    cerr << "Error CRawImageIO::readData: Something is wrong with the input file!\n";
     return false;
   }
   return true;
@@ -354,6 +542,11 @@ bool CRawImageIO::readData( std::ifstream& f_fileIn, char* src_p, CImageSize& f_
 bool CRawImageIO::writeData( std::ofstream& f_fileOut, const CImageSize& f_imageSize,
 			     char* f_src_p )
 {
+  if( f_imageSize.isCompressed() )
+  {
+    return writeCompressedData( f_fileOut, f_imageSize, f_src_p );
+  }
+
   //printf("num of bytes=%i\n", f_imageSize.getNumberBytes()  ); 
   // Write data
   f_fileOut.write( f_src_p, f_imageSize.getNumberBytes() );
@@ -361,7 +554,92 @@ bool CRawImageIO::writeData( std::ofstream& f_fileOut, const CImageSize& f_image
   // Check for errors
   if( f_fileOut.eof() )
   {
-    cout << "ERROR CRawImageIO::writeData: Error writing data!\n";
+    cerr << "ERROR CRawImageIO::writeData: Error writing data!\n";
+    return false;
+  }
+
+  return true;
+}
+
+// Read 2D data coded with the lossless disparity codec
+bool CRawImageIO::readCompressedData( std::ifstream& f_fileIn, char* f_dst_p,
+				      const CImageSize& f_imageSize )
+{
+  uint64_t numBytes = 0;
+  f_fileIn.read( reinterpret_cast<char*>( &numBytes ), sizeof( numBytes ) );
+  // A value is never coded with more than 2 varints of 10 bytes
+  if( !f_fileIn || numBytes > 20ull * f_imageSize.getNumberElements() + 10 )
+  {
+    cerr << "ERROR CRawImageIO::readCompressedData: Invalid coded data size!\n";
+    return false;
+  }
+
+  std::vector<uint8_t> &coded = t_coded;
+  coded.resize( numBytes );
+  f_fileIn.read( reinterpret_cast<char*>( coded.data() ), numBytes );
+  if( static_cast<uint64_t>( f_fileIn.gcount() ) != numBytes )
+  {
+    cerr << "ERROR CRawImageIO::readCompressedData: The coded data is truncated!\n";
+    return false;
+  }
+
+  const uint8_t* begin_p = coded.data();
+  const uint8_t* end_p   = begin_p + coded.size();
+  const unsigned width_ui = f_imageSize.m_width_ui * f_imageSize.m_nChannels_ui;
+  bool ok_b = false;
+  switch( f_imageSize.getBaseDataType() )
+  {
+    case IO_DATATYPE_16Q:
+      ok_b = decodeCodes( begin_p, end_p, width_ui, f_imageSize.m_height_ui,
+			  reinterpret_cast<uint16_t*>( f_dst_p ) );
+      break;
+    case IO_DATATYPE_32F:
+      ok_b = decodeCodes( begin_p, end_p, width_ui, f_imageSize.m_height_ui,
+			  reinterpret_cast<uint32_t*>( f_dst_p ) );
+      break;
+    default:
+      break;
+  }
+
+  if( !ok_b )
+  {
+    cerr << "ERROR CRawImageIO::readCompressedData: Corrupted coded data!\n";
+  }
+  return ok_b;
+}
+
+// Write 2D data with the lossless disparity codec
+bool CRawImageIO::writeCompressedData( std::ofstream& f_fileOut, const CImageSize& f_imageSize,
+				       const char* f_src_p )
+{
+  std::vector<uint8_t> &coded = t_coded;
+  coded.clear();
+  coded.reserve( f_imageSize.getNumberBytes() / 4 );
+
+  const unsigned width_ui = f_imageSize.m_width_ui * f_imageSize.m_nChannels_ui;
+  switch( f_imageSize.getBaseDataType() )
+  {
+    case IO_DATATYPE_16Q:
+      encodeCodes( reinterpret_cast<const uint16_t*>( f_src_p ), width_ui, 
+		   f_imageSize.m_height_ui, coded );
+      break;
+    case IO_DATATYPE_32F:
+      encodeCodes( reinterpret_cast<const uint32_t*>( f_src_p ), width_ui, 
+		   f_imageSize.m_height_ui, coded );
+      break;
+    default:
+      cerr << "ERROR CRawImageIO::writeCompressedData: Only 16-bit fixed point and 32 float "
+	   << "data can be compressed!\n";
+      return false;
+  }
+
+  const uint64_t numBytes = coded.size();
+  f_fileOut.write( reinterpret_cast<const char*>( &numBytes ), sizeof( numBytes ) );
+  f_fileOut.write( reinterpret_cast<const char*>( coded.data() ), coded.size() );
+
+  if( !f_fileOut.good() )
+  {
+    cerr << "ERROR CRawImageIO::writeCompressedData: Error writing data!\n";
     return false;
   }
 
@@ -373,12 +651,19 @@ const char * CRawImageIO::writeDataType( const int f_dataType_i )
   // the break statements are redundant
   switch( f_dataType_i )
   {
+  case IO_DATATYPE_16Q:
+    return typeid(unsigned short).name();
+    break;
   case IO_DATATYPE_32F:
     return typeid(float).name();
     break;
   case IO_DATATYPE_64F:
     return typeid(double).name();
     break;
+  case IO_DATATYPE_COMPRESSED + IO_DATATYPE_16Q:
+  case IO_DATATYPE_COMPRESSED + IO_DATATYPE_32F:
+    return writeDataType( f_dataType_i - IO_DATATYPE_COMPRESSED );
+    break;
   default:
     return nullptr;
   }
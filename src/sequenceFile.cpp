@@ -0,0 +1,438 @@
+/* ******************************** FILE *********************************** */
+/** \file    sequenceFile.cpp
+ *
+ *  \brief   Definition of the classes CSequenceWriter and CSequenceReader.
+ *
+ *  \note    .enpeda.. Project, The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/sequenceFile.h"
+
+// Common includes
+#include <iostream>
+#include <climits>
+#include <cstring>
+#include <limits>
+
+using std::cerr;
+using std::endl;
+
+namespace
+{
+  // Bytes of an image of a stream (see isValidStream)
+  size_t payloadSize( const SSequenceStream &f_stream )
+  {
+    return static_cast<size_t>( f_stream.m_width_ui ) * f_stream.m_height_ui *
+      CV_ELEM_SIZE( f_stream.m_type_i );
+  }
+
+  // True if the type of the stream is a standard OpenCV type (1 to 4
+  // channels) and its images fit a cv::Mat and have at most f_maxBytes
+  // bytes. payloadSize does not overflow for a valid stream
+  bool isValidStream( const SSequenceStream &f_stream, const size_t f_maxBytes )
+  {
+    const int type_i = f_stream.m_type_i;
+    if( type_i < 0 || type_i != CV_MAKETYPE( CV_MAT_DEPTH( type_i ), CV_MAT_CN( type_i ) ) ||
+	CV_MAT_DEPTH( type_i ) > CV_64F || CV_MAT_CN( type_i ) > 4 )
+    {
+      return false;
+    }
+
+    if( f_stream.m_width_ui == 0 || f_stream.m_height_ui == 0 ||
+	f_stream.m_width_ui > INT_MAX || f_stream.m_height_ui > INT_MAX )
+    {
+      return false;
+    }
+
+    const size_t rowBytes = CV_ELEM_SIZE( type_i );
+    return f_stream.m_width_ui <= f_maxBytes / rowBytes &&
+      f_stream.m_height_ui <= f_maxBytes / ( rowBytes * f_stream.m_width_ui );
+  }
+}
+
+/*******************************************************************************/
+/***********************  Class CSequenceWriter ********************************/
+CSequenceWriter::CSequenceWriter()
+  : m_file( ),
+    m_streams( ),
+    m_numFrames_ui( 0 ),
+    m_offsets( )
+{
+  /* Empty body */
+}
+
+CSequenceWriter::~CSequenceWriter()
+{
+  close();
+}
+
+/* *************************** METHOD ************************************** */
+/* open
+ *
+ * \brief      Creates the file and writes a provisional header (no frames)
+ *             and the stream descriptors. The header is rewritten by close.
+ *
+ * \param[in]  const std::string &f_fileName_str: Name of the file.
+ * \param[in]  const std::vector<SSequenceStream> &f_streams: Streams.
+ *
+ * \return     True if the file was created. False otherwise.
+ *************************************************************************** */
+bool CSequenceWriter::open( const std::string &f_fileName_str,
+			    const std::vector<SSequenceStream> &f_streams )
+{
+  close();
+
+  if( f_streams.empty() )
+  {
+    cerr << "ERROR CSequenceWriter::open: At least one stream is needed!\n";
+    return false;
+  }
+
+  for( size_t s = 0; s < f_streams.size(); ++s )
+  {
+    if( !isValidStream( f_streams[ s ], std::numeric_limits<size_t>::max() ) ||
+	f_streams[ s ].m_name_str.size() >= SEQUENCE_NAME_SIZE )
+    {
+      cerr << "ERROR CSequenceWriter::open: Invalid stream " << s << "!\n";
+      return false;
+    }
+  }
+
+  m_file.open( f_fileName_str.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+  if( !m_file.is_open() )
+  {
+    cerr << "ERROR CSequenceWriter::open: Cannot open the file: " << f_fileName_str << endl;
+    return false;
+  }
+
+  m_streams      = f_streams;
+  m_numFrames_ui = 0;
+  m_offsets.clear();
+
+  if( !writeHeader( 0, 0 ) )
+  {
+    m_file.close();
+    return false;
+  }
+
+  for( size_t s = 0; s < m_streams.size(); ++s )
+  {
+    SSequenceStreamDesc desc;
+    memset( &desc, 0, sizeof( desc ) );
+    strncpy( desc.m_name, m_streams[ s ].m_name_str.c_str(), SEQUENCE_NAME_SIZE - 1 );
+    desc.m_type           = m_streams[ s ].m_type_i;
+    desc.m_width          = m_streams[ s ].m_width_ui;
+    desc.m_height         = m_streams[ s ].m_height_ui;
+    desc.m_subpixelBits   = m_streams[ s ].m_subpixelBits_ui;
+    desc.m_intensityScale = m_streams[ s ].m_intensityScale_f;
+    m_file.write( reinterpret_cast<const char*>( &desc ), sizeof( desc ) );
+  }
+
+  return m_file.good();
+}
+
+/* *************************** METHOD ************************************** */
+/* addFrame
+ *
+ * \brief      Appends one image per stream. Each payload starts at an
+ *             aligned offset, so the reader can map it as a cv::Mat of any
+ *             pixel type (and SIMD loads of the first row are aligned).
+ *
+ * \param[in]  const std::vector<cv::Mat> &f_images: Images, in the order of
+ *             the streams. Their type and size must match the streams.
+ *
+ * \return     True if the frame was written. False otherwise.
+ *************************************************************************** */
+bool CSequenceWriter::addFrame( const std::vector<cv::Mat> &f_images )
+{
+  if( !m_file.is_open() )
+  {
+    cerr << "ERROR CSequenceWriter::addFrame: The file is not open!\n";
+    return false;
+  }
+
+  if( f_images.size() != m_streams.size() )
+  {
+    cerr << "ERROR CSequenceWriter::addFrame: One image per stream is needed!\n";
+    return false;
+  }
+
+  for( size_t s = 0; s < m_streams.size(); ++s )
+  {
+    const SSequenceStream &stream = m_streams[ s ];
+    if( f_images[ s ].type() != stream.m_type_i ||
+	f_images[ s ].cols != static_cast<int>( stream.m_width_ui ) ||
+	f_images[ s ].rows != static_cast<int>( stream.m_height_ui ) )
+    {
+      cerr << "ERROR CSequenceWriter::addFrame: The image of stream " << stream.m_name_str
+	   << " does not match its type or size!\n";
+      return false;
+    }
+  }
+
+  for( size_t s = 0; s < m_streams.size(); ++s )
+  {
+    align();
+    m_offsets.push_back( static_cast<uint64_t>( m_file.tellp() ) );
+
+    const cv::Mat &img      = f_images[ s ];
+    const size_t   rowBytes = img.cols * img.elemSize();
+    for( int y = 0; y < img.rows; ++y )
+    {
+      m_file.write( reinterpret_cast<const char*>( img.ptr( y ) ), rowBytes );
+    }
+  }
+
+  if( !m_file.good() )
+  {
+    cerr << "ERROR CSequenceWriter::addFrame: Error writing the frame!\n";
+    return false;
+  }
+
+  ++m_numFrames_ui;
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* close
+ *
+ * \brief      Writes the index after the last payload and rewrites the
+ *             header with the number of frames and the position of the index.
+ *
+ * \return     True if the file was completed. False otherwise (or if it was
+ *             not open).
+ *************************************************************************** */
+bool CSequenceWriter::close()
+{
+  if( !m_file.is_open() )
+  {
+    return false;
+  }
+
+  align();
+  const uint64_t indexOffset = static_cast<uint64_t>( m_file.tellp() );
+  if( !m_offsets.empty() )
+  {
+    m_file.write( reinterpret_cast<const char*>( &m_offsets[ 0 ] ),
+		  m_offsets.size() * sizeof( uint64_t ) );
+  }
+
+  m_file.seekp( 0 );
+  const bool ok_b = writeHeader( m_numFrames_ui, indexOffset ) && m_file.good();
+  m_file.close();
+
+  if( !ok_b )
+  {
+    cerr << "ERROR CSequenceWriter::close: Error writing the index!\n";
+  }
+
+  return ok_b;
+}
+
+void CSequenceWriter::align()
+{
+  static const char zeros_p[ SEQUENCE_ALIGNMENT ] = { 0 };
+  const uint64_t position = static_cast<uint64_t>( m_file.tellp() );
+  const uint64_t padding  = ( SEQUENCE_ALIGNMENT - position % SEQUENCE_ALIGNMENT ) % SEQUENCE_ALIGNMENT;
+  m_file.write( zeros_p, padding );
+}
+
+bool CSequenceWriter::writeHeader( const uint64_t f_numFrames, const uint64_t f_indexOffset )
+{
+  SSequenceFileHeader header;
+  memset( &header, 0, sizeof( header ) );
+  strncpy( header.m_magic, SEQUENCE_MAGIC, sizeof( header.m_magic ) );
+  header.m_version     = SEQUENCE_VERSION;
+  header.m_byteOrder   = SEQUENCE_BYTE_ORDER;
+  header.m_numStreams  = static_cast<uint32_t>( m_streams.size() );
+  header.m_alignment   = SEQUENCE_ALIGNMENT;
+  header.m_numFrames   = f_numFrames;
+  header.m_indexOffset = f_indexOffset;
+
+  m_file.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+  return m_file.good();
+}
+
+/*******************************************************************************/
+/***********************  Class CSequenceReader ********************************/
+CSequenceReader::CSequenceReader()
+  : m_file( ),
+    m_streams( ),
+    m_numFrames_ui( 0 ),
+    m_index_p( nullptr )
+{
+  /* Empty body */
+}
+
+CSequenceReader::~CSequenceReader()
+{
+  close();
+}
+
+/* *************************** METHOD ************************************** */
+/* open
+ *
+ * \brief      Maps the file and reads the header and the stream descriptors.
+ *             The whole index is checked here (every payload must be within
+ *             the file and aligned), so getFrame only does a lookup.
+ *
+ * \param[in]  const std::string &f_fileName_str: Name of the file.
+ *
+ * \return     True if the file is a valid sequence. False otherwise.
+ *************************************************************************** */
+bool CSequenceReader::open( const std::string &f_fileName_str )
+{
+  close();
+
+  if( !m_file.open( f_fileName_str ) )
+  {
+    return false;
+  }
+
+  const char*  data_p = m_file.getData();
+  const size_t size   = m_file.getSize();
+
+  SSequenceFileHeader header;
+  if( size < sizeof( header ) )
+  {
+    cerr << "ERROR CSequenceReader::open: The file is too short: " << f_fileName_str << endl;
+    close();
+    return false;
+  }
+  memcpy( &header, data_p, sizeof( header ) );
+
+  if( strncmp( header.m_magic, SEQUENCE_MAGIC, sizeof( header.m_magic ) ) != 0 ||
+      header.m_version != SEQUENCE_VERSION )
+  {
+    cerr << "ERROR CSequenceReader::open: Not a sequence file (or unknown version): "
+	 << f_fileName_str << endl;
+    close();
+    return false;
+  }
+
+  if( header.m_byteOrder != SEQUENCE_BYTE_ORDER )
+  {
+    cerr << "ERROR CSequenceReader::open: The file was written with another byte order!\n";
+    close();
+    return false;
+  }
+
+  // The counts come from the file: compare by division or against the
+  // room left, so that no product or sum can wrap around
+  const size_t maxStreams = ( size - sizeof( header ) ) / sizeof( SSequenceStreamDesc );
+  if( header.m_numStreams == 0 || header.m_numStreams > maxStreams ||
+      header.m_numFrames > UINT_MAX ||
+      header.m_indexOffset % sizeof( uint64_t ) != 0 || header.m_indexOffset > size ||
+      header.m_numFrames > ( size - header.m_indexOffset ) /
+			   ( header.m_numStreams * sizeof( uint64_t ) ) )
+  {
+    cerr << "ERROR CSequenceReader::open: Corrupted header or index (was the packer "
+	 << "interrupted?): " << f_fileName_str << endl;
+    close();
+    return false;
+  }
+
+  m_streams.resize( header.m_numStreams );
+  for( size_t s = 0; s < m_streams.size(); ++s )
+  {
+    SSequenceStreamDesc desc;
+    memcpy( &desc, data_p + sizeof( header ) + s * sizeof( desc ), sizeof( desc ) );
+    desc.m_name[ SEQUENCE_NAME_SIZE - 1 ] = '\0';
+
+    m_streams[ s ].m_name_str         = desc.m_name;
+    m_streams[ s ].m_type_i           = desc.m_type;
+    m_streams[ s ].m_width_ui         = desc.m_width;
+    m_streams[ s ].m_height_ui        = desc.m_height;
+    m_streams[ s ].m_subpixelBits_ui  = desc.m_subpixelBits;
+    m_streams[ s ].m_intensityScale_f = desc.m_intensityScale;
+
+    if( !isValidStream( m_streams[ s ], size ) )
+    {
+      cerr << "ERROR CSequenceReader::open: Invalid descriptor of stream " << s << ": "
+	   << f_fileName_str << endl;
+      close();
+      return false;
+    }
+  }
+
+  m_index_p      = reinterpret_cast<const uint64_t*>( data_p + header.m_indexOffset );
+  m_numFrames_ui = static_cast<unsigned>( header.m_numFrames );
+
+  for( unsigned f = 0; f < m_numFrames_ui; ++f )
+  {
+    for( size_t s = 0; s < m_streams.size(); ++s )
+    {
+      const uint64_t offset = m_index_p[ f * m_streams.size() + s ];
+      if( offset % SEQUENCE_ALIGNMENT != 0 || offset > size ||
+	  payloadSize( m_streams[ s ] ) > size - offset )
+      {
+	cerr << "ERROR CSequenceReader::open: Corrupted index entry for frame " << f << endl;
+	close();
+	return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+void CSequenceReader::close()
+{
+  m_file.close();
+  m_streams.clear();
+  m_numFrames_ui = 0;
+  m_index_p      = nullptr;
+}
+
+int CSequenceReader::findStream( const std::string &f_name_str ) const
+{
+  for( size_t s = 0; s < m_streams.size(); ++s )
+  {
+    if( m_streams[ s ].m_name_str == f_name_str )
+    {
+      return static_cast<int>( s );
+    }
+  }
+  return -1;
+}
+
+/* *************************** METHOD ************************************** */
+/* getFrame
+ *
+ * \brief      Returns the image of a stream in a frame, as a cv::Mat header
+ *             pointing into the mapped file. Only the pages touched by the
+ *             caller are read.
+ *
+ * \param[in]  const unsigned f_frame_ui: Frame index.
+ * \param[in]  const unsigned f_stream_ui: Stream index.
+ *
+ * \return     The image. Empty if the indices are out of range.
+ *************************************************************************** */
+cv::Mat CSequenceReader::getFrame( const unsigned f_frame_ui, const unsigned f_stream_ui ) const
+{
+  if( f_frame_ui >= m_numFrames_ui || f_stream_ui >= m_streams.size() )
+  {
+    cerr << "ERROR CSequenceReader::getFrame: Frame " << f_frame_ui << " or stream "
+	 << f_stream_ui << " out of range!\n";
+    return cv::Mat();
+  }
+
+  const SSequenceStream &stream = m_streams[ f_stream_ui ];
+  return m_file.getMat( m_index_p[ f_frame_ui * m_streams.size() + f_stream_ui ],
+			stream.m_height_ui, stream.m_width_ui, stream.m_type_i );
+}
+
+bool CSequenceReader::getFrame( const unsigned f_frame_ui, std::vector<cv::Mat> &f_images ) const
+{
+  f_images.resize( m_streams.size() );
+  for( unsigned s = 0; s < m_streams.size(); ++s )
+  {
+    f_images[ s ] = getFrame( f_frame_ui, s );
+    if( f_images[ s ].empty() )
+    {
+      return false;
+    }
+  }
+  return true;
+}
@@ -10,13 +10,24 @@
  *************************************************************************** */
 // Corresponding header
 #include "../h/thirdeye.h"
+#include "../h/rawImageIO.h"
+#include "../h/imagePool.h"
+#include "../h/thirdeyeParallel.h"
 
 // Common includes
+#include <algorithm>
 #include <iostream>
 
+using std::cerr;
 using std::cout;
 using std::endl;
 
+namespace
+{
+  // Rows of the base image whose positions are computed by each parallel task
+  const unsigned ROW_BLOCK_UI = 16;
+}
+
 /* *************************** METHOD ************************************** */
 /* Standard constructor.
  *
@@ -32,7 +43,10 @@ CThirdEye::CThirdEye( )
     m_params_b( false ),
 
     m_background_f( 127.f ),
-    m_invalid_f( -1.f )
+    m_invalid_f( -1.f ),
+    m_intensityScale_f( 1.f ),
+    m_subpixelBits_ui( 0 ),
+    m_numThreads_ui( 0 )
 {
   /* Empty body */
 }
@@ -57,7 +71,10 @@ CThirdEye::CThirdEye( const SThirdEyeParams &f_params )
      
      m_background_f( 127.f ),
      
-     m_invalid_f( -1.f )
+     m_invalid_f( -1.f ),
+     m_intensityScale_f( 1.f ),
+     m_subpixelBits_ui( 0 ),
+    m_numThreads_ui( 0 )
 {
   /* Empty body */
 }
@@ -100,113 +117,294 @@ CThirdEye::~CThirdEye()
  *************************************************************************** */
 bool CThirdEye::generateVirtualImage( const cv::Mat f_disparityMap, 
 				      const cv::Mat f_baseImg,
-				      cv::Mat &f_virtualImg )
+				      cv::Mat &f_virtualImg ) const
+{
+  cv::Mat sourceDisparity;
+  return generateVirtualImage( f_disparityMap, f_baseImg, f_virtualImg, sourceDisparity );
+}
+
+/* *************************** METHOD ************************************** */
+/* createVirtualView (overloaded)
+ *
+ * \brief      Same as the above method, but it also returns the disparity
+ *             that won each position of the virtual image. It is the image
+ *             used to solve the case when two "pixels" are mapped into the
+ *             same position, so it comes at no extra cost.
+ *
+ * \param[in]  const cv::Mat f_disparityMap: Input disparity map, 32 float or
+ *             16-bit fixed point (see setSubpixelBits).
+ * \param[in]  const cv::Mat f_baseImg: Base image of the stareo pair.
+ * \param[out] cv::Mat &f_virtualImg: Generated virtual image.
+ * \param[out] cv::Mat &f_sourceDisparity: Disparity of the "pixel" mapped into
+ *             each position of the virtual image (32 float). Positions where
+ *             nothing was mapped are set to -1.
+ *
+ * \return     True, if the virtual image was succesfully generated. False
+ *             otherwise.
+ *************************************************************************** */
+bool CThirdEye::generateVirtualImage( const cv::Mat f_disparityMap, 
+				      const cv::Mat f_baseImg,
+				      cv::Mat &f_virtualImg,
+				      cv::Mat &f_sourceDisparity ) const
 {	
   if ( f_disparityMap.empty() || f_baseImg.empty() )
   {
-    cout << "ERROR CThirdEye::generateVirtualImage: No enough input data!\n";
+    cerr << "ERROR CThirdEye::generateVirtualImage: No enough input data!\n";
     return false;
   }
   
   if ( !m_params_b )
   {
-    cout << "ERROR CThirdEye::generateVirtualImage: Set up first the transformation parameters!\n";
+    cerr << "ERROR CThirdEye::generateVirtualImage: Set up first the transformation parameters!\n";
+    return false;
+  }
+
+  if( f_baseImg.type() != CV_8UC1 && f_baseImg.type() != CV_16UC1 && f_baseImg.type() != CV_32FC1 )
+  {
+    cerr << "ERROR CThirdEye::generateVirtualImage: The base image must be an 8 bit, 16 bit or 32 float one!\n";
+    return false;
+  }
+
+  if( f_disparityMap.type() != CV_32FC1 && f_disparityMap.type() != CV_16UC1 )
+  {
+    cerr << "ERROR CThirdEye::generateVirtualImage: The disparity map must be a 32 float or 16-bit fixed point one!\n";
     return false;
   }
 
+  // The pixel and disparity types are template parameters of the warp, so the
+  // virtual image keeps the type of the base image and fixed point
+  // disparities are decoded on the fly (no conversion)
+  const bool fixedPoint_b = ( f_disparityMap.type() == CV_16UC1 );
+  switch( f_baseImg.depth() )
+  {
+    case CV_8U:
+      if( fixedPoint_b ) warp<uchar, ushort>( f_disparityMap, f_baseImg, f_virtualImg, f_sourceDisparity );
+      else               warp<uchar, float>(  f_disparityMap, f_baseImg, f_virtualImg, f_sourceDisparity );
+    break;
+    case CV_16U:
+      if( fixedPoint_b ) warp<ushort, ushort>( f_disparityMap, f_baseImg, f_virtualImg, f_sourceDisparity );
+      else               warp<ushort, float>(  f_disparityMap, f_baseImg, f_virtualImg, f_sourceDisparity );
+    break;
+    default:
+      if( fixedPoint_b ) warp<float, ushort>( f_disparityMap, f_baseImg, f_virtualImg, f_sourceDisparity );
+      else               warp<float, float>(  f_disparityMap, f_baseImg, f_virtualImg, f_sourceDisparity );
+    break;
+  }
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* readDisparity
+ *
+ * \brief      Reads the disparity at (x,y) of a map of type D. For float, 
+ *             invalid disparities are those equal to the invalid value. For
+ *             ushort (16-bit fixed point), the invalid code is IO_16Q_INVALID
+ *             and any other code v stands for v / 2^subpixelBits.
+ *
+ * \return     True if the disparity is valid.
+ *************************************************************************** */
+template<>
+inline bool CThirdEye::readDisparity<float>( const cv::Mat &f_disparityMap, const int f_y_i, 
+					     const int f_x_i, float &f_disparity_f ) const
+{
+  f_disparity_f = f_disparityMap.ptr<float>( f_y_i )[ f_x_i ];
+  return f_disparity_f != m_invalid_f;
+}
+
+template<>
+inline bool CThirdEye::readDisparity<ushort>( const cv::Mat &f_disparityMap, const int f_y_i, 
+					      const int f_x_i, float &f_disparity_f ) const
+{
+  const ushort code = f_disparityMap.ptr<ushort>( f_y_i )[ f_x_i ];
+  f_disparity_f = static_cast<float>( code ) / static_cast<float>( 1u << m_subpixelBits_ui );
+  return code != IO_16Q_INVALID;
+}
+
+/* *************************** METHOD ************************************** */
+/* warp
+ *
+ * \brief      Core of generateVirtualImage, for a base image of pixel type T
+ *             (uchar, ushort or float) and a disparity map of type D (float or
+ *             16-bit fixed point). The background of the virtual image is
+ *             127 in [0,255] units, i.e. 127 / scale in the units of T.
+ *
+ * \param[in]  const cv::Mat f_disparityMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image of the stareo pair.
+ * \param[out] cv::Mat &f_virtualImg: Generated virtual image.
+ * \param[out] cv::Mat &f_sourceDisparity: Disparity that won each position.
+ *
+ * \return     -
+ *************************************************************************** */
+template<typename T, typename D>
+void CThirdEye::warp( const cv::Mat f_disparityMap, const cv::Mat f_baseImg,
+		      cv::Mat &f_virtualImg, cv::Mat &f_sourceDisparity ) const
+{
   // Reallocate the virtual image, just in case
-  f_virtualImg.create( f_baseImg.size(), f_baseImg.type() );
-  f_virtualImg.setTo( m_background_f );
+  imagePool().create( f_virtualImg, f_baseImg.size(), f_baseImg.type() );
+  f_virtualImg.setTo( cv::saturate_cast<T>( m_background_f / m_intensityScale_f ) );
 
-  // Use this 2-channel image to solve the problem when two positions (wrt the base image)
+  // Use this image to solve the problem when two positions (wrt the base image)
   // are mapped in the same position in the virtual image. The intensity in the virtual image
   // will be that with corresponding larger disparity. I.e., that of the 3D point closer to
-  // the camera.
+  // the camera. The intensity of the kept point is the one already in the virtual image.
   const float free_f = -1.f;
-  cv::Mat hold( f_baseImg.size(), CV_32FC2, cv::Scalar( free_f )  );
+  imagePool().create( f_sourceDisparity, f_baseImg.size(), CV_32FC1 );
+  f_sourceDisparity.setTo( free_f );
   
-  // Compute the virtual image
-  for ( unsigned y = 0; y < static_cast<unsigned>( f_baseImg.rows ); ++y ) 
-  {	
-    for ( unsigned x = 0; x < static_cast<unsigned>( f_baseImg.cols ); ++x )  
+  // Positions in the virtual image, (-1,-1) for invalid disparities and
+  // positions out of the image. They are independent of each other, so they
+  // are computed in parallel
+  const unsigned rows_ui = static_cast<unsigned>( f_baseImg.rows );
+  const unsigned cols_ui = static_cast<unsigned>( f_baseImg.cols );
+  cv::Mat positions = imagePool().acquire( f_baseImg.size(), CV_32SC2 );
+  const unsigned numBlocks_ui = ( rows_ui + ROW_BLOCK_UI - 1 ) / ROW_BLOCK_UI;
+
+  parallelFor( numBlocks_ui, [&]( const unsigned f_block_ui )
+  {
+    const unsigned yEnd_ui = std::min( ( f_block_ui + 1 ) * ROW_BLOCK_UI, rows_ui );
+    for( unsigned y = f_block_ui * ROW_BLOCK_UI; y < yEnd_ui; ++y )
     {
-      // Get the current disparity
-      const float disparity_f = f_disparityMap.ptr<float>( y )[ x ];
-      // Get the current intensity of the base image
-      const float intensity_f = f_baseImg.ptr<float>( y )[ x ];
+      int* position_p = positions.ptr<int>( y );
+      for( unsigned x = 0; x < cols_ui; ++x, position_p += 2 )
+      {
+	position_p[ 0 ] = position_p[ 1 ] = -1;
+
+	// Get the current disparity, ignore invalid values
+	float disparity_f = 0.f;
+	if( !readDisparity<D>( f_disparityMap, y, x, disparity_f ) )
+	{
+	  continue;
+	}
 
-      // Ignore invalid values
-      if( disparity_f == m_invalid_f )
+	// Compute the new position
+	int virtualX_i = 0;
+	int virtualY_i = 0;
+	computeNewPosition( static_cast<float>( x ), static_cast<float>( y ), disparity_f,
+			    virtualX_i, virtualY_i           );
+
+	if( 0 <= virtualX_i && virtualX_i < f_baseImg.cols &&
+	    0 <= virtualY_i && virtualY_i < f_baseImg.rows )
+	{
+	  position_p[ 0 ] = virtualX_i;
+	  position_p[ 1 ] = virtualY_i;
+	}
+      }
+    }
+  }, m_numThreads_ui );
+
+  // Compute the virtual image. Two base positions may land on the same
+  // virtual one, so this pass is serial and in the same order as the base
+  // image (the first of equal disparities wins)
+  for ( unsigned y = 0; y < rows_ui; ++y ) 
+  {	
+    const int* position_p = positions.ptr<int>( y );
+    for ( unsigned x = 0; x < cols_ui; ++x, position_p += 2 )  
+    {
+      const int virtualX_i = position_p[ 0 ];
+      const int virtualY_i = position_p[ 1 ];
+      if( virtualX_i < 0 )
       {
 	continue;
       }
-      
-      // Compute the new position
-      int virtualX_i = 0;
-      int virtualY_i = 0;
-      computeNewPosition( static_cast<float>( x ), static_cast<float>( y ), disparity_f,
-			  virtualX_i, virtualY_i           );
-
-      if( 0 <= virtualX_i && virtualX_i < f_baseImg.cols )
+
+      float disparity_f = 0.f;
+      readDisparity<D>( f_disparityMap, y, x, disparity_f );
+
+      float &hold_f = f_sourceDisparity.ptr<float>( virtualY_i )[ virtualX_i ];
+
+      // If position (virtualX_i, virtualY_i) has not been visitied before,
+      // or the "old" disparity is smaller, use the current intensity (from
+      // the base image) and keep the disparity. We would need to compare it
+      // with the disparity of another (x,y) that is also mapped into
+      // (virtualX_i, virtualY_i).
+      // If the "old" disparity is larger, the intensity of the "old" 
+      // position is already in the virtual image.
+      if( hold_f == free_f || hold_f < disparity_f )
       {
-	if(  0 <= virtualY_i && virtualY_i < f_baseImg.rows ) 
-	{
-	  // To access the 2-channel image hold.
-	  // The + 1 in the following, is also beacause the 2 channel image
-	  const unsigned xPos_ui = virtualX_i*2;
-	  
-	  // If position (virtualX_i, virtualY_i) has not been visitied before,
-	  // set that position's intinsity of the virtual image to the intensity
-	  // of the position (x,y) of the base image.
-	  if( hold.ptr<float>( virtualY_i )[ xPos_ui ] == free_f  )
-	  {
-	    // Keep the disparity. We would need to compare it with the disparity of
-	    // another (x,y) that is also mapped into (virtualX_i, virtualY_i).
-	    hold.ptr<float>( virtualY_i )[ xPos_ui ]            = disparity_f;
-	    // Save to the intensity, just in case.
-	    hold.ptr<float>( virtualY_i )[ xPos_ui + 1]         = intensity_f;
-	    // Set the value of the the virtual image
-	    f_virtualImg.ptr<float>( virtualY_i )[ virtualX_i ] = intensity_f;
-	  }
-	  // If the position has alredy been visited, we keep the intensity of the
-	  // point in the base image whose corresponding disparity is larger.
-	  // I want to keep the 3D point which is closer to the camera.
-	  else
-	  {
-	    // If the "old" disparity is smaller, use the current intensity
-	    // (from the base imag)
-	    if( hold.ptr<float>( virtualY_i )[ xPos_ui ] < disparity_f )
-	    {
-	      // The value in the virtual image is the one with less disparity
-	      f_virtualImg.ptr<float>( virtualY_i )[ virtualX_i ] = intensity_f;
-
-	      // Update the values of hold....
-	      hold.ptr<float>( virtualY_i )[ xPos_ui ]     = disparity_f;
-	      hold.ptr<float>( virtualY_i )[ xPos_ui + 1 ] = intensity_f;
-
-	    }
-	    // If the "old" disparity is larger, use the intensity from the "old"
-	    // position 
-	    else
-	    {
-	      f_virtualImg.ptr<float>( virtualY_i )[ virtualX_i ] =
-	  	hold.ptr<float>( virtualY_i )[ xPos_ui + 1];
-
-	      // No update of the values of hold is required, as the disparity
-	      // in there is larger, so in case of another comparison we would
-	      // the larger value so far.
-	    }
-	    
-	  } // end else hold == free
-	  
-	} // endif virtualX_i whithin bounds
-	
-      } // endif virtualY_i whithin bounds
-      
+	hold_f = disparity_f;
+	f_virtualImg.ptr<T>( virtualY_i )[ virtualX_i ] = f_baseImg.ptr<T>( y )[ x ];
+      }
     
     } //endif x
     
   } //endif y
+}
+
+/* *************************** METHOD ************************************** */
+/* projectPoints
+ *
+ * \brief      Computes the position in the virtual image of each of the given
+ *             positions of the base image (see computeNewPosition). Unlike
+ *             generateVirtualImage, only the disparities of those positions
+ *             are read and no occlusion handling is done, so the cost scales
+ *             with the number of positions.
+ *
+ * \param[in]  const cv::Mat f_disparityMap: Input disparity map (32 float or
+ *             16-bit fixed point).
+ * \param[in]  const std::vector<cv::Point> &f_basePoints: Positions wrt the
+ *             base image. They must be within the disparity map.
+ * \param[out] std::vector<cv::Point> &f_virtualPoints: Positions wrt the
+ *             virtual image. (-1,-1) if the disparity is invalid or the
+ *             position falls outside of the image.
+ *
+ * \return     True, if the positions were succesfully computed. False
+ *             otherwise.
+ *************************************************************************** */
+bool CThirdEye::projectPoints( const cv::Mat f_disparityMap, 
+			       const std::vector<cv::Point> &f_basePoints,
+			       std::vector<cv::Point> &f_virtualPoints ) const
+{
+  if ( f_disparityMap.empty() )
+  {
+    cerr << "ERROR CThirdEye::projectPoints: No enough input data!\n";
+    return false;
+  }
+  
+  if ( !m_params_b )
+  {
+    cerr << "ERROR CThirdEye::projectPoints: Set up first the transformation parameters!\n";
+    return false;
+  }
+
+  if( f_disparityMap.type() != CV_32FC1 && f_disparityMap.type() != CV_16UC1 )
+  {
+    cerr << "ERROR CThirdEye::projectPoints: The disparity map must be a 32 float or 16-bit fixed point one!\n";
+    return false;
+  }
+
+  const bool fixedPoint_b = ( f_disparityMap.type() == CV_16UC1 );
+  f_virtualPoints.resize( f_basePoints.size() );
+
+  for( size_t i = 0; i < f_basePoints.size(); ++i )
+  {
+    const cv::Point &base = f_basePoints[ i ];
+    cv::Point &virt       = f_virtualPoints[ i ];
+    virt = cv::Point( -1, -1 );
+
+    float disparity_f = 0.f;
+    const bool valid_b = fixedPoint_b ? 
+      readDisparity<ushort>( f_disparityMap, base.y, base.x, disparity_f ) :
+      readDisparity<float>(  f_disparityMap, base.y, base.x, disparity_f );
+    if( !valid_b )
+    {
+      continue;
+    }
+
+    int virtualX_i = 0;
+    int virtualY_i = 0;
+    if( !computeNewPosition( static_cast<float>( base.x ), static_cast<float>( base.y ),
+			     disparity_f, virtualX_i, virtualY_i ) )
+    {
+      continue;
+    }
+
+    if( 0 <= virtualX_i && virtualX_i < f_disparityMap.cols &&
+	0 <= virtualY_i && virtualY_i < f_disparityMap.rows    )
+    {
+      virt = cv::Point( virtualX_i, virtualY_i );
+    }
+  }
 
   return true;
 }
@@ -233,7 +431,7 @@ inline bool CThirdEye::computeNewPosition( const float f_xPos_f,
 					   const float f_yPos_f, 
 					   const float f_disp_f,
 					   int& f_xNewPos_i, 
-					   int& f_yNewPos_i	)
+					   int& f_yNewPos_i	) const
 {
   // Coordinates with respect to the image plane of the 
   // base camera of the stereo camera (origin in upper left corner)
@@ -259,7 +457,7 @@ inline bool CThirdEye::computeNewPosition( const float f_xPos_f,
   // Just in case
   if ( denominator_f == 0.f )
   {
-    cout << "Error CThirdEye::computeNewPosition: A division by zero is attempted in the point ("
+    cerr << "Error CThirdEye::computeNewPosition: A division by zero is attempted in the point ("
 	 << myRound( f_xPos_f ) << "," << myRound( f_yPos_f ) << ")\n";
     return false;
   }
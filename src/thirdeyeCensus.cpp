@@ -0,0 +1,546 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeCensus.cpp
+ *
+ *  \brief   Definition of the class CThirdEyeCensus.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyeCensus.h"
+
+// Project includes
+#include "../h/thirdeyeParallel.h"
+#include "../h/thirdeyePixel.h"
+
+// Common includes
+#include <algorithm>
+#include <iostream>
+
+// SIMD includes. SSE2 is part of the x86-64 baseline.
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+using std::cerr;
+
+namespace
+{
+  // Number of rows of the RoI reduced by each parallel task
+  const unsigned ROW_BLOCK_UI = 16;
+
+  // Scalar census Hamming distance of one pixel
+  template<typename T>
+  inline unsigned censusHammingPixel( const T* f_control_p, const T* f_virtual_p,
+				      const ptrdiff_t* f_offsetsC_p, const ptrdiff_t* f_offsetsV_p,
+				      const unsigned f_numBits_ui )
+  {
+    unsigned hamming_ui = 0;
+    for( unsigned k = 0; k < f_numBits_ui; ++k )
+    {
+      const bool control_b = f_control_p[ f_offsetsC_p[ k ] ] < f_control_p[ 0 ];
+      const bool virtual_b = f_virtual_p[ f_offsetsV_p[ k ] ] < f_virtual_p[ 0 ];
+      hamming_ui += ( control_b != virtual_b ) ? 1 : 0;
+    }
+    return hamming_ui;
+  }
+
+#if defined( __SSE2__ )
+  // Sum of the two 64-bit lanes
+  inline uint64_t laneSum( const __m128i f_value )
+  {
+    uint64_t lanes_p[ 2 ];
+    _mm_storeu_si128( reinterpret_cast<__m128i*>( lanes_p ), f_value );
+    return lanes_p[ 0 ] + lanes_p[ 1 ];
+  }
+
+  // Mask of four pixels (all ones if the mask value is larger than zero)
+  inline __m128i maskLanes( const float* f_mask_p )
+  {
+    return _mm_castps_si128( _mm_cmpgt_ps( _mm_loadu_ps( f_mask_p ), _mm_setzero_ps() ) );
+  }
+
+  /* *************************** FUNCTION ************************************ */
+  /* censusHammingSSE
+   *
+   * \brief      Census Hamming distances of a run, as many pixels per
+   *             instruction as the type allows: 16 for 8 bit images (byte
+   *             compares), 8 for 16 bit and 4 for float images. The
+   *             comparisons of each neighbour are XORed and counted per
+   *             pixel, so no descriptors are built. Returns the number of
+   *             pixels processed, the remainder is left to the caller.
+   *************************************************************************** */
+  inline unsigned censusHammingSSE( const uchar* f_control_p, const uchar* f_virtual_p,
+				    const unsigned f_count_ui,
+				    const ptrdiff_t* f_offsetsC_p, const ptrdiff_t* f_offsetsV_p,
+				    const unsigned f_numBits_ui, const float* f_mask_p,
+				    SCensusSums &f_sums )
+  {
+    // Unsigned compares through a signed compare of the biased bytes
+    const __m128i bias = _mm_set1_epi8( static_cast<char>( 0x80 ) );
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero, sumMask = zero;
+
+    unsigned x = 0;
+    for( ; x + 16 <= f_count_ui; x += 16 )
+    {
+      const __m128i centerC = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_control_p + x ) ), bias );
+      const __m128i centerV = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_virtual_p + x ) ), bias );
+
+      // Per byte counts (at most 64)
+      __m128i hamming = zero;
+      for( unsigned k = 0; k < f_numBits_ui; ++k )
+      {
+	const __m128i neighbourC = 
+	  _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_control_p + x + f_offsetsC_p[ k ] ) ), bias );
+	const __m128i neighbourV = 
+	  _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_virtual_p + x + f_offsetsV_p[ k ] ) ), bias );
+	hamming = _mm_sub_epi8( hamming, _mm_xor_si128( _mm_cmplt_epi8( neighbourC, centerC ),
+							_mm_cmplt_epi8( neighbourV, centerV ) ) );
+      }
+      sum = _mm_add_epi64( sum, _mm_sad_epu8( hamming, zero ) );
+
+      if( f_mask_p )
+      {
+	const __m128i lanes = _mm_packs_epi16( _mm_packs_epi32( maskLanes( f_mask_p + x ),
+								maskLanes( f_mask_p + x + 4 ) ),
+					       _mm_packs_epi32( maskLanes( f_mask_p + x + 8 ),
+								maskLanes( f_mask_p + x + 12 ) ) );
+	sumMask = _mm_add_epi64( sumMask, _mm_sad_epu8( _mm_and_si128( hamming, lanes ), zero ) );
+	f_sums.m_countMask += __builtin_popcount( _mm_movemask_epi8( lanes ) );
+      }
+    }
+
+    f_sums.m_hamming     += laneSum( sum );
+    f_sums.m_hammingMask += laneSum( sumMask );
+    return x;
+  }
+
+  inline unsigned censusHammingSSE( const ushort* f_control_p, const ushort* f_virtual_p,
+				    const unsigned f_count_ui,
+				    const ptrdiff_t* f_offsetsC_p, const ptrdiff_t* f_offsetsV_p,
+				    const unsigned f_numBits_ui, const float* f_mask_p,
+				    SCensusSums &f_sums )
+  {
+    const __m128i bias = _mm_set1_epi16( static_cast<short>( 0x8000 ) );
+    const __m128i ones = _mm_set1_epi16( 1 );
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero, sumMask = zero;
+
+    unsigned x = 0;
+    for( ; x + 8 <= f_count_ui; x += 8 )
+    {
+      const __m128i centerC = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_control_p + x ) ), bias );
+      const __m128i centerV = _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_virtual_p + x ) ), bias );
+
+      __m128i hamming = zero;
+      for( unsigned k = 0; k < f_numBits_ui; ++k )
+      {
+	const __m128i neighbourC = 
+	  _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_control_p + x + f_offsetsC_p[ k ] ) ), bias );
+	const __m128i neighbourV = 
+	  _mm_xor_si128( _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_virtual_p + x + f_offsetsV_p[ k ] ) ), bias );
+	hamming = _mm_sub_epi16( hamming, _mm_xor_si128( _mm_cmplt_epi16( neighbourC, centerC ),
+							 _mm_cmplt_epi16( neighbourV, centerV ) ) );
+      }
+      // Pairs of counts into 32-bit lanes, which do not overflow within a row
+      sum = _mm_add_epi32( sum, _mm_madd_epi16( hamming, ones ) );
+
+      if( f_mask_p )
+      {
+	const __m128i lanes = _mm_packs_epi32( maskLanes( f_mask_p + x ), maskLanes( f_mask_p + x + 4 ) );
+	sumMask = _mm_add_epi32( sumMask, _mm_madd_epi16( _mm_and_si128( hamming, lanes ), ones ) );
+	f_sums.m_countMask += __builtin_popcount( _mm_movemask_epi8( lanes ) ) / 2;
+      }
+    }
+
+    f_sums.m_hamming     += laneSum( _mm_add_epi64( _mm_unpacklo_epi32( sum, zero ),
+						    _mm_unpackhi_epi32( sum, zero ) ) );
+    f_sums.m_hammingMask += laneSum( _mm_add_epi64( _mm_unpacklo_epi32( sumMask, zero ),
+						    _mm_unpackhi_epi32( sumMask, zero ) ) );
+    return x;
+  }
+
+  inline unsigned censusHammingSSE( const float* f_control_p, const float* f_virtual_p,
+				    const unsigned f_count_ui,
+				    const ptrdiff_t* f_offsetsC_p, const ptrdiff_t* f_offsetsV_p,
+				    const unsigned f_numBits_ui, const float* f_mask_p,
+				    SCensusSums &f_sums )
+  {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero, sumMask = zero;
+
+    unsigned x = 0;
+    for( ; x + 4 <= f_count_ui; x += 4 )
+    {
+      const __m128 centerC = _mm_loadu_ps( f_control_p + x );
+      const __m128 centerV = _mm_loadu_ps( f_virtual_p + x );
+
+      __m128i hamming = zero;
+      for( unsigned k = 0; k < f_numBits_ui; ++k )
+      {
+	const __m128 differ = _mm_xor_ps( _mm_cmplt_ps( _mm_loadu_ps( f_control_p + x + f_offsetsC_p[ k ] ), centerC ),
+					  _mm_cmplt_ps( _mm_loadu_ps( f_virtual_p + x + f_offsetsV_p[ k ] ), centerV ) );
+	hamming = _mm_sub_epi32( hamming, _mm_castps_si128( differ ) );
+      }
+      sum = _mm_add_epi32( sum, hamming );
+
+      if( f_mask_p )
+      {
+	const __m128i lanes = maskLanes( f_mask_p + x );
+	sumMask = _mm_add_epi32( sumMask, _mm_and_si128( hamming, lanes ) );
+	f_sums.m_countMask += __builtin_popcount( _mm_movemask_ps( _mm_castsi128_ps( lanes ) ) );
+      }
+    }
+
+    f_sums.m_hamming     += laneSum( _mm_add_epi64( _mm_unpacklo_epi32( sum, zero ),
+						    _mm_unpackhi_epi32( sum, zero ) ) );
+    f_sums.m_hammingMask += laneSum( _mm_add_epi64( _mm_unpacklo_epi32( sumMask, zero ),
+						    _mm_unpackhi_epi32( sumMask, zero ) ) );
+    return x;
+  }
+#endif
+}
+
+/* *************************** FUNCTION ************************************ */
+/* censusHammingRow
+ *
+ * \brief      Adds to the input sums the census Hamming distances of a run of
+ *             contiguous pixels: the number of neighbours whose comparison
+ *             with the center (smaller or not) differs between the control
+ *             and the virtual image. The distances of the pixels whose mask
+ *             value is larger than zero are also added to the masked sums.
+ *             All the neighbours of the run must be within the images. This
+ *             is the kernel of the census index (CThirdEyeCensus) and of the
+ *             3x3 census metric (see accumulateMomentsRow).
+ *
+ * \param[in]  const T* f_control_p: First control pixel (uchar, ushort or float).
+ * \param[in]  const T* f_virtual_p: First virtual pixel (same type).
+ * \param[in]  const size_t f_stepC: Row step of the control image, in pixels.
+ * \param[in]  const size_t f_stepV: Row step of the virtual image, in pixels.
+ * \param[in]  const unsigned f_count_ui: Number of pixels.
+ * \param[in]  const int* f_offsetsY_p: Row offsets of the neighbours.
+ * \param[in]  const int* f_offsetsX_p: Column offsets of the neighbours.
+ * \param[in]  const unsigned f_numBits_ui: Number of neighbours (at most 64).
+ * \param[in]  const float* f_mask_p: Mask values. Can be null.
+ * \param[out] SCensusSums &f_sums: Sums, updated.
+ *
+ * \return     -
+ *************************************************************************** */
+template<typename T>
+void censusHammingRow( const T* f_control_p, const T* f_virtual_p,
+		       const size_t f_stepC, const size_t f_stepV,
+		       const unsigned f_count_ui,
+		       const int* f_offsetsY_p, const int* f_offsetsX_p,
+		       const unsigned f_numBits_ui, const float* f_mask_p,
+		       SCensusSums &f_sums )
+{
+  // Neighbour offsets, in pixels
+  ptrdiff_t offsetsC_p[ 64 ], offsetsV_p[ 64 ];
+  for( unsigned k = 0; k < f_numBits_ui; ++k )
+  {
+    offsetsC_p[ k ] = f_offsetsY_p[ k ] * static_cast<ptrdiff_t>( f_stepC ) + f_offsetsX_p[ k ];
+    offsetsV_p[ k ] = f_offsetsY_p[ k ] * static_cast<ptrdiff_t>( f_stepV ) + f_offsetsX_p[ k ];
+  }
+
+  unsigned x = 0;
+#if defined( __SSE2__ )
+  x = censusHammingSSE( f_control_p, f_virtual_p, f_count_ui, offsetsC_p, offsetsV_p,
+			f_numBits_ui, f_mask_p, f_sums );
+#endif
+
+  // Remainder (or everything if no SIMD is available)
+  for( ; x < f_count_ui; ++x )
+  {
+    const unsigned hamming_ui = censusHammingPixel( f_control_p + x, f_virtual_p + x,
+						    offsetsC_p, offsetsV_p, f_numBits_ui );
+    f_sums.m_hamming += hamming_ui;
+    if( f_mask_p && f_mask_p[ x ] > 0.f )
+    {
+      f_sums.m_hammingMask += hamming_ui;
+      ++f_sums.m_countMask;
+    }
+  }
+}
+
+template void censusHammingRow<uchar>(  const uchar*,  const uchar*,  const size_t, const size_t,
+					 const unsigned, const int*, const int*, const unsigned,
+					 const float*, SCensusSums& );
+template void censusHammingRow<ushort>( const ushort*, const ushort*, const size_t, const size_t,
+					 const unsigned, const int*, const int*, const unsigned,
+					 const float*, SCensusSums& );
+template void censusHammingRow<float>(  const float*,  const float*,  const size_t, const size_t,
+					 const unsigned, const int*, const int*, const unsigned,
+					 const float*, SCensusSums& );
+
+/* *************************** METHOD ************************************** */
+/* Standard constructor.
+ *
+ * \brief          Standard constructor. The default window is 9x7, i.e. 62
+ *                 bits per descriptor.
+ *
+ * \return         -
+ *************************************************************************** */
+CThirdEyeCensus::CThirdEyeCensus()
+  : m_x1_ui(    0 ),
+    m_y1_ui(    0 ),
+    m_x2_ui(  640 ),
+    m_y2_ui(  480 ),
+
+    m_width_ui(  9 ),
+    m_height_ui( 7 ),
+
+    m_numThreads_ui( 0 ),
+
+    m_index_f(     -32000.f ),
+    m_indexMask_f( -32000.f ),
+
+    m_meanHamming_d(     -1.0 ),
+    m_meanHammingMask_d( -1.0 )
+{
+  setWindow( m_width_ui, m_height_ui );
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard destructor.
+ *
+ * \brief          Standard destructor.
+ *
+ * \return         -
+ *************************************************************************** */
+CThirdEyeCensus::~CThirdEyeCensus()
+{
+  /* Empty body */
+}
+
+/* *************************** METHOD ************************************** */
+/* setROI
+ *
+ * \brief      Sets the evaluation region of interest.
+ *
+ * \param[in]  const unsigned f_x1_ui: Top left corner horz coordinate of RoI.
+ * \param[in]  const unsigned f_y1_ui: Top left corner vert coordinate of RoI.
+ * \param[in]  const unsigned f_x2_ui: Bottom right corner horz coordinate of RoI.
+ * \param[in]  const unsigned f_y2_ui: Bottom right corner vert coordinate of RoI.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeCensus::setROI( const unsigned f_x1_ui, const unsigned f_y1_ui,
+			      const unsigned f_x2_ui, const unsigned f_y2_ui  )
+{
+  m_x1_ui = f_x1_ui;
+  m_y1_ui = f_y1_ui;
+  m_x2_ui = f_x2_ui;
+  m_y2_ui = f_y2_ui;
+}
+
+/* *************************** METHOD ************************************** */
+/* setConfiguration
+ *
+ * \brief      Copies the settings of another object (RoI, window and
+ *             threads). The results of this object are kept.
+ *
+ * \param[in]  const CThirdEyeCensus &f_config: Object to copy the settings from.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeCensus::setConfiguration( const CThirdEyeCensus &f_config )
+{
+  m_x1_ui         = f_config.m_x1_ui;
+  m_y1_ui         = f_config.m_y1_ui;
+  m_x2_ui         = f_config.m_x2_ui;
+  m_y2_ui         = f_config.m_y2_ui;
+  m_width_ui      = f_config.m_width_ui;
+  m_height_ui     = f_config.m_height_ui;
+  m_offsetsY      = f_config.m_offsetsY;
+  m_offsetsX      = f_config.m_offsetsX;
+  m_numThreads_ui = f_config.m_numThreads_ui;
+}
+
+/* *************************** METHOD ************************************** */
+/* setWindow
+ *
+ * \brief      Sets the size of the census window. Both dimensions must be odd
+ *             and the number of neighbours (width * height - 1) must fit in a
+ *             64-bit descriptor.
+ *
+ * \param[in]  const unsigned f_width_ui: Width of the window.
+ * \param[in]  const unsigned f_height_ui: Height of the window.
+ *
+ * \return     True if the window is valid. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeCensus::setWindow( const unsigned f_width_ui, const unsigned f_height_ui )
+{
+  if( f_width_ui % 2 == 0 || f_height_ui % 2 == 0 ||
+      f_width_ui * f_height_ui - 1 > 64 || f_width_ui * f_height_ui < 3 )
+  {
+    cerr << "ERROR CThirdEyeCensus::setWindow: The window must have odd dimensions and "
+	 << "at most 64 neighbours!\n";
+    return false;
+  }
+
+  m_width_ui  = f_width_ui;
+  m_height_ui = f_height_ui;
+
+  m_offsetsY.clear();
+  m_offsetsX.clear();
+
+  const int radiusX_i = m_width_ui  / 2;
+  const int radiusY_i = m_height_ui / 2;
+  for( int dy = -radiusY_i; dy <= radiusY_i; ++dy )
+  {
+    for( int dx = -radiusX_i; dx <= radiusX_i; ++dx )
+    {
+      if( dx == 0 && dy == 0 )
+      {
+	continue;
+      }
+      m_offsetsY.push_back( dy );
+      m_offsetsX.push_back( dx );
+    }
+  }
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* censusRow
+ *
+ * \brief      Adds the census Hamming distances of a run of pixels of one row
+ *             (see censusHammingRow) with the window of this object, in the
+ *             pixel type of the images, so 8 and 16 bit images are compared
+ *             natively.
+ *
+ * \param[in]  const cv::Mat &f_controlImg: Control image (see isIntensityType).
+ * \param[in]  const cv::Mat &f_virtualImg: Virtual image (same type).
+ * \param[in]  const unsigned f_y_ui: Row.
+ * \param[in]  const unsigned f_x_ui: First column.
+ * \param[in]  const unsigned f_count_ui: Number of pixels.
+ * \param[in]  const float* f_mask_p: Mask values of the run. Can be null.
+ * \param[out] SCensusSums &f_sums: Sums, updated.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeCensus::censusRow( const cv::Mat &f_controlImg, const cv::Mat &f_virtualImg,
+				 const unsigned f_y_ui, const unsigned f_x_ui,
+				 const unsigned f_count_ui, const float* f_mask_p,
+				 SCensusSums &f_sums )
+{
+  const size_t stepC = f_controlImg.step[ 0 ] / f_controlImg.elemSize();
+  const size_t stepV = f_virtualImg.step[ 0 ] / f_virtualImg.elemSize();
+  switch( f_controlImg.depth() )
+  {
+    case CV_8U:
+      censusHammingRow( f_controlImg.ptr<uchar>( f_y_ui ) + f_x_ui, 
+			f_virtualImg.ptr<uchar>( f_y_ui ) + f_x_ui, stepC, stepV, f_count_ui, 
+			&m_offsetsY[ 0 ], &m_offsetsX[ 0 ], getNumBits(), f_mask_p, f_sums );
+    break;
+    case CV_16U:
+      censusHammingRow( f_controlImg.ptr<ushort>( f_y_ui ) + f_x_ui, 
+			f_virtualImg.ptr<ushort>( f_y_ui ) + f_x_ui, stepC, stepV, f_count_ui, 
+			&m_offsetsY[ 0 ], &m_offsetsX[ 0 ], getNumBits(), f_mask_p, f_sums );
+    break;
+    default:
+      censusHammingRow( f_controlImg.ptr<float>( f_y_ui ) + f_x_ui, 
+			f_virtualImg.ptr<float>( f_y_ui ) + f_x_ui, stepC, stepV, f_count_ui, 
+			&m_offsetsY[ 0 ], &m_offsetsX[ 0 ], getNumBits(), f_mask_p, f_sums );
+    break;
+  }
+}
+
+/* *************************** METHOD ************************************** */
+/* evaluate
+ *
+ * \brief      Computes the census index of the full and the masked approach.
+ *             The Hamming distances between the descriptors of the control
+ *             and virtual images are counted row by row (see censusRow)
+ *             straight from the neighbour comparisons, so no descriptors are
+ *             stored. Only the pixels of the RoI whose window is within the
+ *             image are considered. The index is
+ *             100 * ( 1 - mean Hamming distance / number of bits ).
+ *
+ *             The RoI is reduced in parallel row blocks. The sums are integer,
+ *             so the results do not depend on the number of threads.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image (8 bit, 16 bit or 32 float).
+ * \param[in]  const cv::Mat f_virtualImg: Virtual image (same type).
+ * \param[in]  const cv::Mat f_maskImg: Mask image (32 float). Can be empty.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeCensus::evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
+				const cv::Mat f_maskImg )
+{
+  m_index_f           = -32000.f;
+  m_indexMask_f       = -32000.f;
+  m_meanHamming_d     = -1.0;
+  m_meanHammingMask_d = -1.0;
+
+  if( f_controlImg.empty() || f_virtualImg.empty() ||
+      f_controlImg.size() != f_virtualImg.size() ||
+      f_controlImg.type() != f_virtualImg.type() || !isIntensityType( f_controlImg.type() ) )
+  {
+    cerr << "ERROR CThirdEyeCensus::evaluate: The input images do not match!\n";
+    return false;
+  }
+
+  // Clip the RoI so the windows are within the image
+  const unsigned radiusX_ui = m_width_ui  / 2;
+  const unsigned radiusY_ui = m_height_ui / 2;
+  const unsigned x1_ui = std::max( m_x1_ui, radiusX_ui );
+  const unsigned y1_ui = std::max( m_y1_ui, radiusY_ui );
+  const unsigned x2_ui = std::min( m_x2_ui, f_controlImg.cols - radiusX_ui );
+  const unsigned y2_ui = std::min( m_y2_ui, f_controlImg.rows - radiusY_ui );
+
+  if( x2_ui <= x1_ui || y2_ui <= y1_ui )
+  {
+    cerr << "ERROR CThirdEyeCensus::evaluate: Empty RoI!\n";
+    return false;
+  }
+
+  const bool     mask_b       = !f_maskImg.empty();
+  const unsigned width_ui     = x2_ui - x1_ui;
+  const unsigned numBlocks_ui = ( y2_ui - y1_ui + ROW_BLOCK_UI - 1 ) / ROW_BLOCK_UI;
+
+  // Partial sums per block
+  std::vector<SCensusSums> partials( numBlocks_ui );
+
+  parallelFor( numBlocks_ui, [&]( const unsigned f_block_ui )
+  {
+    const unsigned yStart_ui = y1_ui + f_block_ui * ROW_BLOCK_UI;
+    const unsigned yEnd_ui   = std::min( yStart_ui + ROW_BLOCK_UI, y2_ui );
+
+    for( unsigned y = yStart_ui; y < yEnd_ui; ++y )
+    {
+      const float* mask_p = mask_b ? f_maskImg.ptr<float>( y ) + x1_ui : nullptr;
+      censusRow( f_controlImg, f_virtualImg, y, x1_ui, width_ui, mask_p, partials[ f_block_ui ] );
+    }
+  }, m_numThreads_ui );
+
+  uint64_t sum = 0, sumMask = 0, nMask = 0;
+  for( unsigned b = 0; b < numBlocks_ui; ++b )
+  {
+    sum     += partials[ b ].m_hamming;
+    sumMask += partials[ b ].m_hammingMask;
+    nMask   += partials[ b ].m_countMask;
+  }
+
+  const double numBits_d = static_cast<double>( getNumBits() );
+  const double n_d       = static_cast<double>( width_ui ) * ( y2_ui - y1_ui );
+
+  m_meanHamming_d = static_cast<double>( sum ) / n_d;
+  m_index_f       = static_cast<float>( 100.0 * ( 1.0 - m_meanHamming_d / numBits_d ) );
+
+  if( mask_b )
+  {
+    if( nMask == 0 )
+    {
+      cerr << "ERROR CThirdEyeCensus::evaluate: Calculation error (size)!\n";
+      return false;
+    }
+    m_meanHammingMask_d = static_cast<double>( sumMask ) / static_cast<double>( nMask );
+    m_indexMask_f       = static_cast<float>( 100.0 * ( 1.0 - m_meanHammingMask_d / numBits_d ) );
+  }
+
+  return true;
+}
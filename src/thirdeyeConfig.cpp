@@ -0,0 +1,310 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeConfig.cpp
+ *
+ *  \brief   Definition of the configuration file functions.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyeConfig.h"
+
+// Common includes
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+#include <vector>
+
+using std::cerr;
+using std::endl;
+
+namespace
+{
+  std::string trim( const std::string &f_str )
+  {
+    const size_t begin = f_str.find_first_not_of( " \t\r" );
+    if( begin == std::string::npos )
+    {
+      return std::string();
+    }
+    const size_t end = f_str.find_last_not_of( " \t\r" );
+    return f_str.substr( begin, end - begin + 1 );
+  }
+
+  // Values of a key, as numbers. False if one is not a number
+  bool parseValues( const std::string &f_values_str, std::vector<float> &f_values )
+  {
+    f_values.clear();
+    std::istringstream values( f_values_str );
+    std::string token_str;
+    while( values >> token_str )
+    {
+      std::istringstream token( token_str );
+      float value_f = 0.f;
+      if( !( token >> value_f ) || !token.eof() )
+      {
+	return false;
+      }
+      f_values.push_back( value_f );
+    }
+    return true;
+  }
+}
+
+/* *************************** METHOD ************************************** */
+/* loadConfig
+ *
+ * \brief      Reads a configuration file. The keys are:
+ *               baseline                            1 value
+ *               translation                         3 values
+ *               rotation (row by row)               9 values
+ *               principal_base, focal_base          2 values each
+ *               principal_control, focal_control    2 values each
+ *               pixel_size                          2 values
+ *               roi (x1 y1 x2 y2)                   4 values, optional
+ *               mask_gradient, mask_distance        1 value each, optional
+ *               bits                                1 value, optional
+ *               invalid                             1 value, optional
+ *               index (ncc or census)               optional
+ *               latency_budget (ms, see CThirdEyeEvaluation::setLatencyBudget)
+ *                                                   1 value, optional
+ *             All the geometry keys are required.
+ *
+ * \param[in]  const std::string &f_fileName_str: Name of the file.
+ * \param[out] SThirdEyeConfig &f_config: The configuration.
+ *
+ * \return     True if the file is valid. False otherwise.
+ *************************************************************************** */
+bool loadConfig( const std::string &f_fileName_str, SThirdEyeConfig &f_config )
+{
+  std::ifstream file( f_fileName_str.c_str() );
+  if( !file )
+  {
+    cerr << "ERROR loadConfig: Cannot open the file " << f_fileName_str << endl;
+    return false;
+  }
+
+  SThirdEyeParams &params = f_config.m_params;
+  std::set<std::string> found;
+  std::vector<float> values;
+  std::string line_str;
+  unsigned lineNumber_ui = 0;
+
+  while( std::getline( file, line_str ) )
+  {
+    ++lineNumber_ui;
+    line_str = trim( line_str.substr( 0, line_str.find( '#' ) ) );
+    if( line_str.empty() )
+    {
+      continue;
+    }
+
+    const size_t equal = line_str.find( '=' );
+    if( equal == std::string::npos )
+    {
+      cerr << "ERROR loadConfig: " << f_fileName_str << ":" << lineNumber_ui
+	   << ": Expected \"key = values\"\n";
+      return false;
+    }
+    const std::string key_str    = trim( line_str.substr( 0, equal ) );
+    const std::string values_str = trim( line_str.substr( equal + 1 ) );
+
+    // The only key with a non numeric value
+    if( key_str == "index" )
+    {
+      if( values_str == "ncc" )
+      {
+	f_config.m_indexType_e = INDEX_NCC;
+      }
+      else if( values_str == "census" )
+      {
+	f_config.m_indexType_e = INDEX_CENSUS;
+      }
+      else
+      {
+	cerr << "ERROR loadConfig: " << f_fileName_str << ":" << lineNumber_ui
+	     << ": The index must be ncc or census\n";
+	return false;
+      }
+      found.insert( key_str );
+      continue;
+    }
+
+    if( !parseValues( values_str, values ) )
+    {
+      cerr << "ERROR loadConfig: " << f_fileName_str << ":" << lineNumber_ui
+	   << ": Invalid number in \"" << values_str << "\"\n";
+      return false;
+    }
+
+    size_t expected = 0;
+    const size_t n = values.size();
+    if( key_str == "baseline" )
+    {
+      expected = 1;
+      if( n == expected ) params.m_baseLine_f = values[ 0 ];
+    }
+    else if( key_str == "translation" )
+    {
+      expected = 3;
+      if( n == expected )
+      {
+	params.m_translationX_f = values[ 0 ];
+	params.m_translationY_f = values[ 1 ];
+	params.m_translationZ_f = values[ 2 ];
+      }
+    }
+    else if( key_str == "rotation" )
+    {
+      expected = 9;
+      if( n == expected )
+      {
+	params.m_m11_f = values[ 0 ]; params.m_m12_f = values[ 1 ]; params.m_m13_f = values[ 2 ];
+	params.m_m21_f = values[ 3 ]; params.m_m22_f = values[ 4 ]; params.m_m23_f = values[ 5 ];
+	params.m_m31_f = values[ 6 ]; params.m_m32_f = values[ 7 ]; params.m_m33_f = values[ 8 ];
+      }
+    }
+    else if( key_str == "principal_base" )
+    {
+      expected = 2;
+      if( n == expected )
+      {
+	params.m_principalPointBaseX_f = values[ 0 ];
+	params.m_principalPointBaseY_f = values[ 1 ];
+      }
+    }
+    else if( key_str == "focal_base" )
+    {
+      expected = 2;
+      if( n == expected )
+      {
+	params.m_focalLengthBaseX_f = values[ 0 ];
+	params.m_focalLengthBaseY_f = values[ 1 ];
+      }
+    }
+    else if( key_str == "principal_control" )
+    {
+      expected = 2;
+      if( n == expected )
+      {
+	params.m_principalPointControlX_f = values[ 0 ];
+	params.m_principalPointControlY_f = values[ 1 ];
+      }
+    }
+    else if( key_str == "focal_control" )
+    {
+      expected = 2;
+      if( n == expected )
+      {
+	params.m_focalLengthControlX_f = values[ 0 ];
+	params.m_focalLengthControlY_f = values[ 1 ];
+      }
+    }
+    else if( key_str == "pixel_size" )
+    {
+      expected = 2;
+      if( n == expected )
+      {
+	params.m_pixelSizeX_f = values[ 0 ];
+	params.m_pixelSizeY_f = values[ 1 ];
+      }
+    }
+    else if( key_str == "roi" )
+    {
+      expected = 4;
+      if( n == expected )
+      {
+	if( values[ 0 ] < 0.f || values[ 1 ] < 0.f ||
+	    values[ 2 ] <= values[ 0 ] || values[ 3 ] <= values[ 1 ] )
+	{
+	  cerr << "ERROR loadConfig: " << f_fileName_str << ":" << lineNumber_ui
+	       << ": Invalid RoI\n";
+	  return false;
+	}
+	f_config.m_x1_ui = static_cast<unsigned>( values[ 0 ] );
+	f_config.m_y1_ui = static_cast<unsigned>( values[ 1 ] );
+	f_config.m_x2_ui = static_cast<unsigned>( values[ 2 ] );
+	f_config.m_y2_ui = static_cast<unsigned>( values[ 3 ] );
+      }
+    }
+    else if( key_str == "mask_gradient" )
+    {
+      expected = 1;
+      if( n == expected ) f_config.m_maskGradient_f = values[ 0 ];
+    }
+    else if( key_str == "mask_distance" )
+    {
+      expected = 1;
+      if( n == expected ) f_config.m_maskDistance_f = values[ 0 ];
+    }
+    else if( key_str == "bits" )
+    {
+      expected = 1;
+      if( n == expected ) f_config.m_bits_ui = static_cast<unsigned>( values[ 0 ] );
+    }
+    else if( key_str == "invalid" )
+    {
+      expected = 1;
+      if( n == expected ) f_config.m_invalid_f = values[ 0 ];
+    }
+    else if( key_str == "latency_budget" )
+    {
+      expected = 1;
+      if( n == expected ) f_config.m_latencyBudget_f = values[ 0 ];
+    }
+    else
+    {
+      cerr << "ERROR loadConfig: " << f_fileName_str << ":" << lineNumber_ui
+	   << ": Unknown key \"" << key_str << "\"\n";
+      return false;
+    }
+
+    if( n != expected )
+    {
+      cerr << "ERROR loadConfig: " << f_fileName_str << ":" << lineNumber_ui
+	   << ": \"" << key_str << "\" needs " << expected << " value(s)\n";
+      return false;
+    }
+    found.insert( key_str );
+  }
+
+  const char* required_p[] = { "baseline", "translation", "rotation",
+			       "principal_base", "focal_base",
+			       "principal_control", "focal_control", "pixel_size" };
+  for( size_t i = 0; i < sizeof( required_p ) / sizeof( required_p[ 0 ] ); ++i )
+  {
+    if( found.find( required_p[ i ] ) == found.end() )
+    {
+      cerr << "ERROR loadConfig: " << f_fileName_str << ": Missing key \""
+	   << required_p[ i ] << "\"\n";
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* applyConfig
+ *
+ * \brief      Sets the geometry, RoI, mask thresholds, invalid value, index
+ *             type and latency budget of an evaluation object. The bit depth
+ *             is used when loading the images.
+ *
+ * \param[in]  const SThirdEyeConfig &f_config: The configuration.
+ * \param[out] CThirdEyeEvaluation &f_eval: Evaluation object to set up.
+ *
+ * \return     -
+ *************************************************************************** */
+void applyConfig( const SThirdEyeConfig &f_config, CThirdEyeEvaluation &f_eval )
+{
+  f_eval.setParams( f_config.m_params );
+  f_eval.setEvaluationRoi( f_config.m_x1_ui, f_config.m_y1_ui,
+			   f_config.m_x2_ui, f_config.m_y2_ui );
+  // The first argument is the gradient threshold (see CThirdEyeMask::setParams)
+  f_eval.setMaskParams( f_config.m_maskGradient_f, f_config.m_maskDistance_f );
+  f_eval.setInvalidValue( f_config.m_invalid_f );
+  f_eval.setIndexType( f_config.m_indexType_e );
+  f_eval.setLatencyBudget( f_config.m_latencyBudget_f );
+}
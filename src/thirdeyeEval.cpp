@@ -1,12 +1,63 @@
 // Corresponding header
 #include "../h/thirdeyeEval.h"
 
+// OpenCV includes
+#include <opencv2/imgproc/imgproc.hpp>
+
+// Project includes
+#include "../h/thirdeyePixel.h"
+#include "../h/imagePool.h"
+
 // Common includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <random>
 
-using std::cout;
+using std::cerr;
 using std::endl;
 
+namespace
+{
+  // Same buffer, size and layout. The cache keeps a reference to its inputs,
+  // so the buffer cannot have been freed and reused meanwhile
+  inline bool sameImage( const cv::Mat &f_a, const cv::Mat &f_b )
+  {
+    return !f_a.empty() && f_a.data == f_b.data && f_a.size() == f_b.size() &&
+           f_a.type() == f_b.type() && f_a.step[ 0 ] == f_b.step[ 0 ];
+  }
+
+  // True if a cached output was computed for the given frame token, with
+  // the given settings stamp and from the given images. Never without a token
+  inline bool isCurrent( const uint64_t f_cachedFrame, const uint64_t f_frame,
+			 const uint64_t f_cached, const uint64_t f_settings,
+			 const cv::Mat &f_cachedA, const cv::Mat &f_a,
+			 const cv::Mat &f_cachedB, const cv::Mat &f_b )
+  {
+    return f_frame != 0 && f_cachedFrame == f_frame &&
+           f_cached != 0 && f_cached == f_settings &&
+           sameImage( f_cachedA, f_a ) && sameImage( f_cachedB, f_b );
+  }
+
+  // Adaptive mode: nominal cost of each quality level, relative to the full
+  // evaluation
+  const float NOMINAL_COST_F[ QUALITY_NUM_LEVELS ] = { 1.f, 0.7f, 0.08f, 0.05f };
+
+  // Fraction of the budget a level must fit in to be chosen, and fraction a
+  // frame must stay under to count as well under the budget
+  const float BUDGET_LIMIT_F = 0.9f;
+
+  const float BUDGET_ROOM_F  = 0.5f;
+
+  // Frames well under the budget before a probe, and max wait after failed
+  // probes
+  const unsigned PROBE_FRAMES_UI   = 30;
+
+  const unsigned MAX_PROBE_WAIT_UI = 64 * PROBE_FRAMES_UI;
+}
+
 /* *************************** METHOD ************************************** */
 /* Standard constructor
  *
@@ -21,9 +72,21 @@ using std::endl;
  * \return     -
  *************************************************************************** */
 CThirdEyeEvaluation::CThirdEyeEvaluation()
-  : m_maskGenerator( 5.f, 10.f ),
+  : m_workspace( ),
+    m_maskGenerator( 5.f, 10.f ),
     m_virtualImgGenerator( ),
-    m_errorCalculator( )
+    m_errorCalculator( ),
+    m_censusCalculator( ),
+    m_warpSettings( newStamp() ),
+    m_maskSettings( newStamp() ),
+    m_statsSettings( newStamp() ),
+    m_indexType_e( INDEX_NCC ),
+    m_samplingRate_f( 0.05f ),
+    m_samplingSeed_ui( 0 ),
+    m_pyramid_b( false ),
+    m_pyramidLow_f( -100.f ),
+    m_pyramidHigh_f( 100.f ),
+    m_latencyBudget_f( 0.f )
 {
   /* Empty body */
 }
@@ -92,10 +155,40 @@ void CThirdEyeEvaluation::setParams( const float f_baseLine_f,
 		 f_principalPointControlX_f, f_principalPointControlY_f,
 		    f_focalLengthControlX_f, f_focalLengthControlY_f,
 		  	     f_pixelSizeX_f, f_pixelSizeY_f )	 );
+  m_warpSettings = newStamp();
+}
+
+uint64_t CThirdEyeEvaluation::newStamp()
+{
+  static std::atomic<uint64_t> next( 1 );
+  return next++;
 }
 
 /* *************************** METHOD ************************************** */
 /* computeEvaluationIndices
+ *
+ * \brief      Computes the NCC indices for the third eye evaluation approach.
+ *             The results are kept in the internal workspace (see the const
+ *             overload below, and the get methods).
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
+ * \param[in]  const cv::Mat f_controlImg: Control image, for evaluation.
+ * \param[out] float &f_fullIndex_f: NCC index computed from the full approach.
+ * \param[out] float &f_maskIndex_f: NCC index computed from the masked approach.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeEvaluation::computeEvaluationIndices( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+						    const cv::Mat f_controlImg,
+						    float &f_fullIndex_f, float &f_maskIndex_f )
+{
+  computeEvaluationIndices( f_dispMap, f_baseImg, f_controlImg, m_workspace,
+			    f_fullIndex_f, f_maskIndex_f );
+}
+
+/* *************************** METHOD ************************************** */
+/* computeEvaluationIndices (const)
  *
  * \brief      Computes the NCC indices for the third eye evaluation approach.
  *             This method requires as input a disparity map, the base image
@@ -107,7 +200,27 @@ void CThirdEyeEvaluation::setParams( const float f_baseLine_f,
  *             required by the masked approach is also generated in here (by
  *             calling CThirdEyeMask::generateImageMask).
  *             The output evaluation indices are stored in two latter input
- *             arguments.
+ *             arguments. If the index type is INDEX_CENSUS, the census index
+ *             (CThirdEyeCensus::evaluate) is reported instead of the NCC.
+ *
+ *             In pyramid mode (see setPyramid), a coarse evaluation is done
+ *             first (see evaluateCoarse). If its index is out of the band of
+ *             interest, the coarse indices are reported and the full
+ *             resolution evaluation is skipped (see isCoarseResult). The
+ *             census index does not use the pyramid.
+ *
+ *             For the calls with the same frame token (see
+ *             SThirdEyeWorkspace::setFrame) the stages are lazy: the virtual
+ *             image is only regenerated if the disparity map, the base image
+ *             or the warp settings changed (see updateVirtualImage), the mask
+ *             if the control image or the mask settings changed (see
+ *             updateMask), and the indices if any of those or the stats
+ *             settings changed. E.g. changing the RoI only reruns the stats,
+ *             and changing the rig does not rebuild the mask. Without a token
+ *             all the stages run.
+ *
+ *             The intermediate images and all the results are written into
+ *             the workspace, which is the only state this method changes.
  *
  * \author     Sandino Morales.
  * \date       29.10.2010
@@ -115,44 +228,884 @@ void CThirdEyeEvaluation::setParams( const float f_baseLine_f,
  * \param[in]  const cv::Mat f_dispMap: Input disparity map.
  * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
  * \param[in]  const cv::Mat f_controlImg: Control image, for evaluation.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Buffers and results.
  * \param[out] float &f_fullIndex_f: NCC index computed from the full approach.
  * \param[out] float &f_maskIndex_f: NCC index computed from the masked approach.
  *
- * \return     -
+ * \return     True if everything went well. False otherwise.
  *************************************************************************** */
-void CThirdEyeEvaluation::computeEvaluationIndices( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+bool CThirdEyeEvaluation::computeEvaluationIndices( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
 						    const cv::Mat f_controlImg,
-						    float &f_fullIndex_f, float &f_maskIndex_f )
+						    SThirdEyeWorkspace &f_workspace,
+						    float &f_fullIndex_f, float &f_maskIndex_f ) const
 {
   if( f_dispMap.empty() || f_baseImg.empty() || f_controlImg.empty() )
   {
-    cout << "CThirdEyeEvaluation::computeEvaluationIndices: An input image is missing!\n";
-    return;
+    cerr << "CThirdEyeEvaluation::computeEvaluationIndices: An input image is missing!\n";
+    return false;
+  }
+
+  configure( f_workspace );
+
+  if( m_latencyBudget_f > 0.f )
+  {
+    return evaluateAdaptive( f_dispMap, f_baseImg, f_controlImg, f_workspace,
+			     f_fullIndex_f, f_maskIndex_f );
+  }
+
+  f_workspace.m_quality_e = QUALITY_FULL;
+
+  // Nothing changed since the last evaluation
+  if( isCached( f_dispMap, f_baseImg, f_controlImg, f_workspace ) )
+  {
+    f_fullIndex_f = f_workspace.m_fullIndex_f;
+    f_maskIndex_f = f_workspace.m_maskIndex_f;
+    return true;
+  }
+  f_workspace.m_statsSettings = 0;
+
+  // The pyramid band is an NCC band: the census is always evaluated at
+  // full resolution
+  f_workspace.m_coarseResult_b = false;
+  if( m_pyramid_b && m_indexType_e != INDEX_CENSUS )
+  {
+    // Coarse results are not cached
+    if( evaluateCoarse( f_dispMap, f_baseImg, f_controlImg, f_workspace,
+			f_fullIndex_f, f_maskIndex_f ) &&
+	( f_fullIndex_f < m_pyramidLow_f || f_fullIndex_f > m_pyramidHigh_f ) )
+    {
+      f_workspace.m_coarseResult_b = true;
+      return true;
+    }
+  }
+
+  return evaluateFull( f_dispMap, f_baseImg, f_controlImg, f_workspace,
+		       f_fullIndex_f, f_maskIndex_f );
+}
+
+/* *************************** METHOD ************************************** */
+/* isCached
+ *
+ * \brief      True if the indices of a workspace were computed from the given
+ *             images and the current settings (see computeEvaluationIndices).
+ *
+ * \return     True if the cached indices are valid.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::isCached( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+				    const cv::Mat f_controlImg,
+				    const SThirdEyeWorkspace &f_workspace ) const
+{
+  return f_workspace.m_statsSettings == m_statsSettings &&
+         isCurrent( f_workspace.m_warpFrame, f_workspace.m_frame,
+		    f_workspace.m_warpSettings, m_warpSettings,
+		    f_workspace.m_warpDisparity, f_dispMap, f_workspace.m_warpBase, f_baseImg ) &&
+         isCurrent( f_workspace.m_maskFrame, f_workspace.m_frame,
+		    f_workspace.m_maskSettings, m_maskSettings,
+		    f_workspace.m_maskControl, f_controlImg, f_workspace.m_maskControl, f_controlImg ) &&
+         f_workspace.m_statsWarp == f_workspace.m_warpStamp &&
+         f_workspace.m_statsMask == f_workspace.m_maskStamp;
+}
+
+/* *************************** METHOD ************************************** */
+/* evaluateFull
+ *
+ * \brief      Full resolution evaluation: virtual image, mask and indices.
+ *             The first two are only recomputed if needed (see
+ *             updateVirtualImage and updateMask); the indices are kept in the
+ *             workspace for isCached.
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
+ * \param[in]  const cv::Mat f_controlImg: Control image, for evaluation.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Buffers and results.
+ * \param[out] float &f_fullIndex_f: Index of the full approach.
+ * \param[out] float &f_maskIndex_f: Index of the masked approach.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::evaluateFull( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+					const cv::Mat f_controlImg,
+					SThirdEyeWorkspace &f_workspace,
+					float &f_fullIndex_f, float &f_maskIndex_f ) const
+{
+  f_workspace.m_statsSettings = 0;
+
+  // Generate the virtual image and the mask (the latter is required before
+  // computing the error), unless they are still valid
+  if( !updateVirtualImage( f_dispMap, f_baseImg, f_workspace ) ||
+      !updateMask( f_controlImg, f_workspace ) )
+  {
+    return false;
+  }
+
+  if( !evaluateStats( f_controlImg, f_workspace.m_maskGenerator.getMask(), f_workspace,
+		      f_fullIndex_f, f_maskIndex_f ) )
+  {
+    return false;
+  }
+
+  f_workspace.m_fullIndex_f   = f_fullIndex_f;
+  f_workspace.m_maskIndex_f   = f_maskIndex_f;
+  f_workspace.m_statsWarp     = f_workspace.m_warpStamp;
+  f_workspace.m_statsMask     = f_workspace.m_maskStamp;
+  f_workspace.m_statsSettings = m_statsSettings;
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* evaluateStats
+ *
+ * \brief      Stats stage: the NCC or census indices (see setIndexType) of
+ *             the virtual image of the workspace, with the given mask.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image, for evaluation.
+ * \param[in]  const cv::Mat f_mask: Mask of the masked approach.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Virtual image and results.
+ * \param[out] float &f_fullIndex_f: Index of the full approach.
+ * \param[out] float &f_maskIndex_f: Index of the masked approach.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::evaluateStats( const cv::Mat f_controlImg, const cv::Mat f_mask,
+					 SThirdEyeWorkspace &f_workspace,
+					 float &f_fullIndex_f, float &f_maskIndex_f ) const
+{
+  if( m_indexType_e == INDEX_CENSUS )
+  {
+    if( !f_workspace.m_censusCalculator.evaluate( f_controlImg, f_workspace.m_virtualImage,
+						  f_mask ) )
+    {
+      return false;
+    }
+    f_fullIndex_f = f_workspace.m_censusCalculator.getIndex();
+    f_maskIndex_f = f_workspace.m_censusCalculator.getIndexMask();
+    return true;
   }
-	
-  // Generate the virtual image
-  m_virtualImgGenerator.generateVirtualImage( f_dispMap, f_baseImg, m_virtualImage );
 
-  // Generate the mask image. Required before computing the error
-  m_maskGenerator.generateImageMask( f_controlImg );
-	
   // Calculate the error indices
-  m_errorCalculator.evaluate( f_controlImg, m_virtualImage, 
-			      m_maskGenerator.getMask() );
+  if( !f_workspace.m_errorCalculator.evaluate( f_controlImg, f_workspace.m_virtualImage, 
+					       f_mask, f_workspace.m_sourceDisparity ) )
+  {
+    return false;
+  }
   // Get the error indices
-  f_fullIndex_f = m_errorCalculator.getNCC();
-  f_maskIndex_f = m_errorCalculator.getNCCmask();
+  f_fullIndex_f = f_workspace.m_errorCalculator.getNCC();
+  f_maskIndex_f = f_workspace.m_errorCalculator.getNCCmask();
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* evaluateAdaptive
+ *
+ * \brief      Adaptive mode (see setLatencyBudget). Evaluates at the level
+ *             chosen by the quality control of the workspace (see
+ *             CThirdEyeQualityControl) and gives it the measured time. Times
+ *             of frames whose virtual image was cached are not measurements.
+ *             At QUALITY_SAMPLED no index is computed: the estimate and its
+ *             interval go to the workspace (m_estimate_f).
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
+ * \param[in]  const cv::Mat f_controlImg: Control image, for evaluation.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Buffers, results, quality
+ *             level and times.
+ * \param[out] float &f_fullIndex_f: Index of the full approach. -32000 at
+ *             QUALITY_SAMPLED.
+ * \param[out] float &f_maskIndex_f: Index of the masked approach. -32000 at
+ *             QUALITY_SAMPLED.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::evaluateAdaptive( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+					    const cv::Mat f_controlImg,
+					    SThirdEyeWorkspace &f_workspace,
+					    float &f_fullIndex_f, float &f_maskIndex_f ) const
+{
+  // The census index is only computed at the two full resolution levels
+  const unsigned numLevels_ui = ( m_indexType_e == INDEX_CENSUS ) ?
+                                static_cast<unsigned>( QUALITY_COARSE ) :
+                                static_cast<unsigned>( QUALITY_NUM_LEVELS );
+  const EThirdEyeQuality quality_e = f_workspace.m_qualityControl.choose( m_latencyBudget_f,
+									  numLevels_ui );
+  const uint64_t warpStamp = f_workspace.m_warpStamp;
+  const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  f_workspace.m_quality_e       = quality_e;
+  f_workspace.m_coarseResult_b  = false;
+  f_workspace.m_estimate_f      = -32000.f;
+  f_workspace.m_estimateLower_f = -32000.f;
+  f_workspace.m_estimateUpper_f = -32000.f;
+
+  bool ok_b = false;
+  bool cached_b = false;
+  switch( quality_e )
+  {
+  case QUALITY_FULL:
+    cached_b = isCached( f_dispMap, f_baseImg, f_controlImg, f_workspace );
+    if( cached_b )
+    {
+      f_fullIndex_f = f_workspace.m_fullIndex_f;
+      f_maskIndex_f = f_workspace.m_maskIndex_f;
+      ok_b = true;
+    }
+    else
+    {
+      ok_b = evaluateFull( f_dispMap, f_baseImg, f_controlImg, f_workspace,
+			   f_fullIndex_f, f_maskIndex_f );
+    }
+    break;
+
+  case QUALITY_COARSE_MASK:
+    f_workspace.m_statsSettings = 0;
+    ok_b = updateVirtualImage( f_dispMap, f_baseImg, f_workspace ) &&
+           generateCoarseMask( f_controlImg, f_workspace ) &&
+           evaluateStats( f_controlImg, f_workspace.m_halfMask, f_workspace,
+			  f_fullIndex_f, f_maskIndex_f );
+    cached_b = ( warpStamp == f_workspace.m_warpStamp );
+    break;
+
+  case QUALITY_COARSE:
+    ok_b = evaluateCoarse( f_dispMap, f_baseImg, f_controlImg, f_workspace,
+			   f_fullIndex_f, f_maskIndex_f );
+    f_workspace.m_coarseResult_b = ok_b;
+    break;
+
+  default:
+    ok_b = estimateEvaluationIndex( f_dispMap, f_baseImg, f_controlImg, f_workspace,
+				    f_workspace.m_estimate_f, f_workspace.m_estimateLower_f,
+				    f_workspace.m_estimateUpper_f );
+    f_fullIndex_f = -32000.f;
+    f_maskIndex_f = -32000.f;
+    break;
+  }
+
+  const float time_f = std::chrono::duration<float, std::milli>( std::chrono::steady_clock::now() -
+								 start ).count();
+  f_workspace.m_lastTime_f = time_f;
+  f_workspace.m_qualityControl.record( quality_e, time_f, m_latencyBudget_f, ok_b && !cached_b );
+
+  return ok_b;
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard constructor
+ *
+ * \brief      No level has an expected time yet.
+ *************************************************************************** */
+CThirdEyeQualityControl::CThirdEyeQualityControl()
+  : m_level_e( QUALITY_FULL ),
+    m_roomFrames_ui( 0 ),
+    m_probeWait_ui( PROBE_FRAMES_UI ),
+    m_probe_i( -1 )
+{
+  for( unsigned i = 0; i < QUALITY_NUM_LEVELS; ++i )
+  {
+    m_levelTime_f[ i ] = -1.f;
+  }
+}
+
+/* *************************** METHOD ************************************** */
+/* choose
+ *
+ * \brief      Most expensive level whose expected time is within 90% of the
+ *             budget. Levels without a measured time are predicted from the
+ *             nearest measured one with their nominal relative cost; with no
+ *             measurement at all the full evaluation is done (and measured).
+ *             The least expensive level is used if none fits.
+ *
+ * \param[in]  const float f_budget_f: Budget (ms).
+ * \param[in]  const unsigned f_numLevels_ui: Number of levels to choose from.
+ *
+ * \return     The quality level.
+ *************************************************************************** */
+EThirdEyeQuality CThirdEyeQualityControl::choose( const float f_budget_f,
+						  const unsigned f_numLevels_ui ) const
+{
+  const float limit_f = BUDGET_LIMIT_F * f_budget_f;
+
+  for( unsigned level_ui = 0; level_ui < f_numLevels_ui; ++level_ui )
+  {
+    float expected_f = m_levelTime_f[ level_ui ];
+    if( expected_f < 0.f )
+    {
+      // Nearest measured level
+      int known_i = -1;
+      for( unsigned k = 0; k < QUALITY_NUM_LEVELS; ++k )
+      {
+	if( m_levelTime_f[ k ] >= 0.f &&
+	    ( known_i < 0 || std::abs( static_cast<int>( k ) - static_cast<int>( level_ui ) ) <
+	                     std::abs( known_i - static_cast<int>( level_ui ) ) ) )
+	{
+	  known_i = static_cast<int>( k );
+	}
+      }
+      if( known_i < 0 )
+      {
+	return QUALITY_FULL;
+      }
+      expected_f = m_levelTime_f[ known_i ] * NOMINAL_COST_F[ level_ui ] / NOMINAL_COST_F[ known_i ];
+    }
+
+    if( expected_f <= limit_f )
+    {
+      return static_cast<EThirdEyeQuality>( level_ui );
+    }
+  }
+
+  return static_cast<EThirdEyeQuality>( f_numLevels_ui - 1 );
 }
 
+/* *************************** METHOD ************************************** */
+/* record
+ *
+ * \brief      Updates the expected time of the level with a measured time.
+ *             Times go up fast and down slowly, and a time above the limit
+ *             of choose is taken as it is, so one slow frame is enough to
+ *             step down. After m_probeWait_ui frames in a row under half the
+ *             budget, the next more expensive level gets the time predicted
+ *             from this one with the nominal costs, if that time fits and is
+ *             below its own, so choose tries it on the next frame. The
+ *             outcome of that probe sets the wait for the next one.
+ *
+ * \param[in]  const EThirdEyeQuality f_quality_e: Level of the evaluation.
+ * \param[in]  const float f_time_f: Time of the evaluation (ms).
+ * \param[in]  const float f_budget_f: Budget (ms).
+ * \param[in]  const bool f_measured_b: False if the time is not a
+ *             measurement of the level (cached or failed evaluation).
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeQualityControl::record( const EThirdEyeQuality f_quality_e, const float f_time_f,
+				      const float f_budget_f, const bool f_measured_b )
+{
+  const float limit_f = BUDGET_LIMIT_F * f_budget_f;
+
+  if( f_measured_b )
+  {
+    float &expected_f = m_levelTime_f[ f_quality_e ];
+    if( expected_f < 0.f || f_time_f > limit_f )
+    {
+      expected_f = std::max( expected_f, f_time_f );
+    }
+    else
+    {
+      const float weight_f = ( f_time_f > expected_f ) ? 0.5f : 0.1f;
+      expected_f += weight_f * ( f_time_f - expected_f );
+    }
+
+    // Outcome of a probe
+    if( m_probe_i == static_cast<int>( f_quality_e ) )
+    {
+      m_probeWait_ui = ( f_time_f > limit_f ) ? std::min( 2 * m_probeWait_ui, MAX_PROBE_WAIT_UI ) :
+                                                PROBE_FRAMES_UI;
+      m_probe_i = -1;
+    }
+  }
+
+  if( f_quality_e != m_level_e )
+  {
+    m_level_e       = f_quality_e;
+    m_roomFrames_ui = 0;
+  }
+  m_roomFrames_ui = ( f_time_f <= BUDGET_ROOM_F * f_budget_f ) ? m_roomFrames_ui + 1 : 0;
+
+  const float current_f = m_levelTime_f[ f_quality_e ];
+  if( f_quality_e == QUALITY_FULL || m_roomFrames_ui < m_probeWait_ui || current_f < 0.f )
+  {
+    return;
+  }
+  m_roomFrames_ui = 0;
+
+  const unsigned upper_ui = static_cast<unsigned>( f_quality_e ) - 1;
+  const float predicted_f = current_f * NOMINAL_COST_F[ upper_ui ] / NOMINAL_COST_F[ f_quality_e ];
+  if( predicted_f <= limit_f &&
+      ( m_levelTime_f[ upper_ui ] < 0.f || predicted_f < m_levelTime_f[ upper_ui ] ) )
+  {
+    m_levelTime_f[ upper_ui ] = predicted_f;
+    m_probe_i = static_cast<int>( upper_ui );
+  }
+}
+
+/* *************************** METHOD ************************************** */
+/* generateCoarseMask
+ *
+ * \brief      Mask of QUALITY_COARSE_MASK: generated from the control image
+ *             at 1/2 of the resolution (with the distance threshold scaled
+ *             accordingly) and brought back to full resolution by nearest
+ *             neighbour. The gradient and distance transform cost about a
+ *             quarter.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Holds the mask (m_halfMask).
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::generateCoarseMask( const cv::Mat f_controlImg,
+					      SThirdEyeWorkspace &f_workspace ) const
+{
+  const cv::Size halfSize( std::max( f_controlImg.cols / 2, 1 ),
+			   std::max( f_controlImg.rows / 2, 1 ) );
+  imagePool().create( f_workspace.m_halfControl, halfSize, f_controlImg.type() );
+  cv::resize( f_controlImg, f_workspace.m_halfControl, halfSize, 0, 0, cv::INTER_AREA );
+
+  CThirdEyeMask &halfMaskGenerator = f_workspace.m_halfMaskGenerator;
+  halfMaskGenerator.setParams( m_maskGenerator.getThresholdGradient(),
+			       m_maskGenerator.getThresholdDistance() * 0.5f );
+  halfMaskGenerator.setIntensityScale( m_maskGenerator.getIntensityScale() );
+  halfMaskGenerator.setNumThreads( m_maskGenerator.getNumThreads() );
+  if( !halfMaskGenerator.generateImageMask( f_workspace.m_halfControl ) )
+  {
+    return false;
+  }
+
+  imagePool().create( f_workspace.m_halfMask, f_controlImg.size(), CV_32FC1 );
+  cv::resize( halfMaskGenerator.getMask(), f_workspace.m_halfMask, f_controlImg.size(),
+	      0, 0, cv::INTER_NEAREST );
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* updateVirtualImage
+ *
+ * \brief      Warp stage. Generates the virtual image of a workspace unless
+ *             it was generated for the same frame token, from the same
+ *             disparity map and base image, with the current warp settings. A new virtual image gets a new
+ *             stamp, which invalidates the indices computed from the old one.
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Holds the virtual image.
+ *
+ * \return     True if the virtual image is valid. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::updateVirtualImage( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+					      SThirdEyeWorkspace &f_workspace ) const
+{
+  if( isCurrent( f_workspace.m_warpFrame, f_workspace.m_frame,
+		 f_workspace.m_warpSettings, m_warpSettings,
+		 f_workspace.m_warpDisparity, f_dispMap, f_workspace.m_warpBase, f_baseImg ) )
+  {
+    return true;
+  }
+
+  f_workspace.m_warpSettings = 0;
+  if( !m_virtualImgGenerator.generateVirtualImage( f_dispMap, f_baseImg, 
+						   f_workspace.m_virtualImage,
+						   f_workspace.m_sourceDisparity ) )
+  {
+    return false;
+  }
+
+  f_workspace.m_warpFrame     = f_workspace.m_frame;
+  f_workspace.m_warpDisparity = f_dispMap;
+  f_workspace.m_warpBase      = f_baseImg;
+  f_workspace.m_warpSettings  = m_warpSettings;
+  f_workspace.m_warpStamp     = newStamp();
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* updateMask
+ *
+ * \brief      Mask stage. Same as updateVirtualImage, for the mask of the
+ *             control image. The workspace must be configured.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Holds the mask.
+ *
+ * \return     True if the mask is valid. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::updateMask( const cv::Mat f_controlImg,
+				      SThirdEyeWorkspace &f_workspace ) const
+{
+  if( isCurrent( f_workspace.m_maskFrame, f_workspace.m_frame,
+		 f_workspace.m_maskSettings, m_maskSettings,
+		 f_workspace.m_maskControl, f_controlImg, f_workspace.m_maskControl, f_controlImg ) )
+  {
+    return true;
+  }
+
+  f_workspace.m_maskSettings = 0;
+  if( !f_workspace.m_maskGenerator.generateImageMask( f_controlImg ) )
+  {
+    return false;
+  }
+
+  f_workspace.m_maskFrame    = f_workspace.m_frame;
+  f_workspace.m_maskControl  = f_controlImg;
+  f_workspace.m_maskSettings = m_maskSettings;
+  f_workspace.m_maskStamp    = newStamp();
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* runWarpStage
+ *
+ * \brief      Runs the warp stage alone (see updateVirtualImage), e.g. in
+ *             another thread than the stats of the same frame.
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Holds the virtual image.
+ *
+ * \return     True if the virtual image is valid. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::runWarpStage( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+					SThirdEyeWorkspace &f_workspace ) const
+{
+  return updateVirtualImage( f_dispMap, f_baseImg, f_workspace );
+}
+
+/* *************************** METHOD ************************************** */
+/* runMaskStage
+ *
+ * \brief      Runs the mask stage alone (see updateMask), with the mask
+ *             settings of this evaluation.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Holds the mask.
+ *
+ * \return     True if the mask is valid. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::runMaskStage( const cv::Mat f_controlImg,
+					SThirdEyeWorkspace &f_workspace ) const
+{
+  configure( f_workspace );
+  return updateMask( f_controlImg, f_workspace );
+}
+
+/* *************************** METHOD ************************************** */
+/* configure
+ *
+ * \brief      Copies the settings of the evaluation into the objects of a
+ *             workspace. Only settings are copied, the buffers of the
+ *             workspace are kept.
+ *
+ * \param[out] SThirdEyeWorkspace &f_workspace: Workspace to configure.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeEvaluation::configure( SThirdEyeWorkspace &f_workspace ) const
+{
+  f_workspace.m_maskGenerator.setParams( m_maskGenerator.getThresholdGradient(),
+					 m_maskGenerator.getThresholdDistance() );
+  f_workspace.m_maskGenerator.setIntensityScale( m_maskGenerator.getIntensityScale() );
+  f_workspace.m_maskGenerator.setNumThreads( m_maskGenerator.getNumThreads() );
+  f_workspace.m_errorCalculator.setConfiguration( m_errorCalculator );
+  f_workspace.m_censusCalculator.setConfiguration( m_censusCalculator );
+}
+
+/* *************************** METHOD ************************************** */
+/* evaluateCoarse
+ *
+ * \brief      Computes the NCC indices at 1/4 of the resolution. The base and
+ *             control images are downsampled by area averaging, the disparity
+ *             map by nearest neighbour (averaging would mix depths): each
+ *             coarse pixel takes the disparity at the center of its 4x4
+ *             block, (4y+2, 4x+2), and the values are scaled by 1/4; invalid
+ *             values are kept. For 16-bit fixed point maps the codes are kept
+ *             and the coarse warp uses two more fractional bits instead, which
+ *             is the same 1/4 scaling without rounding. The focal lengths, the
+ *             RoI and the distance threshold of the mask are scaled
+ *             accordingly; the principal points are also moved to the centers
+ *             of the blocks, which are at 4x+1.5 in full resolution pixels. It
+ *             is about 16 times cheaper than the full resolution evaluation.
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
+ * \param[in]  const cv::Mat f_controlImg: Control image, for evaluation.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Buffers and results.
+ * \param[out] float &f_fullIndex_f: Coarse NCC index of the full approach.
+ * \param[out] float &f_maskIndex_f: Coarse NCC index of the masked approach.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::evaluateCoarse( const cv::Mat f_dispMap, const cv::Mat f_baseImg,
+					  const cv::Mat f_controlImg,
+					  SThirdEyeWorkspace &f_workspace,
+					  float &f_fullIndex_f, float &f_maskIndex_f ) const
+{
+  const unsigned factor_ui = 4;
+  const float    scale_f   = 1.f / factor_ui;
+
+  const cv::Size size( f_baseImg.cols / factor_ui, f_baseImg.rows / factor_ui );
+  if( size.width == 0 || size.height == 0 || f_dispMap.size() != f_baseImg.size() )
+  {
+    cerr << "CThirdEyeEvaluation::evaluateCoarse: The input images do not match!\n";
+    return false;
+  }
+
+  cv::Mat &base    = f_workspace.m_coarseBase;
+  cv::Mat &control = f_workspace.m_coarseControl;
+  cv::Mat &disp    = f_workspace.m_coarseDisparity;
+  imagePool().create( base,    size, f_baseImg.type() );
+  imagePool().create( control, size, f_controlImg.type() );
+  cv::resize( f_baseImg,    base,    size, 0, 0, cv::INTER_AREA );
+  cv::resize( f_controlImg, control, size, 0, 0, cv::INTER_AREA );
+
+  // Same settings as the full resolution generator, the geometry is scaled
+  // below
+  CThirdEye &coarseImgGenerator = f_workspace.m_coarseImgGenerator;
+  coarseImgGenerator = m_virtualImgGenerator;
+
+  // Disparity at the center of each block (the size is rounded down, so the
+  // centers are within the map)
+  const unsigned center_ui = factor_ui / 2;
+
+  imagePool().create( disp, size, f_dispMap.type() );
+  if( f_dispMap.type() == CV_16UC1 )
+  {
+    for( unsigned y = 0; y < static_cast<unsigned>( size.height ); ++y )
+    {
+      const ushort* src_p = f_dispMap.ptr<ushort>( y * factor_ui + center_ui );
+      ushort*       dst_p = disp.ptr<ushort>( y );
+      for( unsigned x = 0; x < static_cast<unsigned>( size.width ); ++x )
+      {
+	dst_p[ x ] = src_p[ x * factor_ui + center_ui ];
+      }
+    }
+    // factor_ui = 2^2
+    coarseImgGenerator.setSubpixelBits( m_virtualImgGenerator.getSubpixelBits() + 2 );
+  }
+  else
+  {
+    const float invalid_f = m_virtualImgGenerator.getInvalidValue();
+    for( unsigned y = 0; y < static_cast<unsigned>( size.height ); ++y )
+    {
+      const float* src_p = f_dispMap.ptr<float>( y * factor_ui + center_ui );
+      float*       dst_p = disp.ptr<float>( y );
+      for( unsigned x = 0; x < static_cast<unsigned>( size.width ); ++x )
+      {
+	const float disparity_f = src_p[ x * factor_ui + center_ui ];
+	dst_p[ x ] = ( disparity_f == invalid_f ) ? invalid_f : disparity_f * scale_f;
+      }
+    }
+  }
+
+  // Same geometry, in coarse pixels: coarse pixel x covers the full
+  // resolution pixels [4x, 4x+3], its center is at 4x+1.5
+  const float offset_f = 0.5f * ( factor_ui - 1 );
+  SThirdEyeParams params( m_virtualImgGenerator.getParams() );
+  params.m_principalPointBaseX_f    = ( params.m_principalPointBaseX_f    - offset_f ) * scale_f;
+  params.m_principalPointBaseY_f    = ( params.m_principalPointBaseY_f    - offset_f ) * scale_f;
+  params.m_focalLengthBaseX_f       *= scale_f;
+  params.m_focalLengthBaseY_f       *= scale_f;
+  params.m_principalPointControlX_f = ( params.m_principalPointControlX_f - offset_f ) * scale_f;
+  params.m_principalPointControlY_f = ( params.m_principalPointControlY_f - offset_f ) * scale_f;
+  params.m_focalLengthControlX_f    *= scale_f;
+  params.m_focalLengthControlY_f    *= scale_f;
+  coarseImgGenerator.setParams( params );
+
+  CThirdEyeMask &coarseMaskGenerator = f_workspace.m_coarseMaskGenerator;
+  coarseMaskGenerator.setParams( m_maskGenerator.getThresholdGradient(),
+				 m_maskGenerator.getThresholdDistance() * scale_f );
+  coarseMaskGenerator.setIntensityScale( m_maskGenerator.getIntensityScale() );
+
+  CThirdEyeStats &coarseCalculator = f_workspace.m_coarseCalculator;
+  coarseCalculator.setIntensityScale( m_errorCalculator.getIntensityScale() );
+
+  const cv::Rect roi = m_errorCalculator.getROI();
+  const unsigned x1_ui = roi.x / factor_ui;
+  const unsigned y1_ui = roi.y / factor_ui;
+  coarseCalculator.setROI( x1_ui, y1_ui,
+			     std::max( x1_ui + 1, static_cast<unsigned>( roi.br().x ) / factor_ui ),
+			     std::max( y1_ui + 1, static_cast<unsigned>( roi.br().y ) / factor_ui ) );
+  // A few row blocks only, not worth the threads
+  coarseImgGenerator.setNumThreads( 1 );
+  coarseMaskGenerator.setNumThreads( 1 );
+  coarseCalculator.setNumThreads( 1 );
+
+  if( !coarseImgGenerator.generateVirtualImage( disp, base, f_workspace.m_coarseVirtualImage,
+						f_workspace.m_coarseSourceDisparity ) ||
+      !coarseMaskGenerator.generateImageMask( control ) ||
+      !coarseCalculator.evaluate( control, f_workspace.m_coarseVirtualImage, 
+				  coarseMaskGenerator.getMask() ) )
+  {
+    return false;
+  }
+
+  f_fullIndex_f = coarseCalculator.getNCC();
+  f_maskIndex_f = coarseCalculator.getNCCmask();
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* estimateEvaluationIndex
+ *
+ * \brief      Same as the const overload below, with the internal workspace.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::estimateEvaluationIndex( const cv::Mat f_dispMap, 
+						   const cv::Mat f_baseImg,
+						   const cv::Mat f_controlImg,
+						   float &f_index_f,
+						   float &f_lower_f, float &f_upper_f )
+{
+  return estimateEvaluationIndex( f_dispMap, f_baseImg, f_controlImg, m_workspace,
+				  f_index_f, f_lower_f, f_upper_f );
+}
+
+/* *************************** METHOD ************************************** */
+/* estimateEvaluationIndex (const)
+ *
+ * \brief      Estimates the NCC index of the full approach from a stratified
+ *             pseudo-random subset of the base pixels (see setSampling), for
+ *             fast screening. Only the sampled disparities are read and warped
+ *             (see CThirdEye::projectPoints), and only the resulting pairs
+ *             are scored, so the whole cost scales with the sampling rate.
+ *             The sampling pattern depends only on the image size, the rate
+ *             and the seed, so the estimate is reproducible.
+ *
+ *             The pairs are the base intensity and the control intensity at
+ *             the warped position, if that position is within the RoI. No
+ *             occlusion handling is done and the background of the virtual
+ *             image is not scored, so the estimate converges to the NCC of
+ *             the mapped pixels rather than to the exact index.
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map.
+ * \param[in]  const cv::Mat f_baseImg: Base image from a stereo pair.
+ * \param[in]  const cv::Mat f_controlImg: Control image, for evaluation.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Sampling pattern, kept for
+ *             the next calls.
+ * \param[out] float &f_index_f: Estimated NCC index (* 100).
+ * \param[out] float &f_lower_f: Lower bound of the 95% confidence interval.
+ * \param[out] float &f_upper_f: Upper bound of the 95% confidence interval.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeEvaluation::estimateEvaluationIndex( const cv::Mat f_dispMap, 
+						   const cv::Mat f_baseImg,
+						   const cv::Mat f_controlImg,
+						   SThirdEyeWorkspace &f_workspace,
+						   float &f_index_f,
+						   float &f_lower_f, float &f_upper_f ) const
+{
+  f_index_f = -32000.f;
+  f_lower_f = -32000.f;
+  f_upper_f = -32000.f;
+
+  if( f_dispMap.empty() || f_baseImg.empty() || f_controlImg.empty() )
+  {
+    cerr << "CThirdEyeEvaluation::estimateEvaluationIndex: An input image is missing!\n";
+    return false;
+  }
+
+  if( f_dispMap.size() != f_baseImg.size() || f_baseImg.size() != f_controlImg.size() )
+  {
+    cerr << "CThirdEyeEvaluation::estimateEvaluationIndex: The input images do not match!\n";
+    return false;
+  }
+
+  if( f_workspace.m_samples.empty() || f_workspace.m_samplesSize != f_baseImg.size() ||
+      f_workspace.m_samplingRate_f != m_samplingRate_f ||
+      f_workspace.m_samplingSeed_ui != m_samplingSeed_ui )
+  {
+    generateSamples( f_baseImg.size(), f_workspace );
+  }
+
+  const std::vector<cv::Point> &samples        = f_workspace.m_samples;
+  std::vector<cv::Point>       &virtualSamples = f_workspace.m_virtualSamples;
+  if( !m_virtualImgGenerator.projectPoints( f_dispMap, samples, virtualSamples ) )
+  {
+    return false;
+  }
+
+  const cv::Rect roi = m_errorCalculator.getROI();
+
+  SNCCMoments moments;
+  bool shifted_b = false;
+  for( size_t i = 0; i < samples.size(); ++i )
+  {
+    const cv::Point &virt = virtualSamples[ i ];
+    if( !roi.contains( virt ) )
+    {
+      continue;
+    }
+
+    const float control_f = pixelValue( f_controlImg, virt.y, virt.x );
+    const float base_f    = pixelValue( f_baseImg, samples[ i ].y, samples[ i ].x );
+
+    // Shift by the first pair, see SNCCMoments
+    if( !shifted_b )
+    {
+      moments.reset( control_f, base_f );
+      shifted_b = true;
+    }
+    moments.add( control_f, base_f );
+  }
+
+  double ncc_d = 0.0, lower_d = 0.0, upper_d = 0.0;
+  if( !moments.ncc( ncc_d ) || !moments.nccInterval( lower_d, upper_d ) )
+  {
+    cerr << "CThirdEyeEvaluation::estimateEvaluationIndex: Not enough samples!\n";
+    return false;
+  }
+
+  f_index_f = static_cast<float>( ncc_d   * 100.0 );
+  f_lower_f = static_cast<float>( lower_d * 100.0 );
+  f_upper_f = static_cast<float>( upper_d * 100.0 );
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* generateSamples
+ *
+ * \brief      Generates the stratified sampling pattern. The image is split
+ *             in tiles of about 1 / rate pixels, one position is drawn per
+ *             tile. The positions are drawn from a std::mt19937 (whose output
+ *             is fully specified) with a plain modulo, so the pattern is the
+ *             same on every platform. The samples are sorted by row.
+ *
+ * \param[in]  const cv::Size f_size: Size of the images.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Workspace that keeps the
+ *             pattern.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeEvaluation::generateSamples( const cv::Size f_size, 
+					   SThirdEyeWorkspace &f_workspace ) const
+{
+  std::vector<cv::Point> &samples = f_workspace.m_samples;
+  samples.clear();
+  f_workspace.m_samplesSize     = f_size;
+  f_workspace.m_samplingRate_f  = m_samplingRate_f;
+  f_workspace.m_samplingSeed_ui = m_samplingSeed_ui;
+
+  const float rate_f = std::min( std::max( m_samplingRate_f, 1e-6f ), 1.f );
+
+  // Tiles of tileW x tileH ~ 1 / rate pixels, as square as possible
+  const unsigned tileW_ui = std::max( 1, static_cast<int>( std::ceil( std::sqrt( 1.f / rate_f ) ) ) );
+  const unsigned tileH_ui = std::max( 1, static_cast<int>( std::floor( 1.f / ( rate_f * tileW_ui ) + 0.5f ) ) );
+
+  std::mt19937 generator( m_samplingSeed_ui );
+
+  for( unsigned y0 = 0; y0 < static_cast<unsigned>( f_size.height ); y0 += tileH_ui )
+  {
+    const unsigned h_ui = std::min( tileH_ui, f_size.height - y0 );
+    for( unsigned x0 = 0; x0 < static_cast<unsigned>( f_size.width ); x0 += tileW_ui )
+    {
+      const unsigned w_ui      = std::min( tileW_ui, f_size.width - x0 );
+      const unsigned offset_ui = generator() % ( w_ui * h_ui );
+      samples.push_back( cv::Point( x0 + offset_ui % w_ui, y0 + offset_ui / w_ui ) );
+    }
+  }
+}
 
 /* *************************** METHOD ************************************** */
 /* getVirtualImage
  *
- * \brief      Returns the generated virtual image.
+ * \brief      Generates the virtual image of the given inputs, into the
+ *             internal workspace.
  * \author     Sandino Morales.
  * \date       01.09.2015
  *
- * \param[in]  const cv::Mat f_dispMap: Input disparity map (32 float).
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map (32 float or
+ *             16-bit fixed point).
  * \param[in]  const cv::Mat f_baseImg: Base image of the stereo pair.
  *
  * \return     cv::Mat: The generated virtual image.
@@ -160,17 +1113,59 @@ void CThirdEyeEvaluation::computeEvaluationIndices( const cv::Mat f_dispMap, con
 cv::Mat CThirdEyeEvaluation::getVirtualImage( const cv::Mat f_dispMap, 
 					      const cv::Mat f_baseImg )
 {
-  // Generate the virtual image if necessary
-  if( m_virtualImage.empty() )
+  return getVirtualImage( f_dispMap, f_baseImg, m_workspace );
+}
+
+/* *************************** METHOD ************************************** */
+/* getVirtualImage (const)
+ *
+ * \brief      Generates the virtual image of the given inputs. The image of
+ *             a previous call is reused if the inputs and the warp settings
+ *             are the same (see updateVirtualImage).
+ *
+ * \param[in]  const cv::Mat f_dispMap: Input disparity map (32 float or
+ *             16-bit fixed point).
+ * \param[in]  const cv::Mat f_baseImg: Base image of the stereo pair.
+ * \param[out] SThirdEyeWorkspace &f_workspace: Holds the virtual image.
+ *
+ * \return     cv::Mat: The generated virtual image. Empty on error.
+ *************************************************************************** */
+cv::Mat CThirdEyeEvaluation::getVirtualImage( const cv::Mat f_dispMap, 
+					      const cv::Mat f_baseImg,
+					      SThirdEyeWorkspace &f_workspace ) const
+{
+  if( !updateVirtualImage( f_dispMap, f_baseImg, f_workspace ) )
   {
-    m_virtualImgGenerator.generateVirtualImage( f_dispMap, f_baseImg, m_virtualImage );
+    return cv::Mat();
   }
 
-  return m_virtualImage;
+  return f_workspace.m_virtualImage;
 }
 
 /* *************************** METHOD ************************************** */
 /* getMask
+ *
+ * \brief      Same as the const overload below, with the internal workspace.
+ *             Thresholds larger than zero are also kept for the next
+ *             evaluations, as CThirdEyeMask::generateImageMask does.
+ *
+ * \return     cv::Mat: The generated masked image.
+ *************************************************************************** */
+cv::Mat CThirdEyeEvaluation::getMask( const cv::Mat f_controlImg,
+				      const float f_thresholdGradient_f, 
+				      const float f_thresholdDistance_f )
+{
+  if( f_thresholdDistance_f > 0.f && f_thresholdGradient_f > 0.f )
+  {
+    m_maskGenerator.setParams( f_thresholdGradient_f, f_thresholdDistance_f );
+    m_maskSettings = newStamp();
+  }
+
+  return getMask( f_controlImg, m_workspace );
+}
+
+/* *************************** METHOD ************************************** */
+/* getMask (const)
  *
  * \brief      Returns a masked image. If the last two parameters are given
  *             a value larger than zero, the mask will be generated using those
@@ -181,6 +1176,7 @@ cv::Mat CThirdEyeEvaluation::getVirtualImage( const cv::Mat f_dispMap,
  * \date       01.09.2015
  *
  * \param[in]  const cv::Mat f_controlImg: Input image (32 float).
+ * \param[out] SThirdEyeWorkspace &f_workspace: Holds the binary mask.
  * \param[in]  const float f_thresholdGradient_f: Defines the length of the gradient.
                This param, has a default value of -1.f.
  * \param[in]  const float f_thresholdDistance_f: Defines the required distance used by
@@ -189,23 +1185,29 @@ cv::Mat CThirdEyeEvaluation::getVirtualImage( const cv::Mat f_dispMap,
  * \return     cv::Mat: The generated masked image.
  *************************************************************************** */
 cv::Mat CThirdEyeEvaluation::getMask( const cv::Mat f_controlImg,
+				      SThirdEyeWorkspace &f_workspace,
 				      const float f_thresholdGradient_f, 
-				      const float f_thresholdDistance_f )
+				      const float f_thresholdDistance_f ) const
 {
+  configure( f_workspace );
+
+  CThirdEyeMask &maskGenerator = f_workspace.m_maskGenerator;
   if( f_thresholdDistance_f > 0.f && f_thresholdGradient_f > 0.f )
   {
-    m_maskGenerator.generateImageMask( f_controlImg,
-				       f_thresholdGradient_f,
-				       f_thresholdDistance_f   );
+    // Not the mask of the settings, so it is not cached
+    f_workspace.m_maskSettings = 0;
+    maskGenerator.generateImageMask( f_controlImg,
+				     f_thresholdGradient_f,
+				     f_thresholdDistance_f   );
   }
   else
   {
-    m_maskGenerator.generateImageMask( f_controlImg );
+    updateMask( f_controlImg, f_workspace );
   }
 
   // This will return a masked image. The binary mask used to generated a masked
   // image can be accessed using CThirdEyeMask::getMask.
-  return m_maskGenerator.maskImage( f_controlImg );  
+  return maskGenerator.maskImage( f_controlImg );  
 }
 
 /* *************************** METHOD ************************************** */
@@ -0,0 +1,349 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeIntegral.cpp
+ *
+ *  \brief   Definition of the class CMomentsIntegral.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyeIntegral.h"
+
+// Project includes
+#include "../h/thirdeyeParallel.h"
+#include "../h/thirdeyePixel.h"
+#include "../h/imagePool.h"
+
+// Common includes
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+using std::cerr;
+
+namespace
+{
+  // Number of channels of the tables
+  const int NUM_MOMENTS_I = 6;
+
+  // Table values (doubles) per column strip summed by a task of
+  // CMomentsIntegral::finish
+  const int STRIP_VALUES_I = 1536;
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard constructor.
+ *
+ * \brief          Standard constructor.
+ *
+ * \return         -
+ *************************************************************************** */
+CMomentsIntegral::CMomentsIntegral()
+  : m_roi(          ),
+    m_shiftC_d( 0.0 ),
+    m_shiftV_d( 0.0 ),
+    m_table(        ),
+    m_tableMask(    )
+{
+  /* Empty body */
+}
+
+/* *************************** METHOD ************************************** */
+/* Standard destructor.
+ *
+ * \brief          Standard destructor.
+ *
+ * \return         -
+ *************************************************************************** */
+CMomentsIntegral::~CMomentsIntegral()
+{
+  /* Empty body */
+}
+
+/* *************************** METHOD ************************************** */
+/* build
+ *
+ * \brief      Computes the integral images of the moments (n, c, v, c^2, v^2
+ *             and cv) of the control and virtual images over the input
+ *             region. If a mask is given, the integral images of the masked
+ *             moments are computed in the same pass. The values are shifted
+ *             (see SNCCMoments) to keep the sums small. Same as begin, addRow
+ *             for each row of the region and finish, with the rows in
+ *             parallel.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image (8 bit, 16 bit or 32 float).
+ * \param[in]  const cv::Mat f_virtualImg: Virtual image (same type).
+ * \param[in]  const cv::Mat f_mask: Mask image (32 float). Can be empty.
+ * \param[in]  const cv::Rect &f_roi: Region of the images to integrate.
+ * \param[in]  const double f_shiftC_d: Shift of the control values.
+ * \param[in]  const double f_shiftV_d: Shift of the virtual values.
+ * \param[in]  const unsigned f_numThreads_ui: Threads (zero for the default).
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CMomentsIntegral::build( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
+			      const cv::Mat f_mask, const cv::Rect &f_roi,
+			      const double f_shiftC_d, const double f_shiftV_d,
+			      const unsigned f_numThreads_ui )
+{
+  if( !begin( f_controlImg.size(), f_roi, !f_mask.empty(), f_shiftC_d, f_shiftV_d ) )
+  {
+    return false;
+  }
+
+  parallelFor( static_cast<unsigned>( f_roi.height ), [&]( const unsigned f_row_ui )
+  {
+    // Conversion buffers (integer images only)
+    std::vector<float> bufferC( f_roi.width );
+    std::vector<float> bufferV( f_roi.width );
+
+    const int y_i = f_roi.y + static_cast<int>( f_row_ui );
+    addRow( y_i,
+	    rowAsFloat( f_controlImg, y_i, f_roi.x, f_roi.width, &bufferC[ 0 ] ),
+	    rowAsFloat( f_virtualImg, y_i, f_roi.x, f_roi.width, &bufferV[ 0 ] ),
+	    f_mask.empty() ? nullptr : f_mask.ptr<float>( y_i ) + f_roi.x );
+  }, f_numThreads_ui );
+
+  finish( f_numThreads_ui );
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* begin
+ *
+ * \brief      Prepares the tables for a region, whose rows are then given
+ *             by addRow. This lets a caller that already traverses the
+ *             images feed the tables from its own pass.
+ *
+ * \param[in]  const cv::Size &f_imageSize: Size of the images.
+ * \param[in]  const cv::Rect &f_roi: Region of the images to integrate.
+ * \param[in]  const bool f_mask_b: True if the masked tables are required.
+ * \param[in]  const double f_shiftC_d: Shift of the control values.
+ * \param[in]  const double f_shiftV_d: Shift of the virtual values.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CMomentsIntegral::begin( const cv::Size &f_imageSize, const cv::Rect &f_roi,
+			      const bool f_mask_b,
+			      const double f_shiftC_d, const double f_shiftV_d )
+{
+  if( f_roi.width <= 0 || f_roi.height <= 0 ||
+      f_roi.x < 0 || f_roi.y < 0 ||
+      f_roi.x + f_roi.width  > f_imageSize.width ||
+      f_roi.y + f_roi.height > f_imageSize.height    )
+  {
+    cerr << "ERROR CMomentsIntegral::begin: Invalid region!\n";
+    m_table.release();
+    m_tableMask.release();
+    return false;
+  }
+
+  m_roi      = f_roi;
+  m_shiftC_d = f_shiftC_d;
+  m_shiftV_d = f_shiftV_d;
+
+  // The first row is zero, addRow writes the others
+  const cv::Size tableSize( f_roi.width + 1, f_roi.height + 1 );
+  const int values_i = tableSize.width * NUM_MOMENTS_I;
+  imagePool().create( m_table, tableSize, CV_64FC( NUM_MOMENTS_I ) );
+  std::fill( m_table.ptr<double>( 0 ), m_table.ptr<double>( 0 ) + values_i, 0.0 );
+  if( f_mask_b )
+  {
+    imagePool().create( m_tableMask, tableSize, CV_64FC( NUM_MOMENTS_I ) );
+    std::fill( m_tableMask.ptr<double>( 0 ), m_tableMask.ptr<double>( 0 ) + values_i, 0.0 );
+  }
+  else
+  {
+    m_tableMask.release();
+  }
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* addRow
+ *
+ * \brief      Stores the running sums of the moments along one row of the
+ *             region. The rows are independent: they can be added in any
+ *             order and from several threads.
+ *
+ * \param[in]  const int f_y_i: Row (image coordinates) within the region.
+ * \param[in]  const float* f_control_p: Control values of the row, from the
+ *             first column of the region.
+ * \param[in]  const float* f_virtual_p: Virtual values of the row.
+ * \param[in]  const float* f_mask_p: Mask values of the row. Ignored if the
+ *             masked tables were not requested.
+ *
+ * \return     -
+ *************************************************************************** */
+void CMomentsIntegral::addRow( const int f_y_i, const float* f_control_p,
+			       const float* f_virtual_p, const float* f_mask_p )
+{
+  const bool mask_b = !m_tableMask.empty();
+
+  double* table_p     = m_table.ptr<double>( f_y_i - m_roi.y + 1 );
+  double* tableMask_p = mask_b ? m_tableMask.ptr<double>( f_y_i - m_roi.y + 1 ) : nullptr;
+
+  // Running sums of the row
+  double row_p[ NUM_MOMENTS_I ]     = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+  double rowMask_p[ NUM_MOMENTS_I ] = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+
+  for( int k = 0; k < NUM_MOMENTS_I; ++k )
+  {
+    table_p[ k ] = 0.0;
+    if( mask_b )
+    {
+      tableMask_p[ k ] = 0.0;
+    }
+  }
+
+  for( int x = 0; x < m_roi.width; ++x )
+  {
+    const double control_d = f_control_p[ x ] - m_shiftC_d;
+    const double virtual_d = f_virtual_p[ x ] - m_shiftV_d;
+
+    const double values_p[ NUM_MOMENTS_I ] = { 1.0, control_d, virtual_d,
+					       control_d * control_d,
+					       virtual_d * virtual_d,
+					       control_d * virtual_d };
+
+    const int pos_i = ( x + 1 ) * NUM_MOMENTS_I;
+    for( int k = 0; k < NUM_MOMENTS_I; ++k )
+    {
+      row_p[ k ] += values_p[ k ];
+      table_p[ pos_i + k ] = row_p[ k ];
+    }
+
+    if( mask_b )
+    {
+      const bool in_b = f_mask_p[ x ] > 0.f;
+      for( int k = 0; k < NUM_MOMENTS_I; ++k )
+      {
+	if( in_b )
+	{
+	  rowMask_p[ k ] += values_p[ k ];
+	}
+	tableMask_p[ pos_i + k ] = rowMask_p[ k ];
+      }
+    }
+  } // end for x
+}
+
+/* *************************** METHOD ************************************** */
+/* finish
+ *
+ * \brief      Turns the row sums given by addRow into the integral images
+ *             by summing them down the columns. The columns are processed in
+ *             parallel strips.
+ *
+ * \param[in]  const unsigned f_numThreads_ui: Threads (zero for the default).
+ *
+ * \return     -
+ *************************************************************************** */
+void CMomentsIntegral::finish( const unsigned f_numThreads_ui )
+{
+  const int values_i    = ( m_roi.width + 1 ) * NUM_MOMENTS_I;
+  const int numStrips_i = ( values_i + STRIP_VALUES_I - 1 ) / STRIP_VALUES_I;
+
+  parallelFor( static_cast<unsigned>( numStrips_i ), [&]( const unsigned f_strip_ui )
+  {
+    const int begin_i = static_cast<int>( f_strip_ui ) * STRIP_VALUES_I;
+    const int end_i   = std::min( begin_i + STRIP_VALUES_I, values_i );
+
+    for( int y = 1; y <= m_roi.height; ++y )
+    {
+      const double* up_p    = m_table.ptr<double>( y - 1 );
+      double*       table_p = m_table.ptr<double>( y );
+      for( int i = begin_i; i < end_i; ++i )
+      {
+	table_p[ i ] = up_p[ i ] + table_p[ i ];
+      }
+
+      if( !m_tableMask.empty() )
+      {
+	const double* upMask_p    = m_tableMask.ptr<double>( y - 1 );
+	double*       tableMask_p = m_tableMask.ptr<double>( y );
+	for( int i = begin_i; i < end_i; ++i )
+	{
+	  tableMask_p[ i ] = upMask_p[ i ] + tableMask_p[ i ];
+	}
+      }
+    } // end for y
+  }, f_numThreads_ui );
+}
+
+/* *************************** METHOD ************************************** */
+/* query
+ *
+ * \brief      Returns the moments of the full approach within the input
+ *             rectangle, in constant time.
+ *
+ * \param[in]  const cv::Rect &f_rect: Rectangle (image coordinates). It must
+ *             be contained in the region given to CMomentsIntegral::build.
+ * \param[out] SNCCMoments &f_moments: Moments within the rectangle.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CMomentsIntegral::query( const cv::Rect &f_rect, SNCCMoments &f_moments ) const
+{
+  return queryTable( m_table, f_rect, f_moments );
+}
+
+/* *************************** METHOD ************************************** */
+/* queryMask
+ *
+ * \brief      Same as CMomentsIntegral::query, but for the masked approach.
+ *
+ * \param[in]  const cv::Rect &f_rect: Rectangle (image coordinates).
+ * \param[out] SNCCMoments &f_moments: Masked moments within the rectangle.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CMomentsIntegral::queryMask( const cv::Rect &f_rect, SNCCMoments &f_moments ) const
+{
+  return queryTable( m_tableMask, f_rect, f_moments );
+}
+
+/* *************************** METHOD ************************************** */
+/* queryTable
+ *
+ * \brief      Gets the moments within a rectangle from the four corners of an
+ *             integral image.
+ *
+ * \param[in]  const cv::Mat &f_table: Integral image.
+ * \param[in]  const cv::Rect &f_rect: Rectangle (image coordinates).
+ * \param[out] SNCCMoments &f_moments: Moments within the rectangle.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CMomentsIntegral::queryTable( const cv::Mat &f_table, const cv::Rect &f_rect, 
+				   SNCCMoments &f_moments ) const
+{
+  f_moments.reset( m_shiftC_d, m_shiftV_d );
+
+  const int x1_i = f_rect.x - m_roi.x;
+  const int y1_i = f_rect.y - m_roi.y;
+  const int x2_i = x1_i + f_rect.width;
+  const int y2_i = y1_i + f_rect.height;
+
+  if( f_table.empty() || x1_i < 0 || y1_i < 0 || x2_i > m_roi.width || y2_i > m_roi.height ||
+      x2_i < x1_i || y2_i < y1_i )
+  {
+    return false;
+  }
+
+  const double* a_p = f_table.ptr<double>( y1_i ) + x1_i * NUM_MOMENTS_I;
+  const double* b_p = f_table.ptr<double>( y1_i ) + x2_i * NUM_MOMENTS_I;
+  const double* c_p = f_table.ptr<double>( y2_i ) + x1_i * NUM_MOMENTS_I;
+  const double* d_p = f_table.ptr<double>( y2_i ) + x2_i * NUM_MOMENTS_I;
+
+  double sums_p[ NUM_MOMENTS_I ];
+  for( int k = 0; k < NUM_MOMENTS_I; ++k )
+  {
+    sums_p[ k ] = d_p[ k ] - b_p[ k ] - c_p[ k ] + a_p[ k ];
+  }
+
+  f_moments.addShifted( sums_p[ 0 ], sums_p[ 1 ], sums_p[ 2 ],
+			sums_p[ 3 ], sums_p[ 4 ], sums_p[ 5 ] );
+  return true;
+}
@@ -0,0 +1,389 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeLive.cpp
+ *
+ *  \brief   Definition of CThirdEyeLive and CThirdEyeReplayer.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyeLive.h"
+
+// Common includes
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+
+namespace
+{
+  template<typename TDuration>
+  inline float toMilliseconds( const TDuration &f_duration )
+  {
+    return std::chrono::duration<float, std::milli>( f_duration ).count();
+  }
+
+  // Latency histogram: bin k > 0 holds [MIN * RATIO^(k-1), MIN * RATIO^k) ms,
+  // bin 0 what is below MIN, and the last bin also what is above (about 1.7
+  // hours)
+  const float    LATENCY_MIN_F       = 0.01f;
+
+  const float    LATENCY_RATIO_F     = 1.02f;
+
+  const unsigned NUM_LATENCY_BINS_UI = 1024;
+
+  inline unsigned latencyBin( const float f_latency_f )
+  {
+    if( !( f_latency_f >= LATENCY_MIN_F ) )
+    {
+      return 0;
+    }
+    const float bin_f = std::log( f_latency_f / LATENCY_MIN_F ) / std::log( LATENCY_RATIO_F ) + 1.f;
+    return std::min( static_cast<unsigned>( bin_f ), NUM_LATENCY_BINS_UI - 1 );
+  }
+}
+
+/*******************************************************************************/
+/***********************  Class CThirdEyeLive **********************************/
+CThirdEyeLive::CThirdEyeLive( const CThirdEyeEvaluation &f_eval )
+  : m_eval( f_eval ),
+    m_capacity_ui( 4 ),
+    m_policy_e( DROP_OLDEST ),
+    m_deadline_f( 0.f ),
+    m_ring( 1024 ),
+    m_ringFirst_ui( 0 ),
+    m_ringSize_ui( 0 ),
+    m_latencySum_d( 0. ),
+    m_latencyBins( NUM_LATENCY_BINS_UI, 0 )
+{
+  /* Empty body */
+}
+
+CThirdEyeLive::~CThirdEyeLive()
+{
+  stop();
+}
+
+bool CThirdEyeLive::setQueue( const unsigned f_capacity_ui, const EThirdEyeDropPolicy f_policy_e )
+{
+  if( m_worker.joinable() )
+  {
+    cerr << "ERROR CThirdEyeLive::setQueue: The front end is running" << endl;
+    return false;
+  }
+  if( f_capacity_ui == 0 )
+  {
+    cerr << "ERROR CThirdEyeLive::setQueue: The queue needs room for a frame" << endl;
+    return false;
+  }
+
+  m_capacity_ui = f_capacity_ui;
+  m_policy_e    = f_policy_e;
+  return true;
+}
+
+bool CThirdEyeLive::setResultRing( const unsigned f_capacity_ui )
+{
+  if( m_worker.joinable() )
+  {
+    cerr << "ERROR CThirdEyeLive::setResultRing: The front end is running" << endl;
+    return false;
+  }
+  if( f_capacity_ui == 0 )
+  {
+    cerr << "ERROR CThirdEyeLive::setResultRing: The ring needs room for a result" << endl;
+    return false;
+  }
+
+  m_ring.assign( f_capacity_ui, SThirdEyeLiveResult() );
+  m_ringFirst_ui = m_ringSize_ui = 0;
+  return true;
+}
+
+bool CThirdEyeLive::start()
+{
+  if( m_worker.joinable() )
+  {
+    cerr << "ERROR CThirdEyeLive::start: The front end is already running" << endl;
+    return false;
+  }
+
+  m_ringFirst_ui = m_ringSize_ui = 0;
+  m_stats        = SThirdEyeLiveStats();
+  m_latencySum_d = 0.;
+  std::fill( m_latencyBins.begin(), m_latencyBins.end(), 0u );
+  m_queue_p.reset( new CBoundedQueue<SItem>( m_capacity_ui ) );
+  m_worker = std::thread( &CThirdEyeLive::run, this );
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* pushFrame
+ *
+ * \brief      Queues a frame for evaluation. When the queue is full, DROP_NEWEST drops this frame,
+ *             DROP_OLDEST drops the oldest queued frame to make room, and
+ *             DROP_NONE waits for the worker thread to take a frame.
+ *
+ * \param[in]  const SThirdEyeFrame &f_frame: Frame with its inputs.
+ *
+ * \return     True if the frame was queued. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeLive::pushFrame( const SThirdEyeFrame &f_frame )
+{
+  if( !m_queue_p )
+  {
+    cerr << "ERROR CThirdEyeLive::pushFrame: The front end is not running" << endl;
+    return false;
+  }
+
+  SItem item;
+  item.m_frame   = f_frame;
+  item.m_arrival = TClock::now();
+  {
+    std::lock_guard<std::mutex> lock( m_resultsMutex );
+    ++m_stats.m_pushed_ui;
+  }
+
+  bool queued_b = false;
+  if( m_policy_e == DROP_OLDEST )
+  {
+    SItem evicted;
+    bool evicted_b = false;
+    queued_b = m_queue_p->pushEvicting( item, evicted, evicted_b );
+    if( evicted_b )
+    {
+      drop( evicted );
+    }
+  }
+  else if( m_policy_e == DROP_NEWEST )
+  {
+    queued_b = m_queue_p->tryPush( item );
+  }
+  else
+  {
+    queued_b = m_queue_p->push( item );
+  }
+
+  if( !queued_b )
+  {
+    drop( item );
+  }
+  return queued_b;
+}
+
+void CThirdEyeLive::stop()
+{
+  if( !m_worker.joinable() )
+  {
+    return;
+  }
+
+  m_queue_p->close();
+  m_worker.join();
+}
+
+void CThirdEyeLive::drop( const SItem &f_item )
+{
+  SThirdEyeLiveResult result;
+  result.m_index_ui  = f_item.m_frame.m_index_ui;
+  result.m_dropped_b = true;
+
+  std::lock_guard<std::mutex> lock( m_resultsMutex );
+  record( result );
+}
+
+/* *************************** METHOD ************************************** */
+/* record
+ *
+ * \brief      Puts a result into the ring, over the oldest one if it is
+ *             full, and adds the latency of an evaluated frame to the stats:
+ *             the sum for the mean, the max, and its bin for the p95.
+ *
+ * \param[in]  const SThirdEyeLiveResult &f_result: Result of a frame.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeLive::record( const SThirdEyeLiveResult &f_result )
+{
+  if( m_ringSize_ui == m_ring.size() )
+  {
+    m_ringFirst_ui = ( m_ringFirst_ui + 1 ) % m_ring.size();
+    --m_ringSize_ui;
+    ++m_stats.m_lost_ui;
+  }
+  m_ring[ ( m_ringFirst_ui + m_ringSize_ui ) % m_ring.size() ] = f_result;
+  ++m_ringSize_ui;
+
+  if( f_result.m_dropped_b )
+  {
+    ++m_stats.m_dropped_ui;
+    return;
+  }
+
+  ++m_stats.m_evaluated_ui;
+  if( m_deadline_f > 0.f && f_result.m_latency_f > m_deadline_f )
+  {
+    ++m_stats.m_late_ui;
+  }
+  m_latencySum_d += f_result.m_latency_f;
+  m_stats.m_maxLatency_f = std::max( m_stats.m_maxLatency_f, f_result.m_latency_f );
+  ++m_latencyBins[ latencyBin( f_result.m_latency_f ) ];
+}
+
+/* *************************** METHOD ************************************** */
+/* run
+ *
+ * \brief      Body of the worker thread: evaluates the queued frames until
+ *             the queue is closed and empty. The row blocks of each frame
+ *             run on the scheduler (see setNumThreads of the evaluation), and
+ *             with a latency budget set the evaluation lowers its quality
+ *             when the frames come faster than it can evaluate them.
+ *************************************************************************** */
+void CThirdEyeLive::run()
+{
+  SItem item;
+  while( m_queue_p->pop( item ) )
+  {
+    SThirdEyeLiveResult result;
+    result.m_index_ui   = item.m_frame.m_index_ui;
+    result.m_waitTime_f = toMilliseconds( TClock::now() - item.m_arrival );
+
+    m_eval.setIntensityScale( item.m_frame.m_intensityScale_f );
+    m_eval.setSubpixelBits( item.m_frame.m_subpixelBits_ui );
+    result.m_valid_b = m_eval.computeEvaluationIndices( item.m_frame.m_disparity, item.m_frame.m_base,
+							item.m_frame.m_control, m_workspace,
+							result.m_fullIndex_f, result.m_maskIndex_f );
+    result.m_quality_e       = m_workspace.m_quality_e;
+    result.m_estimate_f      = m_workspace.m_estimate_f;
+    result.m_estimateLower_f = m_workspace.m_estimateLower_f;
+    result.m_estimateUpper_f = m_workspace.m_estimateUpper_f;
+    result.m_latency_f = toMilliseconds( TClock::now() - item.m_arrival );
+
+    {
+      std::lock_guard<std::mutex> lock( m_resultsMutex );
+      record( result );
+    }
+    if( m_callback )
+    {
+      m_callback( result );
+    }
+
+    // Release the images before waiting for the next frame
+    item = SItem();
+  }
+}
+
+size_t CThirdEyeLive::takeResults( std::vector<SThirdEyeLiveResult> &f_results )
+{
+  std::lock_guard<std::mutex> lock( m_resultsMutex );
+
+  const size_t taken_ui = m_ringSize_ui;
+  for( size_t i = 0; i < taken_ui; ++i )
+  {
+    f_results.push_back( m_ring[ ( m_ringFirst_ui + i ) % m_ring.size() ] );
+  }
+  m_ringFirst_ui = m_ringSize_ui = 0;
+  return taken_ui;
+}
+
+/* *************************** METHOD ************************************** */
+/* getStats
+ *
+ * \brief      Summary of the running stats. The p95 latency is the upper
+ *             edge of the histogram bin that holds it (capped by the max),
+ *             so it is at most 2% above the exact one.
+ *
+ * \return     The stats.
+ *************************************************************************** */
+SThirdEyeLiveStats CThirdEyeLive::getStats() const
+{
+  std::lock_guard<std::mutex> lock( m_resultsMutex );
+
+  SThirdEyeLiveStats stats = m_stats;
+  if( stats.m_evaluated_ui == 0 )
+  {
+    return stats;
+  }
+
+  stats.m_meanLatency_f = static_cast<float>( m_latencySum_d / stats.m_evaluated_ui );
+
+  // Bin of the latency of rank (n - 1) * 95 / 100 in increasing order
+  const size_t rank_ui = ( static_cast<size_t>( stats.m_evaluated_ui ) - 1 ) * 95 / 100;
+  size_t below_ui = 0;
+  unsigned bin_ui = 0;
+  while( below_ui + m_latencyBins[ bin_ui ] <= rank_ui )
+  {
+    below_ui += m_latencyBins[ bin_ui ];
+    ++bin_ui;
+  }
+  const float edge_f = LATENCY_MIN_F * std::pow( LATENCY_RATIO_F, static_cast<float>( bin_ui ) );
+  stats.m_p95Latency_f = ( bin_ui + 1 < NUM_LATENCY_BINS_UI ) ? std::min( edge_f, stats.m_maxLatency_f ) :
+                                                                stats.m_maxLatency_f;
+
+  return stats;
+}
+
+/*******************************************************************************/
+/***********************  Class CThirdEyeReplayer ******************************/
+CThirdEyeReplayer::CThirdEyeReplayer( CThirdEyeFrameSource &f_source, const float f_fps_f )
+  : m_source( f_source ),
+    m_fps_f( f_fps_f ),
+    m_late_ui( 0 )
+{
+  /* Empty body */
+}
+
+/* *************************** METHOD ************************************** */
+/* run
+ *
+ * \brief      Replays a range of frames. The times are taken from the start
+ *             of the run, not from the previous push, so a late frame does
+ *             not delay the ones after it.
+ *
+ * \param[in]  const unsigned f_first_ui: First frame index.
+ * \param[in]  const unsigned f_count_ui: Number of frames.
+ * \param[in]  const std::function<bool( const SThirdEyeFrame& )> &f_push:
+ *             Called with each frame at its time.
+ *
+ * \return     True if all the frames were loaded. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeReplayer::run( const unsigned f_first_ui, const unsigned f_count_ui,
+			     const std::function<bool( const SThirdEyeFrame& )> &f_push )
+{
+  m_late_ui = 0;
+  if( m_fps_f <= 0.f )
+  {
+    cerr << "ERROR CThirdEyeReplayer::run: The frame rate must be positive" << endl;
+    return false;
+  }
+
+  typedef std::chrono::steady_clock TClock;
+  const std::chrono::duration<double> period( 1. / m_fps_f );
+  const TClock::time_point start = TClock::now();
+
+  bool ok_b = true;
+  for( unsigned i = 0; i < f_count_ui; ++i )
+  {
+    SThirdEyeFrame frame;
+    frame.m_index_ui = f_first_ui + i;
+    if( !m_source.loadFrame( frame ) )
+    {
+      cerr << "ERROR CThirdEyeReplayer::run: Cannot load frame " << frame.m_index_ui << endl;
+      ok_b = false;
+      continue;
+    }
+
+    const TClock::time_point due =
+      start + std::chrono::duration_cast<TClock::duration>( period * static_cast<double>( i ) );
+    std::this_thread::sleep_until( due );
+    if( TClock::now() - due > period )
+    {
+      ++m_late_ui;
+    }
+    f_push( frame );
+  }
+
+  return ok_b;
+}
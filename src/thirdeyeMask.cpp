@@ -14,9 +14,34 @@
 // OpenCV includes
 #include <opencv2/imgproc/imgproc.hpp>
 
+// Project includes
+#include "../h/thirdeyePixel.h"
+#include "../h/imagePool.h"
+#include "../h/thirdeyeParallel.h"
+
 // Regular includes
+#include <algorithm>
 #include <iostream>
 
+namespace
+{
+  // Rows processed by each parallel task
+  const unsigned ROW_BLOCK_UI = 16;
+
+  // Runs f_rows( yStart, yEnd ) over blocks of ROW_BLOCK_UI rows in parallel
+  template<typename TRows>
+  void parallelRows( const unsigned f_rows_ui, const TRows &f_rows,
+		     const unsigned f_numThreads_ui )
+  {
+    const unsigned numBlocks_ui = ( f_rows_ui + ROW_BLOCK_UI - 1 ) / ROW_BLOCK_UI;
+    parallelFor( numBlocks_ui, [&]( const unsigned f_block_ui )
+    {
+      f_rows( f_block_ui * ROW_BLOCK_UI,
+	      std::min( ( f_block_ui + 1 ) * ROW_BLOCK_UI, f_rows_ui ) );
+    }, f_numThreads_ui );
+  }
+}
+
 /* *************************** METHOD ************************************** */
 /* Standard constructor.
  *
@@ -30,6 +55,8 @@ CThirdEyeMask::CThirdEyeMask()
   : m_thresholdDistance_f( 10.f ),
     m_thresholdGradient_f(  5.f ), 
     m_kernelSize_ui(        3   ),
+    m_intensityScale_f(     1.f ),
+    m_numThreads_ui(        0   ),
     
     m_gradientImage(            ),
     m_distanceImage(            ),
@@ -60,6 +87,8 @@ CThirdEyeMask::CThirdEyeMask( const float f_thresholdGradient_f,
   : m_thresholdDistance_f( f_thresholdDistance_f ),
     m_thresholdGradient_f( f_thresholdGradient_f  ),
     m_kernelSize_ui( 3 ),
+    m_intensityScale_f( 1.f ),
+    m_numThreads_ui( 0 ),
  
     m_gradientImage(    ),
     m_trueMask(         )
@@ -204,38 +233,46 @@ void CThirdEyeMask::generateBinaryGradientImage( const cv::Mat f_img )
 {
   /// Allocate images for the horizontal and vertical derivatives
   const cv::Size imgSize( f_img.size() );
-  cv::Mat centralDiffX( imgSize, CV_32FC1 );
-  cv::Mat centralDiffY( imgSize, CV_32FC1 );
+  cv::Mat centralDiffX = imagePool().acquire( imgSize, CV_32FC1 );
+  cv::Mat centralDiffY = imagePool().acquire( imgSize, CV_32FC1 );
 
   
+  // The input can be 8 bit, 16 bit or 32 float, the derivatives are float
   cv::filter2D( f_img, centralDiffX, CV_32FC1, m_horizontalKernel );
   cv::filter2D( f_img, centralDiffY, CV_32FC1, m_verticalKernel   );
 
   /// Just in case, initilize or reset
-  m_gradientImage.create( imgSize, CV_8UC1 );
+  imagePool().create( m_gradientImage, imgSize, CV_8UC1 );
+
+  // Threshold in the units of the input image
+  const float thresholdGradient_f = m_thresholdGradient_f / m_intensityScale_f;
 
 
-  for ( unsigned y = 0; y < static_cast<unsigned>( imgSize.height ); ++y )
+  parallelRows( static_cast<unsigned>( imgSize.height ), [&]( const unsigned f_yStart_ui,
+							      const unsigned f_yEnd_ui )
   {
-    const float* yDir_p = centralDiffY.ptr<float>( y );
-    const float* xDir_p = centralDiffX.ptr<float>( y );
-    for ( unsigned x = 0; x < static_cast<unsigned>( imgSize.width ); ++x )
+    for ( unsigned y = f_yStart_ui; y < f_yEnd_ui; ++y )
     {
-      // Compute the length of the gradient
-      const float lengthGradient_f = sqrt( (xDir_p[x]*xDir_p[x]) + (yDir_p[x]*yDir_p[x]) );
-
-      // We kepth the points with large value. It is assigned the value zero
-      // so we can use the cvDistTransform function
-      if ( lengthGradient_f > m_thresholdGradient_f )
-      {
-	m_gradientImage.ptr<uchar>( y )[ x ] = 0;
-      }
-      else
+      const float* yDir_p = centralDiffY.ptr<float>( y );
+      const float* xDir_p = centralDiffX.ptr<float>( y );
+      for ( unsigned x = 0; x < static_cast<unsigned>( imgSize.width ); ++x )
       {
-	m_gradientImage.ptr<uchar>( y )[ x ] = 255;
-      }
-    } // end for x
-  } // end for y
+	// Compute the length of the gradient
+	const float lengthGradient_f = sqrt( (xDir_p[x]*xDir_p[x]) + (yDir_p[x]*yDir_p[x]) );
+
+	// We kepth the points with large value. It is assigned the value zero
+	// so we can use the cvDistTransform function
+	if ( lengthGradient_f > thresholdGradient_f )
+	{
+	  m_gradientImage.ptr<uchar>( y )[ x ] = 0;
+	}
+	else
+	{
+	  m_gradientImage.ptr<uchar>( y )[ x ] = 255;
+	}
+      } // end for x
+    } // end for y
+  }, m_numThreads_ui );
 
 }
 
@@ -264,28 +301,32 @@ bool CThirdEyeMask::generateImageMaskAuxiliar( cv::Mat f_img )
   generateBinaryGradientImage( f_img );
   
   /// Allocate the distance transformed image
-  m_distanceImage.create( imgSize, CV_32FC1 );
+  imagePool().create( m_distanceImage, imgSize, CV_32FC1 );
 	
   /// Compute the distance transform image
   cv::distanceTransform( m_gradientImage, m_distanceImage, 
 			 CV_DIST_L2, CV_DIST_MASK_PRECISE );
  
   /// Allocate space for the mask
-  m_trueMask.create( imgSize, CV_32FC1 );
-  for ( unsigned y = 0; y < static_cast<unsigned>( imgSize.height ); ++y )
+  imagePool().create( m_trueMask, imgSize, CV_32FC1 );
+  parallelRows( static_cast<unsigned>( imgSize.height ), [&]( const unsigned f_yStart_ui,
+							      const unsigned f_yEnd_ui )
   {
-    for ( unsigned x = 0; x < static_cast<unsigned>( imgSize.width ); ++x )
-    {			
-      if ( m_distanceImage.ptr<float>( y )[ x ] > m_thresholdDistance_f )
-      {
-	m_trueMask.ptr<float>( y )[ x ] = 0.f;
-      }
-      else
-      {
-	m_trueMask.ptr<float>( y )[ x ] = 255.f;
-      }
-    } // end for y
-  } // end for x
+    for ( unsigned y = f_yStart_ui; y < f_yEnd_ui; ++y )
+    {
+      for ( unsigned x = 0; x < static_cast<unsigned>( imgSize.width ); ++x )
+      {			
+	if ( m_distanceImage.ptr<float>( y )[ x ] > m_thresholdDistance_f )
+	{
+	  m_trueMask.ptr<float>( y )[ x ] = 0.f;
+	}
+	else
+	{
+	  m_trueMask.ptr<float>( y )[ x ] = 255.f;
+	}
+      } // end for y
+    } // end for x
+  }, m_numThreads_ui );
 
   return true;
 }
@@ -365,7 +406,8 @@ cv::Mat	CThirdEyeMask::maskImage( const cv::Mat f_img,
 {
   // Maybe not that efficient to initilize the image to something...
   // maybe try it later in the loop.
-  cv::Mat maskedImage( f_img.size(), CV_32FC1, cv::Scalar( 255.f ) );
+  cv::Mat maskedImage = imagePool().acquire( f_img.size(), CV_32FC1 );
+  maskedImage.setTo( cv::Scalar( 255.f ) );
 
   // If the mask has not been created yet, create it!
   if( m_trueMask.empty() )
@@ -381,16 +423,20 @@ cv::Mat	CThirdEyeMask::maskImage( const cv::Mat f_img,
   }
 
   // Mask it!
-  for ( unsigned y = 0; y < static_cast<unsigned>( f_img.rows ); ++y )
+  parallelRows( static_cast<unsigned>( f_img.rows ), [&]( const unsigned f_yStart_ui,
+							  const unsigned f_yEnd_ui )
   {
-    for ( unsigned x = 0; x < static_cast<unsigned>( f_img.cols ); ++x )
-    {			
+    for ( unsigned y = f_yStart_ui; y < f_yEnd_ui; ++y )
+    {
+      for ( unsigned x = 0; x < static_cast<unsigned>( f_img.cols ); ++x )
+      {			
 	if( m_trueMask.ptr<float>( y )[ x ] != 0.f )
 	{
-	  maskedImage.ptr<float>( y )[ x ] = f_img.ptr<float>( y )[ x ];
+	  maskedImage.ptr<float>( y )[ x ] = pixelValue( f_img, y, x );
 	}
       }
-   } 
+    }
+  }, m_numThreads_ui );
   
   return maskedImage;
 }
@@ -0,0 +1,361 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeMoments.cpp
+ *
+ *  \brief   Accumulation kernels for the moments (see SNCCMoments) used by
+ *           the third eye statistics.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyeMoments.h"
+
+// Project includes
+#include "../h/thirdeyeCensus.h"
+
+// SIMD includes. SSE2 is part of the x86-64 baseline.
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // Iterations of the SSE kernel (16 pairs each) summed in float lanes before
+  // the lanes are widened and added to the double lanes. Each float lane
+  // then holds the sum of 4 * FLOAT_ITERATIONS_UI products, so its rounding
+  // error stays at the level of that of the products themselves. The double
+  // lanes are reduced into the moments at the end of the run.
+  const unsigned FLOAT_ITERATIONS_UI = 4;
+
+  // Offsets (in rows, cols) of the 8 neighbours used by the census transform
+  const int CENSUS_DY_P[ 8 ] = { -1, -1, -1,  0, 0,  1, 1, 1 };
+  const int CENSUS_DX_P[ 8 ] = { -1,  0,  1, -1, 1, -1, 0, 1 };
+
+#if defined( __SSE2__ )
+  // Horizontal sum of the four lanes, in double precision
+  inline double horizontalSum( const __m128 f_value )
+  {
+    const __m128d low  = _mm_cvtps_pd( f_value );
+    const __m128d high = _mm_cvtps_pd( _mm_movehl_ps( f_value, f_value ) );
+    const __m128d sum  = _mm_add_pd( low, high );
+    return _mm_cvtsd_f64( _mm_add_sd( sum, _mm_unpackhi_pd( sum, sum ) ) );
+  }
+
+  inline double horizontalSum( const __m128d f_value )
+  {
+    return _mm_cvtsd_f64( _mm_add_sd( f_value, _mm_unpackhi_pd( f_value, f_value ) ) );
+  }
+
+  // Adds the four float lanes of f_value to the two double lanes of f_sum
+  inline __m128d widenAdd( const __m128d f_sum, const __m128 f_value )
+  {
+    return _mm_add_pd( f_sum, _mm_add_pd( _mm_cvtps_pd( f_value ),
+					  _mm_cvtps_pd( _mm_movehl_ps( f_value, f_value ) ) ) );
+  }
+
+  // Per-lane sums of the moments: float lanes for the pairs of the last
+  // iterations, double lanes for the flushed ones
+  struct SMomentLanes
+  {
+    SMomentLanes()
+      : m_c( _mm_setzero_ps() ), m_v( _mm_setzero_ps() ),
+	m_cc( _mm_setzero_ps() ), m_vv( _mm_setzero_ps() ), m_cv( _mm_setzero_ps() ),
+	m_abs( _mm_setzero_ps() ), m_sq( _mm_setzero_ps() ),
+	m_cD( _mm_setzero_pd() ), m_vD( _mm_setzero_pd() ),
+	m_ccD( _mm_setzero_pd() ), m_vvD( _mm_setzero_pd() ), m_cvD( _mm_setzero_pd() ),
+	m_absD( _mm_setzero_pd() ), m_sqD( _mm_setzero_pd() )
+    { }
+
+    inline void add( const __m128 f_control, const __m128 f_virtual,
+		     const __m128 f_cc, const __m128 f_vv, const __m128 f_cv,
+		     const __m128 f_abs, const __m128 f_sq )
+    {
+      m_c   = _mm_add_ps( m_c,   f_control );
+      m_v   = _mm_add_ps( m_v,   f_virtual );
+      m_cc  = _mm_add_ps( m_cc,  f_cc );
+      m_vv  = _mm_add_ps( m_vv,  f_vv );
+      m_cv  = _mm_add_ps( m_cv,  f_cv );
+      m_abs = _mm_add_ps( m_abs, f_abs );
+      m_sq  = _mm_add_ps( m_sq,  f_sq );
+    }
+
+    // Moves the float lanes into the double lanes
+    inline void flush()
+    {
+      const __m128 zero = _mm_setzero_ps();
+      m_cD   = widenAdd( m_cD,   m_c   );  m_c   = zero;
+      m_vD   = widenAdd( m_vD,   m_v   );  m_v   = zero;
+      m_ccD  = widenAdd( m_ccD,  m_cc  );  m_cc  = zero;
+      m_vvD  = widenAdd( m_vvD,  m_vv  );  m_vv  = zero;
+      m_cvD  = widenAdd( m_cvD,  m_cv  );  m_cv  = zero;
+      m_absD = widenAdd( m_absD, m_abs );  m_abs = zero;
+      m_sqD  = widenAdd( m_sqD,  m_sq  );  m_sq  = zero;
+    }
+
+    // Reduces the double lanes into the moments. The float lanes must have
+    // been flushed
+    inline void reduce( const double f_n_d, SNCCMoments &f_moments ) const
+    {
+      f_moments.addShifted( f_n_d,
+			    horizontalSum( m_cD  ), horizontalSum( m_vD  ),
+			    horizontalSum( m_ccD ), horizontalSum( m_vvD ),
+			    horizontalSum( m_cvD ) );
+      f_moments.addDifferences( horizontalSum( m_absD ), horizontalSum( m_sqD ) );
+    }
+
+    __m128  m_c, m_v, m_cc, m_vv, m_cv, m_abs, m_sq;
+
+    __m128d m_cD, m_vD, m_ccD, m_vvD, m_cvD, m_absD, m_sqD;
+  };
+
+  // Shifted values, products and differences of 4 control/virtual pairs
+  struct SPairTerms
+  {
+    inline SPairTerms( const __m128 f_control, const __m128 f_virtual,
+		       const __m128 f_shiftC, const __m128 f_shiftV, const __m128 f_absMask )
+      : m_c( _mm_sub_ps( f_control, f_shiftC ) ),
+	m_v( _mm_sub_ps( f_virtual, f_shiftV ) ),
+	m_cc( _mm_mul_ps( m_c, m_c ) ),
+	m_vv( _mm_mul_ps( m_v, m_v ) ),
+	m_cv( _mm_mul_ps( m_c, m_v ) ),
+	m_diff( _mm_sub_ps( f_control, f_virtual ) ),
+	m_abs( _mm_and_ps( m_diff, f_absMask ) ),
+	m_sq( _mm_mul_ps( m_diff, m_diff ) )
+    { }
+
+    // Terms of the lanes selected by f_lane (all ones or zero)
+    inline SPairTerms masked( const __m128 f_lane ) const
+    {
+      SPairTerms terms( *this );
+      terms.m_c   = _mm_and_ps( f_lane, m_c );
+      terms.m_v   = _mm_and_ps( f_lane, m_v );
+      terms.m_cc  = _mm_and_ps( f_lane, m_cc );
+      terms.m_vv  = _mm_and_ps( f_lane, m_vv );
+      terms.m_cv  = _mm_and_ps( f_lane, m_cv );
+      terms.m_abs = _mm_and_ps( f_lane, m_abs );
+      terms.m_sq  = _mm_and_ps( f_lane, m_sq );
+      return terms;
+    }
+
+    // Lane-wise sum of two sets of terms
+    inline SPairTerms operator+( const SPairTerms &f_other ) const
+    {
+      SPairTerms terms( *this );
+      terms.m_c   = _mm_add_ps( m_c,   f_other.m_c );
+      terms.m_v   = _mm_add_ps( m_v,   f_other.m_v );
+      terms.m_cc  = _mm_add_ps( m_cc,  f_other.m_cc );
+      terms.m_vv  = _mm_add_ps( m_vv,  f_other.m_vv );
+      terms.m_cv  = _mm_add_ps( m_cv,  f_other.m_cv );
+      terms.m_abs = _mm_add_ps( m_abs, f_other.m_abs );
+      terms.m_sq  = _mm_add_ps( m_sq,  f_other.m_sq );
+      return terms;
+    }
+
+    inline void addTo( SMomentLanes &f_lanes ) const
+    {
+      f_lanes.add( m_c, m_v, m_cc, m_vv, m_cv, m_abs, m_sq );
+    }
+
+    __m128 m_c, m_v, m_cc, m_vv, m_cv, m_diff, m_abs, m_sq;
+  };
+
+  /* *************************** FUNCTION ************************************ */
+  /* accumulateRunSSE
+   *
+   * \brief      Accumulates the moments of a run of pixels, 16 control/virtual
+   *             pairs per iteration. The shifted values, squares, cross
+   *             products and differences are computed and summed in float
+   *             lanes; every FLOAT_ITERATIONS_UI iterations the float lanes
+   *             are widened into double lanes, which are reduced into the
+   *             moments at the end of the run. The mask is used as a lane
+   *             predicate, so the full and masked moments are accumulated
+   *             simultaneously. Returns the number of pixels processed (a
+   *             multiple of 16), the remainder is left to the caller. Nothing
+   *             is processed if a shift is not a float value.
+   *************************************************************************** */
+  template<bool MASK>
+  unsigned accumulateRunSSE( const float* f_control_p, const float* f_virtual_p,
+			     const float* f_mask_p, const unsigned f_count_ui,
+			     SNCCMoments &f_moments, SNCCMoments &f_momentsMask )
+  {
+    const unsigned count_ui = f_count_ui & ~15u;
+    const float    shiftC_f = static_cast<float>( f_moments.m_shiftC_d );
+    const float    shiftV_f = static_cast<float>( f_moments.m_shiftV_d );
+    if( count_ui == 0 || shiftC_f != f_moments.m_shiftC_d || shiftV_f != f_moments.m_shiftV_d )
+    {
+      return 0;
+    }
+
+    const __m128 shiftC  = _mm_set1_ps( shiftC_f );
+    const __m128 shiftV  = _mm_set1_ps( shiftV_f );
+    const __m128 absMask = _mm_castsi128_ps( _mm_set1_epi32( 0x7fffffff ) );
+    const __m128 zero    = _mm_setzero_ps();
+    const __m128 one     = _mm_set1_ps( 1.f );
+
+    SMomentLanes sums, sumsMask;
+    __m128 nMask = zero;
+
+    unsigned iterations_ui = 0;
+    for( unsigned x = 0; x < count_ui; x += 16 )
+    {
+      const SPairTerms t0( _mm_loadu_ps( f_control_p + x ),      _mm_loadu_ps( f_virtual_p + x ),
+			   shiftC, shiftV, absMask );
+      const SPairTerms t1( _mm_loadu_ps( f_control_p + x + 4 ),  _mm_loadu_ps( f_virtual_p + x + 4 ),
+			   shiftC, shiftV, absMask );
+      const SPairTerms t2( _mm_loadu_ps( f_control_p + x + 8 ),  _mm_loadu_ps( f_virtual_p + x + 8 ),
+			   shiftC, shiftV, absMask );
+      const SPairTerms t3( _mm_loadu_ps( f_control_p + x + 12 ), _mm_loadu_ps( f_virtual_p + x + 12 ),
+			   shiftC, shiftV, absMask );
+      ( ( t0 + t1 ) + ( t2 + t3 ) ).addTo( sums );
+
+      if( MASK )
+      {
+	const __m128 lane0 = _mm_cmpgt_ps( _mm_loadu_ps( f_mask_p + x ),      zero );
+	const __m128 lane1 = _mm_cmpgt_ps( _mm_loadu_ps( f_mask_p + x + 4 ),  zero );
+	const __m128 lane2 = _mm_cmpgt_ps( _mm_loadu_ps( f_mask_p + x + 8 ),  zero );
+	const __m128 lane3 = _mm_cmpgt_ps( _mm_loadu_ps( f_mask_p + x + 12 ), zero );
+	( ( t0.masked( lane0 ) + t1.masked( lane1 ) ) +
+	  ( t2.masked( lane2 ) + t3.masked( lane3 ) ) ).addTo( sumsMask );
+	nMask = _mm_add_ps( nMask, _mm_add_ps( _mm_add_ps( _mm_and_ps( lane0, one ), _mm_and_ps( lane1, one ) ),
+					       _mm_add_ps( _mm_and_ps( lane2, one ), _mm_and_ps( lane3, one ) ) ) );
+      }
+
+      if( ++iterations_ui == FLOAT_ITERATIONS_UI )
+      {
+	iterations_ui = 0;
+	sums.flush();
+	if( MASK )
+	{
+	  sumsMask.flush();
+	}
+      }
+    } // end for x
+
+    // Reduce into the moments. The masked count is an integer far below 2^24
+    // in each lane
+    sums.flush();
+    sums.reduce( static_cast<double>( count_ui ), f_moments );
+    if( MASK )
+    {
+      sumsMask.flush();
+      sumsMask.reduce( horizontalSum( nMask ), f_momentsMask );
+    }
+
+    return count_ui;
+  }
+#endif
+
+  // Moments of a run without census: the SSE kernel if available, and the
+  // scalar loop for the remainder
+  inline void accumulateRun( const float* f_control_p, const float* f_virtual_p,
+			     const float* f_mask_p, const unsigned f_count_ui,
+			     SNCCMoments &f_moments, SNCCMoments &f_momentsMask )
+  {
+    unsigned x = 0;
+
+#if defined( __SSE2__ )
+    x = f_mask_p ?
+      accumulateRunSSE<true>(  f_control_p, f_virtual_p, f_mask_p, f_count_ui,
+			       f_moments, f_momentsMask ) :
+      accumulateRunSSE<false>( f_control_p, f_virtual_p, f_mask_p, f_count_ui,
+			       f_moments, f_momentsMask );
+#endif
+
+    // Remainder (or everything if no SIMD is available)
+    for( ; x < f_count_ui; ++x )
+    {
+      f_moments.add( f_control_p[ x ], f_virtual_p[ x ] );
+      if( f_mask_p && f_mask_p[ x ] > 0.f )
+      {
+	f_momentsMask.add( f_control_p[ x ], f_virtual_p[ x ] );
+      }
+    }
+  }
+
+} // end anonymous namespace
+
+/* *************************** FUNCTION ************************************ */
+/* accumulateMomentsRow
+ *
+ * \brief      Adds to the input moments the control/virtual pairs of a run
+ *             of contiguous pixels. The pairs whose mask value is larger than
+ *             zero are also added to the masked moments. If no mask is given
+ *             (null pointer), only the full moments are accumulated. Both
+ *             moments must have been reset with the same shifts. The sums of
+ *             the differences are always accumulated; the census Hamming
+ *             distances only if the row steps are given.
+ *
+ *             When SSE2 is available the pixels are processed 16 per
+ *             iteration in float lanes, which are widened into double lanes
+ *             every few iterations (see accumulateRunSSE); the double lanes
+ *             are reduced into the moments at the end of the row.
+ *
+ * \param[in]  const float* f_control_p: Control image values.
+ * \param[in]  const float* f_virtual_p: Virtual image values.
+ * \param[in]  const float* f_mask_p: Mask values. Can be null.
+ * \param[in]  const unsigned f_count_ui: Number of pixels.
+ * \param[in]  const size_t f_stepC: Row step (in floats) of the control image,
+ *             zero to skip the census.
+ * \param[in]  const size_t f_stepV: Row step (in floats) of the virtual image,
+ *             zero to skip the census.
+ * \param[out] SNCCMoments &f_moments: Moments of the full approach.
+ * \param[out] SNCCMoments &f_momentsMask: Moments of the masked approach.
+ *
+ * \return     -
+ *************************************************************************** */
+void accumulateMomentsRow( const float* f_control_p, const float* f_virtual_p,
+			   const float* f_mask_p, const unsigned f_count_ui,
+			   const size_t f_stepC, const size_t f_stepV,
+			   SNCCMoments &f_moments, SNCCMoments &f_momentsMask )
+{
+  accumulateRun( f_control_p, f_virtual_p, f_mask_p, f_count_ui, f_moments, f_momentsMask );
+
+  // Census Hamming distances, with the kernel of the census index. The
+  // neighbours of the run are still in cache
+  if( f_stepC != 0 && f_stepV != 0 )
+  {
+    SCensusSums sums;
+    censusHammingRow( f_control_p, f_virtual_p, f_stepC, f_stepV, f_count_ui,
+		      CENSUS_DY_P, CENSUS_DX_P, 8, f_mask_p, sums );
+    f_moments.addCensus( static_cast<double>( f_count_ui ), static_cast<double>( sums.m_hamming ) );
+    if( f_mask_p )
+    {
+      f_momentsMask.addCensus( static_cast<double>( sums.m_countMask ),
+			       static_cast<double>( sums.m_hammingMask ) );
+    }
+  }
+}
+
+/* *************************** FUNCTION ************************************ */
+/* mergeMomentsTree
+ *
+ * \brief      Merges the input partial moments in a fixed binary tree order:
+ *             first (0,1), (2,3), ..., then (0,2), (4,6), ... and so on. Since
+ *             the order only depends on the number of partials, the result is
+ *             bit-identical no matter which thread computed each partial.
+ *
+ * \param[in]  std::vector<SNCCMoments> &f_partials: Partial moments. They are
+ *             modified by the merge.
+ * \param[out] SNCCMoments &f_moments: Merged moments.
+ *
+ * \return     -
+ *************************************************************************** */
+void mergeMomentsTree( std::vector<SNCCMoments> &f_partials, SNCCMoments &f_moments )
+{
+  const size_t size = f_partials.size();
+  if( size == 0 )
+  {
+    f_moments.reset( f_moments.m_shiftC_d, f_moments.m_shiftV_d );
+    return;
+  }
+
+  for( size_t stride = 1; stride < size; stride *= 2 )
+  {
+    for( size_t i = 0; i + stride < size; i += 2 * stride )
+    {
+      f_partials[ i ].merge( f_partials[ i + stride ] );
+    }
+  }
+
+  f_moments = f_partials[ 0 ];
+}
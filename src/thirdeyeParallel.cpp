@@ -0,0 +1,678 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeParallel.cpp
+ *
+ *  \brief   Definition of the helpers used to run the loops of the third
+ *           eye analysis in parallel.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyeParallel.h"
+
+// Common includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// POSIX includes
+#include <glob.h>
+#include <pthread.h>
+#include <sched.h>
+
+namespace
+{
+  // Upper bound of setSchedulerThreads, so the queues never move
+  const unsigned MAX_SCHEDULER_THREADS_UI = 256;
+
+  // CPUs of a cpulist, e.g. "0-3,8-11"
+  std::vector<unsigned> parseCpuList( const std::string &f_list_str )
+  {
+    std::vector<unsigned> cpus;
+    size_t pos = 0;
+    while( pos < f_list_str.size() )
+    {
+      const size_t end = std::min( f_list_str.find( ',', pos ), f_list_str.size() );
+      const std::string range_str = f_list_str.substr( pos, end - pos );
+      const size_t dash = range_str.find( '-' );
+      if( !range_str.empty() && range_str[ 0 ] >= '0' && range_str[ 0 ] <= '9' )
+      {
+	const unsigned first_ui = static_cast<unsigned>( atoi( range_str.c_str() ) );
+	const unsigned last_ui  = ( dash == std::string::npos ) ? first_ui :
+	                          static_cast<unsigned>( atoi( range_str.c_str() + dash + 1 ) );
+	for( unsigned cpu_ui = first_ui; cpu_ui <= last_ui; ++cpu_ui )
+	{
+	  cpus.push_back( cpu_ui );
+	}
+      }
+      pos = end + 1;
+    }
+    return cpus;
+  }
+
+  // CPUs of each NUMA node (nodes without CPUs are skipped). A single node
+  // without CPUs, i.e. no pinning, if the topology is not available
+  std::vector<std::vector<unsigned> > readNumaNodes()
+  {
+    std::vector<std::vector<unsigned> > nodes;
+
+    glob_t matches;
+    if( glob( "/sys/devices/system/node/node[0-9]*", 0, nullptr, &matches ) == 0 )
+    {
+      // glob sorts by name: node10 before node2, which does not matter here
+      for( size_t i = 0; i < matches.gl_pathc; ++i )
+      {
+	std::ifstream file( ( std::string( matches.gl_pathv[ i ] ) + "/cpulist" ).c_str() );
+	std::string list_str;
+	if( std::getline( file, list_str ) )
+	{
+	  const std::vector<unsigned> cpus = parseCpuList( list_str );
+	  if( !cpus.empty() )
+	  {
+	    nodes.push_back( cpus );
+	  }
+	}
+      }
+    }
+    globfree( &matches );
+
+    if( nodes.empty() )
+    {
+      nodes.push_back( std::vector<unsigned>() );
+    }
+    return nodes;
+  }
+
+  // Restricts a thread to a set of CPUs. Nothing is done for an empty set
+  void pinThread( const pthread_t f_thread, const std::vector<unsigned> &f_cpus )
+  {
+    if( f_cpus.empty() )
+    {
+      return;
+    }
+
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for( size_t i = 0; i < f_cpus.size(); ++i )
+    {
+      if( f_cpus[ i ] < CPU_SETSIZE )
+      {
+	CPU_SET( f_cpus[ i ], &set );
+      }
+    }
+    pthread_setaffinity_np( f_thread, sizeof( set ), &set );
+  }
+
+  // State of one parallelFor call, on the stack of the calling thread. The
+  // call returns only once none of its runners is queued or running
+  struct SLoop
+  {
+    SLoop( const unsigned f_numTasks_ui, const CTaskRef &f_task,
+	   const SLoop* f_parent_p )
+      : m_numTasks_ui( f_numTasks_ui ),
+	m_task_p( &f_task ),
+	m_parent_p( f_parent_p ),
+	m_next( 0 ),
+	m_active( 0 ),
+	m_failed_b( false )
+    { }
+
+    // True if the loop is f_loop_p or nested in one of its tasks
+    bool isWithin( const SLoop* f_loop_p ) const
+    {
+      for( const SLoop* loop_p = this; loop_p; loop_p = loop_p->m_parent_p )
+      {
+	if( loop_p == f_loop_p )
+	{
+	  return true;
+	}
+      }
+      return false;
+    }
+
+    const unsigned m_numTasks_ui;
+
+    const CTaskRef* m_task_p;
+
+    // Loop of the task that started this one, null at the top level. It
+    // outlives this loop, since its task waits for it
+    const SLoop* m_parent_p;
+
+    // Next index to hand out
+    std::atomic<unsigned> m_next;
+
+    // Runners taken from a queue and not yet left. Counted when they are
+    // popped, under the lock of the queue
+    std::atomic<unsigned> m_active;
+
+    // Set by the first task that throws: no further index is started, and
+    // the exception is rethrown by the calling thread
+    std::atomic<bool> m_failed_b;
+
+    std::exception_ptr m_exception;
+
+    std::mutex m_mutex;
+  };
+
+  // Loop whose task the current thread runs. Null outside of any task
+  thread_local const SLoop* t_loop_p = nullptr;
+
+  // Runs indices of the loop until there are none left or a task threw
+  void runLoop( SLoop &f_loop )
+  {
+    const SLoop* outer_p = t_loop_p;
+    t_loop_p = &f_loop;
+
+    for( unsigned i = f_loop.m_next++; i < f_loop.m_numTasks_ui && !f_loop.m_failed_b;
+	 i = f_loop.m_next++ )
+    {
+      try
+      {
+	( *f_loop.m_task_p )( i );
+      }
+      catch( ... )
+      {
+	std::lock_guard<std::mutex> lock( f_loop.m_mutex );
+	if( !f_loop.m_exception )
+	{
+	  f_loop.m_exception = std::current_exception();
+	}
+	f_loop.m_failed_b = true;
+      }
+    }
+
+    t_loop_p = outer_p;
+  }
+
+  // Runners of the loops started by a thread. The owner takes the newest
+  // one (the innermost loop, whose data is hot in its cache); thieves take
+  // the oldest one (the outermost loop, the largest piece of work). A vector
+  // rather than a deque: the queues stay short, and a vector keeps its
+  // storage once grown
+  struct SQueue
+  {
+    std::mutex m_mutex;
+
+    std::vector<SLoop*> m_runners;
+  };
+
+  // Worker index of the current thread. -1 for the other threads
+  thread_local int t_worker_i = -1;
+
+  class CScheduler
+  {
+  public:
+
+    CScheduler()
+      : m_numThreads( defaultNumThreads() ),
+	m_numReserved( 0 ),
+	m_numa_b( false ),
+	m_nodes( readNumaNodes() ),
+	m_numWorkers( 0 ),
+	m_numQueued( 0 ),
+	m_nodeQueued( new std::atomic<int>[ m_nodes.size() + 1 ] ),
+	m_victim( 0 ),
+	m_numPushes( 0 )
+    {
+      for( size_t n = 0; n <= m_nodes.size(); ++n )
+      {
+	m_nodeQueued[ n ] = 0;
+      }
+
+      // To undo the pinning
+      cpu_set_t set;
+      CPU_ZERO( &set );
+      if( sched_getaffinity( 0, sizeof( set ), &set ) == 0 )
+      {
+	for( unsigned cpu_ui = 0; cpu_ui < CPU_SETSIZE; ++cpu_ui )
+	{
+	  if( CPU_ISSET( cpu_ui, &set ) )
+	  {
+	    m_processCpus.push_back( cpu_ui );
+	  }
+	}
+      }
+    }
+
+    void setNumThreads( const unsigned f_numThreads_ui )
+    {
+      const unsigned numThreads_ui = ( f_numThreads_ui > 0 ) ? f_numThreads_ui :
+	                             defaultNumThreads();
+      m_numThreads = std::min( numThreads_ui, MAX_SCHEDULER_THREADS_UI );
+      {
+	std::lock_guard<std::mutex> lock( m_mutex );
+      }
+      m_wake.notify_all();
+    }
+
+    unsigned getNumThreads() const
+    { return m_numThreads; }
+
+    void reserve( const int f_count_i )
+    {
+      {
+	std::lock_guard<std::mutex> lock( m_mutex );
+	m_numReserved += f_count_i;
+      }
+      m_wake.notify_all();
+    }
+
+    // Threads the loops may use: the bound minus the reserved threads, at
+    // least the calling one
+    unsigned getNumAvailable() const
+    {
+      const int available_i = static_cast<int>( m_numThreads ) - m_numReserved;
+      return ( available_i > 1 ) ? static_cast<unsigned>( available_i ) : 1;
+    }
+
+    void setNuma( const bool f_numa_b );
+
+    inline unsigned getNumNodes() const
+    { return static_cast<unsigned>( m_nodes.size() ); }
+
+    // Workers are spread over the nodes in turn
+    inline unsigned workerNode( const unsigned f_worker_ui ) const
+    { return f_worker_ui % getNumNodes(); }
+
+    unsigned currentNode() const
+    { return ( m_numa_b && t_worker_i >= 0 ) ? workerNode( t_worker_i ) : 0; }
+
+    void run( const unsigned f_numTasks_ui, const CTaskRef &f_task,
+	      const unsigned f_numRunners_ui );
+
+  private:
+
+    void startWorkers();
+
+    void workerLoop( const unsigned f_worker_ui );
+
+    void push( SLoop &f_loop, const unsigned f_count_ui );
+
+    SLoop* pop( const unsigned f_queue_ui, const bool f_newest_b, const SLoop* f_within_p );
+
+    // Removes the runners of the loop still in the queue of the thread
+    void withdraw( SLoop &f_loop );
+
+    // Entry of m_nodeQueued for a queue: 0 for queue 0, the node plus one
+    // for the queue of a worker
+    inline unsigned queueGroup( const unsigned f_queue_ui ) const
+    { return ( f_queue_ui > 0 ) ? workerNode( f_queue_ui - 1 ) + 1 : 0; }
+
+    // True if there is a runner that the worker may take
+    bool hasWork( const unsigned f_worker_ui ) const;
+
+    bool runOne( const SLoop* f_within_p );
+
+    std::atomic<unsigned> m_numThreads;
+
+    // Threads outside of the scheduler counted against its bound (see
+    // reserveSchedulerThreads)
+    std::atomic<int> m_numReserved;
+
+    // Workers pinned to their node, and stealing only within it
+    std::atomic<bool> m_numa_b;
+
+    // CPUs of each NUMA node, and those the process started with
+    const std::vector<std::vector<unsigned> > m_nodes;
+
+    std::vector<unsigned> m_processCpus;
+
+    // Queue 0 holds the loops of the threads that are not workers. Worker w
+    // owns queue w + 1
+    SQueue m_queues[ MAX_SCHEDULER_THREADS_UI + 1 ];
+
+    std::atomic<unsigned> m_numWorkers;
+
+    pthread_t m_workers[ MAX_SCHEDULER_THREADS_UI ];
+
+    // Runners in all the queues, and per queue group (see queueGroup). With
+    // NUMA pinning an idle worker waits for runners of its own group or of
+    // queue 0 only, since it cannot take the others
+    std::atomic<int> m_numQueued;
+
+    std::unique_ptr<std::atomic<int>[]> m_nodeQueued;
+
+    // First queue to steal from, rotated so that thieves spread out
+    std::atomic<unsigned> m_victim;
+
+    // Idle workers sleep on m_wake, and the threads waiting for the
+    // runners of their loop to leave on m_leave. Both are notified on each
+    // push, which m_numPushes counts
+    std::mutex m_mutex;
+
+    std::condition_variable m_wake;
+
+    std::condition_variable m_leave;
+
+    std::atomic<unsigned> m_numPushes;
+  };
+
+  // Never deleted: the workers are detached and live until the process ends
+  CScheduler& scheduler()
+  {
+    static CScheduler* scheduler_p = new CScheduler();
+    return *scheduler_p;
+  }
+
+  void CScheduler::startWorkers()
+  {
+    const unsigned numWorkers_ui = m_numThreads - 1;
+    if( m_numWorkers >= numWorkers_ui )
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock( m_mutex );
+    while( m_numWorkers < numWorkers_ui )
+    {
+      const unsigned worker_ui = m_numWorkers;
+      std::thread worker( &CScheduler::workerLoop, this, worker_ui );
+      m_workers[ worker_ui ] = worker.native_handle();
+      worker.detach();
+      ++m_numWorkers;
+    }
+  }
+
+  void CScheduler::setNuma( const bool f_numa_b )
+  {
+    std::lock_guard<std::mutex> lock( m_mutex );
+    m_numa_b = f_numa_b;
+    for( unsigned w = 0; w < m_numWorkers; ++w )
+    {
+      pinThread( m_workers[ w ], f_numa_b ? m_nodes[ workerNode( w ) ] : m_processCpus );
+    }
+    // The runners the idle workers may take change
+    m_wake.notify_all();
+  }
+
+  bool CScheduler::hasWork( const unsigned f_worker_ui ) const
+  {
+    if( !m_numa_b )
+    {
+      return m_numQueued > 0;
+    }
+    return m_nodeQueued[ 0 ] > 0 || m_nodeQueued[ workerNode( f_worker_ui ) + 1 ] > 0;
+  }
+
+  void CScheduler::workerLoop( const unsigned f_worker_ui )
+  {
+    t_worker_i = static_cast<int>( f_worker_ui );
+
+    // Pinned before running anything, so the buffers the worker first
+    // touches are on its node. Under m_mutex, so that setNuma either comes
+    // before and is seen here, or after and pins this worker again
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      if( m_numa_b )
+      {
+	pinThread( pthread_self(), m_nodes[ workerNode( f_worker_ui ) ] );
+      }
+    }
+
+    for( ;; )
+    {
+      // Workers above the current bound, less the reserved threads, stay idle
+      const bool active_b = f_worker_ui + 1 < getNumAvailable();
+      if( active_b && runOne( nullptr ) )
+      {
+	continue;
+      }
+
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_wake.wait( lock, [&]() { return f_worker_ui + 1 < getNumAvailable() && hasWork( f_worker_ui ); } );
+    }
+  }
+
+  void CScheduler::push( SLoop &f_loop, const unsigned f_count_ui )
+  {
+    const unsigned queue_ui = static_cast<unsigned>( t_worker_i + 1 );
+    SQueue &queue = m_queues[ queue_ui ];
+    {
+      std::lock_guard<std::mutex> lock( queue.m_mutex );
+      queue.m_runners.insert( queue.m_runners.end(), f_count_ui, &f_loop );
+    }
+    m_nodeQueued[ queueGroup( queue_ui ) ] += static_cast<int>( f_count_ui );
+    m_numQueued += static_cast<int>( f_count_ui );
+
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      ++m_numPushes;
+    }
+    m_wake.notify_all();
+    m_leave.notify_all();
+  }
+
+  // Takes the newest or the oldest runner of the queue, among those of the
+  // loops within f_within_p if not null. Null if there is none
+  SLoop* CScheduler::pop( const unsigned f_queue_ui, const bool f_newest_b,
+			  const SLoop* f_within_p )
+  {
+    SQueue &queue = m_queues[ f_queue_ui ];
+    std::lock_guard<std::mutex> lock( queue.m_mutex );
+    std::vector<SLoop*> &runners = queue.m_runners;
+
+    const size_t size = runners.size();
+    for( size_t k = 0; k < size; ++k )
+    {
+      const size_t pos = f_newest_b ? size - 1 - k : k;
+      SLoop* loop_p = runners[ pos ];
+      if( f_within_p && !loop_p->isWithin( f_within_p ) )
+      {
+	continue;
+      }
+
+      runners.erase( runners.begin() + pos );
+      ++loop_p->m_active;
+      --m_nodeQueued[ queueGroup( f_queue_ui ) ];
+      --m_numQueued;
+      return loop_p;
+    }
+    return nullptr;
+  }
+
+  void CScheduler::withdraw( SLoop &f_loop )
+  {
+    const unsigned queue_ui = static_cast<unsigned>( t_worker_i + 1 );
+    SQueue &queue = m_queues[ queue_ui ];
+    std::lock_guard<std::mutex> lock( queue.m_mutex );
+    std::vector<SLoop*> &runners = queue.m_runners;
+
+    const std::vector<SLoop*>::iterator end = std::remove( runners.begin(), runners.end(), &f_loop );
+    const int count_i = static_cast<int>( runners.end() - end );
+    runners.erase( end, runners.end() );
+    m_nodeQueued[ queueGroup( queue_ui ) ] -= count_i;
+    m_numQueued -= count_i;
+  }
+
+  // Runs a runner: first from the own queue, then from the threads that are
+  // not workers, then stolen from the other workers. Only runners of the
+  // loops within f_within_p are taken if it is not null. False if none was
+  // found
+  bool CScheduler::runOne( const SLoop* f_within_p )
+  {
+    const int self_i = t_worker_i;
+
+    SLoop* loop_p = ( self_i >= 0 ) ? pop( self_i + 1, true, f_within_p ) : nullptr;
+    if( !loop_p )
+    {
+      loop_p = pop( 0, false, f_within_p );
+    }
+
+    // With NUMA pinning a worker only steals from its own node, so the
+    // loops nested in a frame stay on the node that started the frame
+    const bool sameNode_b = m_numa_b && self_i >= 0;
+    const unsigned numWorkers_ui = m_numWorkers;
+    const unsigned start_ui = m_victim++;
+    for( unsigned k = 0; !loop_p && k < numWorkers_ui; ++k )
+    {
+      const unsigned victim_ui = ( start_ui + k ) % numWorkers_ui;
+      if( static_cast<int>( victim_ui ) != self_i &&
+	  ( !sameNode_b || workerNode( victim_ui ) == workerNode( self_i ) ) )
+      {
+	loop_p = pop( victim_ui + 1, false, f_within_p );
+      }
+    }
+
+    if( !loop_p )
+    {
+      return false;
+    }
+
+    runLoop( *loop_p );
+
+    // The loop may be gone as soon as the count drops to zero: only the
+    // scheduler is touched afterwards
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      --loop_p->m_active;
+    }
+    m_leave.notify_all();
+    return true;
+  }
+
+  void CScheduler::run( const unsigned f_numTasks_ui,
+			const CTaskRef &f_task,
+			const unsigned f_numRunners_ui )
+  {
+    SLoop loop( f_numTasks_ui, f_task, t_loop_p );
+
+    startWorkers();
+    push( loop, f_numRunners_ui - 1 );
+
+    // The calling thread also works. Once it is done all the indices are
+    // handed out, so the runners still queued have nothing left to do
+    runLoop( loop );
+    withdraw( loop );
+
+    // Wait for the runners that took indices to leave. Meanwhile, run the
+    // runners of the loops nested in this one (the other threads wait for
+    // them), but not those of outer loops, which could hold this thread
+    // long after this loop is done
+    for( ;; )
+    {
+      const unsigned numPushes_ui = m_numPushes;
+      if( runOne( &loop ) )
+      {
+	continue;
+      }
+
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_leave.wait( lock, [&]() { return loop.m_active == 0 || m_numPushes != numPushes_ui; } );
+      if( loop.m_active == 0 )
+      {
+	break;
+      }
+    }
+
+    if( loop.m_exception )
+    {
+      std::rethrow_exception( loop.m_exception );
+    }
+  }
+}
+
+/* *************************** FUNCTION ************************************ */
+/* defaultNumThreads
+ *
+ * \brief      Returns the number of hardware threads, at least one.
+ *
+ * \return     Number of threads.
+ *************************************************************************** */
+unsigned defaultNumThreads()
+{
+  const unsigned numThreads_ui = std::thread::hardware_concurrency();
+  return ( numThreads_ui > 0 ) ? numThreads_ui : 1;
+}
+
+void setSchedulerThreads( const unsigned f_numThreads_ui )
+{
+  scheduler().setNumThreads( f_numThreads_ui );
+}
+
+unsigned getSchedulerThreads()
+{
+  return scheduler().getNumThreads();
+}
+
+void reserveSchedulerThreads( const unsigned f_count_ui )
+{
+  scheduler().reserve( static_cast<int>( f_count_ui ) );
+}
+
+void releaseSchedulerThreads( const unsigned f_count_ui )
+{
+  scheduler().reserve( -static_cast<int>( f_count_ui ) );
+}
+
+void setSchedulerNuma( const bool f_numa_b )
+{
+  scheduler().setNuma( f_numa_b );
+}
+
+unsigned getNumNumaNodes()
+{
+  return scheduler().getNumNodes();
+}
+
+unsigned currentNumaNode()
+{
+  return scheduler().currentNode();
+}
+
+/* *************************** FUNCTION ************************************ */
+/* parallelFor
+ *
+ * \brief      Runs the input task for each index in [0, f_numTasks_ui). The
+ *             loop gets up to f_numThreads_ui - 1 runners, queued on the
+ *             scheduler; the threads that pick one up hand out the indices
+ *             one by one from the loop's counter, together with the calling
+ *             thread. A runner queued by a worker goes to its own queue, where
+ *             idle workers steal it, so the row blocks of a large frame are
+ *             spread out once there are no more frames to start. While the
+ *             last indices run elsewhere, the calling thread runs the queued
+ *             runners of the loops nested in its own, and sleeps otherwise
+ *             until it is woken by a runner that leaves. The function returns
+ *             once all the tasks are done. If a task throws, no further task
+ *             is started and the first exception is rethrown here, once the
+ *             other threads are out of the loop.
+ *
+ * \param[in]  const unsigned f_numTasks_ui: Number of tasks.
+ * \param[in]  const CTaskRef &f_task: Task to run.
+ * \param[in]  const unsigned f_numThreads_ui: Max number of threads. If zero,
+ *             or above getSchedulerThreads() less the reserved threads (see
+ *             reserveSchedulerThreads), that bound is used.
+ *
+ * \return     -
+ *************************************************************************** */
+void parallelFor( const unsigned f_numTasks_ui,
+		  const CTaskRef &f_task,
+		  const unsigned f_numThreads_ui )
+{
+  const unsigned schedulerThreads_ui = scheduler().getNumAvailable();
+  unsigned numThreads_ui = ( f_numThreads_ui > 0 ) ?
+                           std::min( f_numThreads_ui, schedulerThreads_ui ) : schedulerThreads_ui;
+  if( numThreads_ui > f_numTasks_ui )
+  {
+    numThreads_ui = f_numTasks_ui;
+  }
+
+  // Nothing to share
+  if( numThreads_ui <= 1 )
+  {
+    for( unsigned i = 0; i < f_numTasks_ui; ++i )
+    {
+      f_task( i );
+    }
+    return;
+  }
+
+  scheduler().run( f_numTasks_ui, f_task, numThreads_ui );
+}
@@ -0,0 +1,100 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyePixel.cpp
+ *
+ *  \brief   Definition of the helpers to read the intensity images in their
+ *           native pixel type.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyePixel.h"
+
+// SIMD includes. SSE2 is part of the x86-64 baseline.
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  /* *************************** FUNCTION ************************************ */
+  /* convertRow
+   *
+   * \brief      Converts a run of unsigned integer pixels into floats. With
+   *             SSE2, 8 pixels are widened (unpack with zero) and converted
+   *             per iteration.
+   *************************************************************************** */
+  template<typename T>
+  void convertRow( const T* f_src_p, const unsigned f_count_ui, float* f_dst_p );
+
+  template<>
+  void convertRow<uchar>( const uchar* f_src_p, const unsigned f_count_ui, float* f_dst_p )
+  {
+    unsigned x = 0;
+#if defined( __SSE2__ )
+    const __m128i zero = _mm_setzero_si128();
+    for( ; x + 8 <= f_count_ui; x += 8 )
+    {
+      const __m128i bytes = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( f_src_p + x ) );
+      const __m128i words = _mm_unpacklo_epi8( bytes, zero );
+      _mm_storeu_ps( f_dst_p + x,     _mm_cvtepi32_ps( _mm_unpacklo_epi16( words, zero ) ) );
+      _mm_storeu_ps( f_dst_p + x + 4, _mm_cvtepi32_ps( _mm_unpackhi_epi16( words, zero ) ) );
+    }
+#endif
+    for( ; x < f_count_ui; ++x )
+    {
+      f_dst_p[ x ] = f_src_p[ x ];
+    }
+  }
+
+  template<>
+  void convertRow<ushort>( const ushort* f_src_p, const unsigned f_count_ui, float* f_dst_p )
+  {
+    unsigned x = 0;
+#if defined( __SSE2__ )
+    const __m128i zero = _mm_setzero_si128();
+    for( ; x + 8 <= f_count_ui; x += 8 )
+    {
+      const __m128i words = _mm_loadu_si128( reinterpret_cast<const __m128i*>( f_src_p + x ) );
+      _mm_storeu_ps( f_dst_p + x,     _mm_cvtepi32_ps( _mm_unpacklo_epi16( words, zero ) ) );
+      _mm_storeu_ps( f_dst_p + x + 4, _mm_cvtepi32_ps( _mm_unpackhi_epi16( words, zero ) ) );
+    }
+#endif
+    for( ; x < f_count_ui; ++x )
+    {
+      f_dst_p[ x ] = f_src_p[ x ];
+    }
+  }
+}
+
+/* *************************** FUNCTION ************************************ */
+/* rowAsFloat
+ *
+ * \brief      Returns a run of pixels of an intensity image as floats. Float
+ *             images are returned in place, 8 and 16 bit images are converted
+ *             into the given buffer.
+ *
+ * \param[in]  const cv::Mat &f_img: Intensity image (see isIntensityType).
+ * \param[in]  const unsigned f_y_ui: Row.
+ * \param[in]  const unsigned f_x_ui: First column.
+ * \param[in]  const unsigned f_count_ui: Number of pixels.
+ * \param[out] float* f_buffer_p: Buffer for the converted pixels.
+ *
+ * \return     Pointer to the first float.
+ *************************************************************************** */
+const float* rowAsFloat( const cv::Mat &f_img, const unsigned f_y_ui, 
+			 const unsigned f_x_ui, const unsigned f_count_ui,
+			 float* f_buffer_p )
+{
+  switch( f_img.depth() )
+  {
+    case CV_8U:
+      convertRow( f_img.ptr<uchar>( f_y_ui ) + f_x_ui, f_count_ui, f_buffer_p );
+      return f_buffer_p;
+    case CV_16U:
+      convertRow( f_img.ptr<ushort>( f_y_ui ) + f_x_ui, f_count_ui, f_buffer_p );
+      return f_buffer_p;
+    default:
+      return f_img.ptr<float>( f_y_ui ) + f_x_ui;
+  }
+}
@@ -0,0 +1,389 @@
+/* ******************************** FILE *********************************** */
+/** \file    thirdeyeSequence.cpp
+ *
+ *  \brief   Definition of CThirdEyeSequence and of the frame sources.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Corresponding header
+#include "../h/thirdeyeSequence.h"
+
+// Common includes
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <thread>
+
+// Project includes
+#include "../h/boundedQueue.h"
+#include "../h/loader.h"
+#include "../h/thirdeyeParallel.h"
+
+using std::cerr;
+using std::endl;
+
+/*******************************************************************************/
+/***********************  Class CThirdEyePatternSource *************************/
+CThirdEyePatternSource::CThirdEyePatternSource( const std::string &f_basePattern_str,
+						const std::string &f_controlPattern_str,
+						const std::string &f_dispPattern_str,
+						const unsigned f_bits_ui )
+  : m_basePattern_str( f_basePattern_str ),
+    m_controlPattern_str( f_controlPattern_str ),
+    m_dispPattern_str( f_dispPattern_str ),
+    m_bits_ui( f_bits_ui )
+{
+  /* Empty body */
+}
+
+bool CThirdEyePatternSource::loadFrame( SThirdEyeFrame &f_frame )
+{
+  float controlScale_f = 1.f;
+  f_frame.m_base      = loadImageFileNative( frameFileName( m_basePattern_str, f_frame.m_index_ui ),
+					     m_bits_ui, f_frame.m_intensityScale_f );
+  f_frame.m_control   = loadImageFileNative( frameFileName( m_controlPattern_str, f_frame.m_index_ui ),
+					     m_bits_ui, controlScale_f );
+  f_frame.m_disparity = loadRawImage( frameFileName( m_dispPattern_str, f_frame.m_index_ui ),
+				      f_frame.m_subpixelBits_ui );
+
+  return !f_frame.m_base.empty() && !f_frame.m_control.empty() && !f_frame.m_disparity.empty();
+}
+
+/*******************************************************************************/
+/***********************  Class CThirdEyeListSource ****************************/
+CThirdEyeListSource::CThirdEyeListSource( const std::vector<std::string> &f_baseFiles,
+					  const std::vector<std::string> &f_controlFiles,
+					  const std::vector<std::string> &f_dispFiles,
+					  const unsigned f_bits_ui )
+  : m_baseFiles( f_baseFiles ),
+    m_controlFiles( f_controlFiles ),
+    m_dispFiles( f_dispFiles ),
+    m_bits_ui( f_bits_ui )
+{
+  /* Empty body */
+}
+
+unsigned CThirdEyeListSource::getNumFrames() const
+{
+  return static_cast<unsigned>( std::min( m_baseFiles.size(),
+					  std::min( m_controlFiles.size(), m_dispFiles.size() ) ) );
+}
+
+bool CThirdEyeListSource::loadFrame( SThirdEyeFrame &f_frame )
+{
+  const unsigned i = f_frame.m_index_ui;
+  if( i >= getNumFrames() )
+  {
+    cerr << "ERROR CThirdEyeListSource::loadFrame: No frame " << i << endl;
+    return false;
+  }
+
+  float controlScale_f = 1.f;
+  f_frame.m_base      = loadImageFileNative( m_baseFiles[ i ], m_bits_ui, f_frame.m_intensityScale_f );
+  f_frame.m_control   = loadImageFileNative( m_controlFiles[ i ], m_bits_ui, controlScale_f );
+  f_frame.m_disparity = loadRawImage( m_dispFiles[ i ], f_frame.m_subpixelBits_ui );
+
+  return !f_frame.m_base.empty() && !f_frame.m_control.empty() && !f_frame.m_disparity.empty();
+}
+
+/*******************************************************************************/
+/***********************  Class CThirdEyeContainerSource ***********************/
+CThirdEyeContainerSource::CThirdEyeContainerSource( )
+  : m_reader( ),
+    m_base_i( -1 ),
+    m_control_i( -1 ),
+    m_disparity_i( -1 )
+{
+  /* Empty body */
+}
+
+bool CThirdEyeContainerSource::open( const std::string &f_fileName_str )
+{
+  if( !m_reader.open( f_fileName_str ) )
+  {
+    return false;
+  }
+
+  m_base_i      = m_reader.findStream( "base" );
+  m_control_i   = m_reader.findStream( "control" );
+  m_disparity_i = m_reader.findStream( "disparity" );
+  if( m_base_i < 0 || m_control_i < 0 || m_disparity_i < 0 )
+  {
+    cerr << "ERROR CThirdEyeContainerSource::open: The file needs a base, a control "
+	 << "and a disparity stream: " << f_fileName_str << endl;
+    m_reader.close();
+    return false;
+  }
+
+  return true;
+}
+
+bool CThirdEyeContainerSource::loadFrame( SThirdEyeFrame &f_frame )
+{
+  f_frame.m_base             = m_reader.getFrame( f_frame.m_index_ui, m_base_i );
+  f_frame.m_control          = m_reader.getFrame( f_frame.m_index_ui, m_control_i );
+  f_frame.m_disparity        = m_reader.getFrame( f_frame.m_index_ui, m_disparity_i );
+  f_frame.m_intensityScale_f = m_reader.getStream( m_base_i ).m_intensityScale_f;
+  f_frame.m_subpixelBits_ui  = m_reader.getStream( m_disparity_i ).m_subpixelBits_ui;
+
+  return !f_frame.m_base.empty() && !f_frame.m_control.empty() && !f_frame.m_disparity.empty();
+}
+
+/*******************************************************************************/
+/***********************  Class CThirdEyeSequence ******************************/
+CThirdEyeSequence::CThirdEyeSequence( const CThirdEyeEvaluation &f_eval )
+  : m_eval( f_eval ),
+    m_slots( ),
+    m_lastFrame( 0 ),
+    m_numLoaders_ui( 2 ),
+    m_depth_ui( 4 )
+{
+  /* Empty body */
+}
+
+CThirdEyeSequence::~CThirdEyeSequence()
+{
+  /* Empty body */
+}
+
+/* *************************** METHOD ************************************** */
+/* run
+ *
+ * \brief      Evaluates a range of frames. A loader thread takes a free slot
+ *             (see SSlot) and a frame index from a shared counter, loads the
+ *             frame and pushes it into the first queue; a warp thread and a
+ *             mask thread run those stages into the workspace of the slot
+ *             (see runWarpStage and runMaskStage), and the stats stage runs in
+ *             the calling thread, where computeEvaluationIndices finds the
+ *             virtual image and the mask cached and only computes the indices
+ *             (each loaded frame gets a new frame token, see
+ *             SThirdEyeWorkspace::setFrame).
+ *             The row blocks of the three stages share the scheduler workers
+ *             (see parallelFor). The slot goes back to the loaders with the
+ *             result, so the number of slots bounds the frames in flight and
+ *             the memory in use. In pyramid or adaptive mode (see
+ *             hasFullStages) the warp and mask threads pass the frames on
+ *             untouched, and the stats stage evaluates them as usual. A frame
+ *             that fails in a stage goes on as invalid, so there is one result
+ *             per frame.
+ *
+ *             The threads of the stages count against the scheduler bound
+ *             (see setSchedulerThreads): they are reserved while the frames
+ *             run (see reserveSchedulerThreads), and with a small bound the
+ *             stages share threads. With three threads the warp and mask
+ *             stages share one, with two they run in the calling thread with
+ *             the stats, and with one the calling thread also loads the
+ *             frames. The loaders take what is left of the bound.
+ *
+ * \param[in]  CThirdEyeFrameSource &f_source: Source of the frames.
+ * \param[in]  const unsigned f_first_ui: First frame index.
+ * \param[in]  const unsigned f_count_ui: Number of frames.
+ * \param[out] std::vector<SThirdEyeFrameResult> &f_results: One result per
+ *             frame, sorted by frame index.
+ *
+ * \return     True if all the frames were evaluated. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeSequence::run( CThirdEyeFrameSource &f_source, const unsigned f_first_ui,
+			     const unsigned f_count_ui, std::vector<SThirdEyeFrameResult> &f_results )
+{
+  f_results.clear();
+  f_results.reserve( f_count_ui );
+
+  // Threads of the stages besides the calling one, within the bound
+  const unsigned numThreads_ui      = getSchedulerThreads();
+  const unsigned numStageThreads_ui = ( numThreads_ui >= 4 ) ? 2 : ( numThreads_ui == 3 ? 1 : 0 );
+  const unsigned numLoaders_ui      = ( numThreads_ui == 1 ) ? 0 :
+                                      std::min( std::min( m_numLoaders_ui, std::max( f_count_ui, 1u ) ),
+						numThreads_ui - 1 - numStageThreads_ui );
+
+  // One slot per loader, per waiting frame and per stage
+  const unsigned numSlots_ui = numLoaders_ui + m_depth_ui + 3;
+  while( m_slots.size() < numSlots_ui )
+  {
+    m_slots.push_back( std::unique_ptr<SSlot>( new SSlot{ m_eval, SThirdEyeWorkspace() } ) );
+  }
+
+  CBoundedQueue<SSlot*> freeSlots( numSlots_ui );
+  for( unsigned s = 0; s < numSlots_ui; ++s )
+  {
+    freeSlots.push( m_slots[ s ].get() );
+  }
+
+  CBoundedQueue<SItem> loaded( m_depth_ui );
+  CBoundedQueue<SItem> warped( m_depth_ui );
+  CBoundedQueue<SItem> masked( m_depth_ui );
+
+  const bool stages_b = m_eval.hasFullStages();
+
+  // The stages of one frame
+  std::atomic<uint64_t> lastFrame( m_lastFrame );
+  auto loadItem = [&]( const unsigned f_index_ui, SItem &f_item )
+  {
+    freeSlots.pop( f_item.m_slot_p );
+    f_item.m_frame.m_index_ui = f_first_ui + f_index_ui;
+    f_item.m_frame.m_valid_b  = f_source.loadFrame( f_item.m_frame );
+    f_item.m_slot_p->m_workspace.setFrame( ++lastFrame );
+    if( f_item.m_frame.m_valid_b )
+    {
+      f_item.m_slot_p->m_eval.setIntensityScale( f_item.m_frame.m_intensityScale_f );
+      f_item.m_slot_p->m_eval.setSubpixelBits( f_item.m_frame.m_subpixelBits_ui );
+    }
+    else
+    {
+      cerr << "ERROR CThirdEyeSequence::run: Cannot load frame " << f_item.m_frame.m_index_ui << endl;
+    }
+  };
+
+  auto warpItem = [&]( SItem &f_item )
+  {
+    if( stages_b && f_item.m_frame.m_valid_b )
+    {
+      f_item.m_frame.m_valid_b = f_item.m_slot_p->m_eval.runWarpStage( f_item.m_frame.m_disparity,
+								       f_item.m_frame.m_base,
+								       f_item.m_slot_p->m_workspace );
+    }
+  };
+
+  auto maskItem = [&]( SItem &f_item )
+  {
+    if( stages_b && f_item.m_frame.m_valid_b )
+    {
+      f_item.m_frame.m_valid_b = f_item.m_slot_p->m_eval.runMaskStage( f_item.m_frame.m_control,
+								       f_item.m_slot_p->m_workspace );
+    }
+  };
+
+  // The slot goes back to the loaders with the result
+  bool ok_b = true;
+  auto statsItem = [&]( SItem &f_item )
+  {
+    SThirdEyeFrameResult result;
+    result.m_index_ui = f_item.m_frame.m_index_ui;
+    if( f_item.m_frame.m_valid_b )
+    {
+      SThirdEyeWorkspace &workspace = f_item.m_slot_p->m_workspace;
+      result.m_valid_b = f_item.m_slot_p->m_eval.computeEvaluationIndices( f_item.m_frame.m_disparity,
+									   f_item.m_frame.m_base,
+									   f_item.m_frame.m_control,
+									   workspace,
+									   result.m_fullIndex_f,
+									   result.m_maskIndex_f );
+      result.m_quality_e       = workspace.m_quality_e;
+      result.m_estimate_f      = workspace.m_estimate_f;
+      result.m_estimateLower_f = workspace.m_estimateLower_f;
+      result.m_estimateUpper_f = workspace.m_estimateUpper_f;
+    }
+    ok_b = ok_b && result.m_valid_b;
+    f_results.push_back( result );
+
+    freeSlots.push( f_item.m_slot_p );
+  };
+
+  // Load
+  std::atomic<unsigned> next( 0 );
+  std::atomic<unsigned> activeLoaders( numLoaders_ui );
+  auto loader = [&]()
+  {
+    for( unsigned i = next++; i < f_count_ui; i = next++ )
+    {
+      SItem item;
+      loadItem( i, item );
+      loaded.push( item );
+    }
+    // The last loader closes the queue
+    if( --activeLoaders == 0 )
+    {
+      loaded.close();
+    }
+  };
+
+  // Warp, and also mask if the stages share a thread
+  auto warp = [&]()
+  {
+    CBoundedQueue<SItem> &output = ( numStageThreads_ui == 2 ) ? warped : masked;
+    SItem item;
+    while( loaded.pop( item ) )
+    {
+      warpItem( item );
+      if( numStageThreads_ui == 1 )
+      {
+	maskItem( item );
+      }
+      output.push( item );
+      item = SItem();
+    }
+    output.close();
+  };
+
+  // Mask
+  auto mask = [&]()
+  {
+    SItem item;
+    while( warped.pop( item ) )
+    {
+      maskItem( item );
+      masked.push( item );
+      item = SItem();
+    }
+    masked.close();
+  };
+
+  const unsigned numReserved_ui = numLoaders_ui + numStageThreads_ui;
+  reserveSchedulerThreads( numReserved_ui );
+
+  std::vector<std::thread> threads;
+  for( unsigned t = 0; t < numLoaders_ui; ++t )
+  {
+    threads.push_back( std::thread( loader ) );
+  }
+  if( numStageThreads_ui > 0 )
+  {
+    threads.push_back( std::thread( warp ) );
+  }
+  if( numStageThreads_ui > 1 )
+  {
+    threads.push_back( std::thread( mask ) );
+  }
+
+  // Stats, in this thread, and the stages that have no thread of their own
+  SItem item;
+  if( numLoaders_ui == 0 )
+  {
+    for( unsigned i = 0; i < f_count_ui; ++i )
+    {
+      loadItem( i, item );
+      warpItem( item );
+      maskItem( item );
+      statsItem( item );
+      item = SItem();
+    }
+  }
+  else
+  {
+    CBoundedQueue<SItem> &input = ( numStageThreads_ui > 0 ) ? masked : loaded;
+    while( input.pop( item ) )
+    {
+      if( numStageThreads_ui == 0 )
+      {
+	warpItem( item );
+	maskItem( item );
+      }
+      statsItem( item );
+      item = SItem();
+    }
+  }
+
+  for( size_t t = 0; t < threads.size(); ++t )
+  {
+    threads[ t ].join();
+  }
+  releaseSchedulerThreads( numReserved_ui );
+  m_lastFrame = lastFrame;
+
+  std::sort( f_results.begin(), f_results.end(),
+	     []( const SThirdEyeFrameResult &a, const SThirdEyeFrameResult &b )
+	     { return a.m_index_ui < b.m_index_ui; } );
+
+  return ok_b && f_results.size() == f_count_ui;
+}
@@ -9,10 +9,33 @@
 // Corresponding header
 #include "../h/thirdeyeStats.h"
 
+// Project includes
+#include "../h/thirdeyeParallel.h"
+#include "../h/thirdeyePixel.h"
+#include "../h/imagePool.h"
+
 // Common includes
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <vector>
+
+using std::cerr;
 
-using std::cout;
+namespace
+{
+  // Number of rows of the RoI reduced by each parallel task. It is fixed, so
+  // the partial moments (and therefore the results) do not depend on the 
+  // number of threads.
+  const unsigned ROW_BLOCK_UI = 16;
+
+  // Shortest run of pixels of the same disparity band that is binned with
+  // the row kernel (one iteration of its SSE loop), rather than pixel by pixel
+  const unsigned BAND_RUN_UI = 16;
+}
+
+/*******************************************************************************/
+/***********************  Class CThirdEyeStats *********************************/
 
 /* *************************** METHOD ************************************** */
 /* Standard constructor.
@@ -30,8 +53,23 @@ CThirdEyeStats::CThirdEyeStats()
     m_x2_ui(  640 ), 
     m_y2_ui(  480 ),
 
+    m_numThreads_ui( 0 ),
+
     m_ncc_f(     -32000.f ),
-    m_nccMask_f( -32000.f )
+    m_nccMask_f( -32000.f ),
+
+    m_localWindow_ui( 0 ),
+    m_localStride_ui( 1 ),
+
+    m_numLabels_ui( 0 ),
+
+    m_bandMin_f( 0.f ),
+    m_bandMax_f( 0.f ),
+    m_numBands_ui( 0 ),
+
+    m_metrics_ui( METRIC_NCC ),
+
+    m_intensityScale_f( 1.f )
 {
   /* Empty body */
 }
@@ -76,12 +114,48 @@ void CThirdEyeStats::setROI( const unsigned f_x1_ui, const unsigned f_y1_ui,
   m_y2_ui = f_y2_ui;
 }
 
+/* *************************** METHOD ************************************** */
+/* setConfiguration
+ *
+ * \brief      Copies the settings of another object (RoI, threads, local
+ *             window, regions, labels, bands, metrics and intensity scale).
+ *             The results and the buffers of this object are kept, so it can
+ *             be configured before every evaluation at little cost.
+ *
+ * \param[in]  const CThirdEyeStats &f_config: Object to copy the settings from.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeStats::setConfiguration( const CThirdEyeStats &f_config )
+{
+  m_x1_ui            = f_config.m_x1_ui;
+  m_y1_ui            = f_config.m_y1_ui;
+  m_x2_ui            = f_config.m_x2_ui;
+  m_y2_ui            = f_config.m_y2_ui;
+  m_numThreads_ui    = f_config.m_numThreads_ui;
+  m_localWindow_ui   = f_config.m_localWindow_ui;
+  m_localStride_ui   = f_config.m_localStride_ui;
+  m_regions          = f_config.m_regions;
+  m_labels           = f_config.m_labels;
+  m_numLabels_ui     = f_config.m_numLabels_ui;
+  m_bandMin_f        = f_config.m_bandMin_f;
+  m_bandMax_f        = f_config.m_bandMax_f;
+  m_numBands_ui      = f_config.m_numBands_ui;
+  m_metrics_ui       = f_config.m_metrics_ui;
+  m_intensityScale_f = f_config.m_intensityScale_f;
+}
+
 /* *************************** METHOD ************************************** */
 /* calculateNCCindex
  *
  * \brief      Computes the NCC index given a control, virtual and a mask image.
  *             The actual computation of the index is done by calling the method
  *             CThirdEyeStats::normalizedCrossCorrelation.
+ *             The control and virtual images can be 8 bit, 16 bit (unsigned)
+ *             or 32 float, both of the same type. Integer images are read
+ *             natively and converted row by row, in cache; the NCC is scale
+ *             invariant and the other metrics are scaled with the intensity
+ *             scale (see setIntensityScale). The mask is 32 float.
  *
  * \author     Sandino Morales
  * \date       17.11.2010
@@ -94,9 +168,68 @@ void CThirdEyeStats::setROI( const unsigned f_x1_ui, const unsigned f_y1_ui,
  *************************************************************************** */
 bool CThirdEyeStats::evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
 			       const cv::Mat f_maskImg )
+{
+  return evaluate( f_controlImg, f_virtualImg, f_maskImg, cv::Mat() );
+}
+
+/* *************************** METHOD ************************************** */
+/* evaluate (overloaded)
+ *
+ * \brief      Same as the above method, but the moments are also binned by
+ *             the source disparity of each pixel of the virtual image (see
+ *             setDisparityBands). The binning is done in the same pass as the
+ *             global moments.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image of the third eye analysis.
+ * \param[in]  const cv::Mat f_virtualImg: Virtual image of the third eye analysis.
+ * \param[in]  const cv::Mat f_maskImg: Mask image of the third eye analysis.
+ * \param[in]  const cv::Mat f_sourceDisparity: Source disparity of each pixel
+ *             of the virtual image (32 float). Can be empty.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeStats::evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
+			       const cv::Mat f_maskImg, const cv::Mat f_sourceDisparity )
 {	
-  // NOTE: Put the control image as the first argument
-  if ( !normalizedCrossCorrelation( f_controlImg, f_virtualImg, f_maskImg ) )
+  // Just in case
+  if( f_controlImg.empty() || f_virtualImg.empty() ||
+      f_controlImg.size() != f_virtualImg.size() ||
+      f_controlImg.type() != f_virtualImg.type() || !isIntensityType( f_controlImg.type() ) ||
+      ( !f_maskImg.empty() && ( f_maskImg.size() != f_controlImg.size() ||
+				f_maskImg.type() != CV_32FC1 ) ) ||
+      ( !f_sourceDisparity.empty() && 
+	( f_sourceDisparity.size() != f_controlImg.size() ||
+	  f_sourceDisparity.type() != CV_32FC1 ) ) )
+  {
+    cerr << "ERROR CThirdEyeStats::evaluate: The input images do not match!\n";
+    return false;
+  }
+
+  if( m_x2_ui > static_cast<unsigned>( f_controlImg.cols ) ||
+      m_y2_ui > static_cast<unsigned>( f_controlImg.rows ) ||
+      m_x2_ui <= m_x1_ui || m_y2_ui <= m_y1_ui                 )
+  {
+    cerr << "ERROR CThirdEyeStats::evaluate: The RoI does not fit in the images!\n";
+    return false;
+  }
+
+  // NOTE: Put the control image as the first argument. The integral images
+  // (shared by the local NCC maps and the rectangles) and the label moments
+  // are built in the same traversal
+  if ( !normalizedCrossCorrelation( f_controlImg, f_virtualImg, f_maskImg,
+				     f_sourceDisparity ) )
+  {
+    return false;
+  }
+
+  // Local NCC maps, if required
+  if( m_localWindow_ui > 0 && !localNCC() )
+  {
+    return false;
+  }
+
+  // Statistics per rectangle, if required
+  if( !regionStats() )
   {
     return false;
   }
@@ -104,12 +237,55 @@ bool CThirdEyeStats::evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtu
   return true;
 }
 
+/* *************************** METHOD ************************************** */
+/* evaluate (overloaded)
+ *
+ * \brief      Same as the above method, but without a mask. Only the indices
+ *             and metrics of the full approach are computed, the ones of the
+ *             masked approach are set to -32000.
+ *
+ * \param[in]  const cv::Mat f_controlImg: Control image of the third eye analysis.
+ * \param[in]  const cv::Mat f_virtualImg: Virtual image of the third eye analysis.
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeStats::evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtualImg )
+{
+  return evaluate( f_controlImg, f_virtualImg, cv::Mat() );
+}
+
 
 /* *************************** METHOD ************************************** */
-/* mean
+/* accumulateMoments
+ *
+ * \brief      Accumulates, in a single pass over the RoI, the moments required
+ *             to compute the NCC of the full and the masked approach. The row
+ *             kernel (see accumulateMomentsRow) is vectorized, the sums are
+ *             reduced to double precision at the end of each row. The values
+ *             are shifted by the first pixel of the RoI to keep the partial
+ *             sums small.
+ *
+ *             The RoI is split in blocks of ROW_BLOCK_UI rows that are reduced
+ *             in parallel. The partial moments of the blocks are merged in a
+ *             fixed tree order (see mergeMomentsTree), so the results are
+ *             bit-identical regardless of the number of threads.
+ *
+ *             If disparity bands are set and a source disparity is given, 
+ *             each row is also binned by band while it is in cache: the row
+ *             is split in runs of the same band, and the runs of at least
+ *             BAND_RUN_UI pixels are accumulated by the row kernel into the
+ *             tables of their band. It costs one band index per pixel. The
+ *             band tables are reduced as the label tables.
  *
- * \brief      Computes the mean of all the images involved in the third eye
- *             analysis. 
+ *             The region statistics are gathered in the same traversal: each
+ *             row converted for the moments also feeds the integral images
+ *             (see CMomentsIntegral) over the box of integralBox, and the
+ *             label moments (see setLabelImage). The traversal covers the
+ *             RoI and the box, in blocks on the grid of the RoI blocks,
+ *             extended upwards. Each RoI block keeps the moments of the
+ *             labels it sees in a compact table, and the tables are merged
+ *             label by label in a fixed order (see mergeLabels), so the label
+ *             moments depend neither on the number of threads nor on the box.
  *
  * \author     Sandino Morales
  * \date       17.11.2010
@@ -117,67 +293,399 @@ bool CThirdEyeStats::evaluate( const cv::Mat f_controlImg, const cv::Mat f_virtu
  * \param[in]  const cv::Mat f_controlImg: Control image of the third eye analysis.
  * \param[in]  const cv::Mat f_virtualImg: Virtual image of the third eye analysis.
  * \param[in]  const cv::Mat f_maskImg: Mask image of the third eye analysis.
- * \param[out] float& f_meanControl_f: Mask image of the third eye analysis.
- * \param[out] float& f_meanVirtual_f: Mask image of the third eye analysis.
- * \param[out] float& f_meanControlMask_f: Mask image of the third eye analysis.
- * \param[out] float& f_meanVirtualMask_f: Mask image of the third eye analysis.
+ * \param[in]  const cv::Mat f_sourceDisparity: Source disparities. Can be empty.
+ * \param[out] SNCCMoments &f_moments: Moments of the full approach.
+ * \param[out] SNCCMoments &f_momentsMask: Moments of the masked approach.
+ * \param[out] std::vector<SRegionStats> &f_bands: Per-band moments and NCC
+ *             indices. Empty if the bands are disabled.
  *
- * \return     True if everything went well. False otherwise.
+ * \return     False if the label image or the regions are not valid. True
+ *             otherwise.
  *************************************************************************** */
-bool CThirdEyeStats::mean( const cv::Mat f_controlImg, const cv::Mat f_virtualImg,
-			   const cv::Mat f_mask,
-			   float& f_meanControl_f, float& f_meanVirtual_f,
-			   float& f_meanControlMask_f, 
-			   float& f_meanVirtualMask_f	)
+bool CThirdEyeStats::accumulateMoments( const cv::Mat f_controlImg, 
+					const cv::Mat f_virtualImg,
+					const cv::Mat f_mask,
+					const cv::Mat f_sourceDisparity,
+					SNCCMoments &f_moments, 
+					SNCCMoments &f_momentsMask,
+					std::vector<SRegionStats> &f_bands )
 {
-  float addControl_f = 0.f,
-        addVirtual_f = 0.f;
-  float addControlMask_f = 0.f,
-        addVirtualMask_f = 0.f;
+  f_moments.reset();
+  f_momentsMask.reset();
+  f_bands.clear();
+  m_labelStats.clear();
+
+  if( m_x2_ui <= m_x1_ui || m_y2_ui <= m_y1_ui )
+  {
+    return true;
+  }
 
-  unsigned size_ui     = 0;
-  unsigned sizeMask_ui = 0;
-	
-  for( unsigned y = m_y1_ui; y < m_y2_ui; ++y )
+  const bool integral_b = m_localWindow_ui > 0 || !m_regions.empty();
+  const bool labels_b   = !m_labels.empty() && m_numLabels_ui > 0;
+
+  if( labels_b && ( m_labels.size() != f_controlImg.size() ||
+		    ( m_labels.type() != CV_8UC1 && m_labels.type() != CV_16UC1 ) ) )
+  {
+    cerr << "ERROR CThirdEyeStats::accumulateMoments: The label image must be an 8 or 16 bit "
+	 << "image of the same size as the evaluated images!\n";
+    return false;
+  }
+
+  // Region of the integral images
+  cv::Rect box;
+  if( integral_b && !integralBox( f_controlImg.size(), box ) )
+  {
+    cerr << "ERROR CThirdEyeStats::accumulateMoments: Empty region!\n";
+    return false;
+  }
+
+  const double shiftC_d = pixelValue( f_controlImg, m_y1_ui, m_x1_ui );
+  const double shiftV_d = pixelValue( f_virtualImg, m_y1_ui, m_x1_ui );
+  f_moments.reset(     shiftC_d, shiftV_d );
+  f_momentsMask.reset( shiftC_d, shiftV_d );
+
+  if( integral_b && !m_integral.begin( f_controlImg.size(), box, !f_mask.empty(),
+				       shiftC_d, shiftV_d ) )
   {
-    for( unsigned x = m_x1_ui; x < m_x2_ui; ++x )
+    return false;
+  }
+
+  const unsigned numRoIBlocks_ui = ( m_y2_ui - m_y1_ui + ROW_BLOCK_UI - 1 ) / ROW_BLOCK_UI;
+  const bool     mask_b          = !f_mask.empty();
+  const bool     census_b        = ( m_metrics_ui & METRIC_CENSUS ) != 0;
+
+  // Only the pixels with a full 3x3 neighbourhood have a census transform
+  const unsigned censusX1_ui = ( m_x1_ui > 0 ) ? m_x1_ui : 1;
+  const unsigned censusX2_ui = ( m_x2_ui < static_cast<unsigned>( f_controlImg.cols ) ) ?
+                               m_x2_ui : f_controlImg.cols - 1;
+
+  // Traversed region: the RoI plus, for the census, one neighbour on each
+  // side, and the box of the integral images
+  const unsigned xa_ui = census_b ? censusX1_ui - 1 : m_x1_ui;
+  const unsigned xb_ui = census_b ? censusX2_ui + 1 : m_x2_ui;
+  cv::Rect span( xa_ui, m_y1_ui, xb_ui - xa_ui, m_y2_ui - m_y1_ui );
+  if( integral_b )
+  {
+    span = span | box;
+  }
+  const unsigned spanX_ui = span.x;
+  const unsigned spanW_ui = span.width;
+
+  // Blocks of ROW_BLOCK_UI rows starting at the RoI, extended upwards to
+  // cover the span. The blocks [ first, first + numRoIBlocks ) are those of
+  // the RoI
+  const int      roiY_i       = static_cast<int>( m_y1_ui );
+  const int      first_i      = std::max( 0, ( roiY_i - span.y + static_cast<int>( ROW_BLOCK_UI ) - 1 ) / 
+					  static_cast<int>( ROW_BLOCK_UI ) );
+  const int      origin_i     = roiY_i - first_i * static_cast<int>( ROW_BLOCK_UI );
+  const unsigned numBlocks_ui = ( span.y + span.height - origin_i + ROW_BLOCK_UI - 1 ) / ROW_BLOCK_UI;
+
+  // Rows of the images as floats, starting at the column of the span. Float
+  // images are read in place. Integer images are converted into the buffer
+  // of the task: three rows (the census neighbours and the center), with a
+  // row step of spanW floats. f_step is the row step in floats.
+  auto fetchRow = [&]( const cv::Mat &f_img, const unsigned f_y_ui, const bool f_census_b,
+		       float* f_buffer_p, size_t &f_step ) -> const float*
+  {
+    if( f_img.depth() == CV_32F )
     {
-      addControl_f += f_controlImg.ptr<float>( y )[ x ];
-      addVirtual_f += f_virtualImg.ptr<float>( y )[ x ];
-      size_ui++;
-      
-      if( f_mask.ptr<float>( y )[ x ] > 0.f )
+      f_step = f_img.step[ 0 ] / sizeof( float );
+      return f_img.ptr<float>( f_y_ui ) + spanX_ui;
+    }
+
+    f_step = spanW_ui;
+    if( f_census_b )
+    {
+      rowAsFloat( f_img, f_y_ui - 1, spanX_ui, spanW_ui, f_buffer_p );
+      rowAsFloat( f_img, f_y_ui + 1, spanX_ui, spanW_ui, f_buffer_p + 2 * spanW_ui );
+    }
+    return rowAsFloat( f_img, f_y_ui, spanX_ui, spanW_ui, f_buffer_p + spanW_ui );
+  };
+
+  // One partial per RoI block. The tables and buffers are members, so their
+  // memory is reused from frame to frame
+  std::vector<SNCCMoments> &partials     = m_partials;
+  std::vector<SNCCMoments> &partialsMask = m_partialsMask;
+  partials.assign(     numRoIBlocks_ui, f_moments     );
+  partialsMask.assign( numRoIBlocks_ui, f_momentsMask );
+
+  // One band table per RoI block. Stored block-major: [ block * numBands + band ]
+  const unsigned numBands_ui = f_sourceDisparity.empty() ? 0 : m_numBands_ui;
+  const float    bandMin_f   = m_bandMin_f;
+  const float    bandScale_f = ( numBands_ui > 0 ) ? 
+                               numBands_ui / ( m_bandMax_f - m_bandMin_f ) : 0.f;
+  const float    numBands_f  = static_cast<float>( numBands_ui );
+
+  std::vector<SNCCMoments> &bands     = m_bandTables;
+  std::vector<SNCCMoments> &bandsMask = m_bandTablesMask;
+  bands.assign(     numRoIBlocks_ui * numBands_ui, f_moments );
+  bandsMask.assign( numRoIBlocks_ui * numBands_ui, f_moments );
+
+  // One label table per RoI block. Labels beyond the range of the label
+  // type cannot occur
+  const bool     labels8_b    = ( m_labels.type() == CV_8UC1 );
+  const unsigned numLabels_ui = labels_b ? std::min( m_numLabels_ui, labels8_b ? 256u : 65536u ) : 0;
+
+  const unsigned numTables_ui = labels_b ? numRoIBlocks_ui : 0;
+  if( m_labelTables.size() < numTables_ui )
+  {
+    m_labelTables.resize( numTables_ui );
+  }
+  for( unsigned k = 0; k < numTables_ui; ++k )
+  {
+    m_labelTables[ k ].reset();
+  }
+
+  // Conversion buffers of each block (integer images only): three rows of
+  // the control image, then three of the virtual one
+  const size_t blockBuffer = 6 * static_cast<size_t>( spanW_ui );
+  if( f_controlImg.depth() != CV_32F || f_virtualImg.depth() != CV_32F )
+  {
+    m_rowBuffers.resize( numBlocks_ui * blockBuffer );
+  }
+
+  parallelFor( numBlocks_ui, [&]( const unsigned f_block_ui )
+  {
+    const unsigned yStart_ui = std::max( span.y, origin_i + static_cast<int>( f_block_ui * ROW_BLOCK_UI ) );
+    const unsigned yEnd_ui   = std::min( span.y + span.height,
+					 origin_i + static_cast<int>( ( f_block_ui + 1 ) * ROW_BLOCK_UI ) );
+
+    // The rows of the RoI only come in the RoI blocks
+    const unsigned roiBlock_ui = f_block_ui - first_i;
+
+    float* bufferC_p = m_rowBuffers.empty() ? nullptr : &m_rowBuffers[ f_block_ui * blockBuffer ];
+    float* bufferV_p = m_rowBuffers.empty() ? nullptr : bufferC_p + 3 * spanW_ui;
+
+    for( unsigned y = yStart_ui; y < yEnd_ui; ++y )
+    {
+      const bool roiRow_b    = y >= m_y1_ui && y < m_y2_ui;
+      const bool rowCensus_b = roiRow_b && census_b && y > 0 && 
+	                       y + 1 < static_cast<unsigned>( f_controlImg.rows ) &&
+	                       censusX1_ui < censusX2_ui;
+
+      // Pointers to the column of the span
+      size_t stepC = 0, stepV = 0;
+      const float* control_p = fetchRow( f_controlImg, y, rowCensus_b, bufferC_p, stepC );
+      const float* virtual_p = fetchRow( f_virtualImg, y, rowCensus_b, bufferV_p, stepV );
+      const float* mask_p    = mask_b ? f_mask.ptr<float>( y ) + spanX_ui : nullptr;
+
+      if( integral_b && static_cast<int>( y ) >= box.y && static_cast<int>( y ) < box.y + box.height )
       {
-	addControlMask_f += f_controlImg.ptr<float>( y )[ x ];
-	addVirtualMask_f += f_virtualImg.ptr<float>( y )[ x ];
-	sizeMask_ui++;
+	const unsigned x_ui = box.x - spanX_ui;
+	m_integral.addRow( y, control_p + x_ui, virtual_p + x_ui, mask_p ? mask_p + x_ui : nullptr );
       }
-			
-    } // end for x
-  } // end for y
 
-  // Just in case
-  if ( size_ui <= 0 || sizeMask_ui <= 0 )
+      if( !roiRow_b )
+      {
+	continue;
+      }
+
+      // Columns of the RoI
+      const unsigned x1_ui = m_x1_ui - spanX_ui;
+      const unsigned x2_ui = m_x2_ui - spanX_ui;
+
+      if( numBands_ui > 0 )
+      {
+	SNCCMoments* table_p     = &bands[     roiBlock_ui * numBands_ui ];
+	SNCCMoments* tableMask_p = &bandsMask[ roiBlock_ui * numBands_ui ];
+	const float* source_p    = f_sourceDisparity.ptr<float>( y ) + spanX_ui;
+
+	// Band of a position, numBands if none: nothing was mapped there
+	// (negative values), or the disparity is outside the bands
+	auto bandOf = [&]( const unsigned f_x_ui ) -> unsigned
+	{
+	  const float band_f = ( source_p[ f_x_ui ] - bandMin_f ) * bandScale_f;
+	  if( source_p[ f_x_ui ] < 0.f || !( band_f >= 0.f && band_f < numBands_f ) )
+	  {
+	    return numBands_ui;
+	  }
+	  return static_cast<unsigned>( band_f );
+	};
+
+	// The row is split in runs of the same band. Disparities are smooth, so
+	// most runs are long and go through the row kernel with the tables of
+	// their band; the short ones are added pixel by pixel
+	unsigned band_ui = ( x1_ui < x2_ui ) ? bandOf( x1_ui ) : numBands_ui;
+	for( unsigned x = x1_ui; x < x2_ui; )
+	{
+	  unsigned end_ui = x + 1, next_ui = numBands_ui;
+	  for( ; end_ui < x2_ui; ++end_ui )
+	  {
+	    next_ui = bandOf( end_ui );
+	    if( next_ui != band_ui )
+	    {
+	      break;
+	    }
+	  }
+
+	  if( band_ui < numBands_ui && end_ui - x >= BAND_RUN_UI )
+	  {
+	    accumulateMomentsRow( control_p + x, virtual_p + x, mask_b ? mask_p + x : nullptr,
+				  end_ui - x, 0, 0, table_p[ band_ui ], tableMask_p[ band_ui ] );
+	  }
+	  else if( band_ui < numBands_ui )
+	  {
+	    for( unsigned i = x; i < end_ui; ++i )
+	    {
+	      table_p[ band_ui ].add( control_p[ i ], virtual_p[ i ] );
+	      if( mask_p && mask_p[ i ] > 0.f )
+	      {
+		tableMask_p[ band_ui ].add( control_p[ i ], virtual_p[ i ] );
+	      }
+	    }
+	  }
+
+	  x       = end_ui;
+	  band_ui = next_ui;
+	} // end for x
+      }
+
+      if( labels_b )
+      {
+	CLabelTable   &table      = m_labelTables[ roiBlock_ui ];
+	const uchar*  labels8_p  = m_labels.ptr<uchar>( y )  + spanX_ui;
+	const ushort* labels16_p = m_labels.ptr<ushort>( y ) + spanX_ui;
+
+	for( unsigned x = x1_ui; x < x2_ui; ++x )
+	{
+	  const unsigned label_ui = labels8_b ? labels8_p[ x ] : labels16_p[ x ];
+	  if( label_ui >= numLabels_ui )
+	  {
+	    continue;
+	  }
+
+	  CLabelTable::SEntry &entry = table.entry( label_ui, f_moments );
+	  entry.m_moments.add( control_p[ x ], virtual_p[ x ] );
+	  if( mask_p && mask_p[ x ] > 0.f )
+	  {
+	    entry.m_momentsMask.add( control_p[ x ], virtual_p[ x ] );
+	  }
+	} // end for x
+      }
+
+      SNCCMoments &moments     = partials[ roiBlock_ui ];
+      SNCCMoments &momentsMask = partialsMask[ roiBlock_ui ];
+
+      if( !rowCensus_b )
+      {
+	accumulateMomentsRow( control_p + x1_ui, virtual_p + x1_ui,
+			      mask_b ? mask_p + x1_ui : nullptr,
+			      m_x2_ui - m_x1_ui, 0, 0, moments, momentsMask );
+	continue;
+      }
+
+      // Split the row so the image borders are left out of the census
+      const unsigned splits_p[ 4 ] = { m_x1_ui, censusX1_ui, censusX2_ui, m_x2_ui };
+      for( unsigned k = 0; k < 3; ++k )
+      {
+	if( splits_p[ k + 1 ] <= splits_p[ k ] )
+	{
+	  continue;
+	}
+	const bool     runCensus_b = ( k == 1 );
+	const unsigned x_ui        = splits_p[ k ] - spanX_ui;
+	accumulateMomentsRow( control_p + x_ui, virtual_p + x_ui,
+			      mask_b ? mask_p + x_ui : nullptr,
+			      splits_p[ k + 1 ] - splits_p[ k ], 
+			      runCensus_b ? stepC : 0, runCensus_b ? stepV : 0,
+			      moments, momentsMask );
+      }
+    } // end for y
+  }, m_numThreads_ui );
+
+  // Fixed merge order
+  mergeMomentsTree( partials,     f_moments     );
+  mergeMomentsTree( partialsMask, f_momentsMask );
+
+  // Merge the band tables, band by band, in a fixed order
+  f_bands.assign( numBands_ui, SRegionStats() );
+
+  std::vector<SNCCMoments> &column     = m_partials;
+  std::vector<SNCCMoments> &columnMask = m_partialsMask;
+  column.resize(     numRoIBlocks_ui );
+  columnMask.resize( numRoIBlocks_ui );
+  for( unsigned b = 0; b < numBands_ui; ++b )
   {
-    cout << "ERROR CThirdEyeStats::mean: Calculation error (size_ui)!\n";
-    return false;
+    for( unsigned k = 0; k < numRoIBlocks_ui; ++k )
+    {
+      column[ k ]     = bands[     k * numBands_ui + b ];
+      columnMask[ k ] = bandsMask[ k * numBands_ui + b ];
+    }
+
+    mergeMomentsTree( column,     f_bands[ b ].m_moments );
+    mergeMomentsTree( columnMask, f_bands[ b ].m_momentsMask );
+    regionNCC( f_bands[ b ] );
   }
 
-  f_meanControl_f = addControl_f / static_cast<float>( size_ui );
-  f_meanVirtual_f = addVirtual_f / static_cast<float>( size_ui );
-  
-  f_meanControlMask_f = addControlMask_f / static_cast<float>( sizeMask_ui );
-  f_meanVirtualMask_f = addVirtualMask_f / static_cast<float>( sizeMask_ui );
+  if( integral_b )
+  {
+    m_integral.finish( m_numThreads_ui );
+  }
+
+  if( labels_b )
+  {
+    SNCCMoments empty;
+    empty.reset( shiftC_d, shiftV_d );
+    mergeLabels( numTables_ui, numLabels_ui, empty );
+  }
 
   return true;
-	    	
+}
+
+/* *************************** METHOD ************************************** */
+/* integralBox
+ *
+ * \brief      Region covered by the integral images: the bounding box of the
+ *             RoI (if the local NCC maps are enabled) and of the evaluation
+ *             rectangles, clipped to the image.
+ *
+ * \param[in]  const cv::Size &f_size: Size of the evaluated images.
+ * \param[out] cv::Rect &f_box: Region.
+ *
+ * \return     False if the region is empty. True otherwise.
+ *************************************************************************** */
+bool CThirdEyeStats::integralBox( const cv::Size &f_size, cv::Rect &f_box ) const
+{
+  const cv::Rect image( 0, 0, f_size.width, f_size.height );
+
+  int x1_i = image.width, y1_i = image.height;
+  int x2_i = 0,           y2_i = 0;
+
+  if( m_localWindow_ui > 0 )
+  {
+    x1_i = m_x1_ui;  y1_i = m_y1_ui;
+    x2_i = m_x2_ui;  y2_i = m_y2_ui;
+  }
+
+  for( unsigned i = 0; i < m_regions.size(); ++i )
+  {
+    const cv::Rect region = m_regions[ i ] & image;
+    if( region.area() <= 0 )
+    {
+      continue;
+    }
+    x1_i = std::min( x1_i, region.x );
+    y1_i = std::min( y1_i, region.y );
+    x2_i = std::max( x2_i, region.x + region.width  );
+    y2_i = std::max( y2_i, region.y + region.height );
+  }
+
+  if( x2_i <= x1_i || y2_i <= y1_i )
+  {
+    return false;
+  }
+
+  f_box = cv::Rect( x1_i, y1_i, x2_i - x1_i, y2_i - y1_i );
+  return true;
 }
 
 /* *************************** METHOD ************************************** */
 /* normalizedCrossCorrelation
  *
  * \brief      Computes the required normalized cross correlation for the
- *             third eye analysis. 
+ *             third eye analysis. The moments of both approaches are
+ *             accumulated in a single pass (see accumulateMoments) and the
+ *             NCC is derived from them.
  *
  * \author     Sandino Morales
  * \date       17.11.2010
@@ -185,83 +693,54 @@ bool CThirdEyeStats::mean( const cv::Mat f_controlImg, const cv::Mat f_virtualIm
  * \param[in]  const cv::Mat f_controlImg: Control image of the third eye analysis.
  * \param[in]  const cv::Mat f_virtualImg: Virtual image of the third eye analysis.
  * \param[in]  const cv::Mat f_maskImg: Mask image of the third eye analysis.
+ * \param[in]  const cv::Mat f_sourceDisparity: Source disparities. Can be empty.
  *
- * \return    -
+ * \return     True if everything went well. False otherwise.
  *************************************************************************** */
 bool CThirdEyeStats::normalizedCrossCorrelation( const cv::Mat f_controlImg,
 						 const cv::Mat f_virtualImg,
-						 const cv::Mat f_mask )  
+						 const cv::Mat f_mask,
+						 const cv::Mat f_sourceDisparity )  
 {
-  //Calulate the mean
-  float meanControl_f = 0.f;
-  float meanVirtual_f = 0.f;
-  float meanControlMask_f = 0.f;
-  float meanVirtualMask_f = 0.f;
-  if( !mean( f_controlImg, f_controlImg, f_mask, 
-	     meanControl_f, meanVirtual_f,
-	     meanControlMask_f, meanVirtualMask_f )        )
+  if( !accumulateMoments( f_controlImg, f_virtualImg, f_mask, f_sourceDisparity,
+			  m_moments, m_momentsMask, m_bandStats ) )
   {
     return false;
   }
 
-  // Debug
-  //printf( "meanControl=%f  meanVirtual=%f\n",  meanControl_f, meanVirtual_f );	
+  const bool mask_b = !f_mask.empty();
 
-  unsigned size_ui	  = 0;      
-  float	   numeratorNCC_f  = 0.f;
-  float	   addSDcontrol_f  = 0.f;
-  float	   addSDvirtual_f  = 0.f;
-  
-  unsigned sizeMask_ui     = 0;
-  float	numeratorNCCmask_f = 0.f;
-  float	addSDcontrolMask_f = 0.f;
-  float	addSDvirtualMask_f = 0.f;
+  // Not computed (yet)
+  m_nccMask_f = -32000.f;
+  m_metrics     = SThirdEyeMetrics();
+  m_metricsMask = SThirdEyeMetrics();
 
-  // main loop
-  for( unsigned y = m_y1_ui; y < m_y2_ui; ++y )
+  // Just in case
+  if ( m_moments.m_n_d <= 0.0 || ( mask_b && m_momentsMask.m_n_d <= 0.0 ) )
   {
-    const float* controlImg_p = f_controlImg.ptr<float>( y );
-    const float* virtualImg_p = f_virtualImg.ptr<float>( y );
-    for( unsigned x = m_x1_ui; x < m_x2_ui; ++x )
-    {
-      size_ui++;
-			
-      //Calculating the numerator of NCC
-      numeratorNCC_f += numeratorNCC( controlImg_p[ x ], meanControl_f,
-				      virtualImg_p[ x ], meanVirtual_f );
-				
-      // Addition for the SD
-      addSDcontrol_f += addSD( controlImg_p[ x ], meanControl_f );
-      addSDvirtual_f += addSD( virtualImg_p[ x ], meanVirtual_f );
-
-      // Do the same stuff for the mask analysis
-      if( f_mask.ptr<float>( y )[ x ] > 0.f )
-      {
-	//Calculating the numerator of NCC
-	numeratorNCCmask_f += numeratorNCC( controlImg_p[ x ], meanControl_f,
-					    virtualImg_p[ x ], meanVirtual_f  );
-
-	// Addition for the SD
-	addSDcontrolMask_f += addSD( controlImg_p[ x ], meanControl_f );
-	addSDvirtualMask_f += addSD( virtualImg_p[ x ], meanVirtual_f );
-	sizeMask_ui++;
-      } // end if mask
+    cerr << "ERROR CThirdEyeStats::normalizedCrossCorrelation: Calculation error (size)!\n";
+    return false;
+  }
 
-    } // end for x
-  } // end for y
+  // Debug
+  //printf( "meanControl=%f  meanVirtual=%f\n",  
+  //        m_moments.meanControl(), m_moments.meanVirtual() );
 
   // Compute the values for the regular approach
-  if( !computeNCC( addSDcontrol_f, addSDvirtual_f, static_cast<float>( size_ui ),
-		   numeratorNCC_f, m_ncc_f ) )
+  if( !computeNCC( m_moments, m_ncc_f ) )
   {
     return false;
   }
+  computeMetrics( m_moments, m_ncc_f, m_metrics );
 
   // Compute the values for the mask approach
-  if( !computeNCC( addSDcontrolMask_f, addSDvirtualMask_f, static_cast<float>( sizeMask_ui ),
-		   numeratorNCCmask_f,   m_nccMask_f ) )
+  if( mask_b )
   {
-    return false;
+    if( !computeNCC( m_momentsMask, m_nccMask_f ) )
+    {
+      return false;
+    }
+    computeMetrics( m_momentsMask, m_nccMask_f, m_metricsMask );
   }
 
   return  true;
@@ -271,52 +750,277 @@ bool CThirdEyeStats::normalizedCrossCorrelation( const cv::Mat f_controlImg,
 /* *************************** METHOD ************************************** */
 /* computeNCC
  *
- * \brief      Computes the final NCC value from the input values. The input
- *             values represent the additions (over all the involved images)
- *             required to compute NCC.
+ * \brief      Computes the final NCC value from the input moments. 
  *
  * \author     Sandino Morales
  * \date       17.11.2010
  *
- * \param[in]  const float f_addSDControl_f: Addition required for computing the SD of
- *             the control image.
- * \param[in]  const float f_addSDVirtual_f: Addition required for computing the SD of
- *             the virtual image.
- * \param[in]  const float f_size_f: Number of elements considered for calculatin the SD
- *             and the NCC.
- * \param[in]  const float f_numeratorNCC_f: Numerator for the NCC. Computed previouslly.
+ * \param[in]  const SNCCMoments &f_moments: Moments of the control and virtual
+ *             images over the considered set of pixels.
  * \param[out] float &f_ncc_f: NCC value (* 100, so that it looks nicer).
  *
- * \return     False, if there were no divisions by zero. True otherwise.
+ * \return     True, if there were no divisions by zero. False otherwise.
  *************************************************************************** */
-bool CThirdEyeStats::computeNCC( const float f_addSDControl_f, const float f_addSDVirtual_f,
-				 const float f_size_f, const float f_numeratorNCC_f,
-				 float &f_ncc_f )
+bool CThirdEyeStats::computeNCC( const SNCCMoments &f_moments, float &f_ncc_f )
 {
-  // Compute the SD
-  const float SDControl_f = SD( f_addSDControl_f, f_size_f );
-  const float SDVirtual_f = SD( f_addSDVirtual_f, f_size_f );
-
-  // Compute NCC's denominators
-  const float denominatorNCC_f = denominatorNCC( f_size_f, SDControl_f, SDVirtual_f );
+  double ncc_d = 0.0;
 
   // Just in case
-  if( denominatorNCC_f == 0.f )
+  if( !f_moments.ncc( ncc_d ) )
   {
-    cout << "ERROR CThirdEyeStats::computeNCC: It is intended to divide by zero!\n";
+    cerr << "ERROR CThirdEyeStats::computeNCC: It is intended to divide by zero!\n";
     f_ncc_f = 32000.f;
     return false;
   }
 
   // Compute the final value
-  f_ncc_f = ( f_numeratorNCC_f / denominatorNCC_f ) * 100.0f;
+  f_ncc_f = static_cast<float>( ncc_d * 100.0 );
 
   // One more final check
   if( fabs( f_ncc_f  ) > 100.01f )
   {
-    cout << "ERROR CThirdEyeStats::computeNCC: Calculation error!\n";
+    cerr << "ERROR CThirdEyeStats::computeNCC: Calculation error!\n";
     return false;
   }
   
   return true;
 }
+
+/* *************************** METHOD ************************************** */
+/* computeMetrics
+ *
+ * \brief      Derives the enabled metrics (see setMetrics) from the input
+ *             moments. SAD and SSD are normalized by the number of pixels.
+ *             The PSNR is computed wrt a peak value of 255 (the range of the
+ *             input images). Metrics not enabled are set to -32000.
+ *
+ * \param[in]  const SNCCMoments &f_moments: Moments of the control and virtual
+ *             images over the considered set of pixels.
+ * \param[in]  const float f_ncc_f: NCC value, already computed.
+ * \param[out] SThirdEyeMetrics &f_metrics: Metrics.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeStats::computeMetrics( const SNCCMoments &f_moments, const float f_ncc_f,
+				     SThirdEyeMetrics &f_metrics )
+{
+  f_metrics = SThirdEyeMetrics();
+  f_metrics.m_ncc_f = f_ncc_f;
+
+  if( f_moments.m_n_d <= 0.0 )
+  {
+    return;
+  }
+
+  // Differences in [0,255] units (see setIntensityScale)
+  const double scale_d = m_intensityScale_f;
+  const double mse_d   = f_moments.m_sumSqDiff_d / f_moments.m_n_d * scale_d * scale_d;
+
+  if( m_metrics_ui & METRIC_SAD )
+  {
+    f_metrics.m_sad_f = static_cast<float>( f_moments.m_sumAbsDiff_d / f_moments.m_n_d * scale_d );
+  }
+
+  if( m_metrics_ui & ( METRIC_SSD | METRIC_PSNR ) )
+  {
+    f_metrics.m_ssd_f = static_cast<float>( mse_d );
+  }
+
+  if( m_metrics_ui & METRIC_PSNR )
+  {
+    // Identical images, as in computeNCC a large value is used
+    f_metrics.m_psnr_f = ( mse_d > 0.0 ) ? 
+                         static_cast<float>( 10.0 * log10( ( 255.0 * 255.0 ) / mse_d ) ) :
+                         32000.f;
+  }
+
+  if( ( m_metrics_ui & METRIC_CENSUS ) && f_moments.m_nCensus_d > 0.0 )
+  {
+    f_metrics.m_census_f = static_cast<float>( f_moments.m_sumHamming_d / 
+					       f_moments.m_nCensus_d );
+  }
+}
+
+/* *************************** METHOD ************************************** */
+/* mergeLabels
+ *
+ * \brief      Merges the label tables of the row blocks. Each label seen is
+ *             merged over all the blocks in block order (blocks that did not
+ *             see it give empty moments), with the same fixed tree as the
+ *             global moments.
+ *
+ * \param[in]  const unsigned f_numTables_ui: Number of tables in use, one per
+ *             RoI block. They are sorted by label.
+ * \param[in]  const unsigned f_numLabels_ui: Number of labels reported.
+ * \param[in]  const SNCCMoments &f_empty: Empty moments with the shifts.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeStats::mergeLabels( const unsigned f_numTables_ui,
+				  const unsigned f_numLabels_ui,
+				  const SNCCMoments &f_empty )
+{
+  SRegionStats unseen;
+  unseen.m_moments     = f_empty;
+  unseen.m_momentsMask = f_empty;
+  regionNCC( unseen );
+  m_labelStats.assign( f_numLabels_ui, unseen );
+
+  // Labels seen by any block, in increasing order
+  std::vector<unsigned> &seen = m_labelsSeen;
+  seen.clear();
+  for( unsigned b = 0; b < f_numTables_ui; ++b )
+  {
+    m_labelTables[ b ].sort();
+    const std::vector<CLabelTable::SEntry> &entries = m_labelTables[ b ].entries();
+    for( size_t i = 0; i < entries.size(); ++i )
+    {
+      seen.push_back( entries[ i ].m_label_ui );
+    }
+  }
+  std::sort( seen.begin(), seen.end() );
+  seen.erase( std::unique( seen.begin(), seen.end() ), seen.end() );
+
+  // The entries of each table are visited in order along with the labels.
+  // The partials of accumulateMoments are free by now
+  std::vector<size_t>      &next       = m_labelsNext;
+  std::vector<SNCCMoments> &column     = m_partials;
+  std::vector<SNCCMoments> &columnMask = m_partialsMask;
+  next.assign( f_numTables_ui, 0 );
+  column.resize(     f_numTables_ui );
+  columnMask.resize( f_numTables_ui );
+  for( size_t l = 0; l < seen.size(); ++l )
+  {
+    for( unsigned b = 0; b < f_numTables_ui; ++b )
+    {
+      const std::vector<CLabelTable::SEntry> &entries = m_labelTables[ b ].entries();
+      if( next[ b ] < entries.size() && entries[ next[ b ] ].m_label_ui == seen[ l ] )
+      {
+	column[ b ]     = entries[ next[ b ] ].m_moments;
+	columnMask[ b ] = entries[ next[ b ] ].m_momentsMask;
+	++next[ b ];
+      }
+      else
+      {
+	column[ b ]     = f_empty;
+	columnMask[ b ] = f_empty;
+      }
+    }
+
+    SRegionStats &stats = m_labelStats[ seen[ l ] ];
+    mergeMomentsTree( column,     stats.m_moments );
+    mergeMomentsTree( columnMask, stats.m_momentsMask );
+    regionNCC( stats );
+  }
+}
+
+/* *************************** METHOD ************************************** */
+/* localNCC
+ *
+ * \brief      Computes the local NCC maps (full and masked approach) over the
+ *             RoI. Each value of a map is the NCC (* 100) of a window of size
+ *             m_localWindow_ui, windows are m_localStride_ui pixels apart. The
+ *             moments of each window are obtained from integral images (see
+ *             CThirdEyeStats::accumulateMoments), so the cost per window does not
+ *             depend on its size. Windows where the NCC is not defined are set
+ *             to -32000.
+ *
+ * \param[in]  -
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeStats::localNCC()  
+{
+  const cv::Rect roi( m_x1_ui, m_y1_ui, m_x2_ui - m_x1_ui, m_y2_ui - m_y1_ui );
+  if( roi.width < static_cast<int>( m_localWindow_ui ) || 
+      roi.height < static_cast<int>( m_localWindow_ui )    )
+  {
+    cerr << "ERROR CThirdEyeStats::localNCC: The window is larger than the RoI!\n";
+    m_localNCC.release();
+    m_localNCCMask.release();
+    return false;
+  }
+
+  const int window_i = static_cast<int>( m_localWindow_ui );
+  const int stride_i = static_cast<int>( m_localStride_ui );
+  const int cols_i   = ( roi.width  - window_i ) / stride_i + 1;
+  const int rows_i   = ( roi.height - window_i ) / stride_i + 1;
+
+  imagePool().create( m_localNCC,     cv::Size( cols_i, rows_i ), CV_32FC1 );
+  imagePool().create( m_localNCCMask, cv::Size( cols_i, rows_i ), CV_32FC1 );
+
+  // Rows of the maps are independent
+  parallelFor( static_cast<unsigned>( rows_i ), [&]( const unsigned f_row_ui )
+  {
+    float* local_p     = m_localNCC.ptr<float>( f_row_ui );
+    float* localMask_p = m_localNCCMask.ptr<float>( f_row_ui );
+
+    SNCCMoments moments;
+    double ncc_d = 0.0;
+    for( int i = 0; i < cols_i; ++i )
+    {
+      const cv::Rect window( roi.x + i * stride_i, roi.y + f_row_ui * stride_i,
+			     window_i, window_i );
+
+      local_p[ i ] = ( m_integral.query( window, moments ) && moments.ncc( ncc_d ) ) ?
+	             static_cast<float>( ncc_d * 100.0 ) : -32000.f;
+
+      localMask_p[ i ] = ( m_integral.queryMask( window, moments ) && moments.ncc( ncc_d ) ) ?
+	                 static_cast<float>( ncc_d * 100.0 ) : -32000.f;
+    } // end for i
+  }, m_numThreads_ui );
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* regionStats
+ *
+ * \brief      Computes the moments and NCC indices of each evaluation
+ *             rectangle (see setRegions) from the integral images. The 
+ *             rectangles are clipped to the image.
+ *
+ * \param[in]  -
+ *
+ * \return     True if everything went well. False otherwise.
+ *************************************************************************** */
+bool CThirdEyeStats::regionStats()  
+{
+  m_regionStats.assign( m_regions.size(), SRegionStats() );
+
+  const cv::Rect& covered = m_integral.getROI();
+  for( unsigned i = 0; i < m_regions.size(); ++i )
+  {
+    const cv::Rect region = m_regions[ i ] & covered;
+    if( region.area() <= 0 )
+    {
+      continue;
+    }
+
+    m_integral.query(     region, m_regionStats[ i ].m_moments );
+    m_integral.queryMask( region, m_regionStats[ i ].m_momentsMask );
+    regionNCC( m_regionStats[ i ] );
+  }
+
+  return true;
+}
+
+/* *************************** METHOD ************************************** */
+/* regionNCC
+ *
+ * \brief      Derives the NCC indices of a region from its moments. Unlike
+ *             CThirdEyeStats::computeNCC, undefined values (e.g. an empty
+ *             region) are silently set to -32000.
+ *
+ * \param[in]  SRegionStats &f_stats: Region. Its indices are updated.
+ *
+ * \return     -
+ *************************************************************************** */
+void CThirdEyeStats::regionNCC( SRegionStats &f_stats )  
+{
+  double ncc_d = 0.0;
+  f_stats.m_ncc_f     = f_stats.m_moments.ncc( ncc_d ) ? 
+                        static_cast<float>( ncc_d * 100.0 ) : -32000.f;
+  f_stats.m_nccMask_f = f_stats.m_momentsMask.ncc( ncc_d ) ? 
+                        static_cast<float>( ncc_d * 100.0 ) : -32000.f;
+}
@@ -0,0 +1,84 @@
+/* ******************************** FILE *********************************** */
+/** \file    testCensus.cpp
+ *
+ *  \brief   Tests of the census kernel and of CThirdEyeCensus.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Project includes
+#include "testing.h"
+#include "../h/thirdeyeCensus.h"
+#include "../h/thirdeyePixel.h"
+
+namespace
+{
+  // Mean census Hamming distance of the RoI, pixel by pixel
+  double referenceHamming( const cv::Mat f_control, const cv::Mat f_virtual,
+			   const int f_width_i, const int f_height_i, const cv::Rect &f_roi )
+  {
+    double sum_d = 0.;
+    for( int y = f_roi.y; y < f_roi.y + f_roi.height; ++y )
+    {
+      for( int x = f_roi.x; x < f_roi.x + f_roi.width; ++x )
+      {
+	for( int dy = -f_height_i / 2; dy <= f_height_i / 2; ++dy )
+	{
+	  for( int dx = -f_width_i / 2; dx <= f_width_i / 2; ++dx )
+	  {
+	    const bool control_b = pixelValue( f_control, y + dy, x + dx ) < pixelValue( f_control, y, x );
+	    const bool virtual_b = pixelValue( f_virtual, y + dy, x + dx ) < pixelValue( f_virtual, y, x );
+	    sum_d += ( control_b != virtual_b ) ? 1. : 0.;
+	  }
+	}
+      }
+    }
+    return sum_d / f_roi.area();
+  }
+}
+
+// The vectorised kernel (16, 8 or 4 pixels per instruction depending on the
+// type) agrees with the plain comparisons, ties and row tails included
+TEST_CASE( censusMatchesScalarReference )
+{
+  const int types_p[ 3 ]  = { CV_8UC1, CV_16UC1, CV_32FC1 };
+  const int ranges_p[ 3 ] = { 256, 65536, 4 };
+  const unsigned windows_p[ 3 ][ 2 ] = { { 9, 7 }, { 3, 3 }, { 11, 5 } };
+  for( int t = 0; t < 3; ++t )
+  {
+    const cv::Mat control  = randomImage( 61, 83, types_p[ t ], ranges_p[ t ], 11 );
+    const cv::Mat virtual_ = randomImage( 61, 83, types_p[ t ], ranges_p[ t ], 12 );
+    for( int w = 0; w < 3; ++w )
+    {
+      const int width_i  = windows_p[ w ][ 0 ];
+      const int height_i = windows_p[ w ][ 1 ];
+
+      CThirdEyeCensus census;
+      CHECK( census.setWindow( width_i, height_i ) );
+      census.setROI( 0, 0, 83, 61 );
+      CHECK( census.evaluate( control, virtual_, cv::Mat() ) );
+
+      // The RoI is clipped so the windows are within the image
+      const cv::Rect roi( width_i / 2, height_i / 2, 83 - 2 * ( width_i / 2 ), 61 - 2 * ( height_i / 2 ) );
+      CHECK_NEAR( referenceHamming( control, virtual_, width_i, height_i, roi ),
+		  census.getMeanHamming(), 1e-12 );
+    }
+  }
+}
+
+// A mask selects the same pixels in all the vectorised paths
+TEST_CASE( censusMaskedMatchesFullOnAllOnes )
+{
+  const int types_p[ 3 ] = { CV_8UC1, CV_16UC1, CV_32FC1 };
+  for( int t = 0; t < 3; ++t )
+  {
+    const cv::Mat control  = randomImage( 40, 77, types_p[ t ], 200, 21 );
+    const cv::Mat virtual_ = randomImage( 40, 77, types_p[ t ], 200, 22 );
+    const cv::Mat ones( 40, 77, CV_32FC1, cv::Scalar( 1.f ) );
+
+    CThirdEyeCensus census;
+    census.setROI( 0, 0, 77, 40 );
+    CHECK( census.evaluate( control, virtual_, ones ) );
+    CHECK_EQUAL( census.getMeanHamming(), census.getMeanHammingMask() );
+  }
+}
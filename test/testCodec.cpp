@@ -0,0 +1,141 @@
+/* ******************************** FILE *********************************** */
+/** \file    testCodec.cpp
+ *
+ *  \brief   Tests of the lossless disparity codec (IO_DATATYPE_COMPRESSED
+ *           raw images).
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdint.h>
+
+// Project includes
+#include "testing.h"
+#include "../h/loader.h"
+
+namespace
+{
+  // Disparity-like map: smooth surfaces with sub-pixel values, constant
+  // invalid regions and a few special values, whose bits must survive
+  cv::Mat makeDisparity()
+  {
+    cv::Mat disp( 48, 64, CV_32FC1 );
+    const cv::Mat noise = randomImage( 48, 64, CV_32FC1, 16, 5 );
+    for( int y = 0; y < disp.rows; ++y )
+    {
+      for( int x = 0; x < disp.cols; ++x )
+      {
+	disp.at<float>( y, x ) = ( x < 10 ) ? -1.f :
+	  20.f + 0.25f * x - 0.125f * y + ( ( y > 30 ) ? noise.at<float>( y, x ) / 16.f : 0.f );
+      }
+    }
+    disp.at<float>( 5, 40 )  = -0.f;
+    disp.at<float>( 6, 40 )  = std::numeric_limits<float>::quiet_NaN();
+    disp.at<float>( 7, 40 )  = std::numeric_limits<float>::infinity();
+    disp.at<float>( 47, 63 ) = std::numeric_limits<float>::max();
+    return disp;
+  }
+
+  std::string readBytes( const std::string &f_fileName_str )
+  {
+    std::ifstream file( f_fileName_str.c_str(), std::ios::binary );
+    return std::string( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+  }
+
+  std::string writeBytes( const std::string &f_bytes_str )
+  {
+    const std::string fileName_str = temporaryFileName( ".raw" );
+    std::ofstream file( fileName_str.c_str(), std::ios::binary | std::ios::trunc );
+    file.write( f_bytes_str.data(), f_bytes_str.size() );
+    return fileName_str;
+  }
+
+  // Position of the coded data size, the uint64 that is followed by exactly
+  // that many bytes up to the end of the file. npos if there is none
+  size_t codedSizePosition( const std::string &f_bytes_str )
+  {
+    for( size_t p = 0; p + sizeof( uint64_t ) <= f_bytes_str.size(); ++p )
+    {
+      uint64_t numBytes = 0;
+      memcpy( &numBytes, &f_bytes_str[ p ], sizeof( numBytes ) );
+      if( numBytes == f_bytes_str.size() - p - sizeof( numBytes ) )
+      {
+	return p;
+      }
+    }
+    return std::string::npos;
+  }
+
+  // Saves the image compressed, checks that it loads back unchanged and that
+  // truncated or corrupted copies are rejected
+  void checkRoundTrip( const cv::Mat f_img, const unsigned f_subpixelBits_ui )
+  {
+    const std::string fileName_str = temporaryFileName( ".raw" );
+    CHECK( saveRawImage( fileName_str, f_img, "codec test", f_subpixelBits_ui, true ) );
+
+    unsigned subpixelBits_ui = 0;
+    CHECK( sameContents( f_img, loadRawImage( fileName_str, subpixelBits_ui ) ) );
+    CHECK_EQUAL( f_subpixelBits_ui, subpixelBits_ui );
+
+    const std::string bytes_str = readBytes( fileName_str );
+    CHECK( bytes_str.size() < f_img.total() * f_img.elemSize() );
+    const size_t position = codedSizePosition( bytes_str );
+    CHECK( position != std::string::npos );
+    if( position == std::string::npos )
+    {
+      return;
+    }
+    const size_t data = position + sizeof( uint64_t );
+
+    // Files cut in the size, at the start, in the middle and before the last
+    // byte of the coded data
+    const size_t cuts[] = { position + 4, data, data + 1, ( data + bytes_str.size() ) / 2,
+			    bytes_str.size() - 1 };
+    for( size_t i = 0; i < sizeof( cuts ) / sizeof( cuts[ 0 ] ); ++i )
+    {
+      CHECK( loadRawImage( writeBytes( bytes_str.substr( 0, cuts[ i ] ) ) ).empty() );
+    }
+
+    // Coded data cut, with a size that matches it: the decoder runs out of
+    // data before the image is complete
+    const uint64_t numBytes = bytes_str.size() - data;
+    const uint64_t sizes[] = { 0, 1, numBytes / 2, numBytes - 1 };
+    for( size_t i = 0; i < sizeof( sizes ) / sizeof( sizes[ 0 ] ); ++i )
+    {
+      std::string cut_str = bytes_str.substr( 0, data + sizes[ i ] );
+      memcpy( &cut_str[ position ], &sizes[ i ], sizeof( sizes[ i ] ) );
+      CHECK( loadRawImage( writeBytes( cut_str ) ).empty() );
+    }
+
+    // Size larger than any coded image of this size
+    std::string huge_str = bytes_str;
+    const uint64_t hugeSize = ~0ull;
+    memcpy( &huge_str[ position ], &hugeSize, sizeof( hugeSize ) );
+    CHECK( loadRawImage( writeBytes( huge_str ) ).empty() );
+  }
+}
+
+TEST_CASE( codecRoundTripFloat )
+{
+  checkRoundTrip( makeDisparity(), 0 );
+}
+
+TEST_CASE( codecRoundTripFixedPoint )
+{
+  cv::Mat disp = toFixedPointDisparity( makeDisparity(), 4, -1.f );
+  // Full range codes too, so that the residuals wrap around
+  const cv::Mat codes = randomImage( 4, 64, CV_16UC1, 65536, 6 );
+  for( int y = 0; y < codes.rows; ++y )
+  {
+    for( int x = 0; x < codes.cols; ++x )
+    {
+      disp.at<unsigned short>( y + 40, x ) = codes.at<unsigned short>( y, x );
+    }
+  }
+  checkRoundTrip( disp, 4 );
+}
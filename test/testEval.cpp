@@ -0,0 +1,346 @@
+/* ******************************** FILE *********************************** */
+/** \file    testEval.cpp
+ *
+ *  \brief   Tests of CThirdEyeEvaluation.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+
+// Project includes
+#include "testing.h"
+#include "../h/thirdeyeEval.h"
+#include "../h/thirdeyeParallel.h"
+#include "../h/thirdeyeSequence.h"
+
+namespace
+{
+  // Control camera at the base camera, so the virtual image is the base
+  // image moved by nothing but the rounding of the warp
+  void setRig( CThirdEyeEvaluation &f_eval, const int f_cols_i, const int f_rows_i )
+  {
+    f_eval.setParams( SThirdEyeParams( 10.f,
+				       0.f, 0.f, 0.f,
+				       1.f, 0.f, 0.f,
+				       0.f, 1.f, 0.f,
+				       0.f, 0.f, 1.f,
+				       0.5f * f_cols_i, 0.5f * f_rows_i, 400.f, 400.f,
+				       0.5f * f_cols_i, 0.5f * f_rows_i, 400.f, 400.f,
+				       1.f, 1.f ) );
+    f_eval.setEvaluationRoi( 0, 0, f_cols_i, f_rows_i );
+  }
+
+  // Base image, a noisy copy as the control image and a float disparity map
+  void makeInputs( cv::Mat &f_disparity, cv::Mat &f_base, cv::Mat &f_control )
+  {
+    f_base    = randomImage( 96, 128, CV_8UC1, 200, 31 );
+    f_control = f_base.clone();
+    const cv::Mat noise = randomImage( 96, 128, CV_8UC1, 40, 32 );
+    for( int y = 0; y < f_control.rows; ++y )
+    {
+      for( int x = 0; x < f_control.cols; ++x )
+      {
+	f_control.at<unsigned char>( y, x ) += noise.at<unsigned char>( y, x );
+      }
+    }
+    f_disparity = randomImage( 96, 128, CV_32FC1, 20, 33 );
+  }
+
+  // Writes the contents of an image into another one of the same size and
+  // type, in place
+  void overwrite( const cv::Mat f_src, cv::Mat f_dst )
+  {
+    for( int y = 0; y < f_dst.rows; ++y )
+    {
+      memcpy( f_dst.ptr( y ), f_src.ptr( y ), f_dst.cols * f_dst.elemSize() );
+    }
+  }
+
+  // Frames made by makeInputs, with a disparity map of their own
+  class CMemorySource : public CThirdEyeFrameSource
+  {
+  public:
+    CMemorySource()
+      : m_otherThreads( 0 ),
+        m_caller( std::this_thread::get_id() )
+    {};
+
+    bool loadFrame( SThirdEyeFrame &f_frame )
+    {
+      if( std::this_thread::get_id() != m_caller )
+      {
+	++m_otherThreads;
+      }
+      makeInputs( f_frame.m_disparity, f_frame.m_base, f_frame.m_control );
+      f_frame.m_disparity = randomImage( 96, 128, CV_32FC1, 20, 100 + f_frame.m_index_ui );
+      return true;
+    }
+
+    // Frames loaded outside of the thread that created the source
+    std::atomic<unsigned> m_otherThreads;
+
+  private:
+    std::thread::id       m_caller;
+  };
+}
+
+// The coarse disparity of each 4x4 block is taken at its center
+TEST_CASE( coarseDisparitySampledAtBlockCenters )
+{
+  cv::Mat disparity, base, control;
+  makeInputs( disparity, base, control );
+
+  CThirdEyeEvaluation eval;
+  setRig( eval, base.cols, base.rows );
+  eval.setPyramid( true, 200.f, 300.f );
+
+  SThirdEyeWorkspace workspace;
+  float full_f = 0.f, mask_f = 0.f;
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, full_f, mask_f ) );
+  CHECK( workspace.m_coarseResult_b );
+
+  const cv::Mat &coarse = workspace.m_coarseDisparity;
+  CHECK_EQUAL( base.rows / 4, coarse.rows );
+  CHECK_EQUAL( base.cols / 4, coarse.cols );
+  unsigned wrong_ui = 0;
+  for( int y = 0; y < coarse.rows; ++y )
+  {
+    for( int x = 0; x < coarse.cols; ++x )
+    {
+      wrong_ui += ( coarse.at<float>( y, x ) != 0.25f * disparity.at<float>( 4 * y + 2, 4 * x + 2 ) ) ? 1 : 0;
+    }
+  }
+  CHECK_EQUAL( 0u, wrong_ui );
+}
+
+// The pyramid band is an NCC band: the census index ignores the pyramid
+TEST_CASE( censusIndexSkipsThePyramid )
+{
+  cv::Mat disparity, base, control;
+  makeInputs( disparity, base, control );
+
+  CThirdEyeEvaluation eval;
+  setRig( eval, base.cols, base.rows );
+  eval.setIndexType( INDEX_CENSUS );
+
+  SThirdEyeWorkspace workspace;
+  float full_f = 0.f, mask_f = 0.f;
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, full_f, mask_f ) );
+
+  // Every coarse index is out of the band
+  eval.setPyramid( true, 200.f, 300.f );
+  SThirdEyeWorkspace pyramid;
+  float fullPyramid_f = 0.f, maskPyramid_f = 0.f;
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, pyramid, 
+					fullPyramid_f, maskPyramid_f ) );
+  CHECK( !pyramid.m_coarseResult_b );
+  CHECK_EQUAL( full_f, fullPyramid_f );
+  CHECK_EQUAL( mask_f, maskPyramid_f );
+}
+
+// The pipeline gives the results of evaluating the frames one by one
+namespace
+{
+  // Runs frames through a quality control, with a fixed cost (ms) per level.
+  // Counts the frames above the budget after the first one (which has no
+  // measurement yet), and returns the level of the last frame
+  EThirdEyeQuality runFrames( CThirdEyeQualityControl &f_control, const float f_budget_f,
+			      const float f_cost_f[ QUALITY_NUM_LEVELS ],
+			      const unsigned f_count_ui, unsigned &f_over_ui )
+  {
+    EThirdEyeQuality quality_e = QUALITY_FULL;
+    for( unsigned i = 0; i < f_count_ui; ++i )
+    {
+      quality_e = f_control.choose( f_budget_f, QUALITY_NUM_LEVELS );
+      const bool first_b = f_control.getExpectedTime( QUALITY_FULL ) < 0.f;
+      if( !first_b && f_cost_f[ quality_e ] > f_budget_f )
+      {
+	++f_over_ui;
+      }
+      f_control.record( quality_e, f_cost_f[ quality_e ], f_budget_f, true );
+    }
+    return quality_e;
+  }
+}
+
+// Once settled, the adaptive mode keeps every frame within the budget: the
+// expensive levels are not retried while their cost does not fit, they are
+// when the costs go down, and a probe that does not fit is not repeated soon
+TEST_CASE( adaptiveQualityStaysWithinBudget )
+{
+  const float budget_f = 5.f;
+  CThirdEyeQualityControl control;
+  unsigned over_ui = 0;
+
+  const float slow_f[ QUALITY_NUM_LEVELS ] = { 10.f, 7.5f, 0.9f, 0.5f };
+  CHECK_EQUAL( QUALITY_COARSE, runFrames( control, budget_f, slow_f, 5000, over_ui ) );
+  CHECK_EQUAL( 0u, over_ui );
+
+  // Faster: the half resolution mask fits again, the full evaluation not
+  const float fast_f[ QUALITY_NUM_LEVELS ] = { 4.6f, 3.2f, 0.36f, 0.2f };
+  CHECK_EQUAL( QUALITY_COARSE_MASK, runFrames( control, budget_f, fast_f, 5000, over_ui ) );
+  CHECK_EQUAL( 0u, over_ui );
+
+  // The nominal costs predict the half resolution mask to fit, but it does
+  // not: each failed probe overruns once, and the next one waits twice as long
+  CThirdEyeQualityControl misled;
+  over_ui = 0;
+  const float misleading_f[ QUALITY_NUM_LEVELS ] = { 10.f, 7.5f, 0.3f, 0.2f };
+  CHECK_EQUAL( QUALITY_COARSE, runFrames( misled, budget_f, misleading_f, 10000, over_ui ) );
+  CHECK( over_ui > 0u && over_ui <= 10u );
+}
+
+// The sampled estimate converges to the NCC of the mapped pixels: its 95%
+// interval contains the NCC of all of them (the estimate at a rate of one).
+// In adaptive mode the sampled level reports the estimate and its interval
+// in their own fields, and no index
+TEST_CASE( sampledIntervalContainsExactNCC )
+{
+  cv::Mat base( 96, 128, CV_8UC1 );
+  const cv::Mat noise = randomImage( 96, 128, CV_8UC1, 50, 41 );
+  for( int y = 0; y < base.rows; ++y )
+  {
+    for( int x = 0; x < base.cols; ++x )
+    {
+      base.at<unsigned char>( y, x ) = static_cast<unsigned char>( 100.0 + 60.0 * std::sin( x / 7.0 ) *
+								   std::cos( y / 9.0 ) );
+    }
+  }
+  cv::Mat control = base.clone();
+  for( int y = 0; y < control.rows; ++y )
+  {
+    for( int x = 0; x < control.cols; ++x )
+    {
+      control.at<unsigned char>( y, x ) += noise.at<unsigned char>( y, x );
+    }
+  }
+  const cv::Mat disparity( 96, 128, CV_32FC1, cv::Scalar( 6.f ) );
+
+  CThirdEyeEvaluation eval;
+  setRig( eval, base.cols, base.rows );
+
+  eval.setSampling( 1.f, 7 );
+  float exact_f = 0.f, lower_f = 0.f, upper_f = 0.f;
+  CHECK( eval.estimateEvaluationIndex( disparity, base, control, exact_f, lower_f, upper_f ) );
+
+  eval.setSampling( 0.05f, 7 );
+  float index_f = 0.f;
+  CHECK( eval.estimateEvaluationIndex( disparity, base, control, index_f, lower_f, upper_f ) );
+  CHECK( lower_f <= exact_f && exact_f <= upper_f );
+  CHECK( lower_f < index_f && index_f < upper_f );
+  CHECK( exact_f > 50.f );
+
+  // A budget nothing fits in: the first frame is measured at the full level,
+  // the next ones are sampled
+  eval.setLatencyBudget( 1e-6f );
+  SThirdEyeWorkspace workspace;
+  float full_f = 0.f, mask_f = 0.f;
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, full_f, mask_f ) );
+  CHECK_EQUAL( QUALITY_FULL, workspace.m_quality_e );
+  CHECK_EQUAL( -32000.f, workspace.m_estimate_f );
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, full_f, mask_f ) );
+  CHECK_EQUAL( QUALITY_SAMPLED, workspace.m_quality_e );
+  CHECK_EQUAL( -32000.f, full_f );
+  CHECK_EQUAL( -32000.f, mask_f );
+  CHECK_EQUAL( index_f, workspace.m_estimate_f );
+  CHECK_EQUAL( lower_f, workspace.m_estimateLower_f );
+  CHECK_EQUAL( upper_f, workspace.m_estimateUpper_f );
+}
+
+// Whatever the scheduler bound leaves for the stages, the results are those
+// of the frame by frame evaluation
+TEST_CASE( sequenceMatchesFrameByFrame )
+{
+  CThirdEyeEvaluation eval;
+  setRig( eval, 128, 96 );
+
+  const unsigned numThreads_ui = getSchedulerThreads();
+  for( unsigned bound_ui = 1; bound_ui <= 5; ++bound_ui )
+  {
+    setSchedulerThreads( bound_ui );
+
+    CThirdEyeSequence sequence( eval );
+    sequence.setPrefetch( 2, 2 );
+    CMemorySource source;
+    std::vector<SThirdEyeFrameResult> results;
+    CHECK( sequence.run( source, 5, 12, results ) );
+    CHECK_EQUAL( 12u, static_cast<unsigned>( results.size() ) );
+
+    // With one thread the caller loads the frames itself
+    if( bound_ui == 1 )
+    {
+      CHECK_EQUAL( 0u, source.m_otherThreads.load() );
+    }
+
+    for( unsigned i = 0; i < results.size(); ++i )
+    {
+      SThirdEyeFrame frame;
+      frame.m_index_ui = 5 + i;
+      source.loadFrame( frame );
+      SThirdEyeWorkspace workspace;
+      float full_f = 0.f, mask_f = 0.f;
+      CHECK( eval.computeEvaluationIndices( frame.m_disparity, frame.m_base, frame.m_control,
+					    workspace, full_f, mask_f ) );
+      CHECK_EQUAL( frame.m_index_ui, results[ i ].m_index_ui );
+      CHECK( results[ i ].m_valid_b );
+      CHECK_EQUAL( full_f, results[ i ].m_fullIndex_f );
+      CHECK_EQUAL( mask_f, results[ i ].m_maskIndex_f );
+    }
+  }
+  setSchedulerThreads( numThreads_ui );
+}
+
+// New contents written into the input buffers give new indices, with or
+// without a frame token, while the settings changes of one frame only rerun
+// the stages they affect
+TEST_CASE( cacheFollowsFrameToken )
+{
+  cv::Mat disparity, base, control;
+  makeInputs( disparity, base, control );
+  const unsigned char* baseData_p = base.data;
+
+  CThirdEyeEvaluation eval;
+  setRig( eval, base.cols, base.rows );
+
+  SThirdEyeWorkspace workspace;
+  float first_f = 0.f, mask_f = 0.f;
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, first_f, mask_f ) );
+
+  // Reference index of the new contents, from a fresh workspace
+  const cv::Mat newBase = randomImage( base.rows, base.cols, CV_8UC1, 200, 34 );
+  SThirdEyeWorkspace reference;
+  float expected_f = 0.f;
+  CHECK( eval.computeEvaluationIndices( disparity, newBase, control, reference, expected_f, mask_f ) );
+  CHECK( expected_f != first_f );
+
+  // No token: the same buffer with new contents is evaluated again
+  overwrite( newBase, base );
+  CHECK( base.data == baseData_p );
+  float index_f = 0.f;
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, index_f, mask_f ) );
+  CHECK_EQUAL( expected_f, index_f );
+
+  // Token: a settings change of the frame keeps its virtual image and mask
+  workspace.setFrame( 1 );
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, index_f, mask_f ) );
+  const uint64_t warpStamp = workspace.m_warpStamp;
+  const uint64_t maskStamp = workspace.m_maskStamp;
+  eval.setEvaluationRoi( 8, 8, base.cols - 8, base.rows - 8 );
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, index_f, mask_f ) );
+  CHECK_EQUAL( warpStamp, workspace.m_warpStamp );
+  CHECK_EQUAL( maskStamp, workspace.m_maskStamp );
+  eval.setEvaluationRoi( 0, 0, base.cols, base.rows );
+
+  // A new token for new contents in the same buffer
+  overwrite( randomImage( base.rows, base.cols, CV_8UC1, 200, 31 ), base );
+  CHECK( base.data == baseData_p );
+  workspace.setFrame( 2 );
+  CHECK( eval.computeEvaluationIndices( disparity, base, control, workspace, index_f, mask_f ) );
+  CHECK_EQUAL( first_f, index_f );
+  CHECK( warpStamp != workspace.m_warpStamp );
+}
@@ -0,0 +1,124 @@
+/* ******************************** FILE *********************************** */
+/** \file    testImagePool.cpp
+ *
+ *  \brief   Tests of CImagePool.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Project includes
+#include "testing.h"
+#include "../h/imagePool.h"
+#include "../h/thirdeyeEval.h"
+
+namespace
+{
+  // Frames of the same size, each with inputs of its own
+  struct SFrame
+  {
+    cv::Mat m_disparity;
+    cv::Mat m_base;
+    cv::Mat m_control;
+  };
+
+  std::vector<SFrame> makeFrames( const unsigned f_count_ui )
+  {
+    std::vector<SFrame> frames( f_count_ui );
+    for( unsigned i = 0; i < f_count_ui; ++i )
+    {
+      frames[ i ].m_base      = randomImage( 96, 128, CV_8UC1, 200, 40 + i );
+      frames[ i ].m_control   = randomImage( 96, 128, CV_8UC1, 200, 60 + i );
+      frames[ i ].m_disparity = randomImage( 96, 128, CV_32FC1, 20, 80 + i );
+    }
+    return frames;
+  }
+
+  void setRig( CThirdEyeEvaluation &f_eval )
+  {
+    f_eval.setParams( SThirdEyeParams( 10.f,
+				       -2.f, 0.f, 0.f,
+				       1.f, 0.f, 0.f,
+				       0.f, 1.f, 0.f,
+				       0.f, 0.f, 1.f,
+				       64.f, 48.f, 400.f, 400.f,
+				       64.f, 48.f, 400.f, 400.f,
+				       1.f, 1.f ) );
+    f_eval.setEvaluationRoi( 4, 4, 124, 92 );
+  }
+
+  // Image buffers taken from the heap by the pool while evaluating the
+  // frames twice, after one warm-up pass. f_heap is the number of heap
+  // allocations of any kind over the same frames
+  size_t steadyStateAllocations( const CThirdEyeEvaluation &f_eval, size_t &f_heap )
+  {
+    const std::vector<SFrame> frames = makeFrames( 4 );
+    SThirdEyeWorkspace workspace;
+    float full_f = 0.f, mask_f = 0.f;
+    bool ok_b = true;
+
+    for( size_t i = 0; i < frames.size(); ++i )
+    {
+      ok_b = f_eval.computeEvaluationIndices( frames[ i ].m_disparity, frames[ i ].m_base,
+					      frames[ i ].m_control, workspace,
+					      full_f, mask_f ) && ok_b;
+    }
+
+    const size_t before     = imagePool().getNumAllocations();
+    const size_t heapBefore = heapAllocations();
+    for( unsigned pass_ui = 0; pass_ui < 2; ++pass_ui )
+    {
+      for( size_t i = 0; i < frames.size(); ++i )
+      {
+	ok_b = f_eval.computeEvaluationIndices( frames[ i ].m_disparity, frames[ i ].m_base,
+						frames[ i ].m_control, workspace,
+						full_f, mask_f ) && ok_b;
+      }
+    }
+    f_heap = heapAllocations() - heapBefore;
+    CHECK( ok_b );
+    return imagePool().getNumAllocations() - before;
+  }
+}
+
+// Once the buffers of the first frames exist, the evaluation of the next
+// frames takes all its image buffers from the pool, and allocates nothing
+// else either
+TEST_CASE( poolSteadyStateWithoutAllocations )
+{
+  const size_t start = imagePool().getNumAllocations();
+  size_t heap = 0;
+
+  CThirdEyeEvaluation eval;
+  setRig( eval );
+  eval.setMetrics( METRIC_ALL );
+  eval.setLocalNCCWindow( 9, 2 );
+  eval.setDisparityBands( 0.f, 20.f, 4 );
+  CHECK_EQUAL( 0u, steadyStateAllocations( eval, heap ) );
+  CHECK_EQUAL( 0u, heap );
+
+  // Rectangles, one of them outside the RoI, and a label image: the label
+  // tables and the integral images are reused as well
+  std::vector<cv::Rect> regions;
+  regions.push_back( cv::Rect(  0,  0, 40, 30 ) );
+  regions.push_back( cv::Rect( 50, 40, 60, 50 ) );
+  eval.setEvaluationRegions( regions );
+  cv::Mat labels( 96, 128, CV_16UC1 );
+  for( int y = 0; y < labels.rows; ++y )
+  {
+    for( int x = 0; x < labels.cols; ++x )
+    {
+      labels.at<unsigned short>( y, x ) = static_cast<unsigned short>( ( y / 8 ) * 16 + x / 8 );
+    }
+  }
+  eval.setEvaluationLabels( labels, 256 );
+  CHECK_EQUAL( 0u, steadyStateAllocations( eval, heap ) );
+  CHECK_EQUAL( 0u, heap );
+
+  // Pyramid mode: the coarse level has buffers of its own
+  eval.setPyramid( true, -2.f, 2.f );
+  CHECK_EQUAL( 0u, steadyStateAllocations( eval, heap ) );
+  CHECK_EQUAL( 0u, heap );
+
+  // The warm-up did take buffers from the pool
+  CHECK( imagePool().getNumAllocations() > start );
+}
@@ -0,0 +1,245 @@
+/* ******************************** FILE *********************************** */
+/** \file    testLive.cpp
+ *
+ *  \brief   Tests of the drop policies of CThirdEyeLive, and of its result
+ *           ring and running stats.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Project includes
+#include "testing.h"
+#include "../h/thirdeyeLive.h"
+
+namespace
+{
+  const unsigned NUM_FRAMES_UI = 4;
+
+  // Holds the worker thread in the result callback of the first frame until
+  // it is opened, so the queue fills up behind it. Records the evaluation
+  // order
+  class CGate
+  {
+  public:
+    CGate() : m_entered_b( false ), m_open_b( false ) { }
+
+    void onResult( const SThirdEyeLiveResult &f_result )
+    {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_order.push_back( f_result.m_index_ui );
+      m_entered_b = true;
+      m_changed.notify_all();
+      m_changed.wait( lock, [&]() { return m_open_b; } );
+    }
+
+    void waitEntered()
+    {
+      std::unique_lock<std::mutex> lock( m_mutex );
+      m_changed.wait( lock, [&]() { return m_entered_b; } );
+    }
+
+    void open()
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      m_open_b = true;
+      m_changed.notify_all();
+    }
+
+    std::vector<unsigned> getOrder()
+    {
+      std::lock_guard<std::mutex> lock( m_mutex );
+      return m_order;
+    }
+
+  private:
+    std::mutex m_mutex;
+
+    std::condition_variable m_changed;
+
+    bool m_entered_b;
+
+    bool m_open_b;
+
+    std::vector<unsigned> m_order;
+  };
+
+  SThirdEyeFrame makeFrame( const unsigned f_index_ui )
+  {
+    SThirdEyeFrame frame;
+    frame.m_index_ui  = f_index_ui;
+    frame.m_base      = randomImage( 48, 64, CV_8UC1, 200, 50 + f_index_ui );
+    frame.m_control   = randomImage( 48, 64, CV_8UC1, 200, 60 + f_index_ui );
+    frame.m_disparity = randomImage( 48, 64, CV_32FC1, 20, 70 + f_index_ui );
+    return frame;
+  }
+
+  CThirdEyeEvaluation makeEval()
+  {
+    CThirdEyeEvaluation eval;
+    eval.setParams( SThirdEyeParams( 10.f,
+				     -2.f, 0.f, 0.f,
+				     1.f, 0.f, 0.f,
+				     0.f, 1.f, 0.f,
+				     0.f, 0.f, 1.f,
+				     32.f, 24.f, 400.f, 400.f,
+				     32.f, 24.f, 400.f, 400.f,
+				     1.f, 1.f ) );
+    eval.setEvaluationRoi( 0, 0, 64, 48 );
+    return eval;
+  }
+
+  // Frame 0 is taken by the worker, which is then held, frames 1 and 2 fill
+  // the queue of two and frame 3 finds it full. Returns what the push of
+  // frame 3 returned; the pushes of the other frames must succeed
+  bool pushIntoFullQueue( const EThirdEyeDropPolicy f_policy_e,
+			  std::vector<SThirdEyeLiveResult> &f_results,
+			  std::vector<unsigned> &f_order )
+  {
+    CGate gate;
+    CThirdEyeLive live( makeEval() );
+    CHECK( live.setQueue( 2, f_policy_e ) );
+    live.setResultCallback( [&]( const SThirdEyeLiveResult &f_result ) { gate.onResult( f_result ); } );
+    CHECK( live.start() );
+
+    CHECK( live.pushFrame( makeFrame( 0 ) ) );
+    gate.waitEntered();
+    CHECK( live.pushFrame( makeFrame( 1 ) ) );
+    CHECK( live.pushFrame( makeFrame( 2 ) ) );
+
+    bool pushed_b = false;
+    if( f_policy_e == DROP_NONE )
+    {
+      // The push waits for the worker to take a frame
+      std::atomic<bool> returned( false );
+      const SThirdEyeFrame frame = makeFrame( 3 );
+      std::thread producer( [&]() { pushed_b = live.pushFrame( frame ); returned = true; } );
+      std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+      CHECK( !returned );
+      gate.open();
+      producer.join();
+    }
+    else
+    {
+      pushed_b = live.pushFrame( makeFrame( 3 ) );
+      gate.open();
+    }
+
+    live.stop();
+    f_results.clear();
+    live.takeResults( f_results );
+    f_order = gate.getOrder();
+
+    const SThirdEyeLiveStats stats = live.getStats();
+    CHECK_EQUAL( NUM_FRAMES_UI, stats.m_pushed_ui );
+    CHECK_EQUAL( stats.m_pushed_ui, stats.m_evaluated_ui + stats.m_dropped_ui );
+    CHECK_EQUAL( 0u, stats.m_lost_ui );
+    return pushed_b;
+  }
+
+  // One result per pushed frame; the frames that were not dropped are valid
+  void checkResults( std::vector<SThirdEyeLiveResult> f_results, const int f_dropped_i )
+  {
+    std::sort( f_results.begin(), f_results.end(),
+	       []( const SThirdEyeLiveResult &a, const SThirdEyeLiveResult &b )
+	       { return a.m_index_ui < b.m_index_ui; } );
+    CHECK_EQUAL( static_cast<size_t>( NUM_FRAMES_UI ), f_results.size() );
+    for( size_t i = 0; i < f_results.size(); ++i )
+    {
+      CHECK_EQUAL( static_cast<unsigned>( i ), f_results[ i ].m_index_ui );
+      CHECK_EQUAL( static_cast<int>( i ) == f_dropped_i, f_results[ i ].m_dropped_b );
+      CHECK_EQUAL( static_cast<int>( i ) != f_dropped_i, f_results[ i ].m_valid_b );
+    }
+  }
+}
+
+// A full queue gives way to the new frame: the oldest waiting one is dropped
+TEST_CASE( liveDropOldest )
+{
+  std::vector<SThirdEyeLiveResult> results;
+  std::vector<unsigned> order;
+  CHECK( pushIntoFullQueue( DROP_OLDEST, results, order ) );
+  checkResults( results, 1 );
+
+  const unsigned expected[] = { 0, 2, 3 };
+  CHECK( order == std::vector<unsigned>( expected, expected + 3 ) );
+}
+
+// A full queue keeps its frames: the new one is dropped
+TEST_CASE( liveDropNewest )
+{
+  std::vector<SThirdEyeLiveResult> results;
+  std::vector<unsigned> order;
+  CHECK( !pushIntoFullQueue( DROP_NEWEST, results, order ) );
+  checkResults( results, 3 );
+
+  const unsigned expected[] = { 0, 1, 2 };
+  CHECK( order == std::vector<unsigned>( expected, expected + 3 ) );
+}
+
+// A full queue blocks the producer until there is room: no frame is lost
+TEST_CASE( liveBlockWhenFull )
+{
+  std::vector<SThirdEyeLiveResult> results;
+  std::vector<unsigned> order;
+  CHECK( pushIntoFullQueue( DROP_NONE, results, order ) );
+  checkResults( results, -1 );
+
+  const unsigned expected[] = { 0, 1, 2, 3 };
+  CHECK( order == std::vector<unsigned>( expected, expected + 4 ) );
+}
+
+// The ring keeps the newest results when the caller does not take them, and
+// the running stats match the latencies of all the evaluated frames
+TEST_CASE( liveRingKeepsNewestResults )
+{
+  const unsigned numFrames_ui = 40;
+  std::vector<float> latencies;
+
+  CThirdEyeLive live( makeEval() );
+  CHECK( live.setQueue( 2, DROP_NONE ) );
+  CHECK( live.setResultRing( 4 ) );
+  live.setDeadline( 1e6f );
+  live.setResultCallback( [&]( const SThirdEyeLiveResult &f_result )
+			  { latencies.push_back( f_result.m_latency_f ); } );
+  CHECK( live.start() );
+  for( unsigned i = 0; i < numFrames_ui; ++i )
+  {
+    CHECK( live.pushFrame( makeFrame( i ) ) );
+  }
+  live.stop();
+
+  std::vector<SThirdEyeLiveResult> results;
+  CHECK_EQUAL( static_cast<size_t>( 4 ), live.takeResults( results ) );
+  for( unsigned k = 0; k < 4; ++k )
+  {
+    CHECK_EQUAL( numFrames_ui - 4 + k, results[ k ].m_index_ui );
+    CHECK( results[ k ].m_valid_b );
+  }
+  CHECK_EQUAL( static_cast<size_t>( 0 ), live.takeResults( results ) );
+
+  const SThirdEyeLiveStats stats = live.getStats();
+  CHECK_EQUAL( numFrames_ui, stats.m_pushed_ui );
+  CHECK_EQUAL( numFrames_ui, stats.m_evaluated_ui );
+  CHECK_EQUAL( numFrames_ui - 4, stats.m_lost_ui );
+  CHECK_EQUAL( 0u, stats.m_late_ui );
+
+  CHECK_EQUAL( static_cast<size_t>( numFrames_ui ), latencies.size() );
+  std::sort( latencies.begin(), latencies.end() );
+  double sum_d = 0.;
+  for( size_t i = 0; i < latencies.size(); ++i )
+  {
+    sum_d += latencies[ i ];
+  }
+  const float p95_f = latencies[ ( latencies.size() - 1 ) * 95 / 100 ];
+  CHECK_NEAR( sum_d / latencies.size(), stats.m_meanLatency_f, 1e-3 );
+  CHECK_EQUAL( latencies.back(), stats.m_maxLatency_f );
+  CHECK( stats.m_p95Latency_f >= 0.999f * p95_f && stats.m_p95Latency_f <= 1.02f * p95_f );
+}
@@ -0,0 +1,181 @@
+/* ******************************** FILE *********************************** */
+/** \file    testMain.cpp
+ *
+ *  \brief   Runs the unit tests (see testing.h). Without arguments all the
+ *           tests run; otherwise only those whose name contains one of the
+ *           arguments. The exit code is 1 if a test failed.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+
+// POSIX includes
+#include <unistd.h>
+
+// Project includes
+#include "testing.h"
+#include "../h/thirdeyeParallel.h"
+
+using std::cout;
+using std::endl;
+
+std::vector<STestCase>& testCases()
+{
+  static std::vector<STestCase> cases;
+  return cases;
+}
+
+unsigned& testFailures()
+{
+  static unsigned failures_ui = 0;
+  return failures_ui;
+}
+
+namespace
+{
+  std::atomic<size_t> g_heapAllocations( 0 );
+}
+
+// Counted replacement of the global operator new (see heapAllocations). The
+// array and nothrow forms call this one, and the default operator delete
+// releases its blocks with free
+void* operator new( size_t f_size )
+{
+  ++g_heapAllocations;
+  void* block_p = malloc( f_size > 0 ? f_size : 1 );
+  if( !block_p )
+  {
+    throw std::bad_alloc();
+  }
+  return block_p;
+}
+
+size_t heapAllocations()
+{
+  return g_heapAllocations;
+}
+
+namespace
+{
+  std::vector<std::string>& temporaryFiles()
+  {
+    static std::vector<std::string> files;
+    return files;
+  }
+
+  void removeTemporaryFiles()
+  {
+    for( size_t i = 0; i < temporaryFiles().size(); ++i )
+    {
+      std::remove( temporaryFiles()[ i ].c_str() );
+    }
+  }
+}
+
+namespace
+{
+  template<typename T>
+  void fillRandom( cv::Mat &f_image, const int f_range_i, std::mt19937 &f_generator )
+  {
+    for( int y = 0; y < f_image.rows; ++y )
+    {
+      T* row_p = f_image.ptr<T>( y );
+      for( int x = 0; x < f_image.cols * f_image.channels(); ++x )
+      {
+	row_p[ x ] = static_cast<T>( f_generator() % f_range_i );
+      }
+    }
+  }
+}
+
+cv::Mat randomImage( const int f_rows_i, const int f_cols_i, const int f_type_i,
+		     const int f_range_i, const unsigned f_seed_ui )
+{
+  std::mt19937 generator( f_seed_ui );
+  cv::Mat image( f_rows_i, f_cols_i, f_type_i );
+  switch( image.depth() )
+  {
+  case CV_8U:  fillRandom<unsigned char>(  image, f_range_i, generator ); break;
+  case CV_16U: fillRandom<unsigned short>( image, f_range_i, generator ); break;
+  case CV_16S: fillRandom<short>(          image, f_range_i, generator ); break;
+  case CV_32S: fillRandom<int>(            image, f_range_i, generator ); break;
+  case CV_32F: fillRandom<float>(          image, f_range_i, generator ); break;
+  default:     fillRandom<double>(         image, f_range_i, generator ); break;
+  }
+  return image;
+}
+
+std::string temporaryFileName( const std::string &f_suffix_str )
+{
+  const char* dir_p = getenv( "TMPDIR" );
+  std::string name_str = std::string( dir_p ? dir_p : "/tmp" ) + "/thirdEyeTestXXXXXX" + f_suffix_str;
+  std::vector<char> name( name_str.begin(), name_str.end() );
+  name.push_back( '\0' );
+  const int fd_i = mkstemps( &name[ 0 ], static_cast<int>( f_suffix_str.size() ) );
+  if( fd_i >= 0 )
+  {
+    close( fd_i );
+  }
+  temporaryFiles().push_back( &name[ 0 ] );
+  return &name[ 0 ];
+}
+
+bool sameContents( const cv::Mat f_a, const cv::Mat f_b )
+{
+  if( f_a.size() != f_b.size() || f_a.type() != f_b.type() )
+  {
+    return false;
+  }
+  const size_t rowBytes = f_a.cols * f_a.elemSize();
+  for( int y = 0; y < f_a.rows; ++y )
+  {
+    if( memcmp( f_a.ptr( y ), f_b.ptr( y ), rowBytes ) != 0 )
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main( int argc, char** argv )
+{
+  atexit( removeTemporaryFiles );
+
+  // Enough scheduler threads for the thread count tests, also on small
+  // machines
+  setSchedulerThreads( 8 );
+
+  unsigned run_ui = 0, failed_ui = 0;
+  for( size_t i = 0; i < testCases().size(); ++i )
+  {
+    const STestCase &test = testCases()[ i ];
+    bool selected_b = ( argc < 2 );
+    for( int a = 1; a < argc && !selected_b; ++a )
+    {
+      selected_b = strstr( test.m_name_p, argv[ a ] ) != nullptr;
+    }
+    if( !selected_b )
+    {
+      continue;
+    }
+
+    testFailures() = 0;
+    test.m_function_p();
+    ++run_ui;
+    if( testFailures() > 0 )
+    {
+      ++failed_ui;
+    }
+    cout << ( testFailures() == 0 ? "[  OK  ] " : "[ FAIL ] " ) << test.m_name_p << endl;
+  }
+
+  cout << run_ui - failed_ui << "/" << run_ui << " tests passed" << endl;
+  return failed_ui == 0 ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+/* ******************************** FILE *********************************** */
+/** \file    testMappedFile.cpp
+ *
+ *  \brief   Tests of CMappedFile and of the raw images loaded through it
+ *           (loadRawImage): the images point into the mapping when the data
+ *           is aligned to the pixel size, and are read into memory when not.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <cstdio>
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <unistd.h>
+
+// Project includes
+#include "testing.h"
+#include "../h/loader.h"
+#include "../h/mappedFile.h"
+
+namespace
+{
+  size_t fileSize( const std::string &f_fileName_str )
+  {
+    std::ifstream file( f_fileName_str.c_str(), std::ios::binary | std::ios::ate );
+    return static_cast<size_t>( file.tellg() );
+  }
+
+  // True if the image data is in a mapping: the data of a raw file is at
+  // its end, and the mapping starts at a page
+  bool pointsIntoMapping( const cv::Mat f_img, const std::string &f_fileName_str )
+  {
+    const size_t offset = fileSize( f_fileName_str ) - f_img.total() * f_img.elemSize();
+    return ( reinterpret_cast<uintptr_t>( f_img.data ) - offset ) % sysconf( _SC_PAGESIZE ) == 0;
+  }
+
+  // Saves the image with comments of 0 to 7 characters, which shift the
+  // data by one byte each, and loads it back: the copies whose data is
+  // aligned to the pixel size are mapped, the others are read. All of them
+  // are aligned and match the image
+  void checkOffsets( const cv::Mat f_img, const unsigned f_subpixelBits_ui )
+  {
+    unsigned mapped_ui = 0, read_ui = 0;
+    for( unsigned length_ui = 0; length_ui < 8; ++length_ui )
+    {
+      const std::string fileName_str = temporaryFileName( ".raw" );
+      CHECK( saveRawImage( fileName_str, f_img, std::string( length_ui, 'c' ), f_subpixelBits_ui ) );
+
+      unsigned subpixelBits_ui = 0;
+      const cv::Mat loaded = loadRawImage( fileName_str, subpixelBits_ui );
+      CHECK( sameContents( f_img, loaded ) );
+      CHECK_EQUAL( f_subpixelBits_ui, subpixelBits_ui );
+      CHECK_EQUAL( static_cast<uintptr_t>( 0 ), reinterpret_cast<uintptr_t>( loaded.data ) % f_img.elemSize() );
+
+      const size_t offset = fileSize( fileName_str ) - f_img.total() * f_img.elemSize();
+      if( offset % f_img.elemSize() == 0 )
+      {
+	CHECK( pointsIntoMapping( loaded, fileName_str ) );
+	++mapped_ui;
+      }
+      else
+      {
+	++read_ui;
+      }
+    }
+    CHECK( mapped_ui > 0 );
+    CHECK( f_img.elemSize() == 1 || read_ui > 0 );
+  }
+}
+
+TEST_CASE( rawImagesMappedOrRead )
+{
+  checkOffsets( randomImage( 21, 37, CV_32FC1, 64, 80 ), 0 );
+  checkOffsets( randomImage( 21, 37, CV_64FC1, 64, 81 ), 0 );
+  checkOffsets( randomImage( 21, 37, CV_16UC1, 65536, 82 ), 4 );
+}
+
+// A mapped image stays valid after the file is removed and the loader is
+// gone, and its copies share the mapping
+TEST_CASE( mappedImageOutlivesFile )
+{
+  const cv::Mat img = randomImage( 16, 24, CV_32FC1, 64, 83 );
+  const std::string fileName_str = temporaryFileName( ".raw" );
+  CHECK( saveRawImage( fileName_str, img, "", 0 ) );
+
+  cv::Mat loaded = loadRawImage( fileName_str );
+  CHECK( pointsIntoMapping( loaded, fileName_str ) );
+  CHECK_EQUAL( 0, std::remove( fileName_str.c_str() ) );
+
+  const cv::Mat copy = loaded;
+  loaded.release();
+  CHECK( sameContents( img, copy ) );
+
+  // The pages are private: writing into the image is fine
+  cv::Mat writable = copy;
+  writable.at<float>( 0, 0 ) = -5.f;
+  CHECK_EQUAL( -5.f, copy.at<float>( 0, 0 ) );
+}
+
+// getMat only gives Mats that fit in the file and are aligned
+TEST_CASE( mappedFileGetMatChecks )
+{
+  const std::string fileName_str = temporaryFileName( ".bin" );
+  {
+    std::ofstream file( fileName_str.c_str(), std::ios::binary | std::ios::trunc );
+    for( unsigned i = 0; i < 64; ++i )
+    {
+      file.put( static_cast<char>( i ) );
+    }
+  }
+
+  CMappedFile file;
+  CHECK( !file.open( fileName_str + ".missing" ) );
+  CHECK( file.open( fileName_str ) );
+  CHECK_EQUAL( static_cast<size_t>( 64 ), file.getSize() );
+
+  const cv::Mat bytes = file.getMat( 8, 4, 14, CV_8UC1 );
+  CHECK( !bytes.empty() );
+  CHECK_EQUAL( 8, static_cast<int>( bytes.at<unsigned char>( 0, 0 ) ) );
+  CHECK_EQUAL( 63, static_cast<int>( bytes.at<unsigned char>( 3, 13 ) ) );
+
+  CHECK( file.getMat( 8, 4, 15, CV_8UC1 ).empty() );
+  CHECK( file.getMat( 2, 2, 2, CV_32FC1 ).empty() );
+  CHECK( !file.getMat( 4, 2, 2, CV_32FC1 ).empty() );
+
+  // The Mat keeps the mapping after the file is closed
+  file.close();
+  CHECK_EQUAL( 21, static_cast<int>( bytes.at<unsigned char>( 0, 13 ) ) );
+}
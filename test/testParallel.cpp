@@ -0,0 +1,172 @@
+/* ******************************** FILE *********************************** */
+/** \file    testParallel.cpp
+ *
+ *  \brief   Tests of parallelFor and its scheduler: nested loops, what a
+ *           thread waiting for its loop runs meanwhile, and exceptions.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Project includes
+#include "testing.h"
+#include "../h/thirdeyeParallel.h"
+
+namespace
+{
+  const unsigned NUM_OUTER_UI = 16;
+  const unsigned NUM_INNER_UI = 8;
+
+  // Outer tasks the current thread is inside of
+  thread_local unsigned t_outerDepth_ui = 0;
+
+  // Nested loops whose inner tasks take a while, so the threads that start
+  // an inner loop wait for the runners other threads stole from it. Counts
+  // the runs of each inner index, and records the deepest nesting of outer
+  // tasks on one thread
+  void runNested( std::vector<std::atomic<unsigned> > &f_runs,
+		  std::atomic<unsigned> &f_maxDepth )
+  {
+    parallelFor( NUM_OUTER_UI, [&]( unsigned o )
+    {
+      const unsigned depth_ui = ++t_outerDepth_ui;
+      unsigned max_ui = f_maxDepth;
+      while( depth_ui > max_ui && !f_maxDepth.compare_exchange_weak( max_ui, depth_ui ) )
+      { }
+
+      parallelFor( NUM_INNER_UI, [&]( unsigned i )
+      {
+	std::this_thread::sleep_for( std::chrono::microseconds( 200 ) );
+	++f_runs[ o * NUM_INNER_UI + i ];
+      } );
+
+      --t_outerDepth_ui;
+    } );
+  }
+}
+
+TEST_CASE( nestedLoopsRunEachIndexOnce )
+{
+  std::vector<std::atomic<unsigned> > runs( NUM_OUTER_UI * NUM_INNER_UI );
+  for( size_t k = 0; k < runs.size(); ++k )
+  {
+    runs[ k ] = 0;
+  }
+  std::atomic<unsigned> maxDepth( 0 );
+
+  runNested( runs, maxDepth );
+
+  for( size_t k = 0; k < runs.size(); ++k )
+  {
+    CHECK_EQUAL( 1u, runs[ k ].load() );
+  }
+}
+
+// A thread waiting for an inner loop must not pick up a task of an outer
+// loop: it would only get back to its own loop once that task is done. Two
+// threads start outer loops at once, so the runners of one are still queued
+// while the workers wait for the inner loops of the other
+TEST_CASE( waitingThreadRunsOnlyNestedTasks )
+{
+  std::vector<std::atomic<unsigned> > runs[ 2 ];
+  std::atomic<unsigned> maxDepth( 0 );
+  for( unsigned c = 0; c < 2; ++c )
+  {
+    runs[ c ] = std::vector<std::atomic<unsigned> >( NUM_OUTER_UI * NUM_INNER_UI );
+    for( size_t k = 0; k < runs[ c ].size(); ++k )
+    {
+      runs[ c ][ k ] = 0;
+    }
+  }
+
+  std::vector<std::thread> callers;
+  for( unsigned c = 0; c < 2; ++c )
+  {
+    callers.push_back( std::thread( [&runs, &maxDepth, c]()
+    {
+      for( unsigned r = 0; r < 4; ++r )
+      {
+	runNested( runs[ c ], maxDepth );
+      }
+    } ) );
+  }
+  for( size_t c = 0; c < callers.size(); ++c )
+  {
+    callers[ c ].join();
+  }
+
+  CHECK_EQUAL( 1u, maxDepth.load() );
+  for( unsigned c = 0; c < 2; ++c )
+  {
+    for( size_t k = 0; k < runs[ c ].size(); ++k )
+    {
+      CHECK_EQUAL( 4u, runs[ c ][ k ].load() );
+    }
+  }
+}
+
+TEST_CASE( taskExceptionIsRethrownToCaller )
+{
+  std::atomic<unsigned> started( 0 );
+  bool caught_b = false;
+  try
+  {
+    parallelFor( 64, [&]( unsigned i )
+    {
+      ++started;
+      std::this_thread::sleep_for( std::chrono::microseconds( 100 ) );
+      if( i == 5 )
+      {
+	throw std::runtime_error( "task 5" );
+      }
+    } );
+  }
+  catch( const std::runtime_error &error )
+  {
+    caught_b = ( std::string( error.what() ) == "task 5" );
+  }
+  CHECK( caught_b );
+  // The indices after the failure are not started
+  CHECK( started < 64u );
+
+  // From a nested loop, through the outer one
+  caught_b = false;
+  try
+  {
+    parallelFor( 8, [&]( unsigned o )
+    {
+      parallelFor( 8, [&]( unsigned i )
+      {
+	if( o == 3 && i == 6 )
+	{
+	  throw std::runtime_error( "inner" );
+	}
+      } );
+    } );
+  }
+  catch( const std::runtime_error &error )
+  {
+    caught_b = ( std::string( error.what() ) == "inner" );
+  }
+  CHECK( caught_b );
+
+  // The workers survived: a later loop still runs all its indices
+  std::vector<std::atomic<unsigned> > runs( NUM_OUTER_UI * NUM_INNER_UI );
+  for( size_t k = 0; k < runs.size(); ++k )
+  {
+    runs[ k ] = 0;
+  }
+  std::atomic<unsigned> maxDepth( 0 );
+  runNested( runs, maxDepth );
+  for( size_t k = 0; k < runs.size(); ++k )
+  {
+    CHECK_EQUAL( 1u, runs[ k ].load() );
+  }
+}
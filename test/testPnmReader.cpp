@@ -0,0 +1,195 @@
+/* ******************************** FILE *********************************** */
+/** \file    testPnmReader.cpp
+ *
+ *  \brief   Tests of the binary PGM/PPM reader: the byte order of 16 bit
+ *           samples, the scaling of 10, 12 and 16 bit images against the
+ *           cv::imread and convertTo path it replaces, and payloads that
+ *           are not aligned to the sample size.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/highgui/highgui.hpp>
+
+// Project includes
+#include "testing.h"
+#include "../h/loader.h"
+#include "../h/pnmReader.h"
+
+namespace
+{
+  // Writes a binary PGM (1 channel) or PPM (3 channels) image with the given
+  // maximum value, 8 or 16 bit (big-endian) samples, and a comment in the
+  // header, which moves the samples by its length. Returns the file name
+  std::string writePnm( const cv::Mat f_img, const unsigned f_maxValue_ui,
+			const std::string &f_comment_str )
+  {
+    const std::string fileName_str = temporaryFileName( f_img.channels() == 1 ? ".pgm" : ".ppm" );
+    std::ostringstream header;
+    header << ( f_img.channels() == 1 ? "P5" : "P6" ) << "\n";
+    if( !f_comment_str.empty() )
+    {
+      header << "# " << f_comment_str << "\n";
+    }
+    header << f_img.cols << " " << f_img.rows << "\n" << f_maxValue_ui << "\n";
+
+    std::ofstream file( fileName_str.c_str(), std::ios::binary | std::ios::trunc );
+    file << header.str();
+    const unsigned samples_ui = f_img.cols * f_img.channels();
+    for( int y = 0; y < f_img.rows; ++y )
+    {
+      for( unsigned x = 0; x < samples_ui; ++x )
+      {
+	if( f_img.depth() == CV_8U )
+	{
+	  file.put( static_cast<char>( f_img.ptr<unsigned char>( y )[ x ] ) );
+	}
+	else
+	{
+	  const unsigned short value = f_img.ptr<unsigned short>( y )[ x ];
+	  file.put( static_cast<char>( value >> 8 ) );
+	  file.put( static_cast<char>( value & 0xFF ) );
+	}
+      }
+    }
+    return fileName_str;
+  }
+
+  // Largest difference between two 32 float images of the same size, or -1
+  // if they do not match in size or type
+  float maxDifference( const cv::Mat f_a, const cv::Mat f_b )
+  {
+    if( f_a.size() != f_b.size() || f_a.type() != f_b.type() || f_a.depth() != CV_32F )
+    {
+      return -1.f;
+    }
+    float max_f = 0.f;
+    const int samples_i = f_a.cols * f_a.channels();
+    for( int y = 0; y < f_a.rows; ++y )
+    {
+      for( int x = 0; x < samples_i; ++x )
+      {
+	max_f = std::max( max_f, std::abs( f_a.ptr<float>( y )[ x ] - f_b.ptr<float>( y )[ x ] ) );
+      }
+    }
+    return max_f;
+  }
+}
+
+// 16 bit samples are big-endian in the file and in host order in the image,
+// also in the tail of the rows that the vector loop leaves
+TEST_CASE( pnmBigEndianSamples )
+{
+  cv::Mat img = randomImage( 5, 37, CV_16UC1, 65536, 90 );
+  img.at<unsigned short>( 0, 0 )  = 0x0102;
+  img.at<unsigned short>( 0, 36 ) = 0xFF00;
+  const std::string fileName_str = writePnm( img, 65535, "" );
+
+  cv::Mat native;
+  CHECK( readPnmImageNative( fileName_str, native ) );
+  CHECK( sameContents( img, native ) );
+  CHECK_EQUAL( 258, static_cast<int>( native.at<unsigned short>( 0, 0 ) ) );
+
+  cv::Mat scaled;
+  CHECK( readPnmImage( fileName_str, 0.5f, scaled ) );
+  CHECK_EQUAL( CV_32FC1, scaled.type() );
+  CHECK_EQUAL( 129.f, scaled.at<float>( 0, 0 ) );
+  CHECK_EQUAL( 32640.f, scaled.at<float>( 0, 36 ) );
+}
+
+// loadImageFile gives what cv::imread followed by convertTo gave
+TEST_CASE( pnmScalingMatchesImread )
+{
+  const unsigned bits[] = { 8, 10, 12, 16 };
+  for( size_t i = 0; i < sizeof( bits ) / sizeof( bits[ 0 ] ); ++i )
+  {
+    const unsigned maxValue_ui = ( 1u << bits[ i ] ) - 1;
+    const cv::Mat img = randomImage( 9, 43, bits[ i ] == 8 ? CV_8UC1 : CV_16UC1,
+				     maxValue_ui + 1, 91 + bits[ i ] );
+    const std::string fileName_str = writePnm( img, maxValue_ui, "scaling" );
+
+    cv::Mat expected;
+    cv::imread( fileName_str, -1 ).convertTo( expected, CV_32FC1, intensityScaleFactor( bits[ i ] ) );
+
+    const cv::Mat loaded = loadImageFile( fileName_str, bits[ i ] );
+    const float difference_f = maxDifference( expected, loaded );
+    CHECK( difference_f >= 0.f && difference_f <= 1e-4f );
+  }
+}
+
+// A comment of odd length puts the 16 bit samples at odd addresses; PPM
+// samples come out in BGR order
+TEST_CASE( pnmUnalignedPayload )
+{
+  for( unsigned length_ui = 0; length_ui < 4; ++length_ui )
+  {
+    const cv::Mat gray = randomImage( 7, 29, CV_16UC1, 4096, 95 + length_ui );
+    const std::string grayName_str = writePnm( gray, 4095, std::string( length_ui + 1, 'u' ) );
+
+    cv::Mat native;
+    CHECK( readPnmImageNative( grayName_str, native ) );
+    CHECK( sameContents( gray, native ) );
+
+    cv::Mat scaled, expected;
+    CHECK( readPnmImage( grayName_str, 2.f, scaled ) );
+    gray.convertTo( expected, CV_32FC1, 2.0 );
+    CHECK_EQUAL( 0.f, maxDifference( expected, scaled ) );
+
+    const cv::Mat color = randomImage( 7, 29, CV_16UC3, 65536, 99 + length_ui );
+    const std::string colorName_str = writePnm( color, 65535, std::string( length_ui + 1, 'u' ) );
+    CHECK( readPnmImageNative( colorName_str, native ) );
+    CHECK_EQUAL( CV_16UC3, native.type() );
+    bool bgr_b = true;
+    for( int y = 0; y < color.rows; ++y )
+    {
+      for( int x = 0; x < color.cols; ++x )
+      {
+	for( int c = 0; c < 3; ++c )
+	{
+	  bgr_b = bgr_b && native.ptr<unsigned short>( y )[ 3 * x + c ] ==
+	                   color.ptr<unsigned short>( y )[ 3 * x + 2 - c ];
+	}
+      }
+    }
+    CHECK( bgr_b );
+  }
+}
+
+// Files that are not binary PGM/PPM are left to cv::imread quietly, broken
+// ones are rejected
+TEST_CASE( pnmRejectsOtherFiles )
+{
+  const std::string textName_str = temporaryFileName( ".pgm" );
+  {
+    std::ofstream file( textName_str.c_str(), std::ios::binary | std::ios::trunc );
+    file << "P2\n2 2\n255\n1 2 3 4\n";
+  }
+  cv::Mat img;
+  CHECK( !readPnmImage( textName_str, 1.f, img ) );
+
+  const cv::Mat gray = randomImage( 4, 4, CV_8UC1, 256, 97 );
+  const std::string fileName_str = writePnm( gray, 255, "" );
+  std::string bytes_str;
+  {
+    std::ifstream file( fileName_str.c_str(), std::ios::binary );
+    bytes_str.assign( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+  }
+  const std::string shortName_str = temporaryFileName( ".pgm" );
+  {
+    std::ofstream file( shortName_str.c_str(), std::ios::binary | std::ios::trunc );
+    file << bytes_str.substr( 0, bytes_str.size() - 1 );
+  }
+  CHECK( !readPnmImageNative( shortName_str, img ) );
+  CHECK( readPnmImageNative( fileName_str, img ) );
+  CHECK( sameContents( gray, img ) );
+}
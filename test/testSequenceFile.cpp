@@ -0,0 +1,156 @@
+/* ******************************** FILE *********************************** */
+/** \file    testSequenceFile.cpp
+ *
+ *  \brief   Tests of CSequenceWriter and CSequenceReader.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+// Project includes
+#include "testing.h"
+#include "../h/sequenceFile.h"
+
+namespace
+{
+  const unsigned NUM_FRAMES_UI = 3;
+
+  std::vector<SSequenceStream> makeStreams()
+  {
+    std::vector<SSequenceStream> streams( 2 );
+    streams[ 0 ].m_name_str         = "base";
+    streams[ 0 ].m_type_i           = CV_8UC1;
+    streams[ 0 ].m_width_ui         = 37;
+    streams[ 0 ].m_height_ui        = 21;
+    streams[ 0 ].m_intensityScale_f = 0.5f;
+    streams[ 1 ].m_name_str         = "disparity";
+    streams[ 1 ].m_type_i           = CV_32FC1;
+    streams[ 1 ].m_width_ui         = 37;
+    streams[ 1 ].m_height_ui        = 21;
+    streams[ 1 ].m_subpixelBits_ui  = 4;
+    return streams;
+  }
+
+  std::vector<cv::Mat> makeFrame( const unsigned f_frame_ui )
+  {
+    std::vector<cv::Mat> images( 2 );
+    images[ 0 ] = randomImage( 21, 37, CV_8UC1, 256, 10 + f_frame_ui );
+    images[ 1 ] = randomImage( 21, 37, CV_32FC1, 64, 20 + f_frame_ui );
+    return images;
+  }
+
+  // Writes a sequence of NUM_FRAMES_UI frames and returns its bytes
+  std::string writeSequence( const std::string &f_fileName_str )
+  {
+    CSequenceWriter writer;
+    CHECK( writer.open( f_fileName_str, makeStreams() ) );
+    for( unsigned f = 0; f < NUM_FRAMES_UI; ++f )
+    {
+      CHECK( writer.addFrame( makeFrame( f ) ) );
+    }
+    CHECK( writer.close() );
+
+    std::ifstream file( f_fileName_str.c_str(), std::ios::binary );
+    return std::string( std::istreambuf_iterator<char>( file ), std::istreambuf_iterator<char>() );
+  }
+
+  // True if the reader accepts a file with the given bytes
+  bool opens( const std::string &f_bytes_str )
+  {
+    const std::string fileName_str = temporaryFileName( ".tes" );
+    std::ofstream file( fileName_str.c_str(), std::ios::binary | std::ios::trunc );
+    file.write( f_bytes_str.data(), f_bytes_str.size() );
+    file.close();
+
+    CSequenceReader reader;
+    return reader.open( fileName_str );
+  }
+
+  template<typename T>
+  std::string patched( std::string f_bytes_str, const size_t f_offset, const T f_value )
+  {
+    memcpy( &f_bytes_str[ f_offset ], &f_value, sizeof( f_value ) );
+    return f_bytes_str;
+  }
+}
+
+// The frames and the stream descriptions read back are the ones written
+TEST_CASE( sequenceRoundTrip )
+{
+  const std::string fileName_str = temporaryFileName( ".tes" );
+  writeSequence( fileName_str );
+
+  CSequenceReader reader;
+  CHECK( reader.open( fileName_str ) );
+  CHECK_EQUAL( NUM_FRAMES_UI, reader.getNumFrames() );
+  CHECK_EQUAL( 2u, reader.getNumStreams() );
+  CHECK_EQUAL( 1, reader.findStream( "disparity" ) );
+  CHECK_EQUAL( -1, reader.findStream( "control" ) );
+
+  const std::vector<SSequenceStream> streams = makeStreams();
+  for( unsigned s = 0; s < reader.getNumStreams(); ++s )
+  {
+    const SSequenceStream &stream = reader.getStream( s );
+    CHECK( stream.m_name_str == streams[ s ].m_name_str );
+    CHECK_EQUAL( streams[ s ].m_type_i, stream.m_type_i );
+    CHECK_EQUAL( streams[ s ].m_width_ui, stream.m_width_ui );
+    CHECK_EQUAL( streams[ s ].m_height_ui, stream.m_height_ui );
+    CHECK_EQUAL( streams[ s ].m_subpixelBits_ui, stream.m_subpixelBits_ui );
+    CHECK_EQUAL( streams[ s ].m_intensityScale_f, stream.m_intensityScale_f );
+  }
+
+  for( unsigned f = 0; f < NUM_FRAMES_UI; ++f )
+  {
+    std::vector<cv::Mat> images;
+    CHECK( reader.getFrame( f, images ) );
+    const std::vector<cv::Mat> expected = makeFrame( f );
+    CHECK( images.size() == expected.size() );
+    for( size_t s = 0; s < images.size() && s < expected.size(); ++s )
+    {
+      CHECK( sameContents( expected[ s ], images[ s ] ) );
+    }
+  }
+
+  CHECK( reader.getFrame( NUM_FRAMES_UI, 0 ).empty() );
+}
+
+// Truncated and corrupted files are rejected by open, including counts and
+// offsets chosen so that the size checks would wrap around
+TEST_CASE( sequenceRejectsCorruptedFiles )
+{
+  const std::string bytes_str = writeSequence( temporaryFileName( ".tes" ) );
+  CHECK( opens( bytes_str ) );
+
+  // Truncated: in the header, in the descriptors, in the index
+  CHECK( !opens( bytes_str.substr( 0, sizeof( SSequenceFileHeader ) - 1 ) ) );
+  CHECK( !opens( bytes_str.substr( 0, sizeof( SSequenceFileHeader ) + 8 ) ) );
+  CHECK( !opens( bytes_str.substr( 0, bytes_str.size() - 8 ) ) );
+
+  // Header counts whose products wrap around
+  const size_t numFrames   = offsetof( SSequenceFileHeader, m_numFrames );
+  const size_t numStreams  = offsetof( SSequenceFileHeader, m_numStreams );
+  const size_t indexOffset = offsetof( SSequenceFileHeader, m_indexOffset );
+  CHECK( !opens( patched<uint64_t>( bytes_str, numFrames, 1ull << 61 ) ) );
+  CHECK( !opens( patched<uint64_t>( bytes_str, numFrames, ( 1ull << 32 ) + 1 ) ) );
+  CHECK( !opens( patched<uint32_t>( bytes_str, numStreams, 0x80000000u ) ) );
+  CHECK( !opens( patched<uint64_t>( bytes_str, indexOffset, ~0ull - 7 ) ) );
+
+  // Index entry whose end wraps around
+  uint64_t index = 0;
+  memcpy( &index, &bytes_str[ indexOffset ], sizeof( index ) );
+  CHECK( !opens( patched<uint64_t>( bytes_str, index, ~0ull - ( SEQUENCE_ALIGNMENT - 1 ) ) ) );
+
+  // Descriptors: unknown type, empty or huge images
+  const size_t desc = sizeof( SSequenceFileHeader );
+  CHECK( !opens( patched<int32_t>( bytes_str, desc + offsetof( SSequenceStreamDesc, m_type ), -1 ) ) );
+  CHECK( !opens( patched<int32_t>( bytes_str, desc + offsetof( SSequenceStreamDesc, m_type ),
+				   CV_MAKETYPE( CV_8U, 5 ) ) ) );
+  CHECK( !opens( patched<uint32_t>( bytes_str, desc + offsetof( SSequenceStreamDesc, m_width ), 0 ) ) );
+  CHECK( !opens( patched<uint32_t>( bytes_str, desc + offsetof( SSequenceStreamDesc, m_height ),
+				    0xffffffffu ) ) );
+}
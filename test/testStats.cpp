@@ -0,0 +1,403 @@
+/* ******************************** FILE *********************************** */
+/** \file    testStats.cpp
+ *
+ *  \brief   Tests of CThirdEyeStats.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+// Common includes
+#include <cstring>
+
+// Project includes
+#include "testing.h"
+#include "../h/thirdeyeStats.h"
+
+namespace
+{
+  bool sameMoments( const SNCCMoments &f_a, const SNCCMoments &f_b )
+  {
+    return f_a.m_n_d == f_b.m_n_d &&
+           f_a.m_sumC_d == f_b.m_sumC_d && f_a.m_sumV_d == f_b.m_sumV_d &&
+           f_a.m_sumCC_d == f_b.m_sumCC_d && f_a.m_sumVV_d == f_b.m_sumVV_d &&
+           f_a.m_sumCV_d == f_b.m_sumCV_d &&
+           f_a.m_sumAbsDiff_d == f_b.m_sumAbsDiff_d && f_a.m_sumSqDiff_d == f_b.m_sumSqDiff_d &&
+           f_a.m_nCensus_d == f_b.m_nCensus_d && f_a.m_sumHamming_d == f_b.m_sumHamming_d;
+  }
+
+  template<typename T>
+  void addNoise( cv::Mat &f_image, const cv::Mat f_noise )
+  {
+    for( int y = 0; y < f_image.rows; ++y )
+    {
+      for( int x = 0; x < f_image.cols; ++x )
+      {
+	f_image.at<T>( y, x ) = static_cast<T>( f_image.at<T>( y, x ) + f_noise.at<T>( y, x ) );
+      }
+    }
+  }
+
+  // Control image in [0, f_range_i), a noisy copy of it as the virtual image
+  // (noise in [0, f_range_i / 8), so the sum fits the type with a range of
+  // 7/8 of it) and a random binary mask
+  void makeImages( const int f_type_i, const int f_range_i,
+		   cv::Mat &f_control, cv::Mat &f_virtual, cv::Mat &f_mask )
+  {
+    f_control = randomImage( 240, 320, f_type_i, f_range_i, 1 );
+    f_virtual = f_control.clone();
+    const cv::Mat noise = randomImage( 240, 320, f_type_i, f_range_i / 8, 2 );
+    switch( f_type_i )
+    {
+    case CV_8UC1:  addNoise<unsigned char>(  f_virtual, noise ); break;
+    case CV_16UC1: addNoise<unsigned short>( f_virtual, noise ); break;
+    default:       addNoise<float>(          f_virtual, noise ); break;
+    }
+    f_mask = randomImage( 240, 320, CV_32FC1, 2, 3 );
+  }
+}
+
+// The RoI reduction must give bit-identical results for any thread count
+TEST_CASE( statsDeterministicAcrossThreadCounts )
+{
+  const int types_p[ 3 ]  = { CV_8UC1, CV_16UC1, CV_32FC1 };
+  const int ranges_p[ 3 ] = { 224, 57344, 256 };
+  for( int t = 0; t < 3; ++t )
+  {
+    cv::Mat control, virtual_, mask;
+    makeImages( types_p[ t ], ranges_p[ t ], control, virtual_, mask );
+    const cv::Mat disparity = randomImage( 240, 320, CV_32FC1, 64, 4 );
+
+    SNCCMoments moments, momentsMask;
+    float ncc_f = 0.f, nccMask_f = 0.f, census_f = 0.f;
+    std::vector<SRegionStats> bands;
+
+    const unsigned threads_p[ 5 ] = { 1, 2, 3, 4, 8 };
+    for( int i = 0; i < 5; ++i )
+    {
+      CThirdEyeStats stats;
+      stats.setROI( 3, 5, 317, 233 );
+      stats.setMetrics( METRIC_ALL );
+      stats.setDisparityBands( 0.f, 64.f, 4 );
+      stats.setNumThreads( threads_p[ i ] );
+      CHECK( stats.evaluate( control, virtual_, mask, disparity ) );
+
+      if( i == 0 )
+      {
+	moments     = stats.getMoments();
+	momentsMask = stats.getMomentsMask();
+	ncc_f       = stats.getNCC();
+	nccMask_f   = stats.getNCCmask();
+	census_f    = stats.getMetrics().m_census_f;
+	bands       = stats.getBandStats();
+	CHECK( ncc_f > 0.f && ncc_f <= 100.f );
+	continue;
+      }
+
+      CHECK( sameMoments( moments, stats.getMoments() ) );
+      CHECK( sameMoments( momentsMask, stats.getMomentsMask() ) );
+      CHECK( ncc_f == stats.getNCC() );
+      CHECK( nccMask_f == stats.getNCCmask() );
+      CHECK( census_f == stats.getMetrics().m_census_f );
+      CHECK_EQUAL( bands.size(), stats.getBandStats().size() );
+      for( size_t b = 0; b < bands.size() && b < stats.getBandStats().size(); ++b )
+      {
+	CHECK( sameMoments( bands[ b ].m_moments, stats.getBandStats()[ b ].m_moments ) );
+      }
+    }
+  }
+}
+
+// The vectorised reduction agrees with a plain double precision sum
+TEST_CASE( statsMatchScalarReference )
+{
+  cv::Mat control, virtual_, mask;
+  makeImages( CV_16UC1, 57344, control, virtual_, mask );
+
+  CThirdEyeStats stats;
+  stats.setROI( 0, 0, 320, 240 );
+  CHECK( stats.evaluate( control, virtual_, mask ) );
+
+  SNCCMoments reference, referenceMask;
+  reference.reset( control.at<unsigned short>( 0, 0 ), virtual_.at<unsigned short>( 0, 0 ) );
+  referenceMask.reset( reference.m_shiftC_d, reference.m_shiftV_d );
+  for( int y = 0; y < control.rows; ++y )
+  {
+    for( int x = 0; x < control.cols; ++x )
+    {
+      reference.add( control.at<unsigned short>( y, x ), virtual_.at<unsigned short>( y, x ) );
+      if( mask.at<float>( y, x ) > 0.f )
+      {
+	referenceMask.add( control.at<unsigned short>( y, x ), virtual_.at<unsigned short>( y, x ) );
+      }
+    }
+  }
+
+  double ncc_d = 0., nccMask_d = 0.;
+  CHECK( reference.ncc( ncc_d ) );
+  CHECK( referenceMask.ncc( nccMask_d ) );
+  CHECK_NEAR( 100. * ncc_d, stats.getNCC(), 1e-4 );
+  CHECK_NEAR( 100. * nccMask_d, stats.getNCCmask(), 1e-4 );
+  CHECK_EQUAL( reference.m_n_d, stats.getMoments().m_n_d );
+  CHECK_EQUAL( referenceMask.m_n_d, stats.getMomentsMask().m_n_d );
+}
+
+// Windows without texture have no local NCC, even when the cancellation in
+// the integral images leaves a tiny variance, and the defined values are
+// within [-100, 100]
+TEST_CASE( localNCCRejectsConstantWindows )
+{
+  cv::Mat control = randomImage( 120, 160, CV_32FC1, 256, 5 );
+  const cv::Rect patch( 60, 40, 48, 48 );
+  for( int y = patch.y; y < patch.y + patch.height; ++y )
+  {
+    for( int x = patch.x; x < patch.x + patch.width; ++x )
+    {
+      control.at<float>( y, x ) = 100.3f;
+    }
+  }
+  cv::Mat virtual_( control.rows, control.cols, CV_32FC1 );
+  for( int y = 0; y < control.rows; ++y )
+  {
+    for( int x = 0; x < control.cols; ++x )
+    {
+      virtual_.at<float>( y, x ) = 0.7f * control.at<float>( y, x ) + 3.3f;
+    }
+  }
+
+  const unsigned window_ui = 15;
+  CThirdEyeStats stats;
+  stats.setROI( 0, 0, 160, 120 );
+  stats.setLocalWindow( window_ui );
+  CHECK( stats.evaluate( control, virtual_ ) );
+
+  const cv::Mat local = stats.getLocalNCC();
+  CHECK_EQUAL( 120 - 15 + 1, local.rows );
+  CHECK_EQUAL( 160 - 15 + 1, local.cols );
+  unsigned flat_ui = 0, wrong_ui = 0, outOfRange_ui = 0;
+  for( int y = 0; y < local.rows; ++y )
+  {
+    for( int x = 0; x < local.cols; ++x )
+    {
+      const float value_f = local.at<float>( y, x );
+      const bool inside_b = x >= patch.x && y >= patch.y &&
+	                    x + static_cast<int>( window_ui ) <= patch.x + patch.width &&
+	                    y + static_cast<int>( window_ui ) <= patch.y + patch.height;
+      if( inside_b )
+      {
+	++flat_ui;
+	wrong_ui += ( value_f != -32000.f ) ? 1 : 0;
+      }
+      else if( value_f < -100.f || value_f > 100.f )
+      {
+	++outOfRange_ui;
+      }
+    }
+  }
+  CHECK( flat_ui > 0 );
+  CHECK_EQUAL( 0u, wrong_ui );
+  CHECK_EQUAL( 0u, outOfRange_ui );
+}
+
+// Sparse 16 bit labels: the per-label moments match a plain sum, do not
+// depend on the thread count or on the rectangles sharing the traversal, and
+// the number of labels is capped to the range of the type
+TEST_CASE( labelStatsSparse16BitLabels )
+{
+  cv::Mat control, virtual_, mask;
+  makeImages( CV_16UC1, 57344, control, virtual_, mask );
+
+  // Labels spread over the whole 16 bit range, a few per row block
+  cv::Mat labels( 240, 320, CV_16UC1 );
+  for( int y = 0; y < labels.rows; ++y )
+  {
+    for( int x = 0; x < labels.cols; ++x )
+    {
+      labels.at<unsigned short>( y, x ) = static_cast<unsigned short>( ( ( y / 10 ) * 7 + x / 40 ) * 769 % 65536 );
+    }
+  }
+
+  const cv::Rect roi( 3, 5, 314, 228 );
+  std::vector<SRegionStats> first;
+
+  const unsigned threads_p[ 3 ] = { 1, 3, 8 };
+  for( int i = 0; i < 3; ++i )
+  {
+    CThirdEyeStats stats;
+    stats.setROI( roi.x, roi.y, roi.x + roi.width, roi.y + roi.height );
+    stats.setLabelImage( labels, 1u << 20 );
+    stats.setNumThreads( threads_p[ i ] );
+    if( i == 2 )
+    {
+      // Rectangles above the RoI extend the traversal
+      stats.setRegions( std::vector<cv::Rect>( 1, cv::Rect( 10, 0, 50, 30 ) ) );
+    }
+    CHECK( stats.evaluate( control, virtual_, mask ) );
+
+    const std::vector<SRegionStats> &result = stats.getLabelStats();
+    CHECK_EQUAL( 65536u, result.size() );
+    if( i == 0 )
+    {
+      first = result;
+      continue;
+    }
+    for( size_t l = 0; l < result.size() && l < first.size(); ++l )
+    {
+      CHECK( sameMoments( first[ l ].m_moments, result[ l ].m_moments ) );
+      CHECK( sameMoments( first[ l ].m_momentsMask, result[ l ].m_momentsMask ) );
+    }
+  }
+
+  // Plain sums per label
+  std::vector<SNCCMoments> reference( 65536 ), referenceMask( 65536 );
+  for( size_t l = 0; l < reference.size(); ++l )
+  {
+    reference[ l ].reset( control.at<unsigned short>( roi.y, roi.x ),
+			  virtual_.at<unsigned short>( roi.y, roi.x ) );
+    referenceMask[ l ] = reference[ l ];
+  }
+  for( int y = roi.y; y < roi.y + roi.height; ++y )
+  {
+    for( int x = roi.x; x < roi.x + roi.width; ++x )
+    {
+      const unsigned short label = labels.at<unsigned short>( y, x );
+      reference[ label ].add( control.at<unsigned short>( y, x ), virtual_.at<unsigned short>( y, x ) );
+      if( mask.at<float>( y, x ) > 0.f )
+      {
+	referenceMask[ label ].add( control.at<unsigned short>( y, x ), virtual_.at<unsigned short>( y, x ) );
+      }
+    }
+  }
+
+  unsigned seen_ui = 0;
+  for( size_t l = 0; l < reference.size() && l < first.size(); ++l )
+  {
+    CHECK_EQUAL( reference[ l ].m_n_d, first[ l ].m_moments.m_n_d );
+    CHECK_EQUAL( referenceMask[ l ].m_n_d, first[ l ].m_momentsMask.m_n_d );
+    double ncc_d = 0.;
+    if( reference[ l ].ncc( ncc_d ) )
+    {
+      ++seen_ui;
+      CHECK_NEAR( 100. * ncc_d, first[ l ].m_ncc_f, 1e-3 );
+    }
+    else
+    {
+      CHECK( first[ l ].m_ncc_f == -32000.f );
+    }
+  }
+  CHECK( seen_ui > 100 );
+}
+
+// The rectangles read the integral images built in the moments traversal,
+// which then spans more than the RoI: their moments match plain sums, with
+// the census (one more column on each side) and integer images converted
+// row by row, and the global moments are those of the RoI alone
+TEST_CASE( regionStatsMatchPlainSums )
+{
+  cv::Mat control, virtual_, mask;
+  makeImages( CV_8UC1, 224, control, virtual_, mask );
+
+  const cv::Rect roi( 40, 50, 200, 120 );
+  std::vector<cv::Rect> regions;
+  regions.push_back( cv::Rect(  60,   0,  64,  40 ) );   // Above the RoI
+  regions.push_back( cv::Rect( 200, 150, 120,  90 ) );   // Across the bottom right corner
+  regions.push_back( cv::Rect(  60,  70,  50,  50 ) );   // Within the RoI
+
+  CThirdEyeStats stats;
+  stats.setROI( roi.x, roi.y, roi.x + roi.width, roi.y + roi.height );
+  stats.setMetrics( METRIC_ALL );
+  stats.setRegions( regions );
+  stats.setNumThreads( 3 );
+  CHECK( stats.evaluate( control, virtual_, mask ) );
+
+  CThirdEyeStats plain;
+  plain.setROI( roi.x, roi.y, roi.x + roi.width, roi.y + roi.height );
+  plain.setMetrics( METRIC_ALL );
+  plain.setNumThreads( 3 );
+  CHECK( plain.evaluate( control, virtual_, mask ) );
+  CHECK( sameMoments( plain.getMoments(), stats.getMoments() ) );
+  CHECK( sameMoments( plain.getMomentsMask(), stats.getMomentsMask() ) );
+
+  const std::vector<SRegionStats> &result = stats.getRegionStats();
+  CHECK_EQUAL( regions.size(), result.size() );
+  for( size_t i = 0; i < regions.size() && i < result.size(); ++i )
+  {
+    SNCCMoments reference, referenceMask;
+    for( int y = regions[ i ].y; y < regions[ i ].y + regions[ i ].height; ++y )
+    {
+      for( int x = regions[ i ].x; x < regions[ i ].x + regions[ i ].width; ++x )
+      {
+	reference.add( control.at<unsigned char>( y, x ), virtual_.at<unsigned char>( y, x ) );
+	if( mask.at<float>( y, x ) > 0.f )
+	{
+	  referenceMask.add( control.at<unsigned char>( y, x ), virtual_.at<unsigned char>( y, x ) );
+	}
+      }
+    }
+
+    double ncc_d = 0., nccMask_d = 0.;
+    CHECK( reference.ncc( ncc_d ) );
+    CHECK( referenceMask.ncc( nccMask_d ) );
+    CHECK_EQUAL( reference.m_n_d, result[ i ].m_moments.m_n_d );
+    CHECK_EQUAL( referenceMask.m_n_d, result[ i ].m_momentsMask.m_n_d );
+    CHECK_NEAR( 100. * ncc_d, result[ i ].m_ncc_f, 1e-3 );
+    CHECK_NEAR( 100. * nccMask_d, result[ i ].m_nccMask_f, 1e-3 );
+  }
+}
+
+// With every source disparity within the bands, the band moments add up to
+// the global ones. The disparities are smooth on the left half of the rows,
+// so runs of one band go through the row kernel, and random on the right
+// half, where the bands change from pixel to pixel
+TEST_CASE( bandMomentsSumToGlobalMoments )
+{
+  const int types_p[ 2 ]  = { CV_8UC1, CV_32FC1 };
+  const int ranges_p[ 2 ] = { 224, 256 };
+  for( int t = 0; t < 2; ++t )
+  {
+    cv::Mat control, virtual_, mask;
+    makeImages( types_p[ t ], ranges_p[ t ], control, virtual_, mask );
+
+    cv::Mat disparity = randomImage( 240, 320, CV_32FC1, 64, 6 );
+    for( int y = 0; y < disparity.rows; ++y )
+    {
+      for( int x = 0; x < disparity.cols / 2; ++x )
+      {
+	disparity.at<float>( y, x ) = 0.1f * ( x + y );
+      }
+    }
+
+    CThirdEyeStats stats;
+    stats.setROI( 3, 5, 317, 233 );
+    stats.setDisparityBands( 0.f, 64.f, 8 );
+    CHECK( stats.evaluate( control, virtual_, mask, disparity ) );
+
+    const std::vector<SRegionStats> &bands = stats.getBandStats();
+    CHECK_EQUAL( 8u, bands.size() );
+
+    SNCCMoments sum, sumMask;
+    sum.reset( stats.getMoments().m_shiftC_d, stats.getMoments().m_shiftV_d );
+    sumMask.reset( sum.m_shiftC_d, sum.m_shiftV_d );
+    for( size_t b = 0; b < bands.size(); ++b )
+    {
+      CHECK( bands[ b ].m_moments.m_n_d > 0. );
+      sum.merge( bands[ b ].m_moments );
+      sumMask.merge( bands[ b ].m_momentsMask );
+    }
+
+    const SNCCMoments* sums_p[ 2 ]   = { &sum, &sumMask };
+    const SNCCMoments* global_p[ 2 ] = { &stats.getMoments(), &stats.getMomentsMask() };
+    for( int k = 0; k < 2; ++k )
+    {
+      const SNCCMoments &a = *sums_p[ k ];
+      const SNCCMoments &g = *global_p[ k ];
+      CHECK_EQUAL( g.m_n_d, a.m_n_d );
+      CHECK_NEAR( g.m_sumC_d,       a.m_sumC_d,       1e-9 * g.m_sumCC_d );
+      CHECK_NEAR( g.m_sumV_d,       a.m_sumV_d,       1e-9 * g.m_sumVV_d );
+      CHECK_NEAR( g.m_sumCC_d,      a.m_sumCC_d,      1e-9 * g.m_sumCC_d );
+      CHECK_NEAR( g.m_sumVV_d,      a.m_sumVV_d,      1e-9 * g.m_sumVV_d );
+      CHECK_NEAR( g.m_sumCV_d,      a.m_sumCV_d,      1e-9 * g.m_sumCC_d );
+      CHECK_NEAR( g.m_sumAbsDiff_d, a.m_sumAbsDiff_d, 1e-9 * g.m_sumSqDiff_d );
+      CHECK_NEAR( g.m_sumSqDiff_d,  a.m_sumSqDiff_d,  1e-9 * g.m_sumSqDiff_d );
+    }
+  }
+}
@@ -0,0 +1,105 @@
+/* ******************************** FILE *********************************** */
+/** \file    testing.h
+ *
+ *  \brief   Minimal test harness of the unit tests: TEST_CASE defines and
+ *           registers a test, and the CHECK macros record a failure (with
+ *           its file and line) and let the test go on. testMain.cpp runs
+ *           the registered tests.
+ *
+ *  \note    .enpeda.. group. The University of Auckland
+ *
+ *************************************************************************** */
+#ifndef FILE_TESTING_H
+#define FILE_TESTING_H
+
+// Common includes
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// OpenCV includes
+#include <opencv2/core/core.hpp>
+
+typedef void (*TTestFunction)();
+
+struct STestCase
+{
+  const char*   m_name_p;
+  TTestFunction m_function_p;
+};
+
+// Registered tests, in registration order
+std::vector<STestCase>& testCases();
+
+// Failed checks of the test that runs
+unsigned& testFailures();
+
+// Registers a test at static initialisation (see TEST_CASE)
+struct STestRegistrar
+{
+  STestRegistrar( const char* f_name_p, const TTestFunction f_function_p )
+  {
+    STestCase testCase = { f_name_p, f_function_p };
+    testCases().push_back( testCase );
+  }
+};
+
+#define TEST_CASE( name )						\
+  static void name();							\
+  static STestRegistrar name##_registrar( #name, name );		\
+  static void name()
+
+#define CHECK( condition )						\
+  do {									\
+    if( !( condition ) )						\
+    {									\
+      ++testFailures();							\
+      std::cout << __FILE__ << ":" << __LINE__				\
+		<< ": CHECK failed: " #condition << std::endl;		\
+    }									\
+  } while( false )
+
+#define CHECK_EQUAL( expected, actual )					\
+  do {									\
+    if( !( ( expected ) == ( actual ) ) )				\
+    {									\
+      ++testFailures();							\
+      std::cout << __FILE__ << ":" << __LINE__				\
+		<< ": CHECK_EQUAL failed: " #expected " == " #actual	\
+		<< " (" << ( expected ) << " vs " << ( actual ) << ")"	\
+		<< std::endl;						\
+    }									\
+  } while( false )
+
+#define CHECK_NEAR( expected, actual, tolerance )			\
+  do {									\
+    if( !( std::fabs( ( expected ) - ( actual ) ) <= ( tolerance ) ) )	\
+    {									\
+      ++testFailures();							\
+      std::cout << __FILE__ << ":" << __LINE__				\
+		<< ": CHECK_NEAR failed: " #expected " ~ " #actual	\
+		<< " (" << ( expected ) << " vs " << ( actual ) << ")"	\
+		<< std::endl;						\
+    }									\
+  } while( false )
+
+// Helpers shared by the tests
+
+// Image of the given type filled with reproducible pseudo-random values in
+// [0, f_range_i)
+cv::Mat randomImage( const int f_rows_i, const int f_cols_i, const int f_type_i,
+		     const int f_range_i, const unsigned f_seed_ui );
+
+// Name of a new, unique file in the temporary directory. The file is
+// removed at exit
+std::string temporaryFileName( const std::string &f_suffix_str );
+
+// True if both images have the same size, type and bytes
+bool sameContents( const cv::Mat f_a, const cv::Mat f_b );
+
+// Calls of the global operator new so far, from all the threads. The test
+// runner replaces operator new to count them
+size_t heapAllocations();
+
+#endif /* FILE_TESTING_H */